@@ -708,6 +708,11 @@ void git_attr_set_direction(enum git_attr_direction new_direction)
 	direction = new_direction;
 }
 
+void git_attr_drop_stacks(void)
+{
+	drop_all_attr_stacks();
+}
+
 static struct attr_stack *read_attr_from_file(const char *path, int macro_ok)
 {
 	FILE *fp = fopen_or_warn(path, "r");
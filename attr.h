@@ -207,6 +207,12 @@ enum git_attr_direction {
 };
 void git_attr_set_direction(enum git_attr_direction new_direction);
 
+/*
+ * Forget the .gitattributes read so far, e.g. because later checks
+ * should read them from a different index_state.
+ */
+void git_attr_drop_stacks(void);
+
 void attr_start(void);
 
 #endif /* ATTR_H */
@@ -6,6 +6,8 @@
 #include "hashmap.h"
 #include "commit-graph.h"
 #include "commit.h"
+#include "progress.h"
+#include "thread-utils.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
@@ -144,6 +146,44 @@ void clear_bloom_key(struct bloom_key *key)
 	FREE_AND_NULL(key->hashes);
 }
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	const char *p;
+	size_t nr = 1, i = 1;
+
+	/*
+	 * At this point, the path is normalized to use Unix-style
+	 * path separators. This is required due to how the
+	 * changed-path Bloom filters store the paths.
+	 */
+	for (p = path; p < path + len; p++)
+		if (*p == '/')
+			nr++;
+
+	vec = xcalloc(1, st_add(sizeof(*vec), st_mult(nr, sizeof(vec->key[0]))));
+	vec->count = nr;
+
+	fill_bloom_key(path, len, &vec->key[0], settings);
+	for (p = path + len - 1; p > path; p--)
+		if (*p == '/')
+			fill_bloom_key(path, p - path, &vec->key[i++], settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	size_t i;
+
+	if (!vec)
+		return;
+	for (i = 0; i < vec->count; i++)
+		clear_bloom_key(&vec->key[i]);
+	free(vec);
+}
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings)
@@ -184,95 +224,134 @@ static void init_truncated_large_filter(struct bloom_filter *filter)
 	filter->len = 1;
 }
 
-struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
-						 struct commit *c,
-						 int compute_if_not_present,
-						 const struct bloom_filter_settings *settings,
-						 enum bloom_filter_computed *computed)
+/*
+ * The changed paths of one commit, collected by the tree diff callbacks
+ * below instead of going through the global diff queue, so that
+ * several commits can be diffed at the same time.
+ */
+struct bloom_changed_paths {
+	struct hashmap pathmap;
+	int nr;		/* number of changes seen so far */
+	int max;	/* give up after this many */
+};
+
+/* protects the submodule config lookups when computing on threads */
+static int bloom_use_threads;
+static pthread_mutex_t bloom_mutex;
+
+static void add_changed_path(struct diff_options *opt, const char *path)
 {
-	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
+	struct bloom_changed_paths *paths = opt->change_fn_data;
+	struct strbuf buf = STRBUF_INIT;
+	struct pathmap_hash_entry *e;
+
+	if (++paths->nr > paths->max) {
+		/* the filter will be truncated; stop the tree walk */
+		opt->flags.quick = 1;
+		opt->flags.has_changes = 1;
+		return;
+	}
 
-	if (computed)
-		*computed = BLOOM_NOT_COMPUTED;
+	/*
+	 * Add each leading directory of the changed file, i.e. for
+	 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
+	 * the Bloom filter could be used to speed up commands like
+	 * 'git log dir/subdir', too.
+	 *
+	 * Note that directories are added without the trailing '/'.
+	 */
+	strbuf_addstr(&buf, path);
+	do {
+		char *last_slash = strrchr(buf.buf, '/');
+
+		FLEX_ALLOC_STR(e, path, buf.buf);
+		hashmap_entry_init(&e->entry, strhash(buf.buf));
+
+		if (!hashmap_get(&paths->pathmap, &e->entry, NULL))
+			hashmap_add(&paths->pathmap, &e->entry);
+		else
+			free(e);
+
+		strbuf_setlen(&buf, last_slash ? last_slash - buf.buf : 0);
+	} while (buf.len);
+	strbuf_release(&buf);
+}
 
-	if (!bloom_filters.slab_size)
-		return NULL;
+static int bloom_submodule_ignored(const char *path,
+				   struct diff_options *opt)
+{
+	int ret;
+
+	if (bloom_use_threads)
+		pthread_mutex_lock(&bloom_mutex);
+	ret = is_submodule_ignored(path, opt);
+	if (bloom_use_threads)
+		pthread_mutex_unlock(&bloom_mutex);
+	return ret;
+}
 
-	filter = bloom_filter_slab_at(&bloom_filters, c);
+static void bloom_add_remove(struct diff_options *opt,
+			     int addremove, unsigned mode,
+			     const struct object_id *oid,
+			     int oid_valid,
+			     const char *path, unsigned dirty_submodule)
+{
+	if (S_ISGITLINK(mode) && bloom_submodule_ignored(path, opt))
+		return;
+	add_changed_path(opt, path);
+}
 
-	if (!filter->data) {
-		load_commit_graph_info(r, c);
-		if (commit_graph_position(c) != COMMIT_NOT_FROM_GRAPH)
-			load_bloom_filter_from_graph(r->objects->commit_graph, filter, c);
-	}
+static void bloom_change(struct diff_options *opt,
+			 unsigned old_mode, unsigned new_mode,
+			 const struct object_id *old_oid,
+			 const struct object_id *new_oid,
+			 int old_oid_valid, int new_oid_valid,
+			 const char *path,
+			 unsigned old_dirty_submodule,
+			 unsigned new_dirty_submodule)
+{
+	if (S_ISGITLINK(old_mode) && S_ISGITLINK(new_mode) &&
+	    bloom_submodule_ignored(path, opt))
+		return;
+	add_changed_path(opt, path);
+}
 
-	if (filter->data && filter->len)
-		return filter;
-	if (!compute_if_not_present)
-		return NULL;
+void compute_bloom_filter(struct repository *r,
+			  const struct object_id *parent,
+			  const struct object_id *oid,
+			  struct bloom_filter *filter,
+			  const struct bloom_filter_settings *settings,
+			  enum bloom_filter_computed *computed)
+{
+	struct bloom_changed_paths paths;
+	struct diff_options diffopt;
+
+	hashmap_init(&paths.pathmap, pathmap_cmp, NULL, 0);
+	paths.nr = 0;
+	paths.max = settings->max_changed_paths;
 
 	repo_diff_setup(r, &diffopt);
 	diffopt.flags.recursive = 1;
 	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
+	diffopt.add_remove = bloom_add_remove;
+	diffopt.change = bloom_change;
+	diffopt.change_fn_data = &paths;
 	diff_setup_done(&diffopt);
 
-	/* ensure commit is parsed so we have parent information */
-	repo_parse_commit(r, c);
-
-	if (c->parents)
-		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
-	else
-		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
+	diff_tree_oid(parent, oid, "", &diffopt);
 
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
-		struct hashmap pathmap;
+	if (paths.nr <= settings->max_changed_paths) {
 		struct pathmap_hash_entry *e;
 		struct hashmap_iter iter;
-		hashmap_init(&pathmap, pathmap_cmp, NULL, 0);
-
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
 
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		}
-
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
+		if (hashmap_get_size(&paths.pathmap) > settings->max_changed_paths) {
 			init_truncated_large_filter(filter);
 			if (computed)
 				*computed |= BLOOM_TRUNC_LARGE;
 			goto cleanup;
 		}
 
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+		filter->len = (hashmap_get_size(&paths.pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
 		if (!filter->len) {
 			if (computed)
 				*computed |= BLOOM_TRUNC_EMPTY;
@@ -280,32 +359,161 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 		}
 		filter->data = xcalloc(filter->len, sizeof(unsigned char));
 
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
+		hashmap_for_each_entry(&paths.pathmap, &iter, e, entry) {
 			struct bloom_key key;
 			fill_bloom_key(e->path, strlen(e->path), &key, settings);
 			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
 		}
-
-	cleanup:
-		hashmap_free_entries(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
-		for (i = 0; i < diff_queued_diff.nr; i++)
-			diff_free_filepair(diff_queued_diff.queue[i]);
 		init_truncated_large_filter(filter);
 
 		if (computed)
 			*computed |= BLOOM_TRUNC_LARGE;
 	}
 
+cleanup:
+	hashmap_free_entries(&paths.pathmap, struct pathmap_hash_entry, entry);
+	clear_pathspec(&diffopt.pathspec);
+
 	if (computed)
 		*computed |= BLOOM_COMPUTED;
+}
 
-	free(diff_queued_diff.queue);
-	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+struct bloom_filter *lookup_bloom_filter(struct repository *r,
+					 struct commit *c)
+{
+	struct bloom_filter *filter;
+
+	if (!bloom_filters.slab_size)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+
+	if (!filter->data) {
+		load_commit_graph_info(r, c);
+		if (commit_graph_position(c) != COMMIT_NOT_FROM_GRAPH)
+			load_bloom_filter_from_graph(r->objects->commit_graph, filter, c);
+	}
 
 	return filter;
 }
 
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+
+	if (computed)
+		*computed = BLOOM_NOT_COMPUTED;
+
+	filter = lookup_bloom_filter(r, c);
+	if (!filter)
+		return NULL;
+
+	if (filter->data && filter->len)
+		return filter;
+	if (!compute_if_not_present)
+		return NULL;
+
+	/* ensure commit is parsed so we have parent information */
+	repo_parse_commit(r, c);
+
+	if (computed)
+		*computed = 0;
+	compute_bloom_filter(r, c->parents ? &c->parents->item->object.oid : NULL,
+			     &c->object.oid, filter, settings, computed);
+	return filter;
+}
+
+struct bloom_filter_pool {
+	struct repository *r;
+	const struct bloom_filter_settings *settings;
+	struct bloom_filter_job *jobs;
+	int nr, next, done;
+	struct progress *progress;
+	uint64_t progress_base;
+	pthread_mutex_t mutex;
+};
+
+static void *run_bloom_filter_jobs(void *data)
+{
+	struct bloom_filter_pool *pool = data;
+
+	for (;;) {
+		struct bloom_filter_job *job;
+
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->next >= pool->nr) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		job = &pool->jobs[pool->next++];
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->computed = 0;
+		compute_bloom_filter(pool->r, job->parent, job->oid,
+				     job->filter, pool->settings,
+				     &job->computed);
+
+		pthread_mutex_lock(&pool->mutex);
+		display_progress(pool->progress,
+				 pool->progress_base + ++pool->done);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return NULL;
+}
+
+void compute_bloom_filter_jobs(struct repository *r,
+			       struct bloom_filter_job *jobs, int nr,
+			       const struct bloom_filter_settings *settings,
+			       int nr_threads,
+			       struct progress *progress,
+			       uint64_t progress_base)
+{
+	struct bloom_filter_pool pool;
+	pthread_t *threads;
+	int i;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.r = r;
+	pool.settings = settings;
+	pool.jobs = jobs;
+	pool.nr = nr;
+	pool.progress = progress;
+	pool.progress_base = progress_base;
+
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+	if (nr_threads > nr)
+		nr_threads = nr;
+	if (!HAVE_THREADS || nr_threads < 2) {
+		run_bloom_filter_jobs(&pool);
+		return;
+	}
+
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_mutex_init(&bloom_mutex, NULL);
+	bloom_use_threads = 1;
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, run_bloom_filter_jobs, &pool))
+			die(_("unable to create thread"));
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	bloom_use_threads = 0;
+	pthread_mutex_destroy(&bloom_mutex);
+	pthread_mutex_destroy(&pool.mutex);
+}
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings)
@@ -325,3 +533,16 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 
 	return 1;
 }
+
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings)
+{
+	int ret = 1;
+	size_t i;
+
+	for (i = 0; ret && i < vec->count; i++)
+		ret = bloom_filter_contains(filter, &vec->key[i], settings);
+
+	return ret;
+}
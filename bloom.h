@@ -2,6 +2,8 @@
 #define BLOOM_H
 
 struct commit;
+struct object_id;
+struct progress;
 struct repository;
 
 struct bloom_filter_settings {
@@ -68,6 +70,16 @@ struct bloom_key {
 	uint32_t *hashes;
 };
 
+/*
+ * A bloom_keyvec holds the keys for a path and each of its leading
+ * directories, e.g. "a/b/c", "a/b" and "a". A commit can only have
+ * touched the path if its filter contains all of them.
+ */
+struct bloom_keyvec {
+	size_t count;
+	struct bloom_key key[FLEX_ARRAY];
+};
+
 /*
  * Calculate the murmur3 32-bit hash value for the given data
  * using the given seed.
@@ -83,6 +95,10 @@ void fill_bloom_key(const char *data,
 		    const struct bloom_filter_settings *settings);
 void clear_bloom_key(struct bloom_key *key);
 
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
 void add_key_to_filter(const struct bloom_key *key,
 		       struct bloom_filter *filter,
 		       const struct bloom_filter_settings *settings);
@@ -105,8 +121,60 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 #define get_bloom_filter(r, c) get_or_compute_bloom_filter( \
 	(r), (c), 0, NULL, NULL)
 
+/*
+ * Returns the slab entry for the filter of 'c', loaded from the
+ * commit-graph if it has one there. The entry has no data if the
+ * filter still needs to be computed. Returns NULL if Bloom filters
+ * are not initialized.
+ */
+struct bloom_filter *lookup_bloom_filter(struct repository *r,
+					 struct commit *c);
+
+/*
+ * Computes the filter of the changes from 'parent' (or from the empty
+ * tree if NULL) to 'oid' into 'filter', adding to the flags in
+ * *computed. Neither the commits nor the global diff queue are
+ * involved.
+ */
+void compute_bloom_filter(struct repository *r,
+			  const struct object_id *parent,
+			  const struct object_id *oid,
+			  struct bloom_filter *filter,
+			  const struct bloom_filter_settings *settings,
+			  enum bloom_filter_computed *computed);
+
+struct bloom_filter_job {
+	const struct object_id *parent;
+	const struct object_id *oid;
+	struct bloom_filter *filter;
+	enum bloom_filter_computed computed;
+};
+
+/*
+ * Runs compute_bloom_filter() for each of the 'nr' jobs, on up to
+ * 'nr_threads' threads (0 means one per processor). The resulting
+ * filters do not depend on the number of threads. Each finished job
+ * advances 'progress', starting from 'progress_base'.
+ */
+void compute_bloom_filter_jobs(struct repository *r,
+			       struct bloom_filter_job *jobs, int nr,
+			       const struct bloom_filter_settings *settings,
+			       int nr_threads,
+			       struct progress *progress,
+			       uint64_t progress_base);
+
 int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Returns 0 if the filter proves that at least one key of "vec" was not
+ * added to it, and a non-zero value if all of them might have been.
+ * A vector holds a path and its leading directories, so a 0 means the
+ * path was not changed.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      const struct bloom_keyvec *vec,
+			      const struct bloom_filter_settings *settings);
+
 #endif
@@ -0,0 +1,390 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "fsmonitor-ipc.h"
+#include "run-command.h"
+#include "strbuf.h"
+#include "trace2.h"
+
+static const char * const builtin_fsmonitor__daemon_usage[] = {
+	N_("git fsmonitor--daemon start"),
+	N_("git fsmonitor--daemon run"),
+	N_("git fsmonitor--daemon stop"),
+	N_("git fsmonitor--daemon status"),
+	NULL
+};
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+#include "fsmonitor--daemon.h"
+#include "compat/fsmonitor/fsm-listen.h"
+#include "sigchain.h"
+#include "unix-socket.h"
+
+/*
+ * Once this many paths are in the journal, it is cheaper for the
+ * clients to scan the worktree than to look up every path.
+ */
+#define MAX_CHANGED_PATHS (100000)
+
+/* How long "start" waits for the new daemon to listen. */
+#define START_TIMEOUT_MS (10000)
+
+struct changed_path {
+	struct hashmap_entry ent;
+	uint64_t seq;
+	char path[FLEX_ARRAY];
+};
+
+static int changed_path_cmp(const void *unused_cmp_data,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *keydata)
+{
+	const struct changed_path *a, *b;
+
+	a = container_of(eptr, const struct changed_path, ent);
+	b = container_of(entry_or_key, const struct changed_path, ent);
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static void new_token_id(struct fsmonitor_daemon_state *state)
+{
+	static int counter;
+
+	strbuf_reset(&state->token_id);
+	strbuf_addf(&state->token_id, "%"PRIuMAX".%"PRIuMAX".%d",
+		    (uintmax_t)getpid(), (uintmax_t)time(NULL), counter++);
+}
+
+void fsmonitor_daemon_force_resync(struct fsmonitor_daemon_state *state)
+{
+	trace2_data_string("fsmonitor", NULL, "resync", state->token_id.buf);
+
+	hashmap_free_entries(&state->changed_paths, struct changed_path, ent);
+	hashmap_init(&state->changed_paths, changed_path_cmp, NULL, 0);
+	new_token_id(state);
+	state->seq = 0;
+	state->pending_changes = 0;
+}
+
+void fsmonitor_daemon_path_changed(struct fsmonitor_daemon_state *state,
+				   const char *path)
+{
+	struct changed_path *entry;
+	unsigned int hash = strhash(path);
+
+	entry = hashmap_get_entry_from_hash(&state->changed_paths, hash, path,
+					    struct changed_path, ent);
+	if (!entry) {
+		if (hashmap_get_size(&state->changed_paths) >= MAX_CHANGED_PATHS) {
+			fsmonitor_daemon_force_resync(state);
+			return;
+		}
+		FLEX_ALLOC_STR(entry, path, path);
+		hashmap_entry_init(&entry->ent, hash);
+		hashmap_add(&state->changed_paths, &entry->ent);
+	}
+
+	/* Report this change with the next token. */
+	entry->seq = state->seq + 1;
+	state->pending_changes = 1;
+}
+
+/*
+ * Parse a token we handed out earlier. Returns 0 and sets `seq` if the
+ * token belongs to the current journal.
+ */
+static int parse_token(struct fsmonitor_daemon_state *state,
+		       const char *token, uint64_t *seq)
+{
+	const char *p;
+	char *end;
+
+	if (!skip_prefix(token, "builtin:", &p) ||
+	    !skip_prefix(p, state->token_id.buf, &p) ||
+	    *p++ != ':')
+		return -1;
+
+	errno = 0;
+	*seq = strtoumax(p, &end, 10);
+	if (errno || end == p || *end || *seq > state->seq)
+		return -1;
+	return 0;
+}
+
+static void handle_token_request(struct fsmonitor_daemon_state *state,
+				 const char *client_token,
+				 struct strbuf *response)
+{
+	uint64_t since;
+	int trivial;
+
+	/*
+	 * The kernel queued the events for every change made before the
+	 * client asked, so after reading them all we can give a
+	 * complete answer.
+	 */
+	if (fsm_listen__drain(state))
+		state->shutdown = 1;
+
+	trivial = state->shutdown || parse_token(state, client_token, &since);
+
+	if (state->pending_changes) {
+		state->seq++;
+		state->pending_changes = 0;
+	}
+
+	strbuf_addf(response, "builtin:%s:%"PRIu64,
+		    state->token_id.buf, state->seq);
+	strbuf_addch(response, '\0');
+
+	if (trivial) {
+		strbuf_addch(response, '/');
+		strbuf_addch(response, '\0');
+	} else {
+		struct hashmap_iter iter;
+		struct changed_path *entry;
+		int count = 0;
+
+		hashmap_for_each_entry(&state->changed_paths, &iter, entry, ent) {
+			if (entry->seq <= since)
+				continue;
+			strbuf_addstr(response, entry->path);
+			strbuf_addch(response, '\0');
+			count++;
+		}
+		trace2_data_intmax("fsmonitor", NULL, "response/paths", count);
+	}
+}
+
+static void handle_client(struct fsmonitor_daemon_state *state, int fd)
+{
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf response = STRBUF_INIT;
+	struct timeval timeout = { 5, 0 };
+
+	/* Do not let a stuck client block everybody else. */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	if (strbuf_read(&request, fd, 0) < 0)
+		goto cleanup;
+
+	trace2_region_enter("fsmonitor", "handle_client", NULL);
+
+	if (!strcmp(request.buf, "quit")) {
+		state->shutdown = 1;
+		strbuf_addstr(&response, "OK");
+	} else if (!strcmp(request.buf, "flush")) {
+		fsmonitor_daemon_force_resync(state);
+		strbuf_addstr(&response, "OK");
+	} else
+		handle_token_request(state, request.buf, &response);
+
+	write_in_full(fd, response.buf, response.len);
+
+	trace2_region_leave("fsmonitor", "handle_client", NULL);
+
+cleanup:
+	strbuf_release(&request);
+	strbuf_release(&response);
+}
+
+static int fsmonitor_run_daemon(void)
+{
+	struct fsmonitor_daemon_state state;
+	const char *ipc_path = fsmonitor_ipc__get_path();
+	int listen_fd, ret = 0;
+
+	if (fsmonitor_ipc__is_listening())
+		die(_("fsmonitor--daemon is already running '%s'"),
+		    get_git_work_tree());
+
+	memset(&state, 0, sizeof(state));
+	strbuf_init(&state.path_worktree_watch, 0);
+	strbuf_addstr(&state.path_worktree_watch,
+		      absolute_path(get_git_work_tree()));
+	strbuf_init(&state.token_id, 0);
+	hashmap_init(&state.changed_paths, changed_path_cmp, NULL, 0);
+	new_token_id(&state);
+
+	/*
+	 * Watch the worktree before we listen, so that no client can get
+	 * an answer from a daemon that is not watching yet.
+	 */
+	if (fsm_listen__ctor(&state)) {
+		ret = -1;
+		goto cleanup;
+	}
+
+	listen_fd = unix_stream_listen(ipc_path);
+	if (listen_fd < 0) {
+		ret = error_errno(_("could not listen on '%s'"), ipc_path);
+		goto cleanup;
+	}
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	trace2_region_enter("fsmonitor", "daemon", NULL);
+
+	while (!state.shutdown) {
+		struct pollfd pfd[2];
+
+		pfd[0].fd = fsm_listen__fd(&state);
+		pfd[0].events = POLLIN;
+		pfd[1].fd = listen_fd;
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = error_errno(_("poll failed"));
+			break;
+		}
+
+		if ((pfd[0].revents & POLLIN) && fsm_listen__drain(&state)) {
+			ret = -1;
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			int fd = accept(listen_fd, NULL, NULL);
+
+			if (fd < 0)
+				continue;
+			handle_client(&state, fd);
+			close(fd);
+		}
+	}
+
+	trace2_region_leave("fsmonitor", "daemon", NULL);
+	sigchain_pop(SIGPIPE);
+
+	close(listen_fd);
+	unlink(ipc_path);
+
+cleanup:
+	fsm_listen__dtor(&state);
+	hashmap_free_entries(&state.changed_paths, struct changed_path, ent);
+	strbuf_release(&state.path_worktree_watch);
+	strbuf_release(&state.token_id);
+	return ret ? 1 : 0;
+}
+
+/*
+ * Start a daemon in the background and wait until it listens.
+ */
+static int fsmonitor_start_daemon(void)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	int waited_ms = 0;
+
+	if (fsmonitor_ipc__is_listening())
+		return 0;
+
+	cp.git_cmd = 1;
+	cp.no_stdin = 1;
+	cp.no_stdout = 1;
+	cp.no_stderr = 1;
+	strvec_pushl(&cp.args, "fsmonitor--daemon", "run", "--detach", NULL);
+
+	if (start_command(&cp))
+		return error(_("could not start the fsmonitor daemon"));
+
+	while (!fsmonitor_ipc__is_listening()) {
+		int status;
+
+		/* Did the daemon die before it got to listen? */
+		if (waitpid(cp.pid, &status, WNOHANG) == cp.pid)
+			return error(_("fsmonitor--daemon failed to start"));
+		if (waited_ms >= START_TIMEOUT_MS)
+			return error(_("fsmonitor--daemon did not start in time"));
+		sleep_millisec(50);
+		waited_ms += 50;
+	}
+
+	return 0;
+}
+
+static int fsmonitor_stop_daemon(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+	int ret;
+
+	ret = fsmonitor_ipc__send_command("quit", &answer);
+	strbuf_release(&answer);
+	if (ret)
+		return 0; /* nothing to stop */
+
+	/* Wait for the daemon to let go of the socket. */
+	while (fsmonitor_ipc__is_listening())
+		sleep_millisec(50);
+
+	return 0;
+}
+
+static int fsmonitor_daemon_status(void)
+{
+	if (fsmonitor_ipc__is_listening()) {
+		printf(_("fsmonitor-daemon is watching '%s'\n"),
+		       get_git_work_tree());
+		return 0;
+	}
+
+	printf(_("fsmonitor-daemon is not watching '%s'\n"),
+	       get_git_work_tree());
+	return 1;
+}
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	int detach = 0;
+
+	struct option options[] = {
+		OPT_BOOL(0, "detach", &detach,
+			 N_("detach from the terminal (used by 'start')")),
+		OPT_END()
+	};
+
+	if (argc < 2 || !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	git_config(git_default_config, NULL);
+
+	subcmd = argv[1];
+	argc = parse_options(argc - 1, argv + 1, prefix, options,
+			     builtin_fsmonitor__daemon_usage, 0);
+	if (argc != 0)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	if (!strcmp(subcmd, "start"))
+		return !!fsmonitor_start_daemon();
+
+	if (!strcmp(subcmd, "run")) {
+		if (detach)
+			setsid();
+		return fsmonitor_run_daemon();
+	}
+
+	if (!strcmp(subcmd, "stop"))
+		return !!fsmonitor_stop_daemon();
+
+	if (!strcmp(subcmd, "status"))
+		return !!fsmonitor_daemon_status();
+
+	die(_("Unhandled subcommand '%s'"), subcmd);
+}
+
+#else
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	die(_("fsmonitor--daemon not supported on this platform"));
+}
+#endif
@@ -22,6 +22,7 @@
 #endif
 
 #define GIT_DEFAULT_HASH_ENVIRONMENT "GIT_DEFAULT_HASH"
+#define GIT_DEFAULT_REF_FORMAT_ENVIRONMENT "GIT_DEFAULT_REF_FORMAT"
 
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
@@ -179,12 +180,14 @@ static int needs_work_tree_config(const char *git_dir, const char *work_tree)
 	return 1;
 }
 
-void initialize_repository_version(int hash_algo, int reinit)
+void initialize_repository_version(int hash_algo, const char *ref_format,
+				   int reinit)
 {
 	char repo_version_string[10];
 	int repo_version = GIT_REPO_VERSION;
+	int default_refs = !ref_format || !strcmp(ref_format, "files");
 
-	if (hash_algo != GIT_HASH_SHA1)
+	if (hash_algo != GIT_HASH_SHA1 || !default_refs)
 		repo_version = GIT_REPO_VERSION_READ;
 
 	/* This forces creation of new config file */
@@ -197,6 +200,11 @@ void initialize_repository_version(int hash_algo, int reinit)
 			       hash_algos[hash_algo].name);
 	else if (reinit)
 		git_config_set_gently("extensions.objectformat", NULL);
+
+	if (!default_refs)
+		git_config_set("extensions.refstorage", ref_format);
+	else if (reinit)
+		git_config_set_gently("extensions.refstorage", NULL);
 }
 
 static int create_default_files(const char *template_path,
@@ -253,6 +261,14 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	/*
+	 * Check for HEAD before setting up the refs db, which might
+	 * create the file as a placeholder.
+	 */
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -260,9 +276,6 @@ static int create_default_files(const char *template_path,
 	 * Point the HEAD symref to the initial branch with if HEAD does
 	 * not yet exist.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		char *ref;
 
@@ -279,7 +292,7 @@ static int create_default_files(const char *template_path,
 		free(ref);
 	}
 
-	initialize_repository_version(fmt->hash_algo, 0);
+	initialize_repository_version(fmt->hash_algo, fmt->ref_storage_format, 0);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -393,9 +406,37 @@ static void validate_hash_algorithm(struct repository_format *repo_fmt, int hash
 	}
 }
 
+static void validate_ref_storage_format(struct repository_format *repo_fmt,
+				       const char *format)
+{
+	const char *env = getenv(GIT_DEFAULT_REF_FORMAT_ENVIRONMENT);
+	const char *current = repo_fmt->ref_storage_format;
+
+	if (!current)
+		current = "files";
+	/*
+	 * As with the hash, the references of an existing repository
+	 * cannot be switched over to another backend.
+	 */
+	if (repo_fmt->version >= 0) {
+		if (format && strcmp(format, current))
+			die(_("attempt to reinitialize repository with different reference storage format"));
+		return;
+	}
+
+	if (!format)
+		format = env;
+	if (!format)
+		return;
+	if (!ref_storage_backend_exists(format))
+		die(_("unknown reference storage format '%s'"), format);
+	free(repo_fmt->ref_storage_format);
+	repo_fmt->ref_storage_format = xstrdup(format);
+}
+
 int init_db(const char *git_dir, const char *real_git_dir,
-	    const char *template_dir, int hash, const char *initial_branch,
-	    unsigned int flags)
+	    const char *template_dir, int hash, const char *ref_format,
+	    const char *initial_branch, unsigned int flags)
 {
 	int reinit;
 	int exist_ok = flags & INIT_DB_EXIST_OK;
@@ -436,6 +477,9 @@ int init_db(const char *git_dir, const char *real_git_dir,
 	check_repository_format(&repo_fmt);
 
 	validate_hash_algorithm(&repo_fmt, hash);
+	validate_ref_storage_format(&repo_fmt, ref_format);
+	repo_set_ref_storage_format(the_repository,
+				    repo_fmt.ref_storage_format);
 
 	reinit = create_default_files(template_dir, original_git_dir,
 				      initial_branch, &repo_fmt);
@@ -544,6 +588,7 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	const char *template_dir = NULL;
 	unsigned int flags = 0;
 	const char *object_format = NULL;
+	const char *ref_format = NULL;
 	const char *initial_branch = NULL;
 	int hash_algo = GIT_HASH_UNKNOWN;
 	const struct option init_db_options[] = {
@@ -562,6 +607,8 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 			   N_("override the name of the initial branch")),
 		OPT_STRING(0, "object-format", &object_format, N_("hash"),
 			   N_("specify the hash algorithm to use")),
+		OPT_STRING(0, "ref-format", &ref_format, N_("format"),
+			   N_("specify the reference storage format to use")),
 		OPT_END()
 	};
 
@@ -700,6 +747,6 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	UNLEAK(work_tree);
 
 	flags |= INIT_DB_EXIST_OK;
-	return init_db(git_dir, real_git_dir, template_dir, hash_algo,
+	return init_db(git_dir, real_git_dir, template_dir, hash_algo, ref_format,
 		       initial_branch, flags);
 }
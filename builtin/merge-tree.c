@@ -8,8 +8,18 @@
 #include "exec-cmd.h"
 #include "merge-blobs.h"
 #include "config.h"
-
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+#include "commit.h"
+#include "commit-reach.h"
+#include "merge-ort.h"
+#include "parse-options.h"
+#include "quote.h"
+#include "string-list.h"
+
+static const char * const merge_tree_usage[] = {
+	N_("git merge-tree --write-tree [<options>] <branch1> <branch2>"),
+	N_("git merge-tree [--trivial-merge] <base-tree> <branch1> <branch2>"),
+	NULL
+};
 
 struct merge_list {
 	struct merge_list *next;
@@ -29,7 +39,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -228,7 +238,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(r, t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -345,7 +355,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -369,20 +379,16 @@ static void *get_tree_descriptor(struct repository *r,
 	return buf;
 }
 
-int cmd_merge_tree(int argc, const char **argv, const char *prefix)
+static int trivial_merge(int argc, const char **argv)
 {
 	struct repository *r = the_repository;
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
 
-	if (argc != 4)
-		usage(merge_tree_usage);
-
-	git_config(git_default_config, NULL);
-	buf1 = get_tree_descriptor(r, t+0, argv[1]);
-	buf2 = get_tree_descriptor(r, t+1, argv[2]);
-	buf3 = get_tree_descriptor(r, t+2, argv[3]);
-	merge_trees(t, "");
+	buf1 = get_tree_descriptor(r, t+0, argv[0]);
+	buf2 = get_tree_descriptor(r, t+1, argv[1]);
+	buf3 = get_tree_descriptor(r, t+2, argv[2]);
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -390,3 +396,124 @@ int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 	show_result();
 	return 0;
 }
+
+struct merge_tree_options {
+	int mode;
+	int show_messages;
+	int name_only;
+	int nul_terminated;
+};
+
+static void show_conflicted_files(struct merge_tree_options *o,
+				  struct string_list *conflicted_files)
+{
+	int line_termination = o->nul_terminated ? 0 : '\n';
+	const char *last = NULL;
+	int i;
+
+	for (i = 0; i < conflicted_files->nr; i++) {
+		const char *path = conflicted_files->items[i].string;
+		struct stage_info *si = conflicted_files->items[i].util;
+
+		if (o->name_only && last && !strcmp(last, path))
+			continue;
+		last = path;
+		if (!o->name_only)
+			printf("%06o %s %d\t", si->mode,
+			       oid_to_hex(&si->oid), si->stage);
+		write_name_quoted(path, stdout, line_termination);
+	}
+}
+
+static int real_merge(struct merge_tree_options *o,
+		      const char *branch1, const char *branch2)
+{
+	struct commit *parent1, *parent2;
+	struct commit_list *merge_bases, *reversed = NULL, *j;
+	struct merge_options opt;
+	struct merge_result result = { 0 };
+
+	parent1 = get_merge_parent(branch1);
+	if (!parent1)
+		die(_("'%s' does not point to a commit"), branch1);
+	parent2 = get_merge_parent(branch2);
+	if (!parent2)
+		die(_("'%s' does not point to a commit"), branch2);
+
+	init_merge_options(&opt, the_repository);
+	opt.show_rename_progress = 0;
+	opt.branch1 = branch1;
+	opt.branch2 = branch2;
+	/* messages are collected and printed after the conflicted files */
+	opt.buffer_output = 2;
+
+	merge_bases = get_merge_bases(parent1, parent2);
+	if (!merge_bases)
+		die(_("refusing to merge unrelated histories"));
+	for (j = merge_bases; j; j = j->next)
+		commit_list_insert(j->item, &reversed);
+	free_commit_list(merge_bases);
+
+	merge_incore_recursive(&opt, reversed, parent1, parent2, &result);
+	if (result.clean < 0)
+		die(_("failure to merge"));
+
+	printf("%s%c", oid_to_hex(&result.tree->object.oid),
+	       o->nul_terminated ? '\0' : '\n');
+	if (!result.clean) {
+		struct string_list conflicted_files = STRING_LIST_INIT_NODUP;
+
+		merge_get_conflicted_files(&result, &conflicted_files);
+		show_conflicted_files(o, &conflicted_files);
+		string_list_clear(&conflicted_files, 1);
+	}
+	if (o->show_messages == -1)
+		o->show_messages = !result.clean;
+	if (o->show_messages) {
+		putchar(o->nul_terminated ? '\0' : '\n');
+		merge_switch_to_result(&opt, NULL, &result, 0, 1);
+		fputs(opt.obuf.buf, stdout);
+		strbuf_release(&opt.obuf);
+	} else {
+		merge_finalize(&opt, &result);
+	}
+	return !result.clean;
+}
+
+int cmd_merge_tree(int argc, const char **argv, const char *prefix)
+{
+	struct merge_tree_options o = { .show_messages = -1 };
+	int expected_remaining_argc;
+
+	const struct option mt_options[] = {
+		OPT_CMDMODE(0, "write-tree", &o.mode,
+			    N_("do a real merge instead of a trivial merge"),
+			    'w'),
+		OPT_CMDMODE(0, "trivial-merge", &o.mode,
+			    N_("do a trivial merge only"), 't'),
+		OPT_BOOL(0, "messages", &o.show_messages,
+			 N_("also show informational/conflict messages")),
+		OPT_BOOL(0, "name-only", &o.name_only,
+			 N_("list filenames without modes/oids/stages")),
+		OPT_BOOL('z', NULL, &o.nul_terminated,
+			 N_("separate paths with the NUL character")),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, mt_options,
+			     merge_tree_usage, PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (!o.mode)
+		o.mode = argc == 2 ? 'w' : 't';
+	expected_remaining_argc = (o.mode == 'w' ? 2 : 3);
+	if (argc != expected_remaining_argc)
+		usage_with_options(merge_tree_usage, mt_options);
+	if (o.mode == 't' &&
+	    (o.show_messages != -1 || o.name_only || o.nul_terminated))
+		die(_("--trivial-merge is incompatible with all other options"));
+
+	if (o.mode == 'w')
+		return real_merge(&o, argv[0], argv[1]);
+	return trivial_merge(argc, argv);
+}
@@ -6,14 +6,18 @@
 #include "trace2.h"
 
 static char const * const builtin_multi_pack_index_usage[] = {
-	N_("git multi-pack-index [<options>] (write|verify|expire|repack --batch-size=<size>)"),
+	N_("git multi-pack-index [<options>] (write [--bitmap] [--preferred-pack=<pack>] [--incremental [--size-multiple=<n>]]|verify|expire|repack --batch-size=<size>)"),
 	NULL
 };
 
 static struct opts_multi_pack_index {
 	const char *object_dir;
+	const char *preferred_pack;
 	unsigned long batch_size;
 	int progress;
+	int bitmap;
+	int incremental;
+	int size_multiple;
 } opts;
 
 int cmd_multi_pack_index(int argc, const char **argv,
@@ -27,6 +31,15 @@ int cmd_multi_pack_index(int argc, const char **argv,
 		OPT_BOOL(0, "progress", &opts.progress, N_("force progress reporting")),
 		OPT_MAGNITUDE(0, "batch-size", &opts.batch_size,
 		  N_("during repack, collect pack-files of smaller size into a batch that is larger than this size")),
+		OPT_BOOL(0, "bitmap", &opts.bitmap,
+		  N_("write a reachability bitmap for the multi-pack-index")),
+		OPT_STRING(0, "preferred-pack", &opts.preferred_pack,
+		  N_("preferred-pack"),
+		  N_("pack for reuse when computing a multi-pack bitmap")),
+		OPT_BOOL(0, "incremental", &opts.incremental,
+		  N_("only write a new layer for the packs not indexed yet")),
+		OPT_INTEGER(0, "size-multiple", &opts.size_multiple,
+		  N_("maximum ratio between two layers of a multi-pack-index chain")),
 		OPT_END(),
 	};
 
@@ -59,8 +72,27 @@ int cmd_multi_pack_index(int argc, const char **argv,
 	if (opts.batch_size)
 		die(_("--batch-size option is only for 'repack' subcommand"));
 
-	if (!strcmp(argv[0], "write"))
-		return write_midx_file(opts.object_dir, flags);
+	if (!strcmp(argv[0], "write")) {
+		struct midx_write_opts write_opts = { 0 };
+
+		if (opts.bitmap)
+			flags |= MIDX_WRITE_BITMAP;
+		if (opts.incremental)
+			flags |= MIDX_WRITE_INCREMENTAL;
+		if (opts.incremental && (opts.bitmap || opts.preferred_pack))
+			die(_("--incremental cannot be combined with --bitmap or --preferred-pack"));
+		if (opts.size_multiple && !opts.incremental)
+			die(_("--size-multiple requires --incremental"));
+		if (opts.size_multiple < 0)
+			die(_("--size-multiple must be positive"));
+		write_opts.size_multiple = opts.size_multiple;
+
+		return write_midx_file(opts.object_dir, opts.preferred_pack,
+				       flags, &write_opts);
+	}
+	if (opts.bitmap || opts.preferred_pack || opts.incremental ||
+	    opts.size_multiple)
+		die(_("--bitmap, --preferred-pack and --incremental are only for 'write' subcommand"));
 	if (!strcmp(argv[0], "verify"))
 		return verify_midx_file(the_repository, opts.object_dir, flags);
 	if (!strcmp(argv[0], "expire"))
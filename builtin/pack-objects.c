@@ -36,6 +36,7 @@
 #include "trace2.h"
 #include "shallow.h"
 #include "promisor-remote.h"
+#include "pack-mtimes.h"
 
 #define IN_PACK(obj) oe_in_pack(&to_pack, obj)
 #define SIZE(obj) oe_size(&to_pack, obj)
@@ -76,6 +77,9 @@ static int pack_loose_unreachable;
 static int local;
 static int have_non_local_packs;
 static int incremental;
+static int stdin_packs;
+static int cruft;
+static timestamp_t cruft_expiration;
 static int ignore_packed_keep_on_disk;
 static int ignore_packed_keep_in_core;
 static int allow_ofs_delta;
@@ -86,8 +90,10 @@ static int window = 10;
 static unsigned long pack_size_limit;
 static int depth = 50;
 static int delta_search_threads;
+static int enumeration_threads = 1;
 static int pack_to_stdout;
 static int sparse;
+static int path_deltas;
 static int thin;
 static int num_preferred_base;
 static struct progress *progress_state;
@@ -419,7 +425,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 {
 	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = oe_type(entry);
 	off_t datalen;
@@ -436,10 +442,15 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 					      type, entry_size);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("write_reuse_object: could not locate %s, expected at "
+		      "offset %"PRIuMAX" in pack %s"),
+		    oid_to_hex(&entry->idx.oid), (uintmax_t)offset,
+		    p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -863,8 +874,8 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 	enum object_type type;
 	unsigned long size;
 
-	offset = reuse_packfile->revindex[pos].offset;
-	next = reuse_packfile->revindex[pos + 1].offset;
+	offset = pack_pos_to_offset(reuse_packfile, pos);
+	next = pack_pos_to_offset(reuse_packfile, pos + 1);
 
 	record_reused_object(offset, offset - hashfile_total(out));
 
@@ -884,11 +895,17 @@ static void write_reused_pack_one(size_t pos, struct hashfile *out,
 
 		/* Convert to REF_DELTA if we must... */
 		if (!allow_ofs_delta) {
-			int base_pos = find_revindex_position(reuse_packfile, base_offset);
+			uint32_t base_pos;
 			struct object_id base_oid;
 
+			if (offset_to_pack_pos(reuse_packfile, base_offset, &base_pos) < 0)
+				die(_("expected object at offset %"PRIuMAX" "
+				      "in pack %s"),
+				    (uintmax_t)base_offset,
+				    reuse_packfile->pack_name);
+
 			nth_packed_object_id(&base_oid, reuse_packfile,
-					     reuse_packfile->revindex[base_pos].nr);
+					     pack_pos_to_index(reuse_packfile, base_pos));
 
 			len = encode_in_pack_object_header(header, sizeof(header),
 							   OBJ_REF_DELTA, size);
@@ -941,7 +958,7 @@ static size_t write_reused_pack_verbatim(struct hashfile *out,
 		off_t to_write;
 
 		written = (pos * BITS_IN_EWORD);
-		to_write = reuse_packfile->revindex[written].offset
+		to_write = pack_pos_to_offset(reuse_packfile, written)
 			- sizeof(struct pack_header);
 
 		/* We're recording one chunk, not one object. */
@@ -1095,7 +1112,7 @@ static void write_pack_file(void)
 			}
 
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
-					    written_list, nr_written,
+					    written_list, nr_written, &to_pack,
 					    &pack_idx_opts, oid.hash);
 
 			if (write_bitmap_index) {
@@ -1106,7 +1123,8 @@ static void write_pack_file(void)
 				bitmap_writer_show_progress(progress);
 				bitmap_writer_reuse_bitmaps(&to_pack);
 				bitmap_writer_select_commits(indexed_commits, indexed_commits_nr, -1);
-				bitmap_writer_build(&to_pack);
+				if (bitmap_writer_build(&to_pack) < 0)
+					die(_("failed to write bitmap index"));
 				bitmap_writer_finish(written_list, nr_written,
 						     tmpname.buf, write_bitmap_options);
 				write_bitmap_index = 0;
@@ -1319,13 +1337,13 @@ static int want_object_in_pack(const struct object_id *oid,
 	return 1;
 }
 
-static void create_object_entry(const struct object_id *oid,
-				enum object_type type,
-				uint32_t hash,
-				int exclude,
-				int no_try_delta,
-				struct packed_git *found_pack,
-				off_t found_offset)
+static struct object_entry *create_object_entry(const struct object_id *oid,
+						enum object_type type,
+						uint32_t hash,
+						int exclude,
+						int no_try_delta,
+						struct packed_git *found_pack,
+						off_t found_offset)
 {
 	struct object_entry *entry;
 
@@ -1342,6 +1360,7 @@ static void create_object_entry(const struct object_id *oid,
 	}
 
 	entry->no_try_delta = no_try_delta;
+	return entry;
 }
 
 static const char no_closure_warning[] = N_(
@@ -1353,6 +1372,7 @@ static int add_object_entry(const struct object_id *oid, enum object_type type,
 {
 	struct packed_git *found_pack = NULL;
 	off_t found_offset = 0;
+	struct object_entry *entry;
 
 	display_progress(progress_state, ++nr_seen);
 
@@ -1369,9 +1389,11 @@ static int add_object_entry(const struct object_id *oid, enum object_type type,
 		return 0;
 	}
 
-	create_object_entry(oid, type, pack_name_hash(name),
-			    exclude, name && no_try_delta(name),
-			    found_pack, found_offset);
+	entry = create_object_entry(oid, type, pack_name_hash(name),
+				    exclude, name && no_try_delta(name),
+				    found_pack, found_offset);
+	if (path_deltas && name)
+		oe_set_path_hash(&to_pack, entry, pack_path_hash(name));
 	return 1;
 }
 
@@ -1807,11 +1829,11 @@ static void check_object(struct object_entry *entry, uint32_t object_index)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				if (!nth_packed_object_id(&base_ref, p, revidx->nr))
+				if (!nth_packed_object_id(&base_ref, p,
+							  pack_pos_to_index(p, pos)))
 					have_base = 1;
 			}
 			entry->in_pack_header_size = used + used_0;
@@ -2111,6 +2133,19 @@ static void get_object_details(void)
 	free(sorted_by_offset);
 }
 
+/*
+ * Set while searching for deltas between objects found at the same
+ * path only (see find_path_deltas()): the list is grouped by the hash
+ * of the full path instead of the filename hash, and the search does
+ * not look past the group of the object at hand.
+ */
+static int searching_by_path;
+
+static inline uint32_t delta_search_hash(const struct object_entry *e)
+{
+	return searching_by_path ? oe_path_hash(&to_pack, e) : e->hash;
+}
+
 /*
  * We search for deltas in a list sorted by type, by filename hash, and then
  * by size, so that we see progressively smaller and smaller files.
@@ -2128,14 +2163,16 @@ static int type_size_sort(const void *_a, const void *_b)
 	const enum object_type b_type = oe_type(b);
 	const unsigned long a_size = SIZE(a);
 	const unsigned long b_size = SIZE(b);
+	const uint32_t a_hash = delta_search_hash(a);
+	const uint32_t b_hash = delta_search_hash(b);
 
 	if (a_type > b_type)
 		return -1;
 	if (a_type < b_type)
 		return 1;
-	if (a->hash > b->hash)
+	if (a_hash > b_hash)
 		return -1;
-	if (a->hash < b->hash)
+	if (a_hash < b_hash)
 		return 1;
 	if (a->preferred_base > b->preferred_base)
 		return -1;
@@ -2250,6 +2287,11 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (oe_type(trg_entry) != oe_type(src_entry))
 		return -1;
 
+	/* ... nor, in the first pass of pack.pathDeltas, between paths */
+	if (searching_by_path &&
+	    oe_path_hash(&to_pack, trg_entry) != oe_path_hash(&to_pack, src_entry))
+		return -1;
+
 	/*
 	 * We do not bother to try a delta that we discarded on an
 	 * earlier try, but only when reusing delta data.  Note that
@@ -2673,8 +2715,9 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 
 		/* try to split chunks on "path" boundaries */
 		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
+		       delta_search_hash(list[sub_size]) &&
+		       delta_search_hash(list[sub_size]) ==
+		       delta_search_hash(list[sub_size-1]))
 			sub_size++;
 
 		p[i].list = list;
@@ -2728,8 +2771,9 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		if (victim) {
 			sub_size = victim->remaining / 2;
 			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
+			while (sub_size && delta_search_hash(list[0]) &&
+			       delta_search_hash(list[0]) ==
+			       delta_search_hash(list[-1])) {
 				list++;
 				sub_size--;
 			}
@@ -2815,6 +2859,55 @@ static int add_ref_tag(const char *path, const struct object_id *oid, int flag,
 	return 0;
 }
 
+/*
+ * With pack.pathDeltas, first search for deltas only between objects
+ * that were found at the same full path: unlike the filename hash, this
+ * keeps e.g. the many unrelated "BUILD" or "index.js" files of a large
+ * tree out of each other's window. The objects that did not get a delta
+ * are moved to the front of "list", for the usual search across paths,
+ * and their number is returned; "nr_deltas" is updated to match.
+ */
+static unsigned find_path_deltas(struct object_entry **list, unsigned n,
+				 int window, int depth, uint32_t *nr_deltas)
+{
+	struct object_entry **path_list;
+	unsigned i, nr = 0, nr_targets = 0, nr_done = 0, left = 0;
+
+	ALLOC_ARRAY(path_list, n);
+	for (i = 0; i < n; i++) {
+		/* objects found via bitmaps have no path */
+		if (!oe_path_hash(&to_pack, list[i]))
+			continue;
+		path_list[nr++] = list[i];
+		if (!list[i]->preferred_base)
+			nr_targets++;
+	}
+
+	if (nr_targets && nr > 1) {
+		if (progress)
+			progress_state = start_progress(_("Compressing objects by path"),
+							nr_targets);
+		searching_by_path = 1;
+		QSORT(path_list, nr, type_size_sort);
+		ll_find_deltas(path_list, nr, window+1, depth, &nr_done);
+		searching_by_path = 0;
+		stop_progress(&progress_state);
+		if (nr_done != nr_targets)
+			die(_("inconsistency with delta count"));
+	}
+	free(path_list);
+
+	*nr_deltas = 0;
+	for (i = 0; i < n; i++) {
+		if (DELTA(list[i]))
+			continue;
+		if (!list[i]->preferred_base)
+			(*nr_deltas)++;
+		list[left++] = list[i];
+	}
+	return left;
+}
+
 static void prepare_pack(int window, int depth)
 {
 	struct object_entry **delta_list;
@@ -2876,6 +2969,9 @@ static void prepare_pack(int window, int depth)
 		delta_list[n++] = entry;
 	}
 
+	if (path_deltas && nr_deltas && n > 1)
+		n = find_path_deltas(delta_list, n, window, depth, &nr_deltas);
+
 	if (nr_deltas && n > 1) {
 		unsigned nr_done = 0;
 
@@ -2938,6 +3034,21 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		}
 		return 0;
 	}
+	if (!strcmp(k, "pack.enumerationthreads")) {
+		enumeration_threads = git_config_int(k, v);
+		if (enumeration_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    enumeration_threads);
+		if (!HAVE_THREADS && enumeration_threads != 1) {
+			warning(_("no threads support, ignoring %s"), k);
+			enumeration_threads = 1;
+		}
+		return 0;
+	}
+	if (!strcmp(k, "pack.pathdeltas")) {
+		path_deltas = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2945,6 +3056,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "uploadpack.blobpackfileuri")) {
 		struct configured_exclusion *ex = xmalloc(sizeof(*ex));
 		const char *oid_end, *pack_end;
@@ -3003,6 +3121,281 @@ static void read_object_list_from_stdin(void)
 	}
 }
 
+static int add_object_entry_from_pack(const struct object_id *oid,
+				      struct packed_git *p,
+				      uint32_t pos,
+				      void *data)
+{
+	off_t offset;
+
+	display_progress(progress_state, ++nr_seen);
+
+	if (have_duplicate_entry(oid, 0))
+		return 0;
+
+	offset = nth_packed_object_offset(p, pos);
+	if (!want_object_in_pack(oid, 0, &p, &offset))
+		return 0;
+
+	/*
+	 * There is no traversal to tell us the type or a name; the type
+	 * is filled in by check_object(), and the missing name hash only
+	 * means that new deltas are searched among objects of similar
+	 * size. Existing deltas between the packs are still reused.
+	 */
+	create_object_entry(oid, OBJ_NONE, 0, 0, 0, p, offset);
+	return 0;
+}
+
+/*
+ * Read pack names from stdin. Pack all objects of the packs listed as
+ * "<name>", except those that can also be found in a pack listed as
+ * "^<name>".
+ */
+static void read_packs_list_from_stdin(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list include_packs = STRING_LIST_INIT_DUP;
+	struct string_list exclude_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (*buf.buf == '^')
+			string_list_append(&exclude_packs, buf.buf + 1);
+		else
+			string_list_append(&include_packs, buf.buf);
+	}
+	string_list_sort(&include_packs);
+	string_list_sort(&exclude_packs);
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = pack_basename(p);
+
+		item = string_list_lookup(&include_packs, name);
+		if (item)
+			item->util = p;
+		item = string_list_lookup(&exclude_packs, name);
+		if (item)
+			item->util = p;
+	}
+
+	for_each_string_list_item(item, &exclude_packs) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		p->pack_keep_in_core = 1;
+	}
+	ignore_packed_keep_in_core = 1;
+
+	for_each_string_list_item(item, &include_packs) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		if (open_pack_index(p))
+			die(_("cannot open pack index"));
+		if (for_each_object_in_pack(p, add_object_entry_from_pack, NULL,
+					    FOR_EACH_OBJECT_PACK_ORDER))
+			die(_("cannot read objects of pack '%s'"), item->string);
+	}
+
+	string_list_clear(&include_packs, 0);
+	string_list_clear(&exclude_packs, 0);
+	strbuf_release(&buf);
+}
+
+/*
+ * Add an object to a cruft pack, remembering the most recent mtime seen
+ * for it. Objects which can be found in one of the packs to retain are
+ * left out.
+ */
+static void add_cruft_object_entry(const struct object_id *oid,
+				   enum object_type type,
+				   struct packed_git *pack, off_t offset,
+				   const char *name, uint32_t mtime)
+{
+	struct object_entry *entry;
+
+	display_progress(progress_state, ++nr_seen);
+
+	entry = packlist_find(&to_pack, oid);
+	if (entry) {
+		if (mtime > oe_cruft_mtime(&to_pack, entry))
+			oe_set_cruft_mtime(&to_pack, entry, mtime);
+		return;
+	}
+
+	if (!want_object_in_pack(oid, 0, &pack, &offset))
+		return;
+	if (!pack && oid_object_info_extended(the_repository, oid, NULL,
+					      OBJECT_INFO_QUICK |
+					      OBJECT_INFO_SKIP_FETCH_OBJECT) < 0)
+		return; /* a missing link below an unreachable object */
+
+	create_object_entry(oid, type, pack_name_hash(name), 0,
+			    name && no_try_delta(name), pack, offset);
+	entry = packlist_find(&to_pack, oid);
+	oe_set_cruft_mtime(&to_pack, entry, mtime);
+}
+
+static int add_cruft_loose_object(const struct object_id *oid,
+				  const char *path, void *data)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		/* the object may have been removed by a concurrent prune */
+		if (errno == ENOENT)
+			return 0;
+		return error_errno(_("unable to stat %s"), oid_to_hex(oid));
+	}
+
+	if (cruft_expiration && st.st_mtime <= cruft_expiration)
+		return 0;
+
+	add_cruft_object_entry(oid, OBJ_NONE, NULL, 0, NULL, st.st_mtime);
+	return 0;
+}
+
+static int add_cruft_packed_object(const struct object_id *oid,
+				   struct packed_git *p, uint32_t pos,
+				   void *data)
+{
+	uint32_t mtime = p->is_cruft ? nth_packed_mtime(p, pos) : p->mtime;
+
+	if (cruft_expiration && mtime <= cruft_expiration)
+		return 0;
+
+	add_cruft_object_entry(oid, OBJ_NONE, p,
+			       nth_packed_object_offset(p, pos), NULL, mtime);
+	return 0;
+}
+
+static void show_cruft_commit(struct commit *commit, void *data)
+{
+	add_cruft_object_entry(&commit->object.oid, OBJ_COMMIT, NULL, 0,
+			       NULL, 0);
+}
+
+static void show_cruft_object(struct object *obj, const char *name,
+			      void *data)
+{
+	add_cruft_object_entry(&obj->oid, obj->type, NULL, 0, name, 0);
+}
+
+/*
+ * Objects which are about to expire must stay around if an unexpired
+ * object still refers to them, much like "git prune" keeps objects that
+ * are reachable from recent ones. Walk from the objects we kept and add
+ * everything they reach; such objects get no mtime of their own, so they
+ * expire as soon as the objects referring to them do.
+ */
+static void add_objects_reachable_from_cruft(void)
+{
+	struct rev_info revs;
+	uint32_t i, nr = to_pack.nr_objects;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	revs.ignore_missing_links = 1;
+
+	for (i = 0; i < nr; i++) {
+		const struct object_id *oid = &to_pack.objects[i].idx.oid;
+		struct object *obj;
+
+		switch (oid_object_info(the_repository, oid, NULL)) {
+		case OBJ_COMMIT:
+		case OBJ_TAG:
+			obj = parse_object(the_repository, oid);
+			break;
+		case OBJ_TREE:
+			obj = (struct object *)lookup_tree(the_repository, oid);
+			break;
+		default:
+			/* blobs do not refer to anything */
+			continue;
+		}
+		if (obj)
+			add_pending_object(&revs, obj, "");
+	}
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, show_cruft_commit, show_cruft_object,
+			     NULL);
+}
+
+/*
+ * Read pack names for a cruft pack from stdin. Packs listed as "-<name>"
+ * are about to be deleted; their objects, along with all loose objects,
+ * go into the cruft pack unless they can be found in a pack listed as
+ * "<name>", which are kept. Objects older than --cruft-expiration are
+ * left out, unless an object which is kept refers to them.
+ */
+static void read_cruft_packs_from_stdin(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list fresh_packs = STRING_LIST_INIT_DUP;
+	struct string_list discard_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct packed_git *p;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (*buf.buf == '-')
+			string_list_append(&discard_packs, buf.buf + 1);
+		else
+			string_list_append(&fresh_packs, buf.buf);
+	}
+	string_list_sort(&fresh_packs);
+	string_list_sort(&discard_packs);
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = pack_basename(p);
+
+		item = string_list_lookup(&fresh_packs, name);
+		if (item)
+			item->util = p;
+		item = string_list_lookup(&discard_packs, name);
+		if (item)
+			item->util = p;
+	}
+
+	for_each_string_list_item(item, &fresh_packs) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		p->pack_keep_in_core = 1;
+	}
+	ignore_packed_keep_in_core = 1;
+
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      add_cruft_loose_object, NULL, NULL, NULL);
+
+	for_each_string_list_item(item, &discard_packs) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		if (p->is_cruft && load_pack_mtimes(p))
+			die(_("could not load cruft pack '%s'"), item->string);
+		if (for_each_object_in_pack(p, add_cruft_packed_object, NULL,
+					    FOR_EACH_OBJECT_PACK_ORDER))
+			die(_("cannot read objects of pack '%s'"), item->string);
+	}
+
+	if (cruft_expiration)
+		add_objects_reachable_from_cruft();
+
+	string_list_clear(&fresh_packs, 0);
+	string_list_clear(&discard_packs, 0);
+	strbuf_release(&buf);
+}
+
 /* Remember to update object flag allocation in object.h */
 #define OBJECT_ADDED (1u<<20)
 
@@ -3382,9 +3775,14 @@ static void get_object_list(int ac, const char **av)
 
 	if (!fn_show_object)
 		fn_show_object = show_object;
-	traverse_commit_list_filtered(&filter_options, &revs,
-				      show_commit, fn_show_object, NULL,
-				      NULL);
+	if (filter_options.choice)
+		traverse_commit_list_filtered(&filter_options, &revs,
+					      show_commit, fn_show_object, NULL,
+					      NULL);
+	else
+		traverse_commit_list_parallel(&revs, show_commit,
+					      fn_show_object, NULL,
+					      enumeration_threads);
 
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
@@ -3466,6 +3864,20 @@ static int option_parse_unpack_unreachable(const struct option *opt,
 	return 0;
 }
 
+static int option_parse_cruft_expiration(const struct option *opt,
+					 const char *arg, int unset)
+{
+	if (unset) {
+		cruft = 0;
+		cruft_expiration = 0;
+	} else {
+		cruft = 1;
+		if (arg)
+			cruft_expiration = approxidate(arg);
+	}
+	return 0;
+}
+
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
@@ -3506,10 +3918,21 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("reuse existing objects")),
 		OPT_BOOL(0, "delta-base-offset", &allow_ofs_delta,
 			 N_("use OFS_DELTA objects")),
+		OPT_BOOL(0, "path-deltas", &path_deltas,
+			 N_("try deltas between objects at the same path first")),
 		OPT_INTEGER(0, "threads", &delta_search_threads,
 			    N_("use threads when searching for best delta matches")),
+		OPT_INTEGER(0, "enumeration-threads", &enumeration_threads,
+			    N_("use threads when walking trees to find objects")),
 		OPT_BOOL(0, "non-empty", &non_empty,
 			 N_("do not create an empty pack output")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from stdin and pack their objects")),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("create a cruft pack of unreachable objects")),
+		OPT_CALLBACK_F(0, "cruft-expiration", NULL, N_("time"),
+		  N_("expire cruft objects older than <time>"),
+		  PARSE_OPT_OPTARG, option_parse_cruft_expiration),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
 		OPT_SET_INT_F(0, "unpacked", &rev_list_unpacked,
@@ -3584,6 +4007,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	reset_pack_idx_option(&pack_idx_opts);
 	git_config(git_pack_config, NULL);
+	if (git_env_bool(GIT_TEST_WRITE_REV_INDEX, 0))
+		pack_idx_opts.flags |= WRITE_REV;
 
 	progress = isatty(2);
 	argc = parse_options(argc, argv, prefix, pack_objects_options,
@@ -3628,7 +4053,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		strvec_push(&rp, "--indexed-objects");
 	}
-	if (rev_list_unpacked) {
+	/* with --stdin-packs, --unpacked adds the loose objects as well */
+	if (rev_list_unpacked && !stdin_packs) {
 		use_internal_rev_list = 1;
 		strvec_push(&rp, "--unpacked");
 	}
@@ -3653,6 +4079,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (!HAVE_THREADS && delta_search_threads != 1)
 		warning(_("no threads support, ignoring --threads"));
+	if (!enumeration_threads)
+		enumeration_threads = online_cpus();
 	if (!pack_to_stdout && !pack_size_limit)
 		pack_size_limit = pack_size_limit_cfg;
 	if (pack_to_stdout && pack_size_limit)
@@ -3675,6 +4103,22 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			die(_("cannot use --filter without --stdout"));
 	}
 
+	if (stdin_packs && use_internal_rev_list)
+		die(_("cannot traverse revisions with --stdin-packs"));
+	if (stdin_packs && filter_options.choice)
+		die(_("cannot use --filter with --stdin-packs"));
+
+	if (cruft) {
+		if (use_internal_rev_list)
+			die(_("cannot traverse revisions with --cruft"));
+		if (stdin_packs)
+			die(_("cannot use --stdin-packs with --cruft"));
+		if (pack_to_stdout)
+			die(_("cannot use --stdout with --cruft"));
+		if (filter_options.choice)
+			die(_("cannot use --filter with --cruft"));
+	}
+
 	/*
 	 * "soft" reasons not to use bitmaps - for on-disk repack by default we want
 	 *
@@ -3733,7 +4177,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Enumerating objects"), 0);
-	if (!use_internal_rev_list)
+	if (cruft) {
+		read_cruft_packs_from_stdin();
+	} else if (stdin_packs) {
+		read_packs_list_from_stdin();
+		if (rev_list_unpacked)
+			add_unreachable_loose_objects();
+	} else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.nr, rp.v);
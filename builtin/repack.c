@@ -19,6 +19,7 @@ static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps = -1;
 static int use_delta_islands;
+static int midx_incremental;
 static char *packdir, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -135,7 +136,11 @@ static void remove_redundant_pack(const char *dir_name, const char *base_name)
 	struct strbuf buf = STRBUF_INIT;
 	struct multi_pack_index *m = get_local_multi_pack_index(the_repository);
 	strbuf_addf(&buf, "%s.pack", base_name);
-	if (m && midx_contains_pack(m, buf.buf))
+	/*
+	 * A new layer of a multi-pack-index chain replaces the layers
+	 * referring to the packs we remove.
+	 */
+	if (m && midx_contains_pack(m, buf.buf) && !midx_incremental)
 		clear_midx_file(the_repository);
 	strbuf_insertf(&buf, 0, "%s/", dir_name);
 	unlink_pack_path(buf.buf, 1);
@@ -260,6 +265,176 @@ static void repack_promisor_objects(const struct pack_objects_args *args,
 		die(_("could not finish pack-objects to repack promisor objects"));
 }
 
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	uint32_t split;
+};
+
+static uint32_t geometric_weight(struct packed_git *p)
+{
+	if (open_pack_index(p))
+		die(_("cannot open index for %s"), p->pack_name);
+	return p->num_objects;
+}
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	uint32_t aw = geometric_weight(*(struct packed_git **)va),
+		 bw = geometric_weight(*(struct packed_git **)vb);
+
+	if (aw < bw)
+		return -1;
+	if (aw > bw)
+		return 1;
+	return 0;
+}
+
+/*
+ * Collect the local packs that may be rolled up, sorted by the number
+ * of objects they hold. Kept, promisor and cruft packs are left alone;
+ * rolling up a cruft pack would lose the mtimes of its objects.
+ */
+static void init_pack_geometry(struct pack_geometry *geometry,
+			       const struct string_list *keep_pack_list)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = pack_basename(p);
+		int i;
+
+		if (!p->pack_local || p->pack_promisor || p->is_cruft)
+			continue;
+		if (p->pack_keep && !pack_kept_objects)
+			continue;
+
+		for (i = 0; i < keep_pack_list->nr; i++)
+			if (!fspathcmp(name, keep_pack_list->items[i].string))
+				break;
+		if (i < keep_pack_list->nr)
+			continue;
+
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+/*
+ * Find the smallest number of packs ("split") to roll up into a new pack
+ * so that the new pack and the remaining ones form a geometric
+ * progression, each pack holding at least "factor" times as many
+ * objects as the next smaller one.
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i, split;
+	uint64_t total = 0;
+
+	if (!geometry->pack_nr) {
+		geometry->split = 0;
+		return;
+	}
+
+	/* The largest packs that already form a progression can stay. */
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		uint64_t ours = geometric_weight(geometry->pack[i]);
+		uint64_t prev = geometric_weight(geometry->pack[i - 1]);
+
+		if (ours < factor * prev)
+			break;
+	}
+	split = i ? i + 1 : 0;
+
+	/*
+	 * Everything below the split goes into the new pack, which may in
+	 * turn be too large for the next pack. Roll that up, too, until
+	 * the progression holds again.
+	 */
+	for (i = 0; i < split; i++)
+		total += geometric_weight(geometry->pack[i]);
+	for (i = split; i < geometry->pack_nr; i++) {
+		uint64_t ours = geometric_weight(geometry->pack[i]);
+
+		if (ours >= factor * total)
+			break;
+		total += ours;
+		split++;
+	}
+
+	geometry->split = split;
+}
+
+/*
+ * Write the unreachable objects of the packs about to be deleted, and
+ * all loose objects, into a cruft pack. Objects that made it into the
+ * freshly written packs in "names" are left out.
+ */
+static int write_cruft_pack(const struct pack_objects_args *args,
+			    const char *cruft_expiration,
+			    struct string_list *names,
+			    struct string_list *existing_packs)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct string_list_item *item;
+	const char *pack_prefix;
+	FILE *in, *out;
+	int ret;
+
+	prepare_pack_objects(&cmd, args);
+
+	strvec_push(&cmd.args, "--cruft");
+	if (cruft_expiration)
+		strvec_pushf(&cmd.args, "--cruft-expiration=%s",
+			     cruft_expiration);
+	strvec_push(&cmd.args, "--honor-pack-keep");
+	strvec_push(&cmd.args, "--non-empty");
+
+	cmd.in = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	/*
+	 * The new packs still carry their temporary names, and are found
+	 * by pack-objects under those.
+	 */
+	pack_prefix = strrchr(packtmp, '/') + 1;
+
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "%s-%s.pack\n", pack_prefix, item->string);
+	for_each_string_list_item(item, existing_packs)
+		fprintf(in, "-%s.pack\n", item->string);
+	fclose(in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != the_hash_algo->hexsz)
+			die(_("repack: Expecting full hex object ID lines only from pack-objects."));
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+
+	strbuf_release(&line);
+	return finish_command(&cmd);
+}
+
+static int has_local_packs(void)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		if (p->pack_local)
+			return 1;
+	return 0;
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
 
@@ -270,6 +445,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		unsigned optional:1;
 	} exts[] = {
 		{".pack"},
+		{".rev", 1},
+		{".mtimes", 1},
 		{".idx"},
 		{".bitmap", 1},
 		{".promisor", 1},
@@ -280,6 +457,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	struct string_list rollback = STRING_LIST_INIT_NODUP;
 	struct string_list existing_packs = STRING_LIST_INIT_DUP;
 	struct strbuf line = STRBUF_INIT;
+	struct pack_geometry geometry = { 0 };
 	int i, ext, ret, failed;
 	FILE *out;
 
@@ -290,6 +468,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int keep_unreachable = 0;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	int no_update_server_info = 0;
+	int geometric_factor = 0;
+	int write_midx = 0;
+	int cruft = 0;
+	const char *cruft_expiration = NULL;
 	struct pack_objects_args po_args = {NULL};
 
 	struct option builtin_repack_options[] = {
@@ -317,6 +499,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
 				N_("with -a, repack unreachable objects")),
+		OPT_BOOL(0, "cruft", &cruft,
+				N_("same as -a, pack unreachable cruft objects separately")),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, expire objects older than this")),
 		OPT_STRING(0, "window", &po_args.window, N_("n"),
 				N_("size of the window used for delta compression")),
 		OPT_STRING(0, "window-memory", &po_args.window_memory, N_("bytes"),
@@ -331,6 +517,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("repack objects in packs marked with .keep")),
 		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
 				N_("do not repack this pack")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("find a geometric progression with factor <n>")),
+		OPT_BOOL('m', "write-midx", &write_midx,
+				N_("write a multi-pack index of the resulting packs")),
 		OPT_END()
 	};
 
@@ -346,15 +536,42 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (cruft) {
+		if (pack_everything & LOOSEN_UNREACHABLE)
+			die(_("--cruft and -A are incompatible"));
+		if (keep_unreachable)
+			die(_("--cruft and --keep-unreachable are incompatible"));
+		if (unpack_unreachable)
+			die(_("--cruft and --unpack-unreachable are incompatible"));
+		pack_everything |= ALL_INTO_ONE;
+	} else if (cruft_expiration)
+		die(_("--cruft-expiration requires --cruft"));
+
+	if (geometric_factor < 0)
+		die(_("--geometric needs a positive factor"));
+	if (geometric_factor && pack_everything)
+		die(_("--geometric is incompatible with -a and -A"));
+	if (geometric_factor && use_delta_islands)
+		die(_("--geometric is incompatible with --delta-islands"));
+
+	if (geometric_factor && !write_midx &&
+	    get_local_multi_pack_index(the_repository))
+		write_midx = 1;
+
 	if (write_bitmaps < 0) {
 		if (!(pack_everything & ALL_INTO_ONE) ||
 		    !is_bare_repository())
 			write_bitmaps = 0;
 	}
+	if (write_midx && write_bitmaps <= 0) {
+		char *chain_name = get_midx_chain_filename(get_object_directory());
+		midx_incremental = file_exists(chain_name);
+		free(chain_name);
+	}
 	if (pack_kept_objects < 0)
-		pack_kept_objects = write_bitmaps > 0;
+		pack_kept_objects = write_bitmaps > 0 && !write_midx;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
+	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE) && !write_midx)
 		die(_(incremental_bitmap_conflict_error));
 
 	packdir = mkpathdup("%s/pack", get_object_directory());
@@ -371,19 +588,40 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		strvec_pushf(&cmd.args, "--keep-pack=%s",
 			     keep_pack_list.items[i].string);
 	strvec_push(&cmd.args, "--non-empty");
-	strvec_push(&cmd.args, "--all");
-	strvec_push(&cmd.args, "--reflog");
-	strvec_push(&cmd.args, "--indexed-objects");
-	if (has_promisor_remote())
-		strvec_push(&cmd.args, "--exclude-promisor-objects");
-	if (write_bitmaps > 0)
+	if (!geometric_factor) {
+		strvec_push(&cmd.args, "--all");
+		strvec_push(&cmd.args, "--reflog");
+		strvec_push(&cmd.args, "--indexed-objects");
+		if (has_promisor_remote())
+			strvec_push(&cmd.args, "--exclude-promisor-objects");
+	}
+	if (write_midx)
+		; /* the bitmap, if any, goes with the multi-pack index */
+	else if (write_bitmaps > 0)
 		strvec_push(&cmd.args, "--write-bitmap-index");
 	else if (write_bitmaps < 0)
 		strvec_push(&cmd.args, "--write-bitmap-index-quiet");
 	if (use_delta_islands)
 		strvec_push(&cmd.args, "--delta-islands");
 
-	if (pack_everything & ALL_INTO_ONE) {
+	if (geometric_factor) {
+		init_pack_geometry(&geometry, &keep_pack_list);
+		split_pack_geometry(&geometry, geometric_factor);
+
+		for (i = 0; i < geometry.split; i++) {
+			struct strbuf buf = STRBUF_INIT;
+			if (geometry.pack[i]->pack_keep)
+				continue;
+			strbuf_addstr(&buf, pack_basename(geometry.pack[i]));
+			strbuf_strip_suffix(&buf, ".pack");
+			string_list_append(&existing_packs, buf.buf);
+			strbuf_release(&buf);
+		}
+
+		/* loose objects are rolled up regardless of reachability */
+		strvec_push(&cmd.args, "--stdin-packs");
+		strvec_push(&cmd.args, "--unpacked");
+	} else if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs, &keep_pack_list);
 
 		repack_promisor_objects(&po_args, &names);
@@ -409,12 +647,29 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		strvec_push(&cmd.args, "--incremental");
 	}
 
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
 
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+
+		/*
+		 * Pack the objects of the packs to roll up, but none that
+		 * the packs left alone have already.
+		 */
+		for (i = 0; i < geometry.split; i++)
+			fprintf(in, "%s\n", pack_basename(geometry.pack[i]));
+		for (i = geometry.split; i < geometry.pack_nr; i++)
+			fprintf(in, "^%s\n", pack_basename(geometry.pack[i]));
+		fclose(in);
+	}
+
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline_lf(&line, out) != EOF) {
 		if (line.len != the_hash_algo->hexsz)
@@ -426,6 +681,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (ret)
 		return ret;
 
+	if (cruft) {
+		ret = write_cruft_pack(&po_args, cruft_expiration, &names,
+				       &existing_packs);
+		if (ret)
+			return ret;
+	}
+
 	if (!names.nr && !po_args.quiet)
 		printf_ln(_("Nothing new to pack."));
 
@@ -568,13 +830,24 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		update_server_info(0);
 	remove_temporary_files();
 
-	if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
-		write_midx_file(get_object_directory(), 0);
+	if (write_midx && has_local_packs()) {
+		unsigned flags = 0;
+		if (write_bitmaps > 0)
+			flags |= MIDX_WRITE_BITMAP;
+		if (midx_incremental)
+			flags |= MIDX_WRITE_INCREMENTAL;
+		if (!po_args.quiet && isatty(2))
+			flags |= MIDX_PROGRESS;
+		if (write_midx_file(get_object_directory(), NULL, flags, NULL))
+			return error(_("could not write multi-pack index"));
+	} else if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
+		write_midx_file(get_object_directory(), NULL, 0, NULL);
 
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
 	strbuf_release(&line);
+	free(geometry.pack);
 
 	return 0;
 }
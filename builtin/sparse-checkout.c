@@ -14,6 +14,7 @@
 #include "unpack-trees.h"
 #include "wt-status.h"
 #include "quote.h"
+#include "sparse-index.h"
 
 static const char *empty_base = "";
 
@@ -138,10 +139,13 @@ static int update_working_directory(struct pattern_list *pl)
 		 * files in the way or dirty entries that can't be removed.
 		 */
 		result = UPDATE_SPARSITY_SUCCESS;
+	/* The new patterns are not written out yet. */
+	r->index->sparse_checkout_patterns = pl;
 	if (result == UPDATE_SPARSITY_SUCCESS)
 		write_locked_index(r->index, &lock_file, COMMIT_LOCK);
 	else
 		rollback_lock_file(&lock_file);
+	r->index->sparse_checkout_patterns = NULL;
 
 	return result;
 }
@@ -285,12 +289,13 @@ static int set_config(enum sparse_checkout_mode mode)
 }
 
 static char const * const builtin_sparse_checkout_init_usage[] = {
-	N_("git sparse-checkout init [--cone]"),
+	N_("git sparse-checkout init [--cone] [--[no-]sparse-index]"),
 	NULL
 };
 
 static struct sparse_checkout_init_opts {
 	int cone_mode;
+	int sparse_index;
 } init_opts;
 
 static int sparse_checkout_init(int argc, const char **argv)
@@ -305,11 +310,15 @@ static int sparse_checkout_init(int argc, const char **argv)
 	static struct option builtin_sparse_checkout_init_options[] = {
 		OPT_BOOL(0, "cone", &init_opts.cone_mode,
 			 N_("initialize the sparse-checkout in cone mode")),
+		OPT_BOOL(0, "sparse-index", &init_opts.sparse_index,
+			 N_("toggle the use of a sparse index")),
 		OPT_END(),
 	};
 
 	repo_read_index(the_repository);
 
+	init_opts.sparse_index = -1;
+
 	argc = parse_options(argc, argv, NULL,
 			     builtin_sparse_checkout_init_options,
 			     builtin_sparse_checkout_init_usage, 0);
@@ -323,6 +332,10 @@ static int sparse_checkout_init(int argc, const char **argv)
 	if (set_config(mode))
 		return 1;
 
+	if (init_opts.sparse_index >= 0 &&
+	    set_sparse_index_config(the_repository, init_opts.sparse_index) < 0)
+		die(_("failed to modify sparse-index config"));
+
 	memset(&pl, 0, sizeof(pl));
 
 	sparse_filename = get_sparse_checkout_filename();
@@ -349,6 +362,12 @@ static int sparse_checkout_init(int argc, const char **argv)
 		return 0;
 	}
 
+	if (core_sparse_checkout_cone) {
+		pl.use_cone_patterns = 1;
+		hashmap_init(&pl.recursive_hashmap, pl_hashmap_cmp, NULL, 0);
+		hashmap_init(&pl.parent_hashmap, pl_hashmap_cmp, NULL, 0);
+	}
+
 	strbuf_addstr(&pattern, "/*");
 	add_pattern(strbuf_detach(&pattern, NULL), empty_base, 0, &pl, 0);
 	strbuf_addstr(&pattern, "!/*/");
@@ -610,6 +629,10 @@ static int sparse_checkout_disable(int argc, const char **argv)
 
 	repo_read_index(the_repository);
 
+	/* Write out a full index along with the full worktree. */
+	if (set_sparse_index_config(the_repository, 0) < 0)
+		die(_("failed to modify sparse-index config"));
+
 	memset(&pl, 0, sizeof(pl));
 	hashmap_init(&pl.recursive_hashmap, pl_hashmap_cmp, NULL, 0);
 	hashmap_init(&pl.parent_hashmap, pl_hashmap_cmp, NULL, 0);
@@ -9,6 +9,8 @@
 #include "strbuf.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "oidset.h"
+#include "thread-utils.h"
 
 static struct bulk_checkin_state {
 	unsigned plugged:1;
@@ -23,10 +25,17 @@ static struct bulk_checkin_state {
 	uint32_t nr_written;
 } state;
 
+/*
+ * The objects written (or, in batch mode, queued to be written) since
+ * the bulk checkin was plugged.
+ */
+static struct oidset bulk_checkin_oids = OIDSET_INIT;
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	struct object_id oid;
 	struct strbuf packname = STRBUF_INIT;
+	unsigned plugged;
 	int i;
 
 	if (!state->f)
@@ -48,32 +57,30 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 	strbuf_addf(&packname, "%s/pack/pack-", get_object_directory());
 	finish_tmp_packfile(&packname, state->pack_tmp_name,
-			    state->written, state->nr_written,
+			    state->written, state->nr_written, NULL,
 			    &state->pack_idx_opts, oid.hash);
 	for (i = 0; i < state->nr_written; i++)
 		free(state->written[i]);
 
 clear_exit:
 	free(state->written);
+	plugged = state->plugged;
 	memset(state, 0, sizeof(*state));
+	state->plugged = plugged;
 
 	strbuf_release(&packname);
 	/* Make objects we just wrote available to ourselves */
 	reprepare_packed_git(the_repository);
 }
 
-static int already_written(struct bulk_checkin_state *state, struct object_id *oid)
+static int already_written(struct object_id *oid)
 {
-	int i;
-
 	/* The object may already exist in the repository */
 	if (has_object_file(oid))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (oideq(&state->written[i]->oid, oid))
-			return 1;
+	if (oidset_contains(&bulk_checkin_oids, oid))
+		return 1;
 
 	/* This is a new object we need to keep */
 	return 0;
@@ -243,12 +250,13 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 		return 0;
 
 	idx->crc32 = crc32_end(state->f);
-	if (already_written(state, result_oid)) {
+	if (already_written(result_oid)) {
 		hashfile_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
 		free(idx);
 	} else {
 		oidcpy(&idx->oid, result_oid);
+		oidset_insert(&bulk_checkin_oids, result_oid);
 		ALLOC_GROW(state->written,
 			   state->nr_written + 1,
 			   state->alloc_written);
@@ -257,14 +265,271 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	return 0;
 }
 
+/*
+ * Batch mode: while the bulk checkin is plugged, objects given to us in
+ * memory are hashed right away, but compressed by a pool of threads.
+ * The main thread appends the compressed objects to the pack as they
+ * come back, so that all pack and object store state is only ever
+ * touched by a single thread.
+ */
+struct bulk_checkin_job {
+	struct bulk_checkin_job *next;
+	struct object_id oid;
+	enum object_type type;
+	void *buf;
+	size_t size;
+	/* The in-pack header and the deflated data. */
+	struct strbuf out;
+};
+
+/* Do not hold more than this many bytes of uncompressed data. */
+#define BULK_CHECKIN_MAX_QUEUED (64 * 1024 * 1024)
+
+static struct bulk_checkin_pool {
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_todo;
+	pthread_cond_t cond_done;
+
+	/* Jobs waiting for a thread, oldest first. */
+	struct bulk_checkin_job *todo, **todo_tail;
+	/* Jobs whose data is ready to be written. */
+	struct bulk_checkin_job *done;
+	/* The number of jobs not yet written and the size of their input. */
+	size_t nr_pending;
+	size_t pending_bytes;
+	int quit;
+} pool;
+
+static void deflate_job(struct bulk_checkin_job *job)
+{
+	unsigned char hdr[MAX_PACK_OBJECT_HEADER];
+	int hdrlen;
+	git_zstream stream;
+	unsigned long maxsize;
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr),
+					      job->type, job->size);
+	git_deflate_init(&stream, pack_compression_level);
+	maxsize = git_deflate_bound(&stream, job->size);
+
+	strbuf_grow(&job->out, hdrlen + maxsize);
+	strbuf_add(&job->out, hdr, hdrlen);
+	stream.next_in = job->buf;
+	stream.avail_in = job->size;
+	stream.next_out = (unsigned char *)job->out.buf + hdrlen;
+	stream.avail_out = maxsize;
+	while (git_deflate(&stream, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&stream);
+	strbuf_setlen(&job->out, hdrlen + stream.total_out);
+
+	FREE_AND_NULL(job->buf);
+}
+
+static void *run_deflate_jobs(void *data)
+{
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		struct bulk_checkin_job *job;
+
+		while (!pool.todo && !pool.quit)
+			pthread_cond_wait(&pool.cond_todo, &pool.mutex);
+		if (!pool.todo)
+			break;
+
+		job = pool.todo;
+		pool.todo = job->next;
+		if (!pool.todo)
+			pool.todo_tail = &pool.todo;
+
+		pthread_mutex_unlock(&pool.mutex);
+		deflate_job(job);
+		pthread_mutex_lock(&pool.mutex);
+
+		job->next = pool.done;
+		pool.done = job;
+		pthread_cond_signal(&pool.cond_done);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return NULL;
+}
+
+static void start_pool(void)
+{
+	int i;
+
+	pool.nr_threads = core_bulk_checkin_threads;
+	if (!pool.nr_threads)
+		pool.nr_threads = online_cpus();
+	if (!HAVE_THREADS || pool.nr_threads < 2) {
+		/* Jobs are run as they are queued. */
+		pool.nr_threads = 1;
+		return;
+	}
+
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond_todo, NULL);
+	pthread_cond_init(&pool.cond_done, NULL);
+	pool.todo_tail = &pool.todo;
+
+	ALLOC_ARRAY(pool.threads, pool.nr_threads);
+	for (i = 0; i < pool.nr_threads; i++) {
+		int err = pthread_create(&pool.threads[i], NULL,
+					 run_deflate_jobs, NULL);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+}
+
+static void write_job(struct bulk_checkin_state *state,
+		      struct bulk_checkin_job *job)
+{
+	struct pack_idx_entry *idx;
+
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+	if (state->nr_written && pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + job->out.len) {
+		finish_bulk_checkin(state);
+		prepare_to_stream(state, HASH_WRITE_OBJECT);
+	}
+
+	idx = xcalloc(1, sizeof(*idx));
+	oidcpy(&idx->oid, &job->oid);
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+	hashwrite(state->f, job->out.buf, job->out.len);
+	idx->crc32 = crc32_end(state->f);
+	state->offset += job->out.len;
+
+	ALLOC_GROW(state->written, state->nr_written + 1,
+		   state->alloc_written);
+	state->written[state->nr_written++] = idx;
+
+	strbuf_release(&job->out);
+	free(job);
+}
+
+/*
+ * Write out the jobs that are done, waiting until no more than
+ * `max_pending` jobs and `max_bytes` bytes of input remain pending.
+ */
+static void write_done_jobs(size_t max_pending, size_t max_bytes)
+{
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		struct bulk_checkin_job *done = pool.done;
+
+		pool.done = NULL;
+		while (done) {
+			struct bulk_checkin_job *job = done;
+
+			done = job->next;
+			pool.nr_pending--;
+			pool.pending_bytes -= job->size;
+
+			pthread_mutex_unlock(&pool.mutex);
+			write_job(&state, job);
+			pthread_mutex_lock(&pool.mutex);
+		}
+
+		if (pool.nr_pending <= max_pending &&
+		    pool.pending_bytes <= max_bytes)
+			break;
+		while (!pool.done)
+			pthread_cond_wait(&pool.cond_done, &pool.mutex);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+static void stop_pool(void)
+{
+	int i;
+
+	if (!pool.threads) {
+		memset(&pool, 0, sizeof(pool));
+		return;
+	}
+
+	write_done_jobs(0, 0);
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.cond_todo);
+	pthread_mutex_unlock(&pool.mutex);
+
+	for (i = 0; i < pool.nr_threads; i++)
+		pthread_join(pool.threads[i], NULL);
+	free(pool.threads);
+
+	pthread_mutex_destroy(&pool.mutex);
+	pthread_cond_destroy(&pool.cond_todo);
+	pthread_cond_destroy(&pool.cond_done);
+	memset(&pool, 0, sizeof(pool));
+}
+
+int bulk_checkin_batched(void)
+{
+	return state.plugged && core_bulk_checkin;
+}
+
+int index_bulk_checkin_mem(struct object_id *oid,
+			   const void *buf, size_t size,
+			   enum object_type type, const char *path,
+			   unsigned flags)
+{
+	struct bulk_checkin_job *job;
+
+	if (!bulk_checkin_batched())
+		BUG("index_bulk_checkin_mem() called outside of batch mode");
+
+	hash_object_file(the_hash_algo, buf, size, type_name(type), oid);
+	if (!(flags & HASH_WRITE_OBJECT) || already_written(oid))
+		return 0;
+	oidset_insert(&bulk_checkin_oids, oid);
+
+	CALLOC_ARRAY(job, 1);
+	oidcpy(&job->oid, oid);
+	job->type = type;
+	job->buf = xmemdupz(buf, size);
+	job->size = size;
+	strbuf_init(&job->out, 0);
+
+	if (!pool.nr_threads)
+		start_pool();
+	if (!pool.threads) {
+		deflate_job(job);
+		write_job(&state, job);
+		return 0;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	*pool.todo_tail = job;
+	pool.todo_tail = &job->next;
+	pool.nr_pending++;
+	pool.pending_bytes += size;
+	pthread_cond_signal(&pool.cond_todo);
+	pthread_mutex_unlock(&pool.mutex);
+
+	/*
+	 * Keep every thread busy, but do not let the uncompressed data
+	 * pile up.
+	 */
+	write_done_jobs(2 * pool.nr_threads, BULK_CHECKIN_MAX_QUEUED);
+	return 0;
+}
+
 int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
 {
 	int status = deflate_to_pack(&state, oid, fd, size, type,
 				     path, flags);
-	if (!state.plugged)
+	if (!state.plugged) {
 		finish_bulk_checkin(&state);
+		oidset_clear(&bulk_checkin_oids);
+	}
 	return status;
 }
 
@@ -275,7 +540,9 @@ void plug_bulk_checkin(void)
 
 void unplug_bulk_checkin(void)
 {
+	stop_pool();
 	state.plugged = 0;
 	if (state.f)
 		finish_bulk_checkin(&state);
+	oidset_clear(&bulk_checkin_oids);
 }
@@ -10,7 +10,29 @@ int index_bulk_checkin(struct object_id *oid,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags);
 
+/*
+ * While the bulk checkin is plugged, objects are collected into a
+ * single pack that is only finished (and fsynced) when it is unplugged.
+ * Until then, they cannot be read back.
+ */
 void plug_bulk_checkin(void);
 void unplug_bulk_checkin(void);
 
+/*
+ * Return true if the bulk checkin is plugged in batch mode
+ * (core.bulkCheckin), in which even small objects that would otherwise
+ * be written as loose objects go to the pack.
+ */
+int bulk_checkin_batched(void);
+
+/*
+ * Like index_bulk_checkin(), but for an object in memory, which is
+ * compressed on another thread. The object name is known on return.
+ * Must only be called in batch mode.
+ */
+int index_bulk_checkin_mem(struct object_id *oid,
+			   const void *buf, size_t size,
+			   enum object_type type, const char *path,
+			   unsigned flags);
+
 #endif
@@ -69,6 +69,12 @@ unsigned long git_deflate_bound(git_zstream *, unsigned long);
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A "sparse directory" entry of a sparse index stands for a whole tree
+ * outside of the sparse-checkout cone; see sparse-index.h.
+ */
+#define S_ISSPARSEDIR(m) ((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -249,6 +255,8 @@ static inline unsigned int create_ce_mode(unsigned int mode)
 {
 	if (S_ISLNK(mode))
 		return S_IFLNK;
+	if (S_ISSPARSEDIR(mode))
+		return S_IFDIR;
 	if (S_ISDIR(mode) || S_ISGITLINK(mode))
 		return S_IFGITLINK;
 	return S_IFREG | ce_permissions(mode);
@@ -305,6 +313,7 @@ static inline unsigned int canon_mode(unsigned int mode)
 struct split_index;
 struct untracked_cache;
 struct progress;
+struct pattern_list;
 
 struct index_state {
 	struct cache_entry **cache;
@@ -319,7 +328,8 @@ struct index_state {
 		 drop_cache_tree : 1,
 		 updated_workdir : 1,
 		 updated_skipworktree : 1,
-		 fsmonitor_has_run_once : 1;
+		 fsmonitor_has_run_once : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	struct object_id oid;
@@ -328,6 +338,12 @@ struct index_state {
 	struct ewah_bitmap *fsmonitor_dirty;
 	struct mem_pool *ce_mem_pool;
 	struct progress *progress;
+
+	/*
+	 * The sparse-checkout patterns the entries were last updated
+	 * for, if they are not (yet) the ones on disk.
+	 */
+	struct pattern_list *sparse_checkout_patterns;
 };
 
 /* Name hashing */
@@ -628,8 +644,10 @@ int path_inside_repo(const char *prefix, const char *path);
 
 int init_db(const char *git_dir, const char *real_git_dir,
 	    const char *template_dir, int hash_algo,
-	    const char *initial_branch, unsigned int flags);
-void initialize_repository_version(int hash_algo, int reinit);
+	    const char *ref_format, const char *initial_branch,
+	    unsigned int flags);
+void initialize_repository_version(int hash_algo, const char *ref_format,
+				   int reinit);
 
 void sanitize_stdfds(void);
 int daemonize(void);
@@ -954,11 +972,14 @@ extern int read_replace_refs;
 extern char *git_replace_ref_base;
 
 extern int fsync_object_files;
+extern int core_bulk_checkin;
+extern int core_bulk_checkin_threads;
 extern int core_preload_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
 extern const char *core_fsmonitor;
+extern int core_fsmonitor_builtin;
 
 extern int core_apply_sparse_checkout;
 extern int core_sparse_checkout_cone;
@@ -1042,6 +1063,7 @@ struct repository_format {
 	int worktree_config;
 	int is_bare;
 	int hash_algo;
+	char *ref_storage_format; /* value of extensions.refstorage */
 	char *work_tree;
 	struct string_list unknown_extensions;
 	struct string_list v1_only_extensions;
@@ -1724,6 +1746,14 @@ struct checkout {
 #define TEMPORARY_FILENAME_LENGTH 25
 int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath, int *nr_checkouts);
 void enable_delayed_checkout(struct checkout *state);
+/*
+ * Helpers used by checkout_entry() which are shared with the parallel
+ * checkout workers (see parallel-checkout.h).
+ */
+void *read_blob_entry(const struct cache_entry *ce, unsigned long *size);
+int fstat_checkout_output(int fd, const struct checkout *state, struct stat *st);
+void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+			   struct stat *st);
 int finish_delayed_checkout(struct checkout *state, int *nr_checkouts);
 /*
  * Unlink the last component and schedule the leading directories for
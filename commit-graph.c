@@ -27,7 +27,9 @@ void git_test_write_commit_graph_or_die(void)
 		return;
 
 	if (git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
-		flags = COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+		flags |= COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	if (git_env_bool(GIT_TEST_COMMIT_GRAPH_REACH_LABELS, 0))
+		flags |= COMMIT_GRAPH_WRITE_REACH_LABELS;
 
 	if (write_commit_graph_reachable(the_repository->objects->odb,
 					 flags, NULL))
@@ -38,13 +40,17 @@ void git_test_write_commit_graph_or_die(void)
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA 0x47444154 /* "GDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f56 /* "GDOV" */
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
 #define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
 #define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_REACH_LABELS 0x524c424c /* "RLBL" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
-#define MAX_NUM_CHUNKS 7
+#define MAX_NUM_CHUNKS 10
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
+#define GRAPH_REACH_LABEL_WIDTH 12
 
 #define GRAPH_VERSION_1 0x1
 #define GRAPH_VERSION GRAPH_VERSION_1
@@ -55,6 +61,8 @@ void git_test_write_commit_graph_or_die(void)
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW (1ULL << 31)
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_CHUNKLOOKUP_WIDTH 12
@@ -64,6 +72,21 @@ void git_test_write_commit_graph_or_die(void)
 /* Remember to update object flag allocation in object.h */
 #define REACHABLE       (1u<<15)
 
+/*
+ * Commits are numbered in post-order of a depth-first search over their
+ * parents. Everything reachable from a commit has a lower number than
+ * the commit itself. The commits with numbers in [tree_low, post] are
+ * the ones the search reached through this commit, so they are known to
+ * be reachable; nothing numbered below reach_low is.
+ */
+struct reach_label {
+	uint32_t post;
+	uint32_t tree_low;
+	uint32_t reach_low;
+};
+
+define_commit_slab(topo_level_slab, uint32_t);
+
 /* Keep track of the order in which commits are added to our list. */
 define_commit_slab(commit_pos, int);
 static struct commit_pos commit_pos = COMMIT_SLAB_INIT(1, commit_pos);
@@ -99,7 +122,7 @@ uint32_t commit_graph_position(const struct commit *c)
 	return data ? data->graph_pos : COMMIT_NOT_FROM_GRAPH;
 }
 
-uint32_t commit_graph_generation(const struct commit *c)
+timestamp_t commit_graph_generation(const struct commit *c)
 {
 	struct commit_graph_data *data =
 		commit_graph_data_slab_peek(&commit_graph_data_slab, c);
@@ -144,8 +167,8 @@ static int commit_gen_cmp(const void *va, const void *vb)
 	const struct commit *a = *(const struct commit **)va;
 	const struct commit *b = *(const struct commit **)vb;
 
-	uint32_t generation_a = commit_graph_generation(a);
-	uint32_t generation_b = commit_graph_generation(b);
+	timestamp_t generation_a = commit_graph_generation(a);
+	timestamp_t generation_b = commit_graph_generation(b);
 	/* lower generation commits first */
 	if (generation_a < generation_b)
 		return -1;
@@ -388,6 +411,20 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 				graph->chunk_commit_data = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_GENERATION_DATA:
+			if (graph->chunk_generation_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW:
+			if (graph->chunk_generation_data_overflow)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data_overflow = data + chunk_offset;
+			break;
+
 		case GRAPH_CHUNKID_EXTRAEDGES:
 			if (graph->chunk_extra_edges)
 				chunk_repeated = 1;
@@ -395,6 +432,13 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 				graph->chunk_extra_edges = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_REACH_LABELS:
+			if (graph->chunk_reach_labels)
+				chunk_repeated = 1;
+			else
+				graph->chunk_reach_labels = data + chunk_offset;
+			break;
+
 		case GRAPH_CHUNKID_BASE:
 			if (graph->chunk_base_graphs)
 				chunk_repeated = 1;
@@ -444,6 +488,10 @@ struct commit_graph *parse_commit_graph(struct repository *r,
 		FREE_AND_NULL(graph->bloom_filter_settings);
 	}
 
+	if (graph->chunk_generation_data &&
+	    r->settings.commit_graph_generation_version >= 2)
+		graph->read_generation_data = 1;
+
 	hashcpy(graph->oid.hash, graph->data + graph->data_len - graph->hash_len);
 
 	if (verify_commit_graph_lite(graph))
@@ -521,6 +569,26 @@ static int add_graph_to_chain(struct commit_graph *g,
 	return 1;
 }
 
+/*
+ * Generation numbers from different layers of a chain are only
+ * comparable if they are of the same kind. Fall back to topological
+ * levels everywhere unless every layer has corrected commit dates.
+ */
+static void validate_mixed_generation_chain(struct commit_graph *g)
+{
+	int read_generation_data = 1;
+	struct commit_graph *p;
+
+	for (p = g; read_generation_data && p; p = p->base_graph)
+		read_generation_data = p->read_generation_data;
+
+	if (read_generation_data)
+		return;
+
+	for (p = g; p; p = p->base_graph)
+		p->read_generation_data = 0;
+}
+
 static struct commit_graph *load_commit_graph_chain(struct repository *r,
 						    struct object_directory *odb)
 {
@@ -583,6 +651,8 @@ static struct commit_graph *load_commit_graph_chain(struct repository *r,
 		}
 	}
 
+	validate_mixed_generation_chain(graph_chain);
+
 	free(oids);
 	fclose(fp);
 	strbuf_release(&line);
@@ -699,6 +769,54 @@ void close_commit_graph(struct raw_object_store *o)
 	o->commit_graph = NULL;
 }
 
+static int load_reach_label(struct commit_graph *g, uint32_t pos,
+			    struct reach_label *label)
+{
+	const unsigned char *data;
+
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || !g->chunk_reach_labels ||
+	    pos >= g->num_commits_in_base + g->num_commits)
+		return 0;
+
+	data = g->chunk_reach_labels +
+	       GRAPH_REACH_LABEL_WIDTH * (pos - g->num_commits_in_base);
+	label->post = get_be32(data);
+	label->tree_low = get_be32(data + 4);
+	label->reach_low = get_be32(data + 8);
+	return 1;
+}
+
+int commit_graph_can_reach(struct repository *r,
+			   struct commit *from,
+			   struct commit *to)
+{
+	struct reach_label from_label, to_label;
+	uint32_t from_pos, to_pos;
+
+	if (from == to)
+		return 1;
+	if (!prepare_commit_graph(r))
+		return -1;
+
+	from_pos = commit_graph_position(from);
+	to_pos = commit_graph_position(to);
+	if (from_pos == COMMIT_NOT_FROM_GRAPH ||
+	    to_pos == COMMIT_NOT_FROM_GRAPH ||
+	    !load_reach_label(r->objects->commit_graph, from_pos, &from_label) ||
+	    !load_reach_label(r->objects->commit_graph, to_pos, &to_label))
+		return -1;
+
+	if (from_label.tree_low <= to_label.post &&
+	    to_label.post <= from_label.post)
+		return 1;
+	if (to_label.post > from_label.post ||
+	    to_label.post < from_label.reach_low)
+		return 0;
+	return -1;
+}
+
 static int bsearch_graph(struct commit_graph *g, struct object_id *oid, uint32_t *pos)
 {
 	return bsearch_hash(oid->hash, g->chunk_oid_fanout,
@@ -748,17 +866,44 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 {
 	const unsigned char *commit_data;
 	struct commit_graph_data *graph_data;
-	uint32_t lex_index;
+	uint32_t lex_index, offset_pos;
+	uint64_t date_high, date_low, offset;
 
 	while (pos < g->num_commits_in_base)
 		g = g->base_graph;
 
+	if (pos >= g->num_commits + g->num_commits_in_base)
+		die(_("invalid commit position. commit-graph is likely corrupt"));
+
 	lex_index = pos - g->num_commits_in_base;
 	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 
 	graph_data = commit_graph_data_at(item);
 	graph_data->graph_pos = pos;
-	graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	item->date = (timestamp_t)((date_high << 32) | date_low);
+
+	if (g->read_generation_data) {
+		offset = (timestamp_t)get_be32(g->chunk_generation_data +
+					       sizeof(uint32_t) * lex_index);
+
+		if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+			if (!g->chunk_generation_data_overflow)
+				die(_("commit-graph requires overflow generation data but has none"));
+
+			offset_pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+			graph_data->generation = item->date +
+				get_be64(g->chunk_generation_data_overflow + 8 * offset_pos);
+		} else
+			graph_data->generation = item->date + offset;
+	} else
+		graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+
+	if (g->topo_levels)
+		*topo_level_slab_at(g->topo_levels, item) =
+			get_be32(commit_data + g->hash_len + 8) >> 2;
 }
 
 static inline void set_commit_tree(struct commit *c, struct tree *t)
@@ -772,38 +917,26 @@ static int fill_commit_in_graph(struct repository *r,
 {
 	uint32_t edge_value;
 	uint32_t *parent_data_ptr;
-	uint64_t date_low, date_high;
 	struct commit_list **pptr;
-	struct commit_graph_data *graph_data;
 	const unsigned char *commit_data;
 	uint32_t lex_index;
 
 	while (pos < g->num_commits_in_base)
 		g = g->base_graph;
 
-	if (pos >= g->num_commits + g->num_commits_in_base)
-		die(_("invalid commit position. commit-graph is likely corrupt"));
+	fill_commit_graph_info(item, g, pos);
 
 	/*
-	 * Store the "full" position, but then use the
+	 * fill_commit_graph_info() stored the "full" position; use the
 	 * "local" position for the rest of the calculation.
 	 */
-	graph_data = commit_graph_data_at(item);
-	graph_data->graph_pos = pos;
 	lex_index = pos - g->num_commits_in_base;
-
-	commit_data = g->chunk_commit_data + (g->hash_len + 16) * lex_index;
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 
 	item->object.parsed = 1;
 
 	set_commit_tree(item, NULL);
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	graph_data->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
-
 	pptr = &item->parents;
 
 	edge_value = get_be32(commit_data + g->hash_len);
@@ -949,6 +1082,7 @@ struct write_commit_graph_context {
 	struct packed_oid_list oids;
 	struct packed_commit_list commits;
 	int num_extra_edges;
+	int num_generation_data_overflows;
 	unsigned long approx_nr_objects;
 	struct progress *progress;
 	int progress_done;
@@ -967,7 +1101,13 @@ struct write_commit_graph_context {
 		 report_progress:1,
 		 split:1,
 		 changed_paths:1,
-		 order_by_pack:1;
+		 order_by_pack:1,
+		 write_generation_data:1,
+		 trust_generation_numbers:1,
+		 write_reach_labels:1;
+
+	struct topo_level_slab *topo_levels;
+	struct reach_label *reach_labels;
 
 	const struct commit_graph_opts *opts;
 	size_t total_bloom_filter_data_size;
@@ -1115,7 +1255,7 @@ static int write_graph_chunk_data(struct hashfile *f,
 		else
 			packedDate[0] = 0;
 
-		packedDate[0] |= htonl(commit_graph_data_at(*list)->generation << 2);
+		packedDate[0] |= htonl(*topo_level_slab_at(ctx->topo_levels, *list) << 2);
 
 		packedDate[1] = htonl((*list)->date);
 		hashwrite(f, packedDate, 8);
@@ -1126,6 +1266,48 @@ static int write_graph_chunk_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_generation_data(struct hashfile *f,
+					     struct write_commit_graph_context *ctx)
+{
+	int i, num_generation_data_overflows = 0;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset = commit_graph_data_at(c)->generation - c->date;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			offset = CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW | num_generation_data_overflows;
+			num_generation_data_overflows++;
+		}
+
+		hashwrite_be32(f, offset);
+	}
+
+	return 0;
+}
+
+static int write_graph_chunk_generation_data_overflow(struct hashfile *f,
+						      struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset = commit_graph_data_at(c)->generation - c->date;
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			hashwrite_be32(f, offset >> 32);
+			hashwrite_be32(f, (uint32_t)offset);
+		}
+	}
+
+	return 0;
+}
+
 static int write_graph_chunk_extra_edges(struct hashfile *f,
 					 struct write_commit_graph_context *ctx)
 {
@@ -1240,6 +1422,23 @@ static int write_graph_chunk_bloom_data(struct hashfile *f,
 	return 0;
 }
 
+static int write_graph_chunk_reach_labels(struct hashfile *f,
+					  struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct reach_label *label = &ctx->reach_labels[i];
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite_be32(f, label->post);
+		hashwrite_be32(f, label->tree_low);
+		hashwrite_be32(f, label->reach_low);
+	}
+
+	return 0;
+}
+
 static int oid_compare(const void *_a, const void *_b)
 {
 	const struct object_id *a = (const struct object_id *)_a;
@@ -1347,21 +1546,79 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 	stop_progress(&ctx->progress);
 }
 
+/*
+ * Make sure that the topological level (and the corrected commit date,
+ * if we can trust the existing graph to have them) of every commit that
+ * came from the existing commit-graph is known, even if it was parsed
+ * before we started writing.
+ */
+static void load_existing_generations(struct write_commit_graph_context *ctx)
+{
+	struct commit_graph *g = ctx->r->objects->commit_graph;
+	int i;
+
+	if (!g)
+		return;
+
+	for (; g; g = g->base_graph)
+		g->topo_levels = ctx->topo_levels;
+	g = ctx->r->objects->commit_graph;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		struct commit_list *parent;
+		uint32_t pos = commit_graph_position(c);
+
+		if (pos != COMMIT_NOT_FROM_GRAPH)
+			fill_commit_graph_info(c, g, pos);
+
+		for (parent = c->parents; parent; parent = parent->next) {
+			pos = commit_graph_position(parent->item);
+			if (pos != COMMIT_NOT_FROM_GRAPH &&
+			    !*topo_level_slab_at(ctx->topo_levels, parent->item))
+				fill_commit_graph_info(parent->item, g, pos);
+		}
+	}
+}
+
+static int generation_computed(struct write_commit_graph_context *ctx,
+			       struct commit *c)
+{
+	timestamp_t corrected_commit_date;
+
+	if (*topo_level_slab_at(ctx->topo_levels, c) == GENERATION_NUMBER_ZERO)
+		return 0;
+	if (!ctx->write_generation_data)
+		return 1;
+
+	corrected_commit_date = commit_graph_data_at(c)->generation;
+	return corrected_commit_date != GENERATION_NUMBER_INFINITY &&
+	       corrected_commit_date != GENERATION_NUMBER_ZERO;
+}
+
 static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct commit_list *list = NULL;
 
+	load_existing_generations(ctx);
+
+	/*
+	 * Without corrected commit dates in the existing graph, what we
+	 * loaded as the generation of its commits are topological levels.
+	 */
+	if (ctx->write_generation_data && !ctx->trust_generation_numbers)
+		for (i = 0; i < ctx->commits.nr; i++)
+			commit_graph_data_at(ctx->commits.list[i])->generation =
+				GENERATION_NUMBER_ZERO;
+
 	if (ctx->report_progress)
 		ctx->progress = start_delayed_progress(
 					_("Computing commit graph generation numbers"),
 					ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
-		uint32_t generation = commit_graph_data_at(ctx->commits.list[i])->generation;
-
 		display_progress(ctx->progress, i + 1);
-		if (generation != GENERATION_NUMBER_INFINITY &&
-		    generation != GENERATION_NUMBER_ZERO)
+		if (generation_computed(ctx, ctx->commits.list[i]))
 			continue;
 
 		commit_list_insert(ctx->commits.list[i], &list);
@@ -1369,32 +1626,175 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 			struct commit *current = list->item;
 			struct commit_list *parent;
 			int all_parents_computed = 1;
-			uint32_t max_generation = 0;
+			uint32_t max_level = 0;
+			timestamp_t max_corrected_commit_date = 0;
 
 			for (parent = current->parents; parent; parent = parent->next) {
-				generation = commit_graph_data_at(parent->item)->generation;
+				uint32_t level;
+				timestamp_t corrected_commit_date;
 
-				if (generation == GENERATION_NUMBER_INFINITY ||
-				    generation == GENERATION_NUMBER_ZERO) {
+				if (!generation_computed(ctx, parent->item)) {
 					all_parents_computed = 0;
 					commit_list_insert(parent->item, &list);
 					break;
-				} else if (generation > max_generation) {
-					max_generation = generation;
 				}
+
+				level = *topo_level_slab_at(ctx->topo_levels, parent->item);
+				if (level > max_level)
+					max_level = level;
+
+				corrected_commit_date = commit_graph_data_at(parent->item)->generation;
+				if (corrected_commit_date > max_corrected_commit_date)
+					max_corrected_commit_date = corrected_commit_date;
 			}
 
 			if (all_parents_computed) {
-				struct commit_graph_data *data = commit_graph_data_at(current);
-
-				data->generation = max_generation + 1;
 				pop_commit(&list);
 
-				if (data->generation > GENERATION_NUMBER_MAX)
-					data->generation = GENERATION_NUMBER_MAX;
+				if (max_level > GENERATION_NUMBER_V1_MAX - 1)
+					max_level = GENERATION_NUMBER_V1_MAX - 1;
+				*topo_level_slab_at(ctx->topo_levels, current) = max_level + 1;
+
+				if (ctx->write_generation_data) {
+					if (current->date && current->date > max_corrected_commit_date)
+						max_corrected_commit_date = current->date - 1;
+					commit_graph_data_at(current)->generation = max_corrected_commit_date + 1;
+				}
+			}
+		}
+	}
+
+	if (ctx->write_generation_data) {
+		for (i = 0; i < ctx->commits.nr; i++) {
+			struct commit *c = ctx->commits.list[i];
+			if (commit_graph_data_at(c)->generation - c->date >
+			    GENERATION_NUMBER_V2_OFFSET_MAX)
+				ctx->num_generation_data_overflows++;
+		}
+	}
+	stop_progress(&ctx->progress);
+}
+
+static int reach_label_root_cmp(const void *va, const void *vb, void *data)
+{
+	struct write_commit_graph_context *ctx = data;
+	struct commit *a = ctx->commits.list[*(const uint32_t *)va];
+	struct commit *b = ctx->commits.list[*(const uint32_t *)vb];
+	uint32_t level_a = *topo_level_slab_at(ctx->topo_levels, a);
+	uint32_t level_b = *topo_level_slab_at(ctx->topo_levels, b);
+
+	/* start the searches from the tips */
+	if (level_a > level_b)
+		return -1;
+	if (level_a < level_b)
+		return 1;
+	return oidcmp(&a->object.oid, &b->object.oid);
+}
+
+static uint32_t base_reach_low(struct write_commit_graph_context *ctx,
+			       struct commit *c)
+{
+	struct reach_label label;
+	uint32_t pos;
+
+	/*
+	 * Nothing is known about what lies below a commit without a
+	 * label, so assume that it may reach everything.
+	 */
+	if (!ctx->new_base_graph ||
+	    !find_commit_in_graph(c, ctx->new_base_graph, &pos) ||
+	    !load_reach_label(ctx->new_base_graph, pos, &label))
+		return 0;
+	return label.reach_low;
+}
+
+struct reach_label_frame {
+	uint32_t pos;
+	struct commit_list *parents;
+};
+
+/*
+ * Number the commits of the new layer in post-order of a depth-first
+ * search that stops at commits from the base graphs. These have lower
+ * numbers already, so the numbering is valid for the whole chain.
+ */
+static void compute_reach_labels(struct write_commit_graph_context *ctx)
+{
+	struct reach_label *labels;
+	struct reach_label_frame *stack = NULL;
+	size_t stack_nr = 0, stack_alloc = 0;
+	uint32_t *roots;
+	uint32_t i, post = ctx->new_num_commits_in_base;
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+					_("Computing commit reachability labels"),
+					ctx->commits.nr);
+
+	CALLOC_ARRAY(labels, ctx->commits.nr);
+	ALLOC_ARRAY(roots, ctx->commits.nr);
+	for (i = 0; i < ctx->commits.nr; i++)
+		roots[i] = i;
+	QSORT_S(roots, ctx->commits.nr, reach_label_root_cmp, ctx);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct reach_label *label = &labels[roots[i]];
+
+		if (label->tree_low)
+			continue;
+
+		label->tree_low = post + 1;
+		label->reach_low = UINT32_MAX;
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr].pos = roots[i];
+		stack[stack_nr++].parents = ctx->commits.list[roots[i]]->parents;
+
+		while (stack_nr) {
+			struct reach_label_frame *frame = &stack[stack_nr - 1];
+			struct commit *parent;
+			int pos;
+
+			label = &labels[frame->pos];
+			if (!frame->parents) {
+				label->post = ++post;
+				if (label->reach_low > label->post)
+					label->reach_low = label->post;
+				display_progress(ctx->progress, post - ctx->new_num_commits_in_base);
+
+				if (--stack_nr) {
+					struct reach_label *child = &labels[stack[stack_nr - 1].pos];
+					if (child->reach_low > label->reach_low)
+						child->reach_low = label->reach_low;
+				}
+				continue;
+			}
+
+			parent = frame->parents->item;
+			frame->parents = frame->parents->next;
+
+			pos = sha1_pos(parent->object.oid.hash, ctx->commits.list,
+				       ctx->commits.nr, commit_to_sha1);
+			if (pos < 0) {
+				uint32_t reach_low = base_reach_low(ctx, parent);
+				if (label->reach_low > reach_low)
+					label->reach_low = reach_low;
+			} else if (labels[pos].tree_low) {
+				/* no cycles, so the parent is done already */
+				if (label->reach_low > labels[pos].reach_low)
+					label->reach_low = labels[pos].reach_low;
+			} else {
+				labels[pos].tree_low = post + 1;
+				labels[pos].reach_low = UINT32_MAX;
+				ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+				stack[stack_nr].pos = pos;
+				stack[stack_nr++].parents = parent->parents;
 			}
 		}
 	}
+
+	ctx->reach_labels = labels;
+	free(roots);
+	free(stack);
 	stop_progress(&ctx->progress);
 }
 
@@ -1412,9 +1812,10 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
-	int i;
+	int i, nr_jobs = 0, nr_threads = 0;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
+	struct bloom_filter_job *jobs;
 	int max_new_filters;
 
 	init_bloom_filters();
@@ -1435,31 +1836,54 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	/*
+	 * Decide which filters to compute here, as that depends on the
+	 * filters computed before; the tree diffs happen below.
+	 */
+	ALLOC_ARRAY(jobs, ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
-		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
-		if (computed & BLOOM_COMPUTED) {
-			ctx->count_bloom_filter_computed++;
-			if (computed & BLOOM_TRUNC_EMPTY)
-				ctx->count_bloom_filter_trunc_empty++;
-			if (computed & BLOOM_TRUNC_LARGE)
-				ctx->count_bloom_filter_trunc_large++;
-		} else if (computed & BLOOM_NOT_COMPUTED)
+		struct bloom_filter *filter = lookup_bloom_filter(ctx->r, c);
+		struct bloom_filter_job *job;
+
+		if (filter->data && filter->len) {
 			ctx->count_bloom_filter_not_computed++;
-		ctx->total_bloom_filter_data_size += filter
-			? sizeof(unsigned char) * filter->len : 0;
-		display_progress(progress, i + 1);
+			ctx->total_bloom_filter_data_size +=
+				sizeof(unsigned char) * filter->len;
+			continue;
+		}
+		if (ctx->count_bloom_filter_computed >= max_new_filters) {
+			ctx->count_bloom_filter_not_computed++;
+			continue;
+		}
+		ctx->count_bloom_filter_computed++;
+
+		repo_parse_commit(ctx->r, c);
+		job = &jobs[nr_jobs++];
+		job->parent = c->parents ? &c->parents->item->object.oid : NULL;
+		job->oid = &c->object.oid;
+		job->filter = filter;
+	}
+
+	repo_config_get_int(ctx->r, "commitgraph.changedpathsthreads",
+			    &nr_threads);
+	compute_bloom_filter_jobs(ctx->r, jobs, nr_jobs, ctx->bloom_settings,
+				  nr_threads, progress,
+				  ctx->commits.nr - nr_jobs);
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (jobs[i].computed & BLOOM_TRUNC_EMPTY)
+			ctx->count_bloom_filter_trunc_empty++;
+		if (jobs[i].computed & BLOOM_TRUNC_LARGE)
+			ctx->count_bloom_filter_trunc_large++;
+		ctx->total_bloom_filter_data_size +=
+			sizeof(unsigned char) * jobs[i].filter->len;
 	}
 
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
+	free(jobs);
 	free(sorted_commits);
 	stop_progress(&progress);
 }
@@ -1757,6 +2181,18 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	chunks[2].id = GRAPH_CHUNKID_DATA;
 	chunks[2].size = (hashsz + 16) * ctx->commits.nr;
 	chunks[2].write_fn = write_graph_chunk_data;
+	if (ctx->write_generation_data) {
+		chunks[num_chunks].id = GRAPH_CHUNKID_GENERATION_DATA;
+		chunks[num_chunks].size = sizeof(uint32_t) * ctx->commits.nr;
+		chunks[num_chunks].write_fn = write_graph_chunk_generation_data;
+		num_chunks++;
+	}
+	if (ctx->num_generation_data_overflows) {
+		chunks[num_chunks].id = GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW;
+		chunks[num_chunks].size = sizeof(uint64_t) * ctx->num_generation_data_overflows;
+		chunks[num_chunks].write_fn = write_graph_chunk_generation_data_overflow;
+		num_chunks++;
+	}
 	if (ctx->num_extra_edges) {
 		chunks[num_chunks].id = GRAPH_CHUNKID_EXTRAEDGES;
 		chunks[num_chunks].size = 4 * ctx->num_extra_edges;
@@ -1774,6 +2210,12 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 		chunks[num_chunks].write_fn = write_graph_chunk_bloom_data;
 		num_chunks++;
 	}
+	if (ctx->write_reach_labels) {
+		chunks[num_chunks].id = GRAPH_CHUNKID_REACH_LABELS;
+		chunks[num_chunks].size = GRAPH_REACH_LABEL_WIDTH * ctx->commits.nr;
+		chunks[num_chunks].write_fn = write_graph_chunk_reach_labels;
+		num_chunks++;
+	}
 	if (ctx->num_commit_graphs_after > 1) {
 		chunks[num_chunks].id = GRAPH_CHUNKID_BASE;
 		chunks[num_chunks].size = hashsz * (ctx->num_commit_graphs_after - 1);
@@ -2149,6 +2591,7 @@ int write_commit_graph(struct object_directory *odb,
 	int res = 0;
 	int replace = 0;
 	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct topo_level_slab topo_levels;
 
 	if (!commit_graph_compatible(the_repository))
 		return 0;
@@ -2162,6 +2605,12 @@ int write_commit_graph(struct object_directory *odb,
 	ctx->opts = opts;
 	ctx->total_bloom_filter_data_size = 0;
 
+	prepare_repo_settings(ctx->r);
+	ctx->write_generation_data =
+		ctx->r->settings.commit_graph_generation_version >= 2;
+	init_topo_level_slab(&topo_levels);
+	ctx->topo_levels = &topo_levels;
+
 	bloom_settings.bits_per_entry = git_env_ulong("GIT_TEST_BLOOM_SETTINGS_BITS_PER_ENTRY",
 						      bloom_settings.bits_per_entry);
 	bloom_settings.num_hashes = git_env_ulong("GIT_TEST_BLOOM_SETTINGS_NUM_HASHES",
@@ -2185,6 +2634,19 @@ int write_commit_graph(struct object_directory *odb,
 		}
 	}
 
+	if (flags & COMMIT_GRAPH_WRITE_REACH_LABELS)
+		ctx->write_reach_labels = 1;
+	if (!(flags & COMMIT_GRAPH_NO_WRITE_REACH_LABELS)) {
+		struct commit_graph *g;
+		prepare_commit_graph_one(ctx->r, ctx->odb);
+
+		g = ctx->r->objects->commit_graph;
+
+		/* We have reachability labels already. Keep them, too. */
+		if (g && g->chunk_reach_labels)
+			ctx->write_reach_labels = 1;
+	}
+
 	if (ctx->split) {
 		struct commit_graph *g;
 		prepare_commit_graph(ctx->r);
@@ -2283,11 +2745,33 @@ int write_commit_graph(struct object_directory *odb,
 	} else
 		ctx->num_commit_graphs_after = 1;
 
+	if (ctx->r->objects->commit_graph)
+		ctx->trust_generation_numbers =
+			ctx->r->objects->commit_graph->read_generation_data;
+
+	/*
+	 * A layer may only have corrected commit dates if every layer
+	 * below it has them, too. Otherwise, keep writing topological
+	 * levels only until the chain is merged into fewer layers.
+	 */
+	if (ctx->write_generation_data) {
+		struct commit_graph *g;
+		for (g = ctx->new_base_graph; g; g = g->base_graph) {
+			if (!g->read_generation_data) {
+				ctx->write_generation_data = 0;
+				break;
+			}
+		}
+	}
+
 	compute_generation_numbers(ctx);
 
 	if (ctx->changed_paths)
 		compute_bloom_filters(ctx);
 
+	if (ctx->write_reach_labels)
+		compute_reach_labels(ctx);
+
 	res = write_commit_graph_file(ctx);
 
 	if (ctx->split)
@@ -2296,9 +2780,17 @@ int write_commit_graph(struct object_directory *odb,
 	expire_commit_graphs(ctx);
 
 cleanup:
+	if (ctx->r->objects->commit_graph) {
+		struct commit_graph *g;
+		for (g = ctx->r->objects->commit_graph; g; g = g->base_graph)
+			g->topo_levels = NULL;
+	}
+	clear_topo_level_slab(&topo_levels);
+
 	free(ctx->graph_name);
 	free(ctx->commits.list);
 	free(ctx->oids.list);
+	free(ctx->reach_labels);
 
 	if (ctx->commit_graph_filenames_after) {
 		for (i = 0; i < ctx->num_commit_graphs_after; i++) {
@@ -2336,6 +2828,123 @@ static void graph_report(const char *fmt, ...)
 #define GENERATION_ZERO_EXISTS 1
 #define GENERATION_NUMBER_EXISTS 2
 
+static uint32_t graph_topo_level(struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data;
+
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || pos >= g->num_commits + g->num_commits_in_base)
+		return 0;
+
+	commit_data = g->chunk_commit_data +
+		GRAPH_DATA_WIDTH * (pos - g->num_commits_in_base);
+	return get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+static int commit_has_graph_parent(struct commit *c, uint32_t pos)
+{
+	struct commit_list *parent;
+
+	for (parent = c->parents; parent; parent = parent->next)
+		if (commit_graph_position(parent->item) == pos)
+			return 1;
+	return 0;
+}
+
+/*
+ * A commit must be numbered after its parents and reach no lower than
+ * they do. The commits numbered just below it, down to its tree_low,
+ * must be covered by the intervals of some of its parents.
+ */
+static void verify_reach_labels(struct repository *r, struct commit_graph *g)
+{
+	uint32_t i, *by_post;
+	uint32_t base = g->num_commits_in_base;
+	int bad_post = 0;
+
+	if (!g->chunk_reach_labels)
+		return;
+
+	ALLOC_ARRAY(by_post, g->num_commits);
+	for (i = 0; i < g->num_commits; i++)
+		by_post[i] = UINT32_MAX;
+
+	for (i = 0; i < g->num_commits; i++) {
+		struct reach_label label;
+
+		load_reach_label(g, base + i, &label);
+		if (label.post <= base || label.post > base + g->num_commits) {
+			graph_report(_("commit-graph reachability label %u for commit %s is out of range"),
+				     label.post,
+				     hash_to_hex(g->chunk_oid_lookup + g->hash_len * i));
+			bad_post = 1;
+		} else if (by_post[label.post - base - 1] != UINT32_MAX) {
+			graph_report(_("commit-graph reachability label %u is used more than once"),
+				     label.post);
+			bad_post = 1;
+		} else
+			by_post[label.post - base - 1] = i;
+	}
+
+	for (i = 0; !bad_post && i < g->num_commits; i++) {
+		struct object_id cur_oid;
+		struct commit *c;
+		struct commit_list *parent;
+		struct reach_label label, parent_label;
+		uint32_t max_reach_low, next;
+
+		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
+		c = lookup_commit(r, &cur_oid);
+		if (!parse_commit_in_graph_one(r, g, c))
+			continue;
+
+		load_reach_label(g, base + i, &label);
+		max_reach_low = label.post;
+		for (parent = c->parents; parent; parent = parent->next) {
+			parse_commit_in_graph_one(r, g, parent->item);
+			if (!load_reach_label(g, commit_graph_position(parent->item),
+					      &parent_label)) {
+				max_reach_low = 0;
+				continue;
+			}
+			if (parent_label.post >= label.post)
+				graph_report(_("commit-graph reachability label for commit %s is not above its parent %s"),
+					     oid_to_hex(&cur_oid),
+					     oid_to_hex(&parent->item->object.oid));
+			if (parent_label.reach_low < max_reach_low)
+				max_reach_low = parent_label.reach_low;
+		}
+		if (label.reach_low > max_reach_low)
+			graph_report(_("commit-graph reachability lower bound for commit %s is %u > %u"),
+				     oid_to_hex(&cur_oid),
+				     label.reach_low, max_reach_low);
+
+		if (label.tree_low <= base || label.tree_low > label.post) {
+			graph_report(_("commit-graph reachability interval for commit %s is invalid"),
+				     oid_to_hex(&cur_oid));
+			continue;
+		}
+
+		next = label.post - 1;
+		while (next >= label.tree_low) {
+			uint32_t lex_index = by_post[next - base - 1];
+
+			load_reach_label(g, base + lex_index, &parent_label);
+			if (!commit_has_graph_parent(c, base + lex_index) ||
+			    parent_label.tree_low < label.tree_low ||
+			    parent_label.tree_low > next) {
+				graph_report(_("commit-graph reachability interval for commit %s covers unreachable commits"),
+					     oid_to_hex(&cur_oid));
+				break;
+			}
+			next = parent_label.tree_low - 1;
+		}
+	}
+
+	free(by_post);
+}
+
 int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 {
 	uint32_t i, cur_fanout_pos = 0;
@@ -2411,8 +3020,10 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
-		uint32_t max_generation = 0;
-		uint32_t generation;
+		timestamp_t max_generation = 0;
+		timestamp_t generation;
+		uint32_t max_level = 0;
+		uint32_t level;
 
 		display_progress(progress, i + 1);
 		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
@@ -2455,6 +3066,10 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			if (generation > max_generation)
 				max_generation = generation;
 
+			level = graph_topo_level(g, commit_graph_position(graph_parents->item));
+			if (level > max_level)
+				max_level = level;
+
 			graph_parents = graph_parents->next;
 			odb_parents = odb_parents->next;
 		}
@@ -2463,7 +3078,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			graph_report(_("commit-graph parent list for commit %s terminates early"),
 				     oid_to_hex(&cur_oid));
 
-		if (!commit_graph_generation(graph_commit)) {
+		level = graph_topo_level(g, i + g->num_commits_in_base);
+		if (!level) {
 			if (generation_zero == GENERATION_NUMBER_EXISTS)
 				graph_report(_("commit-graph has generation number zero for commit %s, but non-zero elsewhere"),
 					     oid_to_hex(&cur_oid));
@@ -2476,19 +3092,35 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			continue;
 
 		/*
-		 * If one of our parents has generation GENERATION_NUMBER_MAX, then
-		 * our generation is also GENERATION_NUMBER_MAX. Decrement to avoid
+		 * If one of our parents has generation GENERATION_NUMBER_V1_MAX, then
+		 * our generation is also GENERATION_NUMBER_V1_MAX. Decrement to avoid
 		 * extra logic in the following condition.
 		 */
-		if (max_generation == GENERATION_NUMBER_MAX)
-			max_generation--;
+		if (max_level == GENERATION_NUMBER_V1_MAX)
+			max_level--;
 
-		generation = commit_graph_generation(graph_commit);
-		if (generation != max_generation + 1)
+		if (level != max_level + 1)
 			graph_report(_("commit-graph generation for commit %s is %u != %u"),
 				     oid_to_hex(&cur_oid),
-				     generation,
-				     max_generation + 1);
+				     level,
+				     max_level + 1);
+
+		if (g->read_generation_data) {
+			/*
+			 * The corrected commit date is the commit date,
+			 * unless a parent's corrected commit date is at
+			 * least as large.
+			 */
+			if (odb_commit->date > max_generation)
+				max_generation = odb_commit->date - 1;
+
+			generation = commit_graph_generation(graph_commit);
+			if (generation != max_generation + 1)
+				graph_report(_("commit-graph corrected commit date for commit %s is %"PRItime" != %"PRItime),
+					     oid_to_hex(&cur_oid),
+					     generation,
+					     max_generation + 1);
+		}
 
 		if (graph_commit->date != odb_commit->date)
 			graph_report(_("commit date for commit %s in commit-graph is %"PRItime" != %"PRItime),
@@ -2498,6 +3130,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	}
 	stop_progress(&progress);
 
+	verify_reach_labels(r, g);
+
 	local_error = verify_commit_graph_error;
 
 	if (!(flags & COMMIT_GRAPH_VERIFY_SHALLOW) && g->base_graph)
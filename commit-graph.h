@@ -8,11 +8,13 @@
 #define GIT_TEST_COMMIT_GRAPH "GIT_TEST_COMMIT_GRAPH"
 #define GIT_TEST_COMMIT_GRAPH_DIE_ON_PARSE "GIT_TEST_COMMIT_GRAPH_DIE_ON_PARSE"
 #define GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS "GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS"
+#define GIT_TEST_COMMIT_GRAPH_REACH_LABELS "GIT_TEST_COMMIT_GRAPH_REACH_LABELS"
 
 /*
  * This method is only used to enhance coverage of the commit-graph
- * feature in the test suite with the GIT_TEST_COMMIT_GRAPH and
- * GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS environment variables. Do not
+ * feature in the test suite with the GIT_TEST_COMMIT_GRAPH,
+ * GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS and
+ * GIT_TEST_COMMIT_GRAPH_REACH_LABELS environment variables. Do not
  * call this method oustide of a builtin, and only if you know what
  * you are doing!
  */
@@ -23,6 +25,7 @@ struct bloom_filter_settings;
 struct repository;
 struct raw_object_store;
 struct string_list;
+struct topo_level_slab;
 
 char *get_commit_graph_filename(struct object_directory *odb);
 char *get_commit_graph_chain_filename(struct object_directory *odb);
@@ -68,10 +71,24 @@ struct commit_graph {
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_generation_data;
+	const unsigned char *chunk_generation_data_overflow;
 	const unsigned char *chunk_extra_edges;
 	const unsigned char *chunk_base_graphs;
 	const unsigned char *chunk_bloom_indexes;
 	const unsigned char *chunk_bloom_data;
+	const unsigned char *chunk_reach_labels;
+
+	/*
+	 * Set when generation numbers are read from the generation data
+	 * chunk (corrected commit dates) rather than from the topological
+	 * levels in the commit data chunk. Either every layer of a chain
+	 * uses corrected commit dates, or none does.
+	 */
+	int read_generation_data;
+
+	/* If non-NULL, topological levels are recorded here on parse. */
+	struct topo_level_slab *topo_levels;
 
 	struct bloom_filter_settings *bloom_filter_settings;
 };
@@ -98,6 +115,8 @@ enum commit_graph_write_flags {
 	COMMIT_GRAPH_WRITE_SPLIT      = (1 << 2),
 	COMMIT_GRAPH_WRITE_BLOOM_FILTERS = (1 << 3),
 	COMMIT_GRAPH_NO_WRITE_BLOOM_FILTERS = (1 << 4),
+	COMMIT_GRAPH_WRITE_REACH_LABELS = (1 << 5),
+	COMMIT_GRAPH_NO_WRITE_REACH_LABELS = (1 << 6),
 };
 
 enum commit_graph_split_flags {
@@ -144,12 +163,26 @@ void disable_commit_graph(struct repository *r);
 
 struct commit_graph_data {
 	uint32_t graph_pos;
-	uint32_t generation;
+	timestamp_t generation;
 };
 
 /*
  * Commits should be parsed before accessing generation, graph positions.
+ *
+ * The generation is the corrected commit date of the commit when the
+ * commit-graph provides one, and its topological level otherwise. Only
+ * the relative order of generations is meaningful.
  */
-uint32_t commit_graph_generation(const struct commit *);
+timestamp_t commit_graph_generation(const struct commit *);
 uint32_t commit_graph_position(const struct commit *);
+
+/*
+ * Use the reachability labels of the commit-graph to tell whether "to"
+ * can be reached from "from". Returns 1 if it can, 0 if it cannot, and
+ * -1 if the labels are missing or inconclusive, in which case the caller
+ * has to walk the history. Both commits must have been parsed.
+ */
+int commit_graph_can_reach(struct repository *r,
+			   struct commit *from,
+			   struct commit *to);
 #endif
@@ -0,0 +1,241 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsmonitor--daemon.h"
+#include "fsm-listen.h"
+#include <sys/inotify.h>
+
+/*
+ * inotify watches single directories, so we add one watch for every
+ * directory of the worktree (but not for the ".git" directories) and
+ * add more as directories are created or moved in.
+ */
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+		    IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DELETE_SELF | IN_MOVE_SELF | \
+		    IN_ONLYDIR | IN_EXCL_UNLINK)
+
+struct fsm_listen_data {
+	int fd;
+
+	/*
+	 * The directory of each watch descriptor, relative to the root
+	 * of the worktree and with a trailing slash ("" for the root).
+	 */
+	char **wd_path;
+	int wd_alloc;
+};
+
+static int add_watch(struct fsmonitor_daemon_state *state,
+		     struct fsm_listen_data *data,
+		     const char *rel_dir)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf sub = STRBUF_INIT;
+	DIR *dir;
+	struct dirent *de;
+	int wd, ret = 0;
+
+	strbuf_addf(&path, "%s/%s", state->path_worktree_watch.buf, rel_dir);
+
+	wd = inotify_add_watch(data->fd, path.buf, WATCH_MASK);
+	if (wd < 0) {
+		/* The directory went away before we could watch it. */
+		if (errno == ENOENT || errno == ENOTDIR)
+			goto cleanup;
+		if (errno == ENOSPC)
+			ret = error(_("too many directories to watch; consider "
+				      "raising fs.inotify.max_user_watches"));
+		else
+			ret = error_errno(_("could not watch '%s'"), path.buf);
+		goto cleanup;
+	}
+
+	if (wd >= data->wd_alloc) {
+		int old_alloc = data->wd_alloc;
+
+		ALLOC_GROW(data->wd_path, wd + 1, data->wd_alloc);
+		memset(data->wd_path + old_alloc, 0,
+		       (data->wd_alloc - old_alloc) * sizeof(*data->wd_path));
+	}
+	free(data->wd_path[wd]);
+	data->wd_path[wd] = xstrdup(rel_dir);
+
+	dir = opendir(path.buf);
+	if (!dir)
+		goto cleanup;
+
+	while (!ret && (de = readdir(dir))) {
+		if (is_dot_or_dotdot(de->d_name) ||
+		    !strcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_reset(&sub);
+		strbuf_addf(&sub, "%s%s/", rel_dir, de->d_name);
+
+		if (de->d_type == DT_UNKNOWN) {
+			struct stat st;
+
+			if (lstat(mkpath("%s/%s", state->path_worktree_watch.buf,
+					 sub.buf), &st) ||
+			    !S_ISDIR(st.st_mode))
+				continue;
+		} else if (de->d_type != DT_DIR)
+			continue;
+
+		ret = add_watch(state, data, sub.buf);
+	}
+	closedir(dir);
+
+cleanup:
+	strbuf_release(&path);
+	strbuf_release(&sub);
+	return ret;
+}
+
+/*
+ * Stop watching `rel_dir` and everything below it, e.g. because it
+ * was moved away. If it was moved within the worktree, the watches are
+ * added back under the new name when we see the IN_MOVED_TO event.
+ */
+static void remove_watches(struct fsm_listen_data *data, const char *rel_dir)
+{
+	int wd;
+
+	for (wd = 0; wd < data->wd_alloc; wd++) {
+		if (!data->wd_path[wd] ||
+		    !starts_with(data->wd_path[wd], rel_dir))
+			continue;
+		inotify_rm_watch(data->fd, wd);
+		FREE_AND_NULL(data->wd_path[wd]);
+	}
+}
+
+static int handle_event(struct fsmonitor_daemon_state *state,
+			struct fsm_listen_data *data,
+			const struct inotify_event *ev)
+{
+	struct strbuf path = STRBUF_INIT;
+	const char *dir;
+	int ret = 0;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		/* The kernel dropped events; we cannot trust the journal. */
+		fsmonitor_daemon_force_resync(state);
+		return 0;
+	}
+
+	if (ev->wd < 0 || ev->wd >= data->wd_alloc || !data->wd_path[ev->wd])
+		return 0;
+	dir = data->wd_path[ev->wd];
+
+	if (ev->mask & IN_IGNORED) {
+		FREE_AND_NULL(data->wd_path[ev->wd]);
+		return 0;
+	}
+
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		/*
+		 * Subdirectories are reported by the events on their
+		 * parent, but there is nothing left to watch once the
+		 * root of the worktree is gone.
+		 */
+		if (!*dir)
+			state->shutdown = 1;
+		return 0;
+	}
+
+	if (!ev->len)
+		return 0;
+
+	if (!strcmp(ev->name, ".git")) {
+		/*
+		 * Our socket lives in there, and keeps the kernel from
+		 * reporting the deletion of the worktree itself.
+		 */
+		if (!*dir && (ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+			state->shutdown = 1;
+		return 0;
+	}
+
+	strbuf_addf(&path, "%s%s", dir, ev->name);
+	if (ev->mask & IN_ISDIR) {
+		strbuf_addch(&path, '/');
+		if (ev->mask & IN_MOVED_FROM)
+			remove_watches(data, path.buf);
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			ret = add_watch(state, data, path.buf);
+	}
+
+	fsmonitor_daemon_path_changed(state, path.buf);
+
+	strbuf_release(&path);
+	return ret;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = xcalloc(1, sizeof(*data));
+	data->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd < 0) {
+		free(data);
+		return error_errno(_("could not initialize inotify"));
+	}
+	state->backend_data = data;
+
+	return add_watch(state, data, "");
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->backend_data;
+	int wd;
+
+	if (!data)
+		return;
+
+	close(data->fd);
+	for (wd = 0; wd < data->wd_alloc; wd++)
+		free(data->wd_path[wd]);
+	free(data->wd_path);
+	FREE_AND_NULL(state->backend_data);
+}
+
+int fsm_listen__fd(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->backend_data;
+
+	return data->fd;
+}
+
+int fsm_listen__drain(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->backend_data;
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+
+	for (;;) {
+		ssize_t len = read(data->fd, u.buf, sizeof(u.buf));
+		const char *p;
+
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+			return error_errno(_("could not read inotify events"));
+		}
+
+		for (p = u.buf; p < u.buf + len; ) {
+			const struct inotify_event *ev =
+				(const struct inotify_event *)p;
+
+			if (handle_event(state, data, ev))
+				return -1;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
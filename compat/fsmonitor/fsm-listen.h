@@ -0,0 +1,36 @@
+#ifndef FSM_LISTEN_H
+#define FSM_LISTEN_H
+
+/* This needs to be implemented by each backend */
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+struct fsmonitor_daemon_state;
+
+/*
+ * Initialize the listener: start watching the worktree recursively.
+ * Returns 0 on success, or -1 after reporting an error.
+ */
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state);
+
+/*
+ * Release the resources of the listener.
+ */
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state);
+
+/*
+ * The file descriptor the daemon polls for incoming events.
+ */
+int fsm_listen__fd(struct fsmonitor_daemon_state *state);
+
+/*
+ * Read every event the kernel has queued so far without blocking, and
+ * report them with fsmonitor_daemon_path_changed(). Sets
+ * `state->shutdown` if the worktree itself went away.
+ *
+ * Returns 0 on success, or -1 after reporting an error.
+ */
+int fsm_listen__drain(struct fsmonitor_daemon_state *state);
+
+#endif /* HAVE_FSMONITOR_DAEMON_BACKEND */
+#endif /* FSM_LISTEN_H */
@@ -20,6 +20,7 @@
 #include "dir.h"
 #include "color.h"
 #include "refs.h"
+#include "fsmonitor-ipc.h"
 
 struct config_source {
 	struct config_source *prev;
@@ -1359,6 +1360,19 @@ static int git_default_core_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.bulkcheckin")) {
+		core_bulk_checkin = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.bulkcheckinthreads")) {
+		core_bulk_checkin_threads = git_config_int(var, value);
+		if (core_bulk_checkin_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    core_bulk_checkin_threads, var);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.preloadindex")) {
 		core_preload_index = git_config_bool(var, value);
 		return 0;
@@ -2355,6 +2369,29 @@ int git_config_get_fsmonitor(void)
 	if (core_fsmonitor && !*core_fsmonitor)
 		core_fsmonitor = NULL;
 
+	/*
+	 * A boolean value selects the builtin daemon or turns the
+	 * feature off; anything else is the path of a hook.
+	 */
+	core_fsmonitor_builtin = 0;
+	if (core_fsmonitor) {
+		switch (git_parse_maybe_bool(core_fsmonitor)) {
+		case 0:
+			core_fsmonitor = NULL;
+			break;
+		case 1:
+			if (fsmonitor_ipc__is_supported()) {
+				core_fsmonitor_builtin = 1;
+			} else {
+				warning(_("core.fsmonitor=true requires the builtin "
+					  "fsmonitor daemon, which is not supported "
+					  "on this platform"));
+				core_fsmonitor = NULL;
+			}
+			break;
+		}
+	}
+
 	if (core_fsmonitor)
 		return 1;
 
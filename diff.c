@@ -26,6 +26,7 @@
 #include "parse-options.h"
 #include "help.h"
 #include "promisor-remote.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -36,6 +37,7 @@
 static int diff_detect_rename_default;
 static int diff_indent_heuristic = 1;
 static int diff_rename_limit_default = 400;
+static int diff_threads_default = 1;
 static int diff_suppress_blank_empty;
 static int diff_use_color_default = -1;
 static int diff_color_moved_default;
@@ -55,6 +57,26 @@ static struct diff_options default_diff_options;
 static long diff_algorithm;
 static unsigned ws_error_highlight_default = WSEH_NEW;
 
+/*
+ * When patches are generated by several threads, everything but
+ * running xdiff itself (reading blobs, looking up attributes, running
+ * textconv, ...) happens with this lock held.
+ */
+static int diff_use_threads;
+static pthread_mutex_t diff_mutex;
+
+static inline void diff_lock(void)
+{
+	if (diff_use_threads)
+		pthread_mutex_lock(&diff_mutex);
+}
+
+static inline void diff_unlock(void)
+{
+	if (diff_use_threads)
+		pthread_mutex_unlock(&diff_mutex);
+}
+
 static char diff_colors[][COLOR_MAXLEN] = {
 	GIT_COLOR_RESET,
 	GIT_COLOR_NORMAL,	/* CONTEXT */
@@ -352,6 +374,10 @@ int git_diff_ui_config(const char *var, const char *value, void *cb)
 		diff_color_moved_default = cm;
 		return 0;
 	}
+	if (!strcmp(var, "diff.threads")) {
+		diff_threads_default = git_config_int(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "diff.colormovedws")) {
 		unsigned cm = parse_color_moved_ws(value);
 		if (cm & COLOR_MOVED_WS_ERROR)
@@ -772,6 +798,7 @@ struct emitted_diff_symbol {
 	int flags;
 	int indent_off;   /* Offset to first non-whitespace character */
 	int indent_width; /* The visual width of the indentation */
+	unsigned id;	  /* Equal lines share an id, see --color-moved */
 	enum diff_symbol s;
 };
 #define EMITTED_DIFF_SYMBOL_INIT {NULL}
@@ -797,9 +824,17 @@ static void append_emitted_diff_symbol(struct diff_options *o,
 }
 
 struct moved_entry {
-	struct hashmap_entry ent;
 	const struct emitted_diff_symbol *es;
 	struct moved_entry *next_line;
+	struct moved_entry *next_match;
+};
+
+/*
+ * All added and deleted lines sharing an id, i.e. the candidates for
+ * where a line of that content may have been moved to or from.
+ */
+struct moved_entry_list {
+	struct moved_entry *add, *del;
 };
 
 struct moved_block {
@@ -885,36 +920,17 @@ static int compute_ws_delta(const struct emitted_diff_symbol *a,
 	return 1;
 }
 
-static int cmp_in_block_with_wsd(const struct diff_options *o,
-				 const struct moved_entry *cur,
-				 const struct moved_entry *match,
-				 struct moved_block *pmb,
-				 int n)
-{
-	struct emitted_diff_symbol *l = &o->emitted_symbols->buf[n];
-	int al = cur->es->len, bl = match->es->len, cl = l->len;
-	const char *a = cur->es->line,
-		   *b = match->es->line,
-		   *c = l->line;
-	int a_off = cur->es->indent_off,
-	    a_width = cur->es->indent_width,
-	    c_off = l->indent_off,
-	    c_width = l->indent_width;
+static int cmp_in_block_with_wsd(const struct moved_entry *cur,
+				 const struct emitted_diff_symbol *l,
+				 struct moved_block *pmb)
+{
+	int a_width = cur->es->indent_width, c_width = l->indent_width;
 	int delta;
 
 	/*
-	 * We need to check if 'cur' is equal to 'match'.  As those
-	 * are from the same (+/-) side, we do not need to adjust for
-	 * indent changes. However these were found using fuzzy
-	 * matching so we do have to check if they are equal. Here we
-	 * just check the lengths. We delay calling memcmp() to check
-	 * the contents until later as if the length comparison for a
-	 * and c fails we can avoid the call all together.
+	 * 'cur' and 'l' share an id, so they are equal when ignoring
+	 * all white space.  If they are both blank then they match.
 	 */
-	if (al != bl)
-		return 1;
-
-	/* If 'l' and 'cur' are both blank then they match. */
 	if (a_width == INDENT_BLANKLINE && c_width == INDENT_BLANKLINE)
 		return 0;
 
@@ -936,92 +952,117 @@ static int cmp_in_block_with_wsd(const struct diff_options *o,
 	if (pmb->wsd == INDENT_BLANKLINE)
 		pmb->wsd = delta;
 
-	return !(delta == pmb->wsd && al - a_off == cl - c_off &&
-		 !memcmp(a, b, al) && !
-		 memcmp(a + a_off, c + c_off, al - a_off));
+	return !(delta == pmb->wsd &&
+		 cur->es->len - cur->es->indent_off == l->len - l->indent_off &&
+		 !memcmp(cur->es->line + cur->es->indent_off,
+			 l->line + l->indent_off,
+			 l->len - l->indent_off));
 }
 
-static int moved_entry_cmp(const void *hashmap_cmp_fn_data,
-			   const struct hashmap_entry *eptr,
-			   const struct hashmap_entry *entry_or_key,
-			   const void *keydata)
+struct interned_diff_symbol {
+	struct hashmap_entry ent;
+	struct emitted_diff_symbol *es;
+};
+
+static int interned_diff_symbol_cmp(const void *hashmap_cmp_fn_data,
+				    const struct hashmap_entry *eptr,
+				    const struct hashmap_entry *entry_or_key,
+				    const void *keydata)
 {
 	const struct diff_options *diffopt = hashmap_cmp_fn_data;
-	const struct moved_entry *a, *b;
+	const struct interned_diff_symbol *a, *b;
 	unsigned flags = diffopt->color_moved_ws_handling
 			 & XDF_WHITESPACE_FLAGS;
 
-	a = container_of(eptr, const struct moved_entry, ent);
-	b = container_of(entry_or_key, const struct moved_entry, ent);
-
-	if (diffopt->color_moved_ws_handling &
-	    COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE)
-		/*
-		 * As there is not specific white space config given,
-		 * we'd need to check for a new block, so ignore all
-		 * white space. The setup of the white space
-		 * configuration for the next block is done else where
-		 */
-		flags |= XDF_IGNORE_WHITESPACE;
+	a = container_of(eptr, const struct interned_diff_symbol, ent);
+	b = container_of(entry_or_key, const struct interned_diff_symbol, ent);
 
 	return !xdiff_compare_lines(a->es->line, a->es->len,
-				    b->es->line, b->es->len,
-				    flags);
+				    b->es->line, b->es->len, flags);
 }
 
-static struct moved_entry *prepare_entry(struct diff_options *o,
-					 int line_no)
+static void prepare_entry(struct diff_options *o, struct emitted_diff_symbol *l,
+			  struct interned_diff_symbol *s)
 {
-	struct moved_entry *ret = xmalloc(sizeof(*ret));
-	struct emitted_diff_symbol *l = &o->emitted_symbols->buf[line_no];
 	unsigned flags = o->color_moved_ws_handling & XDF_WHITESPACE_FLAGS;
 	unsigned int hash = xdiff_hash_string(l->line, l->len, flags);
 
-	hashmap_entry_init(&ret->ent, hash);
-	ret->es = l;
-	ret->next_line = NULL;
-
-	return ret;
+	hashmap_entry_init(&s->ent, hash);
+	s->es = l;
 }
 
-static void add_lines_to_move_detection(struct diff_options *o,
-					struct hashmap *add_lines,
-					struct hashmap *del_lines)
+/*
+ * Give every added and deleted line an id, equal lines (according to
+ * the white space handling of --color-moved) sharing the same one, so
+ * that lines can be compared without looking at their contents again.
+ * Returns the candidate lists indexed by id; *entries_out holds the
+ * entries they point to.
+ */
+static struct moved_entry_list *add_lines_to_move_detection(
+		struct diff_options *o, struct moved_entry **entries_out)
 {
+	struct emitted_diff_symbols *esm = o->emitted_symbols;
 	struct moved_entry *prev_line = NULL;
-
+	struct moved_entry *entries;
+	struct moved_entry_list *entry_list = NULL;
+	struct interned_diff_symbol *interned;
+	struct hashmap interned_lines;
+	size_t entry_list_alloc = 0;
+	unsigned id = 0;
 	int n;
-	for (n = 0; n < o->emitted_symbols->nr; n++) {
-		struct hashmap *hm;
-		struct moved_entry *key;
 
-		switch (o->emitted_symbols->buf[n].s) {
-		case DIFF_SYMBOL_PLUS:
-			hm = add_lines;
-			break;
-		case DIFF_SYMBOL_MINUS:
-			hm = del_lines;
-			break;
-		default:
+	CALLOC_ARRAY(entries, esm->nr);
+	ALLOC_ARRAY(interned, esm->nr);
+	hashmap_init(&interned_lines, interned_diff_symbol_cmp, o, 0);
+
+	for (n = 0; n < esm->nr; n++) {
+		struct emitted_diff_symbol *l = &esm->buf[n];
+		struct interned_diff_symbol *s;
+		struct moved_entry *entry = &entries[n];
+
+		if (l->s != DIFF_SYMBOL_PLUS && l->s != DIFF_SYMBOL_MINUS) {
 			prev_line = NULL;
 			continue;
 		}
 
 		if (o->color_moved_ws_handling &
 		    COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE)
-			fill_es_indent_data(&o->emitted_symbols->buf[n]);
-		key = prepare_entry(o, n);
-		if (prev_line && prev_line->es->s == o->emitted_symbols->buf[n].s)
-			prev_line->next_line = key;
+			fill_es_indent_data(l);
+
+		prepare_entry(o, l, &interned[n]);
+		s = hashmap_get_entry(&interned_lines, &interned[n], ent, NULL);
+		if (s) {
+			l->id = s->es->id;
+		} else {
+			l->id = id;
+			ALLOC_GROW(entry_list, id + 1, entry_list_alloc);
+			entry_list[id].add = entry_list[id].del = NULL;
+			id++;
+			hashmap_add(&interned_lines, &interned[n].ent);
+		}
+
+		entry->es = l;
+		if (prev_line && prev_line->es->s == l->s)
+			prev_line->next_line = entry;
+		prev_line = entry;
 
-		hashmap_add(hm, &key->ent);
-		prev_line = key;
+		if (l->s == DIFF_SYMBOL_PLUS) {
+			entry->next_match = entry_list[l->id].add;
+			entry_list[l->id].add = entry;
+		} else {
+			entry->next_match = entry_list[l->id].del;
+			entry_list[l->id].del = entry;
+		}
 	}
+
+	hashmap_free(&interned_lines);
+	free(interned);
+	*entries_out = entries;
+	return entry_list;
 }
 
 static void pmb_advance_or_null(struct diff_options *o,
-				struct moved_entry *match,
-				struct hashmap *hm,
+				struct emitted_diff_symbol *l,
 				struct moved_block *pmb,
 				int pmb_nr)
 {
@@ -1030,45 +1071,15 @@ static void pmb_advance_or_null(struct diff_options *o,
 		struct moved_entry *prev = pmb[i].match;
 		struct moved_entry *cur = (prev && prev->next_line) ?
 				prev->next_line : NULL;
-		if (cur && !hm->cmpfn(o, &cur->ent, &match->ent, NULL)) {
-			pmb[i].match = cur;
-		} else {
-			pmb[i].match = NULL;
-		}
-	}
-}
-
-static void pmb_advance_or_null_multi_match(struct diff_options *o,
-					    struct moved_entry *match,
-					    struct hashmap *hm,
-					    struct moved_block *pmb,
-					    int pmb_nr, int n)
-{
-	int i;
-	char *got_match = xcalloc(1, pmb_nr);
-
-	hashmap_for_each_entry_from(hm, match, ent) {
-		for (i = 0; i < pmb_nr; i++) {
-			struct moved_entry *prev = pmb[i].match;
-			struct moved_entry *cur = (prev && prev->next_line) ?
-					prev->next_line : NULL;
-			if (!cur)
-				continue;
-			if (!cmp_in_block_with_wsd(o, cur, match, &pmb[i], n))
-				got_match[i] |= 1;
-		}
-	}
 
-	for (i = 0; i < pmb_nr; i++) {
-		if (got_match[i]) {
-			/* Advance to the next line */
-			pmb[i].match = pmb[i].match->next_line;
-		} else {
+		if (cur && cur->es->id == l->id &&
+		    (!(o->color_moved_ws_handling &
+		       COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE) ||
+		     !cmp_in_block_with_wsd(cur, l, &pmb[i])))
+			pmb[i].match = cur;
+		else
 			moved_block_clear(&pmb[i]);
-		}
 	}
-
-	free(got_match);
 }
 
 static int shrink_potential_moved_blocks(struct moved_block *pmb,
@@ -1136,8 +1147,7 @@ static int adjust_last_block(struct diff_options *o, int n, int block_length)
 
 /* Find blocks of moved code, delegate actual coloring decision to helper */
 static void mark_color_as_moved(struct diff_options *o,
-				struct hashmap *add_lines,
-				struct hashmap *del_lines)
+				struct moved_entry_list *entry_list)
 {
 	struct moved_block *pmb = NULL; /* potentially moved blocks */
 	int pmb_nr = 0, pmb_alloc = 0;
@@ -1145,24 +1155,16 @@ static void mark_color_as_moved(struct diff_options *o,
 
 
 	for (n = 0; n < o->emitted_symbols->nr; n++) {
-		struct hashmap *hm = NULL;
-		struct moved_entry *key;
 		struct moved_entry *match = NULL;
 		struct emitted_diff_symbol *l = &o->emitted_symbols->buf[n];
 		enum diff_symbol last_symbol = 0;
 
 		switch (l->s) {
 		case DIFF_SYMBOL_PLUS:
-			hm = del_lines;
-			key = prepare_entry(o, n);
-			match = hashmap_get_entry(hm, key, ent, NULL);
-			free(key);
+			match = entry_list[l->id].del;
 			break;
 		case DIFF_SYMBOL_MINUS:
-			hm = add_lines;
-			key = prepare_entry(o, n);
-			match = hashmap_get_entry(hm, key, ent, NULL);
-			free(key);
+			match = entry_list[l->id].add;
 			break;
 		default:
 			flipped_block = 0;
@@ -1187,11 +1189,7 @@ static void mark_color_as_moved(struct diff_options *o,
 			continue;
 		}
 
-		if (o->color_moved_ws_handling &
-		    COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE)
-			pmb_advance_or_null_multi_match(o, match, hm, pmb, pmb_nr, n);
-		else
-			pmb_advance_or_null(o, match, hm, pmb, pmb_nr);
+		pmb_advance_or_null(o, l, pmb, pmb_nr);
 
 		pmb_nr = shrink_potential_moved_blocks(pmb, pmb_nr);
 
@@ -1200,7 +1198,7 @@ static void mark_color_as_moved(struct diff_options *o,
 			 * The current line is the start of a new block.
 			 * Setup the set of potential blocks.
 			 */
-			hashmap_for_each_entry_from(hm, match, ent) {
+			for (; match; match = match->next_match) {
 				ALLOC_GROW(pmb, pmb_nr + 1, pmb_alloc);
 				if (o->color_moved_ws_handling &
 				    COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE) {
@@ -1572,7 +1570,7 @@ static void emit_diff_symbol_from_struct(struct diff_options *o,
 static void emit_diff_symbol(struct diff_options *o, enum diff_symbol s,
 			     const char *line, int len, unsigned flags)
 {
-	struct emitted_diff_symbol e = {line, len, flags, 0, 0, s};
+	struct emitted_diff_symbol e = {line, len, flags, 0, 0, 0, s};
 
 	if (o->emitted_symbols)
 		append_emitted_diff_symbol(o, &e);
@@ -3607,9 +3605,11 @@ static void builtin_diff(const char *name_a,
 
 		if (o->word_diff)
 			init_diff_words_data(&ecbdata, o, one, two);
+		diff_unlock();
 		if (xdi_diff_outf(&mf1, &mf2, NULL, fn_out_consume,
 				  &ecbdata, &xpp, &xecfg))
 			die("unable to generate diff for %s", one->path);
+		diff_lock();
 		if (o->word_diff)
 			free_diff_words_data(&ecbdata);
 		if (textconv_one)
@@ -4567,6 +4567,7 @@ void repo_diff_setup(struct repository *r, struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->threads = diff_threads_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = diff_context_default;
 	options->interhunkcontext = diff_interhunk_context_default;
@@ -5536,6 +5537,8 @@ static void prep_parse_options(struct diff_options *options)
 			 N_("exit with 1 if there were differences, 0 otherwise")),
 		OPT_BOOL(0, "quiet", &options->flags.quick,
 			 N_("disable all output of the program")),
+		OPT_INTEGER(0, "threads", &options->threads,
+			    N_("generate patches using <n> threads")),
 		OPT_BOOL(0, "ext-diff", &options->flags.allow_external,
 			 N_("allow an external diff helper to be executed")),
 		OPT_CALLBACK_F(0, "textconv", options, NULL,
@@ -6255,9 +6258,240 @@ void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc)
 		warning(_(rename_limit_advice), varname, needed);
 }
 
+/*
+ * Generating patches on several threads: each filepair becomes a job
+ * whose output is recorded as emitted_diff_symbols by a worker, and
+ * the main thread emits the recorded output of the jobs in queue
+ * order.  Workers may only run ahead of the output by a bounded number
+ * of jobs, to bound the memory spent on recorded output.
+ */
+#define PATCH_JOBS_AHEAD 128
+
+struct patch_job {
+	struct diff_filepair *p;
+	struct emitted_diff_symbols out;
+	unsigned found_changes:1;
+	unsigned serial:1;	/* must be run by the main thread */
+	unsigned done:1;
+};
+
+struct patch_pool {
+	struct diff_options tmpl;
+	struct patch_job *jobs;
+	int nr, next, emitted;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_done;
+	pthread_cond_t cond_room;
+};
+
+/*
+ * Pairs whose output does not go through emit_diff_symbol(), or which
+ * run code that is not worth making thread-safe, are diffed by the
+ * main thread when their turn comes.
+ */
+static int patch_needs_main_thread(struct diff_filepair *p,
+				   struct diff_options *o)
+{
+	if (DIFF_PAIR_UNMERGED(p))
+		return 1;
+	if (o->submodule_format != DIFF_SUBMODULE_SHORT &&
+	    (S_ISGITLINK(p->one->mode) || S_ISGITLINK(p->two->mode)))
+		return 1;
+	if (o->flags.allow_external) {
+		struct userdiff_driver *drv;
+
+		if (external_diff())
+			return 1;
+		drv = userdiff_find_by_path(o->repo->index, p->one->path);
+		if (drv && drv->external)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Read a blob before taking the diff lock, so that inflating objects
+ * and applying deltas happens on all threads; the object store has its
+ * own lock.  Large blobs are left to diff_populate_filespec(), which
+ * may not need their contents.
+ */
+static void prefetch_filespec(struct repository *r, struct diff_filespec *s)
+{
+	struct object_info info = OBJECT_INFO_INIT;
+	unsigned long size;
+
+	if (!DIFF_FILE_VALID(s) || !S_ISREG(s->mode) || !s->oid_valid ||
+	    s->data)
+		return;
+	info.sizep = &size;
+	if (oid_object_info_extended(r, &s->oid, &info,
+				     OBJECT_INFO_LOOKUP_REPLACE |
+				     OBJECT_INFO_SKIP_FETCH_OBJECT) ||
+	    size > big_file_threshold)
+		return;
+	info.contentp = &s->data;
+	if (oid_object_info_extended(r, &s->oid, &info,
+				     OBJECT_INFO_LOOKUP_REPLACE |
+				     OBJECT_INFO_SKIP_FETCH_OBJECT)) {
+		s->data = NULL;
+		return;
+	}
+	s->size = size;
+	s->should_free = 1;
+}
+
+static void run_patch_job(struct patch_pool *pool, struct patch_job *job)
+{
+	struct diff_options o = pool->tmpl;
+
+	o.emitted_symbols = &job->out;
+	o.found_changes = 0;
+
+	if (!diff_unmodified_pair(job->p)) {
+		prefetch_filespec(o.repo, job->p->one);
+		prefetch_filespec(o.repo, job->p->two);
+	}
+
+	diff_lock();
+	if (patch_needs_main_thread(job->p, &o))
+		job->serial = 1;
+	else
+		diff_flush_patch(job->p, &o);
+	diff_unlock();
+
+	job->found_changes = o.found_changes;
+}
+
+static void *run_patch_jobs(void *data)
+{
+	struct patch_pool *pool = data;
+
+	for (;;) {
+		struct patch_job *job;
+
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->next < pool->nr &&
+		       pool->next >= pool->emitted + PATCH_JOBS_AHEAD)
+			pthread_cond_wait(&pool->cond_room, &pool->mutex);
+		if (pool->next >= pool->nr) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		job = &pool->jobs[pool->next++];
+		pthread_mutex_unlock(&pool->mutex);
+
+		run_patch_job(pool, job);
+
+		pthread_mutex_lock(&pool->mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&pool->cond_done);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return NULL;
+}
+
+static int patch_threads(struct diff_options *o, struct diff_queue_struct *q)
+{
+	int i, nr_threads = o->threads;
+
+	if (!HAVE_THREADS || nr_threads == 1 || q->nr < 2)
+		return 1;
+	/*
+	 * These make the output of one filepair depend on the ones
+	 * before it.
+	 */
+	if (o->output_prefix || o->word_diff)
+		return 1;
+	/* Filespecs shared between pairs (e.g. copies) are freed early. */
+	for (i = 0; i < q->nr; i++)
+		if (q->queue[i]->one->count > 1 ||
+		    q->queue[i]->two->count > 1)
+			return 1;
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+	return nr_threads < q->nr ? nr_threads : q->nr;
+}
+
+static void diff_flush_patch_threaded(struct diff_options *o, int nr_threads)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct patch_pool pool;
+	pthread_t *threads;
+	int i, j;
+
+	/* set up what builtin_diff() would lazily set in the workers */
+	diff_set_mnemonic_prefix(o, "a/", "b/");
+
+	memset(&pool, 0, sizeof(pool));
+	pool.tmpl = *o;
+	CALLOC_ARRAY(pool.jobs, q->nr);
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if (check_pair_status(p))
+			pool.jobs[pool.nr++].p = p;
+	}
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond_done, NULL);
+	pthread_cond_init(&pool.cond_room, NULL);
+	pthread_mutex_init(&diff_mutex, NULL);
+	diff_use_threads = 1;
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, run_patch_jobs, &pool))
+			die(_("unable to create thread"));
+
+	for (i = 0; i < pool.nr; i++) {
+		struct patch_job *job = &pool.jobs[i];
+
+		pthread_mutex_lock(&pool.mutex);
+		while (!job->done)
+			pthread_cond_wait(&pool.cond_done, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+
+		if (job->serial) {
+			diff_lock();
+			diff_flush_patch(job->p, o);
+			diff_unlock();
+		} else {
+			for (j = 0; j < job->out.nr; j++) {
+				struct emitted_diff_symbol *e = &job->out.buf[j];
+
+				if (o->emitted_symbols)
+					append_emitted_diff_symbol(o, e);
+				else
+					emit_diff_symbol_from_struct(o, e);
+				free((void *)e->line);
+			}
+			free(job->out.buf);
+			if (job->found_changes)
+				o->found_changes = 1;
+		}
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.emitted = i + 1;
+		pthread_cond_broadcast(&pool.cond_room);
+		pthread_mutex_unlock(&pool.mutex);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	diff_use_threads = 0;
+	pthread_mutex_destroy(&diff_mutex);
+	pthread_cond_destroy(&pool.cond_room);
+	pthread_cond_destroy(&pool.cond_done);
+	pthread_mutex_destroy(&pool.mutex);
+	free(pool.jobs);
+}
+
 static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 {
-	int i;
+	int i, nr_threads;
 	static struct emitted_diff_symbols esm = EMITTED_DIFF_SYMBOLS_INIT;
 	struct diff_queue_struct *q = &diff_queued_diff;
 
@@ -6267,32 +6501,33 @@ static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 	if (o->color_moved)
 		o->emitted_symbols = &esm;
 
-	for (i = 0; i < q->nr; i++) {
-		struct diff_filepair *p = q->queue[i];
-		if (check_pair_status(p))
-			diff_flush_patch(p, o);
+	nr_threads = patch_threads(o, q);
+	if (nr_threads > 1)
+		diff_flush_patch_threaded(o, nr_threads);
+	else {
+		for (i = 0; i < q->nr; i++) {
+			struct diff_filepair *p = q->queue[i];
+			if (check_pair_status(p))
+				diff_flush_patch(p, o);
+		}
 	}
 
 	if (o->emitted_symbols) {
 		if (o->color_moved) {
-			struct hashmap add_lines, del_lines;
+			struct moved_entry *entries;
+			struct moved_entry_list *entry_list;
 
 			if (o->color_moved_ws_handling &
 			    COLOR_MOVED_WS_ALLOW_INDENTATION_CHANGE)
 				o->color_moved_ws_handling |= XDF_IGNORE_WHITESPACE;
 
-			hashmap_init(&del_lines, moved_entry_cmp, o, 0);
-			hashmap_init(&add_lines, moved_entry_cmp, o, 0);
-
-			add_lines_to_move_detection(o, &add_lines, &del_lines);
-			mark_color_as_moved(o, &add_lines, &del_lines);
+			entry_list = add_lines_to_move_detection(o, &entries);
+			mark_color_as_moved(o, entry_list);
 			if (o->color_moved == COLOR_MOVED_ZEBRA_DIM)
 				dim_moved_lines(o);
 
-			hashmap_free_entries(&add_lines, struct moved_entry,
-						ent);
-			hashmap_free_entries(&del_lines, struct moved_entry,
-						ent);
+			free(entry_list);
+			free(entries);
 		}
 
 		for (i = 0; i < esm.nr; i++)
@@ -6684,7 +6919,7 @@ int diff_can_quit_early(struct diff_options *opt)
  * Submodule changes can be configured to be ignored separately for each path,
  * but that configuration can be overridden from the command line.
  */
-static int is_submodule_ignored(const char *path, struct diff_options *options)
+int is_submodule_ignored(const char *path, struct diff_options *options)
 {
 	int ignored = 0;
 	struct diff_flags orig_flags = options->flags;
@@ -278,6 +278,12 @@ struct diff_options {
 
 	int needed_rename_limit;
 	int degraded_cc_to_c;
+
+	/*
+	 * Number of threads generating patches in diff_flush(); 0 means
+	 * one per CPU, 1 generates them one after another.
+	 */
+	int threads;
 	int show_rename_progress;
 	int dirstat_permille;
 	int setup;
@@ -477,6 +483,12 @@ void diff_change(struct diff_options *,
 		 const char *fullpath,
 		 unsigned dirty_submodule1, unsigned dirty_submodule2);
 
+/*
+ * Whether diff_addremove() and diff_change() leave out the submodule at
+ * "path", according to the options and the submodule configuration.
+ */
+int is_submodule_ignored(const char *path, struct diff_options *options);
+
 struct diff_filepair *diff_unmerge(struct diff_options *, const char *path);
 
 void compute_diffstat(struct diff_options *options, struct diffstat_t *diffstat,
@@ -9,6 +9,9 @@
 #include "hashmap.h"
 #include "progress.h"
 #include "promisor-remote.h"
+#include "config.h"
+#include "string-list.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -178,81 +181,103 @@ static void prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
-static int estimate_similarity(struct repository *r,
-			       struct diff_filespec *src,
-			       struct diff_filespec *dst,
-			       int minimum_score,
-			       int skip_unmodified)
+static void init_rename_populate_options(struct repository *r,
+					 struct diff_populate_filespec_options *dpf_options,
+					 struct prefetch_options *prefetch_options)
+{
+	if (r == the_repository && has_promisor_remote()) {
+		dpf_options->missing_object_cb = prefetch;
+		dpf_options->missing_object_data = prefetch_options;
+	}
+}
+
+/*
+ * Make sure the size of a rename candidate is known.  Returns non-zero
+ * if it cannot take part in inexact rename detection at all.
+ */
+static int populate_rename_size(struct repository *r,
+				struct diff_filespec *one,
+				int skip_unmodified)
 {
-	/* src points at a file that existed in the original tree (or
-	 * optionally a file in the destination tree) and dst points
-	 * at a newly created file.  They may be quite similar, in which
-	 * case we want to say src is renamed to dst or src is copied into
-	 * dst, and then some edit has been applied to dst.
-	 *
-	 * Compare them and return how similar they are, representing
-	 * the score as an integer between 0 and MAX_SCORE.
-	 *
-	 * When there is an exact match, it is considered a better
-	 * match than anything else; the destination does not even
-	 * call into this function in that case.
-	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	int score;
 	struct diff_populate_filespec_options dpf_options = {
 		.check_size_only = 1
 	};
 	struct prefetch_options prefetch_options = {r, skip_unmodified};
 
-	if (r == the_repository && has_promisor_remote()) {
-		dpf_options.missing_object_cb = prefetch;
-		dpf_options.missing_object_data = &prefetch_options;
-	}
+	init_rename_populate_options(r, &dpf_options, &prefetch_options);
 
 	/* We deal only with regular files.  Symlink renames are handled
 	 * only when they are exact matches --- in other words, no edits
 	 * after renaming.
 	 */
-	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
-		return 0;
+	if (!S_ISREG(one->mode))
+		return -1;
 
 	/*
-	 * Need to check that source and destination sizes are
-	 * filled in before comparing them.
-	 *
 	 * If we already have "cnt_data" filled in, we know it's
 	 * all good (avoid checking the size for zero, as that
 	 * is a possible size - we really should have a flag to
 	 * say whether the size is valid or not!)
 	 */
-	if (!src->cnt_data &&
-	    diff_populate_filespec(r, src, &dpf_options))
-		return 0;
-	if (!dst->cnt_data &&
-	    diff_populate_filespec(r, dst, &dpf_options))
+	if (!one->cnt_data &&
+	    diff_populate_filespec(r, one, &dpf_options))
+		return -1;
+	return 0;
+}
+
+/*
+ * Fill in the "cnt_data" of a rename candidate.  The contents are not
+ * needed afterwards and are dropped right away.
+ */
+static int populate_rename_hash(struct repository *r,
+				struct diff_filespec *one,
+				int skip_unmodified)
+{
+	struct diff_populate_filespec_options dpf_options = { 0 };
+	struct prefetch_options prefetch_options = {r, skip_unmodified};
+
+	init_rename_populate_options(r, &dpf_options, &prefetch_options);
+
+	if (one->cnt_data)
 		return 0;
+	if (diff_populate_filespec(r, one, &dpf_options))
+		return -1;
+	one->cnt_data = diffcore_count_hash(r, one);
+	diff_free_filespec_blob(one);
+	return 0;
+}
+
+/*
+ * Both sizes must be known.  We would not consider edits that change
+ * the file size so drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation in similarity_score() would not
+ * have a divide-by-zero issue.
+ */
+static int rename_sizes_compatible(const struct diff_filespec *src,
+				   const struct diff_filespec *dst,
+				   int minimum_score)
+{
+	unsigned long max_size, delta_size, base_size;
 
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
 	base_size = ((src->size < dst->size) ? src->size : dst->size);
 	delta_size = max_size - base_size;
 
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
-		return 0;
-
-	dpf_options.check_size_only = 0;
+	return max_size * (MAX_SCORE-minimum_score) >= delta_size * MAX_SCORE;
+}
 
-	if (!src->cnt_data && diff_populate_filespec(r, src, &dpf_options))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(r, dst, &dpf_options))
-		return 0;
+/*
+ * Both "cnt_data" must have been filled in by populate_rename_hash(),
+ * which makes this safe to call from several threads at once.
+ */
+static int similarity_score(struct repository *r,
+			    struct diff_filespec *src,
+			    struct diff_filespec *dst)
+{
+	unsigned long max_size, src_copied, literal_added;
 
 	if (diffcore_count_changes(r, src, dst,
 				   &src->cnt_data, &dst->cnt_data,
@@ -262,11 +287,40 @@ static int estimate_similarity(struct repository *r,
 	/* How similar are they?
 	 * what percentage of material in dst are from source?
 	 */
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
 	if (!dst->size)
-		score = 0; /* should not happen */
-	else
-		score = (int)(src_copied * MAX_SCORE / max_size);
-	return score;
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
+static int estimate_similarity(struct repository *r,
+			       struct diff_filespec *src,
+			       struct diff_filespec *dst,
+			       int minimum_score,
+			       int skip_unmodified)
+{
+	/* src points at a file that existed in the original tree (or
+	 * optionally a file in the destination tree) and dst points
+	 * at a newly created file.  They may be quite similar, in which
+	 * case we want to say src is renamed to dst or src is copied into
+	 * dst, and then some edit has been applied to dst.
+	 *
+	 * Compare them and return how similar they are, representing
+	 * the score as an integer between 0 and MAX_SCORE.
+	 *
+	 * When there is an exact match, it is considered a better
+	 * match than anything else; the destination does not even
+	 * call into this function in that case.
+	 */
+	if (populate_rename_size(r, src, skip_unmodified) ||
+	    populate_rename_size(r, dst, skip_unmodified))
+		return 0;
+	if (!rename_sizes_compatible(src, dst, minimum_score))
+		return 0;
+	if (populate_rename_hash(r, src, skip_unmodified) ||
+	    populate_rename_hash(r, dst, skip_unmodified))
+		return 0;
+	return similarity_score(r, src, dst);
 }
 
 static void record_rename_pair(int dst_index, int src_index, int score)
@@ -447,11 +501,10 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
  * 1 if we need to disable inexact rename detection;
  * 2 if we would be under the limit if we were given -C instead of -C -C.
  */
-static int too_many_rename_candidates(int num_create,
+static int too_many_rename_candidates(int num_create, int num_src,
 				      struct diff_options *options)
 {
 	int rename_limit = options->rename_limit;
-	int num_src = rename_src_nr;
 	int i;
 
 	options->needed_rename_limit = 0;
@@ -510,6 +563,259 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+static const char *rename_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+/* Drop the basenames that appear more than once in a sorted list. */
+static void keep_unique_basenames(struct string_list *names)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < names->nr; i++) {
+		const char *name = names->items[i].string;
+
+		if (i && !strcmp(name, names->items[i - 1].string))
+			continue;
+		if (i + 1 < names->nr &&
+		    !strcmp(name, names->items[i + 1].string))
+			continue;
+		names->items[nr++] = names->items[i];
+	}
+	names->nr = nr;
+}
+
+/*
+ * Files are usually moved around without being renamed, so before
+ * comparing every source with every destination, pair up the sources
+ * and destinations that are the only ones on their side with a given
+ * basename, and accept them as renames when they are similar enough.
+ * Everything that remains goes through the full similarity matrix.
+ */
+static int find_basename_matches(struct diff_options *options,
+				 int minimum_score)
+{
+	struct string_list srcs = STRING_LIST_INIT_NODUP;
+	struct string_list dsts = STRING_LIST_INIT_NODUP;
+	int i, renames = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (one->rename_used)
+			continue;
+		string_list_append(&srcs, rename_basename(one->path))->util =
+			(void *)(intptr_t)i;
+	}
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue;
+		string_list_append(&dsts, rename_basename(rename_dst[i].two->path))->util =
+			(void *)(intptr_t)i;
+	}
+	string_list_sort(&srcs);
+	keep_unique_basenames(&srcs);
+	string_list_sort(&dsts);
+	keep_unique_basenames(&dsts);
+
+	for (i = 0; i < dsts.nr; i++) {
+		struct string_list_item *item;
+		struct diff_filespec *one, *two;
+		int src_index, dst_index, score;
+
+		item = string_list_lookup(&srcs, dsts.items[i].string);
+		if (!item)
+			continue;
+		src_index = (intptr_t)item->util;
+		dst_index = (intptr_t)dsts.items[i].util;
+		one = rename_src[src_index].p->one;
+		two = rename_dst[dst_index].two;
+		if (!strcmp(one->path, two->path))
+			continue; /* broken pair, leave it to the matrix */
+
+		score = estimate_similarity(options->repo, one, two,
+					    minimum_score, 0);
+		if (score < minimum_score)
+			continue;
+		record_rename_pair(dst_index, src_index, score);
+		renames++;
+	}
+
+	string_list_clear(&srcs, 0);
+	string_list_clear(&dsts, 0);
+	return renames;
+}
+
+/*
+ * Below this many comparisons, filling the similarity matrix is not
+ * worth starting threads for.
+ */
+#define RENAME_THREADS_MIN_PAIRS 1024
+
+static int rename_threads(uint64_t nr_pairs)
+{
+	static int config_threads = -1;
+
+	if (config_threads < 0) {
+		config_threads = 0;
+		git_config_get_int("diff.renamethreads", &config_threads);
+		if (config_threads <= 0)
+			config_threads = online_cpus();
+	}
+	if (!HAVE_THREADS || nr_pairs < RENAME_THREADS_MIN_PAIRS)
+		return 1;
+	return config_threads;
+}
+
+enum rename_candidate_state {
+	CANDIDATE_UNUSABLE = 0,
+	CANDIDATE_SIZED,
+	CANDIDATE_WANTED,
+	CANDIDATE_HASHED
+};
+
+/*
+ * The similarity matrix has one row of NUM_CANDIDATE_PER_DST entries
+ * for each destination not matched yet.  Reading the blobs is done
+ * up front, so that rows can then be filled in by several threads;
+ * each row only depends on its destination, which keeps the result
+ * the same whatever the number of threads.
+ */
+struct rename_matrix {
+	struct repository *repo;
+	struct diff_score *mx;
+	int minimum_score;
+
+	int *dst;
+	unsigned char *dst_state;
+	int dst_nr;
+
+	int *src;
+	unsigned char *src_state;
+	int src_nr;
+
+	pthread_mutex_t mutex;
+	int next_row;
+	struct progress *progress;
+};
+
+static void fill_rename_row(struct rename_matrix *rm, int row)
+{
+	int i = rm->dst[row], k, j;
+	struct diff_filespec *two = rename_dst[i].two;
+	struct diff_score *m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (k = 0; k < rm->src_nr; k++) {
+		struct diff_filespec *one = rename_src[rm->src[k]].p->one;
+		struct diff_score this_src;
+
+		this_src.score = 0;
+		if (rm->dst_state[row] == CANDIDATE_HASHED &&
+		    rm->src_state[k] == CANDIDATE_HASHED &&
+		    rename_sizes_compatible(one, two, rm->minimum_score))
+			this_src.score = similarity_score(rm->repo, one, two);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = rm->src[k];
+		record_if_better(m, &this_src);
+	}
+}
+
+static void *fill_rename_rows(void *data)
+{
+	struct rename_matrix *rm = data;
+
+	for (;;) {
+		int row;
+
+		pthread_mutex_lock(&rm->mutex);
+		row = rm->next_row++;
+		if (row < rm->dst_nr)
+			display_progress(rm->progress,
+					 (uint64_t)(row + 1) * rm->src_nr);
+		pthread_mutex_unlock(&rm->mutex);
+
+		if (row >= rm->dst_nr)
+			break;
+		fill_rename_row(rm, row);
+	}
+	return NULL;
+}
+
+static void fill_rename_matrix(struct rename_matrix *rm, int skip_unmodified)
+{
+	struct repository *r = rm->repo;
+	int row, k, nr_threads;
+
+	/* Find out which candidates may be similar enough to anything... */
+	for (row = 0; row < rm->dst_nr; row++)
+		if (!populate_rename_size(r, rename_dst[rm->dst[row]].two,
+					  skip_unmodified))
+			rm->dst_state[row] = CANDIDATE_SIZED;
+	for (k = 0; k < rm->src_nr; k++)
+		if (!populate_rename_size(r, rename_src[rm->src[k]].p->one,
+					  skip_unmodified))
+			rm->src_state[k] = CANDIDATE_SIZED;
+	for (row = 0; row < rm->dst_nr; row++) {
+		struct diff_filespec *two = rename_dst[rm->dst[row]].two;
+
+		if (!rm->dst_state[row])
+			continue;
+		for (k = 0; k < rm->src_nr; k++) {
+			struct diff_filespec *one = rename_src[rm->src[k]].p->one;
+
+			if (!rm->src_state[k] ||
+			    !rename_sizes_compatible(one, two, rm->minimum_score))
+				continue;
+			rm->src_state[k] = CANDIDATE_WANTED;
+			rm->dst_state[row] = CANDIDATE_WANTED;
+		}
+	}
+
+	/* ... and summarize only those. */
+	for (row = 0; row < rm->dst_nr; row++)
+		if (rm->dst_state[row] == CANDIDATE_WANTED)
+			rm->dst_state[row] =
+				populate_rename_hash(r, rename_dst[rm->dst[row]].two,
+						     skip_unmodified) ?
+				CANDIDATE_UNUSABLE : CANDIDATE_HASHED;
+	for (k = 0; k < rm->src_nr; k++)
+		if (rm->src_state[k] == CANDIDATE_WANTED)
+			rm->src_state[k] =
+				populate_rename_hash(r, rename_src[rm->src[k]].p->one,
+						     skip_unmodified) ?
+				CANDIDATE_UNUSABLE : CANDIDATE_HASHED;
+
+	nr_threads = rename_threads((uint64_t)rm->dst_nr * rm->src_nr);
+	if (nr_threads > rm->dst_nr)
+		nr_threads = rm->dst_nr;
+	trace2_data_intmax("diff", r, "rename/threads", nr_threads);
+
+	pthread_mutex_init(&rm->mutex, NULL);
+	rm->next_row = 0;
+	if (nr_threads < 2) {
+		fill_rename_rows(rm);
+	} else {
+		pthread_t *threads;
+		int t;
+
+		ALLOC_ARRAY(threads, nr_threads);
+		for (t = 0; t < nr_threads; t++)
+			if (pthread_create(&threads[t], NULL,
+					   fill_rename_rows, rm))
+				die(_("unable to create thread"));
+		for (t = 0; t < nr_threads; t++)
+			pthread_join(threads[t], NULL);
+		free(threads);
+	}
+	pthread_mutex_destroy(&rm->mutex);
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -517,8 +823,9 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_create, dst_cnt;
+	struct rename_matrix rm;
+	int i, rename_count, skip_unmodified = 0;
+	int num_create, num_src, dst_cnt;
 	struct progress *progress = NULL;
 
 	if (!minimum_score)
@@ -579,6 +886,15 @@ void diffcore_rename(struct diff_options *options)
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	/*
+	 * Unless copies are wanted, a source can be used only once;
+	 * first pair up the files that merely moved to another
+	 * directory, holding them to a higher similarity standard.
+	 */
+	if (detect_rename == DIFF_DETECT_RENAME)
+		rename_count += find_basename_matches(options,
+			minimum_score + (MAX_SCORE - minimum_score) / 2);
+
 	/*
 	 * Calculate how many renames are left (but all the source
 	 * files still remain as options for rename/copies!)
@@ -589,7 +905,14 @@ void diffcore_rename(struct diff_options *options)
 	if (!num_create)
 		goto cleanup;
 
-	switch (too_many_rename_candidates(num_create, options)) {
+	for (num_src = i = 0; i < rename_src_nr; i++) {
+		if (detect_rename == DIFF_DETECT_RENAME &&
+		    rename_src[i].p->one->rename_used)
+			continue;
+		num_src++;
+	}
+
+	switch (too_many_rename_candidates(num_create, num_src, options)) {
 	case 1:
 		goto cleanup;
 	case 2:
@@ -600,50 +923,42 @@ void diffcore_rename(struct diff_options *options)
 		break;
 	}
 
+	memset(&rm, 0, sizeof(rm));
+	rm.repo = options->repo;
+	rm.minimum_score = minimum_score;
+	ALLOC_ARRAY(rm.dst, num_create);
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+		rm.dst[rm.dst_nr++] = i;
+	}
+	ALLOC_ARRAY(rm.src, num_src);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filepair *p = rename_src[i].p;
+
+		if (detect_rename == DIFF_DETECT_RENAME && p->one->rename_used)
+			continue; /* cannot be renamed twice */
+		if (skip_unmodified && diff_unmodified_pair(p))
+			continue;
+		rm.src[rm.src_nr++] = i;
+	}
 	if (options->show_rename_progress) {
 		progress = start_delayed_progress(
 				_("Performing inexact rename detection"),
-				(uint64_t)rename_dst_nr * (uint64_t)rename_src_nr);
+				(uint64_t)rm.dst_nr * (uint64_t)rm.src_nr);
+		rm.progress = progress;
 	}
 
-	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     skip_unmodified);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
-	}
+	rm.dst_state = xcalloc(rm.dst_nr, 1);
+	rm.src_state = xcalloc(rm.src_nr, 1);
+	rm.mx = mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create),
+			     sizeof(*mx));
+	fill_rename_matrix(&rm, skip_unmodified);
+	dst_cnt = rm.dst_nr;
+	free(rm.dst);
+	free(rm.dst_state);
+	free(rm.src);
+	free(rm.src_state);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
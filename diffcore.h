@@ -190,6 +190,14 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Compute the summary of "one" that diffcore_count_changes() works on,
+ * so that it can be computed once and handed back through src_count_p
+ * or dst_count_p; with both of them filled in, diffcore_count_changes()
+ * only reads its arguments.
+ */
+void *diffcore_count_hash(struct repository *r, struct diff_filespec *one);
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
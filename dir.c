@@ -18,6 +18,7 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "sparse-index.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -1810,8 +1811,21 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 	/* The "len-1" is to strip the final '/' */
 	enum exist_status status = directory_exists_in_index(istate, dirname, len-1);
 
-	if (status == index_directory)
+	if (status == index_directory) {
+		/*
+		 * The directory is on disk even though the index only
+		 * has a sparse directory entry for it; we need the
+		 * entries to tell tracked from untracked files.
+		 */
+		if (istate->sparse_index) {
+			int pos = index_name_pos(istate, dirname, len);
+
+			if (pos >= 0 &&
+			    S_ISSPARSEDIR(istate->cache[pos]->ce_mode))
+				ensure_full_index(istate);
+		}
 		return path_recurse;
+	}
 	if (status == index_gitdir)
 		return path_none;
 	if (status != index_nonexistent)
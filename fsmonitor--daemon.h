@@ -0,0 +1,52 @@
+#ifndef FSMONITOR_DAEMON_H
+#define FSMONITOR_DAEMON_H
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+#include "hashmap.h"
+#include "strbuf.h"
+
+/*
+ * State of a running "git fsmonitor--daemon".
+ *
+ * The daemon keeps a journal of the paths that changed in the
+ * worktree. Every path is stamped with the sequence number of the
+ * first token that will include it, so the answer to a query for a
+ * token "builtin:<token_id>:<seq>" is the set of paths stamped after
+ * <seq>. A new <token_id> is chosen whenever the journal cannot be
+ * trusted anymore (e.g. when the kernel dropped events), which makes
+ * every client token unknown and forces a full scan.
+ */
+struct fsmonitor_daemon_state {
+	struct strbuf path_worktree_watch;
+	struct strbuf token_id;
+
+	/* The sequence number of the most recent token handed out. */
+	uint64_t seq;
+
+	/* Whether paths were stamped with seq + 1. */
+	unsigned pending_changes : 1;
+
+	/* Set to stop the daemon after the current request. */
+	unsigned shutdown : 1;
+
+	struct hashmap changed_paths;
+
+	/* Private data of the platform-specific listener. */
+	void *backend_data;
+};
+
+/*
+ * Record a change of `path`, relative to the root of the worktree.
+ * Directories are passed with a trailing slash.
+ */
+void fsmonitor_daemon_path_changed(struct fsmonitor_daemon_state *state,
+				   const char *path);
+
+/*
+ * Forget the journal and start over with a new token id.
+ */
+void fsmonitor_daemon_force_resync(struct fsmonitor_daemon_state *state);
+
+#endif /* HAVE_FSMONITOR_DAEMON_BACKEND */
+#endif /* FSMONITOR_DAEMON_H */
@@ -0,0 +1,128 @@
+#include "cache.h"
+#include "fsmonitor-ipc.h"
+#include "run-command.h"
+#include "strbuf.h"
+#include "trace2.h"
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+#include "unix-socket.h"
+
+int fsmonitor_ipc__is_supported(void)
+{
+	return 1;
+}
+
+const char *fsmonitor_ipc__get_path(void)
+{
+	static const char *ipc_path;
+
+	if (!ipc_path)
+		ipc_path = git_pathdup("fsmonitor--daemon.ipc");
+	return ipc_path;
+}
+
+int fsmonitor_ipc__is_listening(void)
+{
+	int fd = unix_stream_connect(fsmonitor_ipc__get_path());
+
+	if (fd < 0)
+		return 0;
+	close(fd);
+	return 1;
+}
+
+static int send_request(const char *request, struct strbuf *answer)
+{
+	int fd = unix_stream_connect(fsmonitor_ipc__get_path());
+	int ret = 0;
+
+	if (fd < 0)
+		return -1;
+
+	if (write_in_full(fd, request, strlen(request)) < 0 ||
+	    shutdown(fd, SHUT_WR) < 0 ||
+	    strbuf_read(answer, fd, 0) < 0)
+		ret = -1;
+
+	close(fd);
+	return ret;
+}
+
+static int spawn_daemon(void)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+
+	cp.git_cmd = 1;
+	cp.no_stdin = 1;
+	cp.no_stdout = 1;
+	strvec_pushl(&cp.args, "fsmonitor--daemon", "start", NULL);
+
+	return run_command(&cp);
+}
+
+int fsmonitor_ipc__send_query(const char *since_token,
+			      struct strbuf *answer)
+{
+	int ret;
+
+	trace2_region_enter("fsm_client", "query", NULL);
+
+	ret = send_request(since_token, answer);
+	if (ret < 0) {
+		/*
+		 * Nobody is listening. Start a daemon so that later
+		 * commands can use it, and ask again: the first answer
+		 * will be a trivial one, as the new daemon has not seen
+		 * our token.
+		 */
+		trace2_data_string("fsm_client", NULL, "query/spawn",
+				   fsmonitor_ipc__get_path());
+		strbuf_reset(answer);
+		if (!spawn_daemon())
+			ret = send_request(since_token, answer);
+	}
+
+	trace2_data_intmax("fsm_client", NULL, "query/response-length",
+			   answer->len);
+	trace2_region_leave("fsm_client", "query", NULL);
+
+	return ret;
+}
+
+int fsmonitor_ipc__send_command(const char *command,
+				struct strbuf *answer)
+{
+	return send_request(command, answer);
+}
+
+#else
+
+int fsmonitor_ipc__is_supported(void)
+{
+	return 0;
+}
+
+const char *fsmonitor_ipc__get_path(void)
+{
+	return NULL;
+}
+
+int fsmonitor_ipc__is_listening(void)
+{
+	return 0;
+}
+
+int fsmonitor_ipc__send_query(const char *since_token,
+			      struct strbuf *answer)
+{
+	return -1;
+}
+
+int fsmonitor_ipc__send_command(const char *command,
+				struct strbuf *answer)
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef FSMONITOR_IPC_H
+#define FSMONITOR_IPC_H
+
+/*
+ * Client side of the builtin filesystem monitor daemon
+ * ("git fsmonitor--daemon").
+ *
+ * The daemon listens on a unix domain socket in the per-worktree
+ * $GIT_DIR. Each connection carries exactly one request: the client
+ * writes the request, shuts down its sending side and reads the
+ * response until EOF.
+ *
+ * A request is either a command ("quit" or "flush") or a token that
+ * was previously returned by the daemon. The response to a token is
+ * in the format of version 2 of the fsmonitor hook: the new token
+ * followed by the changed pathnames, each terminated by a NUL byte.
+ * Directories are reported with a trailing slash and mean that
+ * everything below them may have changed. A "/" in place of the
+ * pathnames means that the daemon cannot tell what changed since the
+ * given token, and that the caller should scan the whole worktree.
+ */
+
+/*
+ * Returns true if this platform has a builtin fsmonitor daemon.
+ */
+int fsmonitor_ipc__is_supported(void);
+
+/*
+ * Returns the pathname of the socket the daemon of the current
+ * worktree listens on.
+ */
+const char *fsmonitor_ipc__get_path(void);
+
+/*
+ * Returns 1 if a daemon is listening for the current worktree, and 0
+ * otherwise.
+ */
+int fsmonitor_ipc__is_listening(void);
+
+/*
+ * Ask the daemon for the paths that changed since the given token.
+ * If no daemon is running, try to start one in the background first.
+ *
+ * Returns 0 and fills `answer` on success, or a negative value if the
+ * daemon could not be reached.
+ */
+int fsmonitor_ipc__send_query(const char *since_token,
+			      struct strbuf *answer);
+
+/*
+ * Send a command such as "quit" or "flush" to a running daemon, without
+ * trying to start one. Returns 0 and fills `answer` on success, or a
+ * negative value if the daemon could not be reached.
+ */
+int fsmonitor_ipc__send_command(const char *command,
+				struct strbuf *answer);
+
+#endif /* FSMONITOR_IPC_H */
@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "run-command.h"
 #include "strbuf.h"
 
@@ -155,9 +156,42 @@ static int query_fsmonitor(int version, const char *last_update, struct strbuf *
 	return capture_command(&cp, query_result, 1024);
 }
 
-static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
+/*
+ * The builtin daemon reports a directory, with a trailing slash, when
+ * everything below it may have changed (e.g. because it was renamed).
+ */
+static void fsmonitor_refresh_directory(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	int len = strlen(name);
+	int pos = index_name_pos(istate, name, len);
+
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (strncmp(ce->name, name, len))
+			break;
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+
+	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_directory '%s'", name);
+}
+
+/*
+ * Returns 1 if `name` is a directory, for which we cannot tell which
+ * parts of the untracked cache are affected.
+ */
+static int fsmonitor_refresh_callback(struct index_state *istate, const char *name)
+{
+	int pos;
+
+	if (*name && name[strlen(name) - 1] == '/') {
+		fsmonitor_refresh_directory(istate, name);
+		return 1;
+	}
+
+	pos = index_name_pos(istate, name, strlen(name));
 
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
@@ -170,12 +204,13 @@ static void fsmonitor_refresh_callback(struct index_state *istate, const char *n
 	 */
 	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback '%s'", name);
 	untracked_cache_invalidate_path(istate, name, 0);
+	return 0;
 }
 
 void refresh_fsmonitor(struct index_state *istate)
 {
 	struct strbuf query_result = STRBUF_INIT;
-	int query_success = 0, hook_version = -1;
+	int query_success = 0, hook_version = -1, dirs_changed = 0;
 	size_t bol = 0; /* beginning of line */
 	uint64_t last_update;
 	struct strbuf last_update_token = STRBUF_INIT;
@@ -185,7 +220,11 @@ void refresh_fsmonitor(struct index_state *istate)
 	if (!core_fsmonitor || istate->fsmonitor_has_run_once)
 		return;
 
-	hook_version = fsmonitor_hook_version();
+	/* The builtin daemon answers in the format of the version 2 hook. */
+	if (core_fsmonitor_builtin)
+		hook_version = HOOK_INTERFACE_VERSION2;
+	else
+		hook_version = fsmonitor_hook_version();
 
 	istate->fsmonitor_has_run_once = 1;
 
@@ -205,8 +244,12 @@ void refresh_fsmonitor(struct index_state *istate)
 	 */
 	if (istate->fsmonitor_last_update) {
 		if (hook_version == -1 || hook_version == HOOK_INTERFACE_VERSION2) {
-			query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION2,
-				istate->fsmonitor_last_update, &query_result);
+			if (core_fsmonitor_builtin)
+				query_success = !fsmonitor_ipc__send_query(
+					istate->fsmonitor_last_update, &query_result);
+			else
+				query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION2,
+					istate->fsmonitor_last_update, &query_result);
 
 			if (query_success) {
 				if (hook_version < 0)
@@ -231,6 +274,9 @@ void refresh_fsmonitor(struct index_state *istate)
 				hook_version = HOOK_INTERFACE_VERSION1;
 				if (!last_update_token.len)
 					strbuf_addf(&last_update_token, "%"PRIu64"", last_update);
+			} else if (core_fsmonitor_builtin) {
+				/* Any token will do; the daemon will not know it. */
+				strbuf_addf(&last_update_token, "%"PRIu64"", last_update);
 			}
 		}
 
@@ -239,9 +285,11 @@ void refresh_fsmonitor(struct index_state *istate)
 				istate->fsmonitor_last_update, &query_result);
 		}
 
-		trace_performance_since(last_update, "fsmonitor process '%s'", core_fsmonitor);
+		trace_performance_since(last_update, "fsmonitor process '%s'",
+			core_fsmonitor_builtin ? "builtin" : core_fsmonitor);
 		trace_printf_key(&trace_fsmonitor, "fsmonitor process '%s' returned %s",
-			core_fsmonitor, query_success ? "success" : "failure");
+			core_fsmonitor_builtin ? "builtin" : core_fsmonitor,
+			query_success ? "success" : "failure");
 	}
 
 	/* a fsmonitor process can return '/' to indicate all entries are invalid */
@@ -251,15 +299,18 @@ void refresh_fsmonitor(struct index_state *istate)
 		for (i = bol; i < query_result.len; i++) {
 			if (buf[i] != '\0')
 				continue;
-			fsmonitor_refresh_callback(istate, buf + bol);
+			dirs_changed |= fsmonitor_refresh_callback(istate, buf + bol);
 			bol = i + 1;
 		}
 		if (bol < query_result.len)
-			fsmonitor_refresh_callback(istate, buf + bol);
+			dirs_changed |= fsmonitor_refresh_callback(istate, buf + bol);
 
-		/* Now mark the untracked cache for fsmonitor usage */
+		/*
+		 * Now mark the untracked cache for fsmonitor usage, unless
+		 * we have to let it validate every directory the usual way.
+		 */
 		if (istate->untracked)
-			istate->untracked->use_fsmonitor = 1;
+			istate->untracked->use_fsmonitor = !dirs_changed;
 	} else {
 
 		/* We only want to run the post index changed hook if we've actually changed entries, so keep track
@@ -12,6 +12,9 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "trace.h"
+#include "khash.h"
+#include "thread-utils.h"
+#include "promisor-remote.h"
 
 struct traversal_context {
 	struct rev_info *revs;
@@ -19,6 +22,7 @@ struct traversal_context {
 	show_commit_fn show_commit;
 	void *show_data;
 	struct filter *filter;
+	int nr_threads;
 };
 
 static void process_blob(struct traversal_context *ctx,
@@ -354,6 +358,328 @@ static void traverse_trees_and_blobs(struct traversal_context *ctx,
 	object_array_clear(&ctx->revs->pending);
 }
 
+/*
+ * Walking the trees on several threads.
+ *
+ * The commits are still walked on the calling thread, which leaves
+ * the trees (and tags and blobs) to show in revs->pending.  Each
+ * pending entry becomes a "job".  Workers pick up the jobs in order,
+ * read the trees below the entry and record every object they reach
+ * with its path, without touching the object hash, which is not
+ * thread-safe.  The calling thread replays the records job by job,
+ * marking objects SEEN and calling show_object() for the ones that
+ * process_tree() would have shown, in the same order and with the
+ * same names.
+ *
+ * So that the workers do not all walk the same subtrees, they share a
+ * set mapping each object to the lowest job that claimed it so far
+ * (job 0 stands for objects that were already UNINTERESTING or SEEN).
+ * A worker only records and descends into an entry when it lowers
+ * that claim.  Whatever it skips is therefore recorded earlier in its
+ * own job or by an earlier job, and is SEEN by the time the job is
+ * replayed.  Losing a race to a later claim by an earlier job only
+ * means some objects are recorded twice; the replay drops the second
+ * copy because it is SEEN by then.
+ */
+
+#define WALK_CLAIM_SHARDS 256
+
+struct walk_claims {
+	kh_oid_pos_t *set[WALK_CLAIM_SHARDS];
+	pthread_mutex_t mutex[WALK_CLAIM_SHARDS];
+};
+
+struct walk_record {
+	struct object_id oid;
+	enum object_type type; /* OBJ_BAD for trees that cannot be read */
+	size_t path; /* offset into walk_job.paths */
+};
+
+struct walk_job {
+	struct object_id oid;
+	enum object_type type;
+	const char *path;
+
+	struct walk_record *records;
+	size_t nr, alloc;
+	struct strbuf paths;
+	int done;
+};
+
+struct walk_pool {
+	struct repository *repo;
+	struct walk_job *jobs;
+	int nr, next;
+	struct walk_claims claims;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/*
+ * Claim "oid" for "job". Returns 1 if the object was not claimed by an
+ * earlier job yet (or, with "allow_equal", by a later or the same job).
+ */
+static int claim_object(struct walk_claims *claims,
+			const struct object_id *oid,
+			int job, int allow_equal)
+{
+	unsigned shard = oid->hash[0];
+	kh_oid_pos_t *set = claims->set[shard];
+	khiter_t pos;
+	int hashmap_ret, ret = 0;
+
+	pthread_mutex_lock(&claims->mutex[shard]);
+	pos = kh_put_oid_pos(set, *oid, &hashmap_ret);
+	if (hashmap_ret || job < kh_value(set, pos) ||
+	    (allow_equal && job == kh_value(set, pos))) {
+		kh_value(set, pos) = job;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&claims->mutex[shard]);
+	return ret;
+}
+
+static void add_walk_record(struct walk_job *job,
+			    const struct object_id *oid,
+			    enum object_type type,
+			    const struct strbuf *path)
+{
+	struct walk_record *rec;
+
+	ALLOC_GROW(job->records, job->nr + 1, job->alloc);
+	rec = &job->records[job->nr++];
+	oidcpy(&rec->oid, oid);
+	rec->type = type;
+	rec->path = job->paths.len;
+	strbuf_add(&job->paths, path->buf, path->len + 1);
+}
+
+static void walk_tree(struct walk_pool *pool, int nr,
+		      const struct object_id *oid, struct strbuf *base)
+{
+	struct walk_job *job = &pool->jobs[nr - 1];
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	size_t baselen = base->len;
+	void *buffer;
+
+	buffer = repo_read_object_file(pool->repo, oid, &type, &size);
+	if (!buffer || type != OBJ_TREE) {
+		free(buffer);
+		add_walk_record(job, oid, OBJ_BAD, base);
+		return;
+	}
+	add_walk_record(job, oid, OBJ_TREE, base);
+	if (base->len)
+		strbuf_addch(base, '/');
+
+	init_tree_desc(&desc, buffer, size);
+	while (tree_entry(&desc, &entry)) {
+		size_t dirlen = base->len;
+
+		if (S_ISGITLINK(entry.mode) ||
+		    !claim_object(&pool->claims, &entry.oid, nr, 0))
+			continue;
+
+		strbuf_add(base, entry.path, tree_entry_len(&entry));
+		if (S_ISDIR(entry.mode))
+			walk_tree(pool, nr, &entry.oid, base);
+		else
+			add_walk_record(job, &entry.oid, OBJ_BLOB, base);
+		strbuf_setlen(base, dirlen);
+	}
+
+	strbuf_setlen(base, baselen);
+	free(buffer);
+}
+
+static void *run_walk_jobs(void *data)
+{
+	struct walk_pool *pool = data;
+	struct strbuf base = STRBUF_INIT;
+
+	for (;;) {
+		struct walk_job *job;
+		int nr;
+
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->next >= pool->nr) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		nr = ++pool->next;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job = &pool->jobs[nr - 1];
+		if (job->type == OBJ_TREE &&
+		    claim_object(&pool->claims, &job->oid, nr, 1)) {
+			strbuf_addstr(&base, job->path);
+			walk_tree(pool, nr, &job->oid, &base);
+			strbuf_reset(&base);
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		job->done = 1;
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	strbuf_release(&base);
+	return NULL;
+}
+
+static void show_object_locked(struct traversal_context *ctx,
+			       struct object *obj, const char *name)
+{
+	/* show_object() may look up objects while the workers read them */
+	obj_read_lock();
+	ctx->show_object(obj, name, ctx->show_data);
+	obj_read_unlock();
+}
+
+static void replay_walk_job(struct traversal_context *ctx,
+			    struct object_array_entry *pending,
+			    struct walk_job *job,
+			    struct strbuf *base)
+{
+	struct object *obj = pending->item;
+	size_t i;
+
+	if (obj->flags & (UNINTERESTING | SEEN))
+		return;
+	if (obj->type == OBJ_TAG) {
+		obj->flags |= SEEN;
+		show_object_locked(ctx, obj, pending->name);
+		return;
+	}
+	if (obj->type == OBJ_BLOB) {
+		obj_read_lock();
+		process_blob(ctx, (struct blob *)obj, base, job->path);
+		obj_read_unlock();
+		return;
+	}
+	if (obj->type != OBJ_TREE)
+		die("unknown pending object %s (%s)",
+		    oid_to_hex(&obj->oid), pending->name);
+
+	for (i = 0; i < job->nr; i++) {
+		struct walk_record *rec = &job->records[i];
+		const char *path = job->paths.buf + rec->path;
+
+		if (rec->type == OBJ_BLOB) {
+			struct blob *b = lookup_blob(ctx->revs->repo, &rec->oid);
+			if (!b)
+				die(_("entry '%s' has blob mode, "
+				      "but is not a blob"), path);
+			obj = &b->object;
+		} else {
+			struct tree *t = lookup_tree(ctx->revs->repo, &rec->oid);
+			if (!t)
+				die(_("entry '%s' has tree mode, "
+				      "but is not a tree"), path);
+			obj = &t->object;
+		}
+		if (i)
+			obj->flags |= NOT_USER_GIVEN;
+		if (obj->flags & (UNINTERESTING | SEEN))
+			continue;
+		if (rec->type == OBJ_BAD)
+			die("bad tree object %s", oid_to_hex(&obj->oid));
+
+		obj->flags |= SEEN;
+		show_object_locked(ctx, obj, path);
+	}
+}
+
+static void init_walk_claims(struct walk_pool *pool,
+			     struct object_array *pending)
+{
+	unsigned int i, max = get_max_object_index();
+
+	for (i = 0; i < WALK_CLAIM_SHARDS; i++) {
+		pool->claims.set[i] = kh_init_oid_pos();
+		pthread_mutex_init(&pool->claims.mutex[i], NULL);
+	}
+
+	for (i = 0; i < max; i++) {
+		struct object *obj = get_indexed_object(i);
+		if (obj && (obj->type == OBJ_TREE || obj->type == OBJ_BLOB) &&
+		    (obj->flags & (UNINTERESTING | SEEN)))
+			claim_object(&pool->claims, &obj->oid, 0, 0);
+	}
+
+	for (i = 0; i < pending->nr; i++) {
+		struct object_array_entry *entry = pending->objects + i;
+		struct walk_job *job = &pool->jobs[i];
+
+		oidcpy(&job->oid, &entry->item->oid);
+		job->type = entry->item->type;
+		job->path = entry->path ? entry->path : "";
+		strbuf_init(&job->paths, 0);
+		if (job->type == OBJ_TREE || job->type == OBJ_BLOB)
+			claim_object(&pool->claims, &job->oid, i + 1, 0);
+	}
+}
+
+static void traverse_trees_and_blobs_parallel(struct traversal_context *ctx,
+					      struct strbuf *base)
+{
+	struct object_array *pending = &ctx->revs->pending;
+	struct walk_pool pool;
+	pthread_t *threads;
+	int i, nr_threads = ctx->nr_threads;
+
+	if (nr_threads > pending->nr)
+		nr_threads = pending->nr;
+	if (nr_threads < 2) {
+		traverse_trees_and_blobs(ctx, base);
+		return;
+	}
+
+	memset(&pool, 0, sizeof(pool));
+	pool.repo = ctx->revs->repo;
+	pool.nr = pending->nr;
+	pool.jobs = xcalloc(pool.nr, sizeof(*pool.jobs));
+	init_walk_claims(&pool, pending);
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	enable_obj_read_lock();
+
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, run_walk_jobs, &pool))
+			die(_("unable to create thread"));
+
+	for (i = 0; i < pool.nr; i++) {
+		struct walk_job *job = &pool.jobs[i];
+
+		pthread_mutex_lock(&pool.mutex);
+		while (!job->done)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+
+		replay_walk_job(ctx, pending->objects + i, job, base);
+		FREE_AND_NULL(job->records);
+		strbuf_release(&job->paths);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	disable_obj_read_lock();
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	for (i = 0; i < WALK_CLAIM_SHARDS; i++) {
+		kh_destroy_oid_pos(pool.claims.set[i]);
+		pthread_mutex_destroy(&pool.claims.mutex[i]);
+	}
+	free(pool.jobs);
+	object_array_clear(pending);
+}
+
 static void do_traverse(struct traversal_context *ctx)
 {
 	struct commit *commit;
@@ -385,7 +711,10 @@ static void do_traverse(struct traversal_context *ctx)
 			 */
 			traverse_trees_and_blobs(ctx, &csp);
 	}
-	traverse_trees_and_blobs(ctx, &csp);
+	if (ctx->nr_threads > 1)
+		traverse_trees_and_blobs_parallel(ctx, &csp);
+	else
+		traverse_trees_and_blobs(ctx, &csp);
 	strbuf_release(&csp);
 }
 
@@ -400,6 +729,44 @@ void traverse_commit_list(struct rev_info *revs,
 	ctx.show_object = show_object;
 	ctx.show_data = show_data;
 	ctx.filter = NULL;
+	ctx.nr_threads = 1;
+	do_traverse(&ctx);
+}
+
+/*
+ * The workers cannot consult pathspecs or the promisor machinery, nor
+ * interleave with the commits, so leave those walks to a single thread.
+ */
+static int can_walk_trees_in_parallel(struct rev_info *revs)
+{
+	return revs->tree_objects && revs->blob_objects &&
+	       !revs->tree_blobs_in_commit_order &&
+	       !revs->diffopt.pathspec.nr &&
+	       !revs->ignore_missing_links &&
+	       !revs->do_not_die_on_missing_tree &&
+	       !revs->exclude_promisor_objects &&
+	       !has_promisor_remote();
+}
+
+void traverse_commit_list_parallel(struct rev_info *revs,
+				   show_commit_fn show_commit,
+				   show_object_fn show_object,
+				   void *show_data,
+				   int nr_threads)
+{
+	struct traversal_context ctx;
+
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS || !can_walk_trees_in_parallel(revs))
+		nr_threads = 1;
+
+	ctx.revs = revs;
+	ctx.show_commit = show_commit;
+	ctx.show_object = show_object;
+	ctx.show_data = show_data;
+	ctx.filter = NULL;
+	ctx.nr_threads = nr_threads;
 	do_traverse(&ctx);
 }
 
@@ -418,6 +785,7 @@ void traverse_commit_list_filtered(
 	ctx.show_commit = show_commit;
 	ctx.show_data = show_data;
 	ctx.filter = list_objects_filter__init(omitted, filter_options);
+	ctx.nr_threads = 1;
 	do_traverse(&ctx);
 	list_objects_filter__free(ctx.filter);
 }
@@ -9,6 +9,23 @@ typedef void (*show_commit_fn)(struct commit *, void *);
 typedef void (*show_object_fn)(struct object *, const char *, void *);
 void traverse_commit_list(struct rev_info *, show_commit_fn, show_object_fn, void *);
 
+/*
+ * Like traverse_commit_list(), but reads and walks the trees on
+ * "nr_threads" threads (0 means one per CPU). The callbacks are still
+ * called on the calling thread, for the same objects, in the same order
+ * and with the same names as traverse_commit_list() would, so they need
+ * not be thread-safe. Walks the threads cannot reproduce (e.g. with a
+ * pathspec or --in-commit-order) quietly use a single thread.
+ *
+ * With more than one thread, the objects found are buffered until the
+ * walk is done, so memory use grows with the number of objects walked.
+ */
+void traverse_commit_list_parallel(struct rev_info *revs,
+				   show_commit_fn show_commit,
+				   show_object_fn show_object,
+				   void *show_data,
+				   int nr_threads);
+
 typedef void (*show_edge_fn)(struct commit *);
 void mark_edges_uninteresting(struct rev_info *revs,
 			      show_edge_fn show_edge,
@@ -0,0 +1,1717 @@
+/*
+ * "Ostensibly Recursive's Twin" merge strategy, or "ort" for short.  Meant
+ * as a drop in replacement for the "recursive" merge strategy, allowing one
+ * to replace
+ *
+ *   git merge [-s recursive]
+ *
+ * with
+ *
+ *   git merge -s ort
+ *
+ * The merge is done entirely in memory: the three trees are walked in
+ * parallel, renames are detected with diffcore, and every path is resolved
+ * into a new tree object without looking at the index or the working tree.
+ * Only merge_switch_to_result() touches them, once, at the very end.
+ */
+#include "cache.h"
+#include "merge-ort.h"
+
+#include "alloc.h"
+#include "attr.h"
+#include "blob.h"
+#include "cache-tree.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "convert.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "dir.h"
+#include "ll-merge.h"
+#include "object-store.h"
+#include "repository.h"
+#include "string-list.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "unpack-trees.h"
+#include "xdiff-interface.h"
+
+/*
+ * Stage numbers used throughout: 0 is the merge base, 1 and 2 are the
+ * two sides being merged.  They are one less than the corresponding index
+ * stages.
+ */
+#define MERGE_BASE 0
+#define MERGE_SIDE1 1
+#define MERGE_SIDE2 2
+
+struct version_info {
+	struct object_id oid;
+	unsigned short mode;
+};
+
+/*
+ * Everything we know about one path of the merge.  Directories that did
+ * not need to be walked are recorded with a trailing slash in their path
+ * and stand for the whole subtree.
+ */
+struct merged_path {
+	/* the version of the path in the merge base and on each side */
+	struct version_info stages[3];
+
+	/* where each version came from, when it was renamed */
+	const char *pathnames[3];
+
+	/* which of stages[] are files, and which are directories */
+	unsigned filemask:3;
+	unsigned dirmask:3;
+
+	/* for directories: take the tree of this side as a whole */
+	unsigned deferred_side:2;
+	unsigned deferred:1;
+	/* for directories: replaced by the entries below it */
+	unsigned expanded:1;
+
+	/* result of the merge for this path */
+	unsigned processed:1;
+	unsigned clean:1;
+	unsigned is_null:1;
+	struct version_info result;
+};
+
+struct merge_options_internal {
+	/*
+	 * All paths of the merge, each with a "struct merged_path" as
+	 * util.  Sorted, except while collect_merge_info() is filling it.
+	 */
+	struct string_list paths;
+
+	/*
+	 * Renames detected on each side, keyed by source path, with the
+	 * destination path as util.  Index 0 is unused.
+	 */
+	struct string_list renames[3];
+
+	/* Merge result, path to "struct version_info", sorted. */
+	struct string_list results;
+
+	/* Directories that end up with some content in the result. */
+	struct string_list nonempty_dirs;
+
+	/*
+	 * Conflicted paths of the result, each with an array of three
+	 * "struct version_info" to record in the index as stages 1-3.
+	 */
+	struct string_list conflicted;
+
+	/* Messages to show the user, path to "struct strbuf". */
+	struct string_list output;
+
+	/*
+	 * With opt->renormalize, an index holding just the merged
+	 * .gitattributes, so that renormalization follows the attributes
+	 * of the merge result rather than those of the current index.
+	 */
+	struct index_state attr_index;
+
+	int call_depth;
+	int needed_rename_limit;
+};
+
+static int show(struct merge_options *opt, int v)
+{
+	return (!opt->priv->call_depth && opt->verbosity >= v) ||
+		opt->verbosity >= 5;
+}
+
+__attribute__((format (printf, 4, 5)))
+static void path_msg(struct merge_options *opt, int v, const char *path,
+		     const char *fmt, ...)
+{
+	struct string_list_item *item;
+	struct strbuf *sb;
+	va_list ap;
+
+	if (!show(opt, v))
+		return;
+
+	item = string_list_insert(&opt->priv->output, path);
+	if (!item->util)
+		item->util = xcalloc(1, sizeof(struct strbuf));
+	sb = item->util;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(sb, fmt, ap);
+	va_end(ap);
+	strbuf_addch(sb, '\n');
+}
+
+static int err(struct merge_options *opt, const char *err, ...)
+{
+	va_list params;
+	struct strbuf sb = STRBUF_INIT;
+
+	va_start(params, err);
+	strbuf_vaddf(&sb, err, params);
+	va_end(params);
+
+	error("%s", sb.buf);
+	strbuf_release(&sb);
+
+	return -1;
+}
+
+static inline int merge_detect_rename(struct merge_options *opt)
+{
+	return (opt->detect_renames >= 0) ? opt->detect_renames : 1;
+}
+
+static int same_version(const struct version_info *a,
+			const struct version_info *b)
+{
+	if (a->mode != b->mode)
+		return 0;
+	return !a->mode || oideq(&a->oid, &b->oid);
+}
+
+static struct merged_path *find_path(struct merge_options *opt,
+				     const char *path)
+{
+	struct string_list_item *item;
+
+	item = string_list_lookup(&opt->priv->paths, path);
+	return item ? item->util : NULL;
+}
+
+static struct merged_path *add_path(struct merge_options *opt,
+				    const char *path)
+{
+	struct merged_path *mp = xcalloc(1, sizeof(*mp));
+
+	string_list_append(&opt->priv->paths, path)->util = mp;
+	return mp;
+}
+
+/*
+ * Find the directory entry (with trailing slash) that covers "path",
+ * if "path" itself was never recorded because we did not walk into one
+ * of its leading directories.
+ */
+static struct merged_path *find_covering_dir(struct merge_options *opt,
+					     const char *path,
+					     const char **dir)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct string_list_item *item = NULL;
+	char *slash;
+
+	strbuf_addstr(&sb, path);
+	while ((slash = strrchr(sb.buf, '/'))) {
+		strbuf_setlen(&sb, slash - sb.buf + 1);
+		item = string_list_lookup(&opt->priv->paths, sb.buf);
+		if (item)
+			break;
+		strbuf_setlen(&sb, slash - sb.buf);
+	}
+	strbuf_release(&sb);
+
+	if (!item)
+		return NULL;
+	if (dir)
+		*dir = item->string;
+	return item->util;
+}
+
+/*** Collecting the paths involved in the merge ***/
+
+struct collect_data {
+	struct merge_options *opt;
+	const char *prefix;
+};
+
+static int collect_merge_info_callback(int n,
+				       unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info);
+
+static int traverse_dir(struct merge_options *opt, const char *prefix,
+			const struct object_id *oids[3])
+{
+	struct collect_data data;
+	struct traverse_info info;
+	struct tree_desc t[3];
+	void *buf[3];
+	int i, ret;
+
+	for (i = 0; i < 3; i++) {
+		buf[i] = fill_tree_descriptor(opt->repo, &t[i], oids[i]);
+		if (oids[i] && !buf[i]) {
+			err(opt, _("unable to read tree (%s)"),
+			    oid_to_hex(oids[i]));
+			while (i--)
+				free(buf[i]);
+			return -1;
+		}
+	}
+
+	data.opt = opt;
+	data.prefix = prefix;
+	setup_traverse_info(&info, "");
+	info.fn = collect_merge_info_callback;
+	info.data = &data;
+	info.show_all_errors = 1;
+
+	ret = traverse_trees(opt->repo->index, 3, t, &info);
+
+	for (i = 0; i < 3; i++)
+		free(buf[i]);
+	return ret;
+}
+
+/*
+ * Record a directory that is present on at least one side.  When both
+ * sides agree, or one side did not touch it, the whole subtree can be
+ * resolved without reading it, unless rename detection later finds
+ * that something inside it matters (see expand_dir()).
+ */
+static int collect_dir(struct merge_options *opt, const char *path,
+		       unsigned long dirmask, struct name_entry *names)
+{
+	const struct object_id *d[3];
+	struct merged_path *mp;
+	int i, side;
+
+	for (i = 0; i < 3; i++)
+		d[i] = (dirmask & (1ul << i)) ? &names[i].oid : NULL;
+
+	if (d[1] && d[2] && oideq(d[1], d[2]))
+		side = 0;
+	else if (!d[0] ? !d[1] : (d[1] && oideq(d[0], d[1])))
+		side = MERGE_SIDE2;
+	else if (!d[0] ? !d[2] : (d[2] && oideq(d[0], d[2])))
+		side = MERGE_SIDE1;
+	else
+		return traverse_dir(opt, path, d);
+
+	mp = add_path(opt, path);
+	mp->dirmask = dirmask;
+	for (i = 0; i < 3; i++) {
+		if (!d[i])
+			continue;
+		mp->stages[i].mode = S_IFDIR;
+		oidcpy(&mp->stages[i].oid, d[i]);
+	}
+
+	if (!side) {
+		/* both sides agree */
+		mp->processed = 1;
+		mp->clean = 1;
+		mp->result = mp->stages[MERGE_SIDE1];
+	} else {
+		mp->deferred = 1;
+		mp->deferred_side = side;
+	}
+	return 0;
+}
+
+static int collect_merge_info_callback(int n,
+				       unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info)
+{
+	struct collect_data *data = info->data;
+	struct merge_options *opt = data->opt;
+	unsigned long filemask = mask & ~dirmask;
+	struct name_entry *p = NULL;
+	struct strbuf path = STRBUF_INIT;
+	int i, ret = 0;
+
+	for (i = 0; i < 3 && !p; i++)
+		if (mask & (1ul << i))
+			p = &names[i];
+
+	strbuf_addstr(&path, data->prefix);
+	strbuf_add(&path, p->path, p->pathlen);
+
+	if (filemask) {
+		struct merged_path *mp = add_path(opt, path.buf);
+
+		mp->filemask = filemask;
+		mp->dirmask = dirmask;
+		for (i = 0; i < 3; i++) {
+			if (!(filemask & (1ul << i)))
+				continue;
+			mp->stages[i].mode = names[i].mode;
+			oidcpy(&mp->stages[i].oid, &names[i].oid);
+		}
+	}
+
+	if (dirmask) {
+		strbuf_addch(&path, '/');
+		ret = collect_dir(opt, path.buf, dirmask, names);
+	}
+
+	strbuf_release(&path);
+	return ret < 0 ? ret : mask;
+}
+
+static int collect_merge_info(struct merge_options *opt,
+			      struct tree *merge_base,
+			      struct tree *side1,
+			      struct tree *side2)
+{
+	const struct object_id *oids[3];
+	int ret;
+
+	oids[MERGE_BASE] = &merge_base->object.oid;
+	oids[MERGE_SIDE1] = &side1->object.oid;
+	oids[MERGE_SIDE2] = &side2->object.oid;
+
+	ret = traverse_dir(opt, "", oids);
+	string_list_sort(&opt->priv->paths);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Walk into a directory that collect_dir() did not need to walk, because
+ * a rename involves something inside it.
+ */
+static int expand_dir(struct merge_options *opt, const char *path,
+		      struct merged_path *mp)
+{
+	const struct object_id *oids[3];
+	int i, ret;
+
+	for (i = 0; i < 3; i++)
+		oids[i] = mp->stages[i].mode ? &mp->stages[i].oid : NULL;
+
+	mp->expanded = 1;
+	ret = traverse_dir(opt, path, oids);
+	string_list_sort(&opt->priv->paths);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Look up "path", walking into deferred directories as needed.  Returns
+ * NULL if the path is not part of the merge, or lives in a directory that
+ * both sides agree on.
+ */
+static struct merged_path *lookup_and_expand(struct merge_options *opt,
+					     const char *path)
+{
+	for (;;) {
+		struct merged_path *mp = find_path(opt, path);
+		const char *dir;
+
+		if (mp)
+			return mp;
+		mp = find_covering_dir(opt, path, &dir);
+		if (!mp || !mp->deferred || mp->expanded)
+			return NULL;
+		if (expand_dir(opt, dir, mp) < 0)
+			return NULL;
+	}
+}
+
+/*** Rename detection ***/
+
+/*
+ * A path deleted on one side only needs to take part in rename detection
+ * if the other side changed it.  Otherwise, treating the rename as a
+ * plain deletion and addition gives the same result, so we can save
+ * comparing it against every added file.
+ */
+static int rename_source_is_relevant(struct merge_options *opt,
+				     const char *path, int other_side)
+{
+	struct merged_path *mp = find_path(opt, path);
+
+	if (!mp)
+		mp = find_covering_dir(opt, path, NULL);
+	if (!mp)
+		return 1;
+	return !same_version(&mp->stages[MERGE_BASE], &mp->stages[other_side]);
+}
+
+static int detect_renames(struct merge_options *opt,
+			  struct tree *merge_base,
+			  struct tree *side,
+			  int side_nr)
+{
+	struct diff_options diff_opts;
+	struct diff_queue_struct *q = &diff_queued_diff;
+	int other_side = 3 - side_nr;
+	int i, j, sources = 0, dests = 0;
+
+	repo_diff_setup(opt->repo, &diff_opts);
+	diff_opts.flags.recursive = 1;
+	diff_opts.flags.rename_empty = 0;
+	diff_opts.detect_rename = DIFF_DETECT_RENAME;
+	diff_opts.rename_limit = (opt->rename_limit >= 0) ? opt->rename_limit : 1000;
+	diff_opts.rename_score = opt->rename_score;
+	diff_opts.show_rename_progress = opt->show_rename_progress;
+	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diff_opts);
+	diff_tree_oid(&merge_base->object.oid, &side->object.oid, "",
+		      &diff_opts);
+
+	/*
+	 * Keep only the additions and the relevant deletions; we do not
+	 * detect copies, so modified paths cannot be rename sources.
+	 */
+	for (i = j = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		int keep = 0;
+
+		if (!DIFF_FILE_VALID(p->one) && DIFF_FILE_VALID(p->two)) {
+			keep = 1;
+			dests++;
+		} else if (DIFF_FILE_VALID(p->one) && !DIFF_FILE_VALID(p->two) &&
+			   rename_source_is_relevant(opt, p->one->path,
+						     other_side)) {
+			keep = 1;
+			sources++;
+		}
+
+		if (keep)
+			q->queue[j++] = p;
+		else
+			diff_free_filepair(p);
+	}
+	q->nr = j;
+
+	if (sources && dests) {
+		diffcore_std(&diff_opts);
+		if (diff_opts.needed_rename_limit > opt->priv->needed_rename_limit)
+			opt->priv->needed_rename_limit = diff_opts.needed_rename_limit;
+
+		for (i = 0; i < q->nr; i++) {
+			struct diff_filepair *p = q->queue[i];
+
+			if (p->status != DIFF_STATUS_RENAMED)
+				continue;
+			string_list_append(&opt->priv->renames[side_nr],
+					   p->one->path)->util =
+				xstrdup(p->two->path);
+		}
+		string_list_sort(&opt->priv->renames[side_nr]);
+	}
+
+	diff_flush(&diff_opts);
+	return 0;
+}
+
+/*** Content merges ***/
+
+static struct index_state *attr_index(struct merge_options *opt)
+{
+	if (opt->priv->attr_index.initialized)
+		return &opt->priv->attr_index;
+	return opt->repo->index;
+}
+
+static int merge_3way(struct merge_options *opt,
+		      const char *path,
+		      const struct version_info *o,
+		      const struct version_info *a,
+		      const struct version_info *b,
+		      const char *pathnames[3],
+		      const int extra_marker_size,
+		      mmbuffer_t *result_buf)
+{
+	mmfile_t orig, src1, src2;
+	struct ll_merge_options ll_opts = {0};
+	const char *ancestor = opt->ancestor ? opt->ancestor :
+		"merged common ancestors";
+	char *base, *name1, *name2;
+	int merge_status;
+
+	ll_opts.renormalize = opt->renormalize;
+	ll_opts.extra_marker_size = extra_marker_size;
+	ll_opts.xdl_opts = opt->xdl_opts;
+
+	if (opt->priv->call_depth) {
+		ll_opts.virtual_ancestor = 1;
+		ll_opts.variant = 0;
+	} else {
+		switch (opt->recursive_variant) {
+		case MERGE_VARIANT_OURS:
+			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+			break;
+		case MERGE_VARIANT_THEIRS:
+			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+			break;
+		default:
+			ll_opts.variant = 0;
+			break;
+		}
+	}
+
+	if (strcmp(pathnames[MERGE_SIDE1], pathnames[MERGE_SIDE2]) ||
+	    strcmp(pathnames[MERGE_SIDE1], pathnames[MERGE_BASE])) {
+		base  = mkpathdup("%s:%s", ancestor, pathnames[MERGE_BASE]);
+		name1 = mkpathdup("%s:%s", opt->branch1, pathnames[MERGE_SIDE1]);
+		name2 = mkpathdup("%s:%s", opt->branch2, pathnames[MERGE_SIDE2]);
+	} else {
+		base  = mkpathdup("%s", ancestor);
+		name1 = mkpathdup("%s", opt->branch1);
+		name2 = mkpathdup("%s", opt->branch2);
+	}
+
+	read_mmblob(&orig, o->mode ? &o->oid : &null_oid);
+	read_mmblob(&src1, &a->oid);
+	read_mmblob(&src2, &b->oid);
+
+	merge_status = ll_merge(result_buf, path, &orig, base,
+				&src1, name1, &src2, name2,
+				attr_index(opt), &ll_opts);
+
+	free(base);
+	free(name1);
+	free(name2);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+	return merge_status;
+}
+
+/*
+ * Merge two versions of a file that both sides changed (or added), with
+ * "o" as the common version (mode 0 if there is none).  Returns 1 if the
+ * merge is clean, 0 if not, and -1 on errors.
+ */
+static int handle_content_merge(struct merge_options *opt,
+				const char *path,
+				const struct version_info *o,
+				const struct version_info *a,
+				const struct version_info *b,
+				const char *pathnames[3],
+				const int extra_marker_size,
+				struct version_info *result)
+{
+	int clean = 1;
+
+	if ((S_IFMT & a->mode) != (S_IFMT & b->mode)) {
+		/* Cannot merge a symlink and a file, etc.; keep one */
+		if (S_ISREG(a->mode) || !S_ISREG(b->mode))
+			*result = *a;
+		else
+			*result = *b;
+		return 0;
+	}
+
+	/*
+	 * Merge modes
+	 */
+	if (a->mode == b->mode || a->mode == o->mode)
+		result->mode = b->mode;
+	else {
+		result->mode = a->mode;
+		if (b->mode != o->mode)
+			clean = 0;
+	}
+
+	if (oideq(&a->oid, &b->oid) || (o->mode && oideq(&a->oid, &o->oid)))
+		oidcpy(&result->oid, &b->oid);
+	else if (o->mode && oideq(&b->oid, &o->oid))
+		oidcpy(&result->oid, &a->oid);
+	else if (S_ISREG(a->mode)) {
+		mmbuffer_t result_buf;
+		int merge_status;
+
+		path_msg(opt, 2, path, _("Auto-merging %s"), path);
+		merge_status = merge_3way(opt, path, o, a, b, pathnames,
+					  extra_marker_size, &result_buf);
+
+		if ((merge_status < 0) || !result_buf.ptr)
+			return err(opt, _("Failed to execute internal merge"));
+
+		if (write_object_file(result_buf.ptr, result_buf.size,
+				      blob_type, &result->oid)) {
+			free(result_buf.ptr);
+			return err(opt, _("Unable to add %s to database"), path);
+		}
+		free(result_buf.ptr);
+		if (merge_status)
+			clean = 0;
+	} else if (S_ISLNK(a->mode) && !opt->priv->call_depth &&
+		   opt->recursive_variant == MERGE_VARIANT_THEIRS) {
+		oidcpy(&result->oid, &b->oid);
+	} else {
+		/*
+		 * Symlinks and submodules that changed differently on
+		 * both sides: keep ours, but report the conflict.
+		 */
+		oidcpy(&result->oid, &a->oid);
+		if (S_ISGITLINK(a->mode) ||
+		    opt->recursive_variant != MERGE_VARIANT_OURS)
+			clean = 0;
+	}
+
+	return clean;
+}
+
+/*** Processing renames ***/
+
+static void record_rename_source_deleted(struct merged_path *source)
+{
+	source->processed = 1;
+	source->clean = 1;
+	source->is_null = 1;
+}
+
+static int process_renames(struct merge_options *opt)
+{
+	struct merge_options_internal *priv = opt->priv;
+	int side, i, clean = 1;
+
+	/*
+	 * Walk into the deferred directories touched by renames first, so
+	 * that the lookups below do not get invalidated by re-sorting.
+	 */
+	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++) {
+		for (i = 0; i < priv->renames[side].nr; i++) {
+			struct string_list_item *item = &priv->renames[side].items[i];
+
+			lookup_and_expand(opt, item->string);
+			lookup_and_expand(opt, item->util);
+		}
+	}
+
+	for (side = MERGE_SIDE1; side <= MERGE_SIDE2; side++) {
+		int other = 3 - side;
+		const char *side_name = side == MERGE_SIDE1 ? opt->branch1 : opt->branch2;
+		const char *other_name = side == MERGE_SIDE1 ? opt->branch2 : opt->branch1;
+
+		for (i = 0; i < priv->renames[side].nr; i++) {
+			const char *src = priv->renames[side].items[i].string;
+			const char *dst = priv->renames[side].items[i].util;
+			struct string_list_item *other_rename;
+			struct merged_path *source, *dest;
+
+			source = find_path(opt, src);
+			dest = find_path(opt, dst);
+			if (!source || !dest || source->processed ||
+			    !(source->filemask & (1 << MERGE_BASE)) ||
+			    (source->filemask & (1 << side)) ||
+			    !(dest->filemask & (1 << side)) ||
+			    (dest->filemask & (1 << MERGE_BASE)))
+				continue;
+
+			other_rename = string_list_lookup(&priv->renames[other], src);
+			if (other_rename && !strcmp(other_rename->util, dst)) {
+				/* renamed the same way on both sides */
+				dest->stages[MERGE_BASE] = source->stages[MERGE_BASE];
+				dest->pathnames[MERGE_BASE] = src;
+				dest->filemask |= 1 << MERGE_BASE;
+				record_rename_source_deleted(source);
+			} else if (other_rename) {
+				/*
+				 * Renamed differently on each side.  We get
+				 * here for side 1 only, as handling it marks
+				 * the source as processed.
+				 */
+				const char *dst2 = other_rename->util;
+				struct merged_path *dest2 = find_path(opt, dst2);
+				const char *pathnames[3];
+				struct version_info merged;
+				int ret;
+
+				if (!dest2 || !(dest2->filemask & (1 << other)))
+					continue;
+
+				pathnames[MERGE_BASE] = src;
+				pathnames[MERGE_SIDE1] = dst;
+				pathnames[MERGE_SIDE2] = dst2;
+				ret = handle_content_merge(opt, dst,
+							   &source->stages[MERGE_BASE],
+							   &dest->stages[MERGE_SIDE1],
+							   &dest2->stages[MERGE_SIDE2],
+							   pathnames,
+							   1 + priv->call_depth * 2,
+							   &merged);
+				if (ret < 0)
+					return -1;
+
+				path_msg(opt, 1, src,
+					 _("CONFLICT (rename/rename): %s renamed to "
+					   "%s in %s and to %s in %s."),
+					 src, dst, opt->branch1, dst2, opt->branch2);
+
+				dest->stages[MERGE_BASE] = source->stages[MERGE_BASE];
+				dest->filemask |= 1 << MERGE_BASE;
+				dest->processed = 1;
+				dest->clean = 0;
+				dest->result = merged;
+				dest2->stages[MERGE_BASE] = source->stages[MERGE_BASE];
+				dest2->filemask |= 1 << MERGE_BASE;
+				dest2->processed = 1;
+				dest2->clean = 0;
+				dest2->result = merged;
+				record_rename_source_deleted(source);
+				clean = 0;
+			} else if (!(source->filemask & (1 << other))) {
+				path_msg(opt, 1, dst,
+					 _("CONFLICT (rename/delete): %s renamed "
+					   "to %s in %s, but deleted in %s."),
+					 src, dst, side_name, other_name);
+				dest->stages[MERGE_BASE] = source->stages[MERGE_BASE];
+				dest->filemask |= 1 << MERGE_BASE;
+				dest->processed = 1;
+				dest->clean = 0;
+				dest->result = dest->stages[side];
+				if (priv->call_depth)
+					dest->result = source->stages[MERGE_BASE];
+				record_rename_source_deleted(source);
+				clean = 0;
+			} else if (dest->filemask & (1 << other)) {
+				/*
+				 * The other side added something at the
+				 * destination; merge the renamed file first,
+				 * then treat it like an add/add conflict.
+				 */
+				const char *pathnames[3];
+				struct version_info merged;
+				int ret;
+
+				pathnames[MERGE_BASE] = src;
+				pathnames[side] = dst;
+				pathnames[other] = src;
+				if (side == MERGE_SIDE1)
+					ret = handle_content_merge(opt, dst,
+								   &source->stages[MERGE_BASE],
+								   &dest->stages[side],
+								   &source->stages[other],
+								   pathnames,
+								   1 + priv->call_depth * 2,
+								   &merged);
+				else
+					ret = handle_content_merge(opt, dst,
+								   &source->stages[MERGE_BASE],
+								   &source->stages[other],
+								   &dest->stages[side],
+								   pathnames,
+								   1 + priv->call_depth * 2,
+								   &merged);
+				if (ret < 0)
+					return -1;
+
+				path_msg(opt, 1, dst,
+					 _("CONFLICT (rename/add): %s renamed to "
+					   "%s in %s, but %s added in %s."),
+					 src, dst, side_name, dst, other_name);
+				dest->stages[side] = merged;
+				record_rename_source_deleted(source);
+				clean = 0;
+			} else {
+				/* the common case: carry the changes along */
+				dest->stages[MERGE_BASE] = source->stages[MERGE_BASE];
+				dest->stages[other] = source->stages[other];
+				dest->pathnames[MERGE_BASE] = src;
+				dest->pathnames[other] = src;
+				dest->filemask |= (1 << MERGE_BASE) | (1 << other);
+				record_rename_source_deleted(source);
+			}
+		}
+	}
+
+	return clean;
+}
+
+/*** Per-path resolution ***/
+
+static int read_oid_strbuf(struct merge_options *opt,
+			   const struct object_id *oid,
+			   struct strbuf *dst)
+{
+	void *buf;
+	enum object_type type;
+	unsigned long size;
+
+	buf = read_object_file(oid, &type, &size);
+	if (!buf)
+		return err(opt, _("cannot read object %s"), oid_to_hex(oid));
+	if (type != OBJ_BLOB) {
+		free(buf);
+		return err(opt, _("object %s is not a blob"), oid_to_hex(oid));
+	}
+	strbuf_attach(dst, buf, size, size + 1);
+	return 0;
+}
+
+/*
+ * Is "a" the same as "o", or (with opt->renormalize) different from it
+ * only in ways that renormalization undoes?
+ */
+static int blob_unchanged(struct merge_options *opt,
+			  const char *path,
+			  const struct version_info *o,
+			  const struct version_info *a)
+{
+	struct strbuf obuf = STRBUF_INIT;
+	struct strbuf abuf = STRBUF_INIT;
+	const struct index_state *idx = attr_index(opt);
+	int ret = 0; /* assume changed for safety */
+
+	if (a->mode != o->mode)
+		return 0;
+	if (oideq(&o->oid, &a->oid))
+		return 1;
+	if (!opt->renormalize || !S_ISREG(a->mode))
+		return 0;
+
+	if (read_oid_strbuf(opt, &o->oid, &obuf) ||
+	    read_oid_strbuf(opt, &a->oid, &abuf))
+		goto out;
+	/*
+	 * Binary "|" so that both buffers are renormalized; if neither
+	 * changes, the differing object names already answered.
+	 */
+	if (renormalize_buffer(idx, path, obuf.buf, obuf.len, &obuf) |
+	    renormalize_buffer(idx, path, abuf.buf, abuf.len, &abuf))
+		ret = (obuf.len == abuf.len &&
+		       !memcmp(obuf.buf, abuf.buf, obuf.len));
+
+out:
+	strbuf_release(&obuf);
+	strbuf_release(&abuf);
+	return ret;
+}
+
+static int process_entry(struct merge_options *opt,
+			 const char *path,
+			 struct merged_path *mp)
+{
+	struct version_info *o = &mp->stages[MERGE_BASE];
+	struct version_info *a = &mp->stages[MERGE_SIDE1];
+	struct version_info *b = &mp->stages[MERGE_SIDE2];
+	const char *pathnames[3];
+	int i, ret;
+
+	for (i = 0; i < 3; i++)
+		pathnames[i] = mp->pathnames[i] ? mp->pathnames[i] : path;
+
+	mp->processed = 1;
+	mp->clean = 1;
+
+	if (same_version(a, b)) {
+		mp->result = *a;
+	} else if (same_version(o, a)) {
+		mp->result = *b;
+	} else if (same_version(o, b)) {
+		mp->result = *a;
+	} else if (o->mode && !b->mode && blob_unchanged(opt, path, o, a)) {
+		mp->result = *b; /* deleted on side 2, only renormalized on side 1 */
+	} else if (o->mode && !a->mode && blob_unchanged(opt, path, o, b)) {
+		mp->result = *a; /* and the other way around */
+	} else if (a->mode && b->mode) {
+		ret = handle_content_merge(opt, path, o, a, b, pathnames,
+					   opt->priv->call_depth * 2,
+					   &mp->result);
+		if (ret < 0)
+			return -1;
+		mp->clean = ret;
+		if (ret)
+			; /* nothing to report */
+		else if ((S_IFMT & a->mode) != (S_IFMT & b->mode))
+			path_msg(opt, 1, path,
+				 _("CONFLICT (distinct types): %s had different "
+				   "types on each side; kept the version from %s."),
+				 path, S_ISREG(mp->result.mode) && !S_ISREG(a->mode) ?
+				 opt->branch2 : opt->branch1);
+		else if (S_ISGITLINK(a->mode))
+			path_msg(opt, 1, path,
+				 _("CONFLICT (submodule): Merge conflict in %s"),
+				 path);
+		else if (!o->mode)
+			path_msg(opt, 1, path,
+				 _("CONFLICT (add/add): Merge conflict in %s"),
+				 path);
+		else
+			path_msg(opt, 1, path,
+				 _("CONFLICT (content): Merge conflict in %s"),
+				 path);
+	} else {
+		/* modify/delete */
+		int modified_side = a->mode ? MERGE_SIDE1 : MERGE_SIDE2;
+
+		mp->clean = 0;
+		mp->result = opt->priv->call_depth ? *o : mp->stages[modified_side];
+		path_msg(opt, 1, path,
+			 _("CONFLICT (modify/delete): %s deleted in %s and "
+			   "modified in %s.  Version %s of %s left in tree."),
+			 path,
+			 modified_side == MERGE_SIDE1 ? opt->branch2 : opt->branch1,
+			 modified_side == MERGE_SIDE1 ? opt->branch1 : opt->branch2,
+			 modified_side == MERGE_SIDE1 ? opt->branch1 : opt->branch2,
+			 path);
+	}
+
+	mp->is_null = !mp->result.mode;
+	return mp->clean;
+}
+
+static void record_result(struct merge_options *opt, const char *path,
+			  const struct version_info *result)
+{
+	struct merge_options_internal *priv = opt->priv;
+	struct version_info *copy = xmalloc(sizeof(*copy));
+	struct strbuf dir = STRBUF_INIT;
+	char *slash;
+
+	*copy = *result;
+	string_list_append(&priv->results, path)->util = copy;
+
+	/*
+	 * Remember that all leading directories (and the directory
+	 * itself, for a whole subtree) have some content.
+	 */
+	strbuf_addstr(&dir, path);
+	if (strbuf_strip_suffix(&dir, "/"))
+		string_list_insert(&priv->nonempty_dirs, dir.buf);
+	while ((slash = strrchr(dir.buf, '/'))) {
+		strbuf_setlen(&dir, slash - dir.buf);
+		if (string_list_has_string(&priv->nonempty_dirs, dir.buf))
+			break;
+		string_list_insert(&priv->nonempty_dirs, dir.buf);
+	}
+	strbuf_release(&dir);
+}
+
+static void record_conflict(struct merge_options *opt, const char *path,
+			    const struct merged_path *mp)
+{
+	struct version_info *stages = xcalloc(3, sizeof(*stages));
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (mp->filemask & (1 << i))
+			stages[i] = mp->stages[i];
+	string_list_insert(&opt->priv->conflicted, path)->util = stages;
+}
+
+static char *unique_path(struct merge_options *opt, const char *path,
+			 const char *branch)
+{
+	struct strbuf newpath = STRBUF_INIT;
+	const char *p;
+	size_t base_len;
+	int suffix = 0;
+
+	strbuf_addf(&newpath, "%s~", path);
+	for (p = branch; *p; p++)
+		strbuf_addch(&newpath, *p == '/' ? '_' : *p);
+	base_len = newpath.len;
+	while (find_path(opt, newpath.buf) ||
+	       string_list_has_string(&opt->priv->nonempty_dirs, newpath.buf)) {
+		strbuf_setlen(&newpath, base_len);
+		strbuf_addf(&newpath, "_%d", suffix++);
+	}
+	return strbuf_detach(&newpath, NULL);
+}
+
+static void add_attr_entry(struct index_state *istate, const char *path,
+			   const struct version_info *vi, int stage)
+{
+	int len = strlen(path);
+	struct cache_entry *ce = make_empty_cache_entry(istate, len);
+
+	ce->ce_mode = create_ce_mode(vi->mode);
+	ce->ce_flags = create_ce_flags(stage);
+	ce->ce_namelen = len;
+	oidcpy(&ce->oid, &vi->oid);
+	memcpy(ce->name, path, len);
+	add_index_entry(istate, ce,
+			ADD_CACHE_OK_TO_ADD | ADD_CACHE_OK_TO_REPLACE);
+}
+
+static int is_attr_file(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+
+	return !strcmp(slash ? slash + 1 : path, GITATTRIBUTES_FILE);
+}
+
+static int add_attr_file_in_tree(const struct object_id *oid,
+				 struct strbuf *base, const char *name,
+				 unsigned mode, int stage, void *cb_data)
+{
+	struct index_state *istate = cb_data;
+	struct version_info vi;
+	size_t baselen = base->len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	if (S_ISGITLINK(mode) || strcmp(name, GITATTRIBUTES_FILE))
+		return 0;
+
+	vi.mode = mode;
+	oidcpy(&vi.oid, oid);
+	strbuf_addstr(base, name);
+	add_attr_entry(istate, base->buf, &vi, 0);
+	strbuf_setlen(base, baselen);
+	return 0;
+}
+
+/*
+ * Renormalization needs attributes, which can only be read from the
+ * working tree or an index_state.  Resolve the .gitattributes files
+ * before anything else and put their results (or, for conflicts, their
+ * stages) into an otherwise empty index for attr_index() to hand out.
+ * Those in directories taken from one side as a whole come straight
+ * from that side's tree.
+ */
+static int initialize_attr_index(struct merge_options *opt)
+{
+	struct index_state *istate = &opt->priv->attr_index;
+	struct string_list *paths = &opt->priv->paths;
+	struct pathspec match_all;
+	int i, j;
+
+	if (!opt->renormalize)
+		return 0;
+
+	for (i = 0; i < paths->nr; i++) {
+		const char *path = paths->items[i].string;
+		struct merged_path *mp = paths->items[i].util;
+
+		if (!mp->expanded && mp->filemask && is_attr_file(path) &&
+		    !mp->processed && process_entry(opt, path, mp) < 0)
+			return -1;
+	}
+
+	istate->initialized = 1;
+	memset(&match_all, 0, sizeof(match_all));
+	for (i = 0; i < paths->nr; i++) {
+		const char *path = paths->items[i].string;
+		struct merged_path *mp = paths->items[i].util;
+		const struct version_info *dir;
+		struct tree *tree;
+
+		if (mp->expanded)
+			continue;
+
+		if (!ends_with(path, "/")) {
+			if (!mp->filemask || !is_attr_file(path))
+				continue;
+			if (mp->clean) {
+				if (mp->result.mode)
+					add_attr_entry(istate, path,
+						       &mp->result, 0);
+				continue;
+			}
+			for (j = 0; j < 3; j++)
+				if (mp->filemask & (1 << j))
+					add_attr_entry(istate, path,
+						       &mp->stages[j], j + 1);
+			continue;
+		}
+
+		dir = mp->deferred ? &mp->stages[mp->deferred_side] :
+			&mp->result;
+		if (!dir->mode)
+			continue;
+		tree = parse_tree_indirect(&dir->oid);
+		if (!tree ||
+		    read_tree_recursive(opt->repo, tree, path, strlen(path),
+					0, &match_all, add_attr_file_in_tree,
+					istate))
+			return err(opt, _("unable to read tree %s"),
+				   oid_to_hex(&dir->oid));
+	}
+
+	/* attributes read before now came from the repository's index */
+	git_attr_drop_stacks();
+	return 0;
+}
+
+static int process_entries(struct merge_options *opt)
+{
+	struct merge_options_internal *priv = opt->priv;
+	int i, clean = 1;
+
+	if (initialize_attr_index(opt) < 0)
+		return -1;
+
+	/*
+	 * Walk backwards, so that everything below a directory is resolved
+	 * before a file of the same name needs to know whether the
+	 * directory is still there.
+	 */
+	for (i = priv->paths.nr - 1; i >= 0; i--) {
+		const char *path = priv->paths.items[i].string;
+		struct merged_path *mp = priv->paths.items[i].util;
+		const char *branch;
+		char *newpath;
+
+		if (mp->expanded)
+			continue;
+
+		if (ends_with(path, "/")) {
+			if (mp->deferred)
+				mp->result = mp->stages[mp->deferred_side];
+			if (mp->result.mode)
+				record_result(opt, path, &mp->result);
+			continue;
+		}
+
+		if (!mp->processed && process_entry(opt, path, mp) < 0)
+			return -1;
+		if (!mp->clean)
+			clean = 0;
+		if (!mp->result.mode) {
+			if (!mp->clean)
+				record_conflict(opt, path, mp);
+			continue;
+		}
+
+		if (!string_list_has_string(&priv->nonempty_dirs, path)) {
+			record_result(opt, path, &mp->result);
+			if (!mp->clean)
+				record_conflict(opt, path, mp);
+			continue;
+		}
+
+		/* a directory is in the way; move the file aside */
+		branch = (same_version(&mp->result, &mp->stages[MERGE_SIDE2]) &&
+			  !same_version(&mp->result, &mp->stages[MERGE_SIDE1])) ?
+			opt->branch2 : opt->branch1;
+		newpath = unique_path(opt, path, branch);
+		path_msg(opt, 1, path,
+			 _("CONFLICT (file/directory): directory in the way "
+			   "of %s from %s; moving it to %s instead."),
+			 path, branch, newpath);
+		record_result(opt, newpath, &mp->result);
+		record_conflict(opt, newpath, mp);
+		free(newpath);
+		clean = 0;
+	}
+
+	return clean;
+}
+
+/*** Writing the result ***/
+
+struct tree_entry {
+	const char *name;
+	size_t len;
+	unsigned mode;
+	struct object_id oid;
+};
+
+static int tree_entry_cmp(const void *va, const void *vb)
+{
+	const struct tree_entry *a = va, *b = vb;
+
+	return base_name_compare(a->name, a->len, a->mode,
+				 b->name, b->len, b->mode);
+}
+
+/*
+ * Write the tree for the results starting at *pos whose paths begin with
+ * "prefix", advancing *pos past them.  Sets *oid to the null oid if a
+ * subtree turns out to be empty.
+ */
+static int write_tree(struct merge_options *opt, size_t *pos,
+		      const char *prefix, size_t prefix_len,
+		      struct object_id *oid)
+{
+	struct string_list *results = &opt->priv->results;
+	struct tree_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0;
+
+	while (*pos < results->nr &&
+	       !strncmp(results->items[*pos].string, prefix, prefix_len)) {
+		const char *path = results->items[*pos].string;
+		const char *name = path + prefix_len;
+		const char *slash = strchr(name, '/');
+		struct version_info *vi = results->items[*pos].util;
+
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].name = name;
+		if (!slash || !slash[1]) {
+			/* a file, or a directory resolved as a whole */
+			entries[nr].len = slash ? slash - name : strlen(name);
+			entries[nr].mode = vi->mode;
+			oidcpy(&entries[nr].oid, &vi->oid);
+			(*pos)++;
+		} else {
+			entries[nr].len = slash - name;
+			entries[nr].mode = S_IFDIR;
+			ret = write_tree(opt, pos, path, slash - path + 1,
+					 &entries[nr].oid);
+			if (ret < 0)
+				goto out;
+			if (is_null_oid(&entries[nr].oid))
+				continue;
+		}
+		nr++;
+	}
+
+	if (!nr && prefix_len) {
+		oidclr(oid);
+		goto out;
+	}
+
+	QSORT(entries, nr, tree_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		strbuf_addf(&buf, "%o %.*s%c", entries[i].mode,
+			    (int)entries[i].len, entries[i].name, '\0');
+		strbuf_add(&buf, entries[i].oid.hash, the_hash_algo->rawsz);
+	}
+	if (write_object_file(buf.buf, buf.len, tree_type, oid))
+		ret = err(opt, _("unable to write tree object"));
+
+out:
+	free(entries);
+	strbuf_release(&buf);
+	return ret;
+}
+
+/*** The merge itself ***/
+
+static void clear_string_list_of_strbufs(struct string_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++) {
+		strbuf_release(list->items[i].util);
+		free(list->items[i].util);
+	}
+	string_list_clear(list, 0);
+}
+
+/* Forget everything about the previous (inner) merge. */
+static void clear_merge_state(struct merge_options_internal *priv)
+{
+	int i;
+
+	string_list_clear(&priv->paths, 1);
+	for (i = MERGE_SIDE1; i <= MERGE_SIDE2; i++)
+		string_list_clear(&priv->renames[i], 1);
+	string_list_clear(&priv->results, 1);
+	string_list_clear(&priv->nonempty_dirs, 0);
+	string_list_clear(&priv->conflicted, 1);
+	clear_string_list_of_strbufs(&priv->output);
+	if (priv->attr_index.initialized) {
+		discard_index(&priv->attr_index);
+		git_attr_drop_stacks();
+	}
+}
+
+static struct tree *shift_tree_object(struct repository *repo,
+				      struct tree *one, struct tree *two,
+				      const char *subtree_shift)
+{
+	struct object_id shifted;
+
+	if (!*subtree_shift) {
+		shift_tree(repo, &one->object.oid, &two->object.oid, &shifted, 0);
+	} else {
+		shift_tree_by(repo, &one->object.oid, &two->object.oid, &shifted,
+			      subtree_shift);
+	}
+	if (oideq(&two->object.oid, &shifted))
+		return two;
+	return lookup_tree(repo, &shifted);
+}
+
+static void merge_ort_nonrecursive_internal(struct merge_options *opt,
+					    struct tree *merge_base,
+					    struct tree *side1,
+					    struct tree *side2,
+					    struct merge_result *result)
+{
+	struct object_id oid;
+	size_t pos = 0;
+	int clean;
+
+	clear_merge_state(opt->priv);
+
+	if (opt->subtree_shift) {
+		side2 = shift_tree_object(opt->repo, side1, side2,
+					  opt->subtree_shift);
+		merge_base = shift_tree_object(opt->repo, side1, merge_base,
+					       opt->subtree_shift);
+	}
+
+	/* Trivial cases that cannot conflict */
+	if (oideq(&merge_base->object.oid, &side2->object.oid) ||
+	    oideq(&side1->object.oid, &side2->object.oid)) {
+		if (oideq(&merge_base->object.oid, &side2->object.oid))
+			path_msg(opt, 0, "", _("Already up to date!"));
+		result->tree = side1;
+		result->clean = 1;
+		return;
+	}
+	if (oideq(&merge_base->object.oid, &side1->object.oid)) {
+		result->tree = side2;
+		result->clean = 1;
+		return;
+	}
+
+	if (parse_tree(merge_base) < 0 ||
+	    parse_tree(side1) < 0 ||
+	    parse_tree(side2) < 0 ||
+	    collect_merge_info(opt, merge_base, side1, side2) < 0) {
+		err(opt, _("collecting merge info failed for trees %s, %s, %s"),
+		    oid_to_hex(&merge_base->object.oid),
+		    oid_to_hex(&side1->object.oid),
+		    oid_to_hex(&side2->object.oid));
+		result->clean = -1;
+		return;
+	}
+
+	clean = 1;
+	if (merge_detect_rename(opt)) {
+		if (detect_renames(opt, merge_base, side1, MERGE_SIDE1) < 0 ||
+		    detect_renames(opt, merge_base, side2, MERGE_SIDE2) < 0) {
+			result->clean = -1;
+			return;
+		}
+		clean = process_renames(opt);
+		if (clean < 0) {
+			result->clean = -1;
+			return;
+		}
+	}
+
+	switch (process_entries(opt)) {
+	case -1:
+		result->clean = -1;
+		return;
+	case 0:
+		clean = 0;
+		break;
+	}
+
+	string_list_sort(&opt->priv->results);
+	if (write_tree(opt, &pos, "", 0, &oid) < 0) {
+		result->clean = -1;
+		return;
+	}
+	result->tree = lookup_tree(opt->repo, &oid);
+	result->clean = clean;
+}
+
+static struct commit *make_virtual_commit(struct repository *repo,
+					  struct tree *tree,
+					  const char *comment)
+{
+	struct commit *commit = alloc_commit_node(repo);
+
+	set_merge_remote_desc(commit, comment, (struct object *)commit);
+	commit->maybe_tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+/*
+ * Merge the commits h1 and h2, first merging the merge bases (if there
+ * are several) into a virtual merge base.
+ */
+static int merge_ort_internal(struct merge_options *opt,
+			      struct commit_list *merge_bases,
+			      struct commit *h1,
+			      struct commit *h2,
+			      struct merge_result *result)
+{
+	struct commit_list *iter;
+	struct commit *merged_merge_bases;
+	const char *ancestor_name;
+	struct strbuf merge_base_abbrev = STRBUF_INIT;
+
+	if (!merge_bases) {
+		merge_bases = get_merge_bases(h1, h2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	merged_merge_bases = pop_commit(&merge_bases);
+	if (merged_merge_bases == NULL) {
+		/* if there is no common ancestor, use an empty tree */
+		struct tree *tree;
+
+		tree = lookup_tree(opt->repo, opt->repo->hash_algo->empty_tree);
+		merged_merge_bases = make_virtual_commit(opt->repo, tree,
+							 "ancestor");
+		ancestor_name = "empty tree";
+	} else if (opt->ancestor && !opt->priv->call_depth) {
+		ancestor_name = opt->ancestor;
+	} else if (merge_bases) {
+		ancestor_name = "merged common ancestors";
+	} else {
+		strbuf_add_unique_abbrev(&merge_base_abbrev,
+					 &merged_merge_bases->object.oid,
+					 DEFAULT_ABBREV);
+		ancestor_name = merge_base_abbrev.buf;
+	}
+
+	for (iter = merge_bases; iter; iter = iter->next) {
+		const char *saved_b1, *saved_b2;
+		struct commit *prev = merged_merge_bases;
+
+		opt->priv->call_depth++;
+		/*
+		 * When the merge fails, the result contains files
+		 * with conflict markers. The cleanness flag is
+		 * ignored (unless indicating an error), it was never
+		 * actually used, as result of merge_trees has always
+		 * overwritten it: the committed "conflicts" were
+		 * already resolved.
+		 */
+		saved_b1 = opt->branch1;
+		saved_b2 = opt->branch2;
+		opt->branch1 = "Temporary merge branch 1";
+		opt->branch2 = "Temporary merge branch 2";
+		merge_ort_internal(opt, NULL, prev, iter->item, result);
+		if (result->clean < 0) {
+			strbuf_release(&merge_base_abbrev);
+			return result->clean;
+		}
+		opt->branch1 = saved_b1;
+		opt->branch2 = saved_b2;
+		opt->priv->call_depth--;
+
+		merged_merge_bases = make_virtual_commit(opt->repo,
+							 result->tree,
+							 "merged tree");
+		commit_list_insert(prev, &merged_merge_bases->parents);
+		commit_list_insert(iter->item,
+				   &merged_merge_bases->parents->next);
+	}
+
+	opt->ancestor = ancestor_name;
+	merge_ort_nonrecursive_internal(opt,
+					repo_get_commit_tree(opt->repo,
+							     merged_merge_bases),
+					repo_get_commit_tree(opt->repo, h1),
+					repo_get_commit_tree(opt->repo, h2),
+					result);
+	strbuf_release(&merge_base_abbrev);
+	opt->ancestor = NULL;  /* avoid accidental re-use of opt->ancestor */
+	return result->clean;
+}
+
+static void merge_start(struct merge_options *opt, struct merge_result *result)
+{
+	/* Sanity checks on opt */
+	assert(opt->repo);
+
+	assert(opt->branch1 && opt->branch2);
+
+	assert(opt->detect_renames >= -1 &&
+	       opt->detect_renames <= DIFF_DETECT_COPY);
+	assert(opt->rename_limit >= -1);
+	assert(opt->rename_score >= 0 && opt->rename_score <= MAX_SCORE);
+	assert(opt->show_rename_progress >= 0 && opt->show_rename_progress <= 1);
+
+	assert(opt->xdl_opts >= 0);
+	assert(opt->recursive_variant >= MERGE_VARIANT_NORMAL &&
+	       opt->recursive_variant <= MERGE_VARIANT_THEIRS);
+
+	assert(opt->verbosity >= 0 && opt->verbosity <= 5);
+	assert(opt->buffer_output <= 2);
+	assert(opt->obuf.len == 0);
+
+	assert(opt->priv == NULL);
+
+	memset(result, 0, sizeof(*result));
+
+	opt->priv = xcalloc(1, sizeof(*opt->priv));
+	string_list_init(&opt->priv->paths, 1);
+	string_list_init(&opt->priv->renames[MERGE_SIDE1], 1);
+	string_list_init(&opt->priv->renames[MERGE_SIDE2], 1);
+	string_list_init(&opt->priv->results, 1);
+	string_list_init(&opt->priv->nonempty_dirs, 1);
+	string_list_init(&opt->priv->conflicted, 1);
+	string_list_init(&opt->priv->output, 1);
+}
+
+/*** Updating the index and working tree ***/
+
+static int checkout(struct merge_options *opt,
+		    struct tree *prev,
+		    struct tree *next)
+{
+	struct unpack_trees_options unpack_opts;
+	struct tree_desc trees[2];
+	int ret;
+
+	memset(&unpack_opts, 0, sizeof(unpack_opts));
+	unpack_opts.head_idx = -1;
+	unpack_opts.src_index = opt->repo->index;
+	unpack_opts.dst_index = opt->repo->index;
+	setup_unpack_trees_porcelain(&unpack_opts, "merge");
+	unpack_opts.update = 1;
+	unpack_opts.merge = 1;
+	unpack_opts.verbose_update = (opt->verbosity > 2);
+	unpack_opts.fn = twoway_merge;
+
+	parse_tree(prev);
+	init_tree_desc(&trees[0], prev->buffer, prev->size);
+	parse_tree(next);
+	init_tree_desc(&trees[1], next->buffer, next->size);
+
+	ret = unpack_trees(2, trees, &unpack_opts);
+	clear_unpack_trees_porcelain(&unpack_opts);
+	return ret;
+}
+
+static int record_conflicted_index_entries(struct merge_options *opt,
+					   struct merge_options_internal *priv)
+{
+	struct index_state *index = opt->repo->index;
+	int i, stage;
+
+	for (i = 0; i < priv->conflicted.nr; i++) {
+		const char *path = priv->conflicted.items[i].string;
+		struct version_info *stages = priv->conflicted.items[i].util;
+
+		remove_file_from_index(index, path);
+		for (stage = 0; stage < 3; stage++) {
+			struct cache_entry *ce;
+
+			if (!stages[stage].mode)
+				continue;
+			ce = make_cache_entry(index, stages[stage].mode,
+					      &stages[stage].oid, path,
+					      stage + 1, 0);
+			if (!ce)
+				return error(_("add_cacheinfo failed for path "
+					       "'%s'; merge aborting."), path);
+			if (add_index_entry(index, ce,
+					    ADD_CACHE_OK_TO_ADD |
+					    ADD_CACHE_OK_TO_REPLACE |
+					    ADD_CACHE_SKIP_DFCHECK))
+				return error(_("add_cacheinfo failed to refresh "
+					       "for path '%s'; merge aborting."),
+					     path);
+		}
+	}
+	return 0;
+}
+
+static void flush_output(struct merge_options *opt)
+{
+	if (opt->buffer_output < 2 && opt->obuf.len) {
+		fputs(opt->obuf.buf, stdout);
+		strbuf_reset(&opt->obuf);
+	}
+}
+
+void merge_switch_to_result(struct merge_options *opt,
+			    struct tree *head,
+			    struct merge_result *result,
+			    int update_worktree_and_index,
+			    int display_update_msgs)
+{
+	struct merge_options_internal *priv = result->priv;
+
+	assert(opt->priv == NULL);
+	if (result->clean >= 0 && update_worktree_and_index) {
+		if (checkout(opt, head, result->tree) ||
+		    record_conflicted_index_entries(opt, priv))
+			/* failure to function */
+			result->clean = -1;
+	}
+
+	if (display_update_msgs) {
+		int i;
+
+		for (i = 0; i < priv->output.nr; i++)
+			strbuf_addbuf(&opt->obuf, priv->output.items[i].util);
+		flush_output(opt);
+	}
+
+	merge_finalize(opt, result);
+}
+
+void merge_get_conflicted_files(struct merge_result *result,
+				struct string_list *conflicted_files)
+{
+	struct merge_options_internal *priv = result->priv;
+	int i, stage;
+
+	for (i = 0; i < priv->conflicted.nr; i++) {
+		const char *path = priv->conflicted.items[i].string;
+		struct version_info *stages = priv->conflicted.items[i].util;
+
+		for (stage = 0; stage < 3; stage++) {
+			struct stage_info *si;
+
+			if (!stages[stage].mode)
+				continue;
+			si = xmalloc(sizeof(*si));
+			oidcpy(&si->oid, &stages[stage].oid);
+			si->mode = stages[stage].mode;
+			si->stage = stage + 1;
+			string_list_append(conflicted_files, path)->util = si;
+		}
+	}
+}
+
+void merge_finalize(struct merge_options *opt,
+		    struct merge_result *result)
+{
+	struct merge_options_internal *priv = result->priv;
+
+	assert(opt->priv == NULL);
+	if (!priv)
+		return;
+
+	flush_output(opt);
+	if (opt->buffer_output < 2)
+		strbuf_release(&opt->obuf);
+	if (opt->verbosity >= 2)
+		diff_warn_rename_limit("merge.renamelimit",
+				       priv->needed_rename_limit, 0);
+
+	clear_merge_state(priv);
+	FREE_AND_NULL(result->priv);
+}
+
+/*** Public entry points ***/
+
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result)
+{
+	assert(opt->ancestor != NULL);
+
+	merge_start(opt, result);
+	merge_ort_nonrecursive_internal(opt, merge_base, side1, side2, result);
+	result->priv = opt->priv;
+	opt->priv = NULL;
+}
+
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result)
+{
+	assert(opt->ancestor == NULL ||
+	       !strcmp(opt->ancestor, "constructed merge base"));
+
+	merge_start(opt, result);
+	merge_ort_internal(opt, merge_bases, side1, side2, result);
+	result->priv = opt->priv;
+	opt->priv = NULL;
+}
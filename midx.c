@@ -10,23 +10,32 @@
 #include "progress.h"
 #include "trace2.h"
 #include "run-command.h"
+#include "refs.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "tag.h"
+#include "pack-bitmap.h"
+#include "pack-revindex.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
 #define MIDX_BYTE_FILE_VERSION 4
 #define MIDX_BYTE_HASH_VERSION 5
 #define MIDX_BYTE_NUM_CHUNKS 6
+#define MIDX_BYTE_NUM_BASE 7
 #define MIDX_BYTE_NUM_PACKS 8
 #define MIDX_HEADER_SIZE 12
 #define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + the_hash_algo->rawsz)
 
-#define MIDX_MAX_CHUNKS 5
+#define MIDX_MAX_CHUNKS 7
 #define MIDX_CHUNK_ALIGNMENT 4
 #define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
 #define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
+#define MIDX_CHUNKID_BASE 0x42415345 /* "BASE" */
 #define MIDX_CHUNKLOOKUP_WIDTH (sizeof(uint32_t) + sizeof(uint64_t))
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
@@ -52,7 +61,34 @@ static char *get_midx_filename(const char *object_dir)
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
-struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - the_hash_algo->rawsz;
+}
+
+char *get_midx_bitmap_filename(const char *object_dir,
+			       const unsigned char *hash)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap", object_dir,
+		       hash_to_hex(hash));
+}
+
+char *get_midx_chain_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-chain",
+		       object_dir);
+}
+
+static char *get_split_midx_filename(const char *object_dir,
+				     const char *hash)
+{
+	return xstrfmt("%s/pack/multi-pack-index.d/multi-pack-index-%s.midx",
+		       object_dir, hash);
+}
+
+static struct multi_pack_index *load_multi_pack_index_one(const char *object_dir,
+							  const char *midx_name,
+							  int local)
 {
 	struct multi_pack_index *m = NULL;
 	int fd;
@@ -60,7 +96,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	size_t midx_size;
 	void *midx_map = NULL;
 	uint32_t hash_version;
-	char *midx_name = get_midx_filename(object_dir);
 	uint32_t i;
 	const char *cur_pack_name;
 
@@ -80,8 +115,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 		goto cleanup_fail;
 	}
 
-	FREE_AND_NULL(midx_name);
-
 	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
 
@@ -142,6 +175,14 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 				m->chunk_large_offsets = m->data + chunk_offset;
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				m->chunk_revindex = m->data + chunk_offset;
+				break;
+
+			case MIDX_CHUNKID_BASE:
+				m->chunk_base_midxs = m->data + chunk_offset;
+				break;
+
 			case 0:
 				die(_("terminating multi-pack-index chunk id appears earlier than expected"));
 				break;
@@ -188,7 +229,6 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 
 cleanup_fail:
 	free(m);
-	free(midx_name);
 	if (midx_map)
 		munmap(midx_map, midx_size);
 	if (0 <= fd)
@@ -196,6 +236,123 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 	return NULL;
 }
 
+static int add_midx_to_chain(struct multi_pack_index *m,
+			     struct multi_pack_index *chain,
+			     struct object_id *oids,
+			     int n)
+{
+	struct multi_pack_index *cur_m = chain;
+
+	if (!hasheq(oids[n].hash, get_midx_checksum(m)) ||
+	    m->data[MIDX_BYTE_NUM_BASE] != n) {
+		warning(_("multi-pack-index chain does not match"));
+		return 0;
+	}
+
+	if (n && !m->chunk_base_midxs) {
+		warning(_("multi-pack-index layer has no base chunk"));
+		return 0;
+	}
+
+	while (n) {
+		n--;
+
+		if (!cur_m ||
+		    !hasheq(oids[n].hash, get_midx_checksum(cur_m)) ||
+		    !hasheq(oids[n].hash, m->chunk_base_midxs + m->hash_len * n)) {
+			warning(_("multi-pack-index chain does not match"));
+			return 0;
+		}
+
+		cur_m = cur_m->base_midx;
+	}
+
+	m->base_midx = chain;
+
+	if (chain) {
+		m->num_packs_in_base = chain->num_packs + chain->num_packs_in_base;
+		m->num_objects_in_base = chain->num_objects + chain->num_objects_in_base;
+	}
+
+	return 1;
+}
+
+static struct multi_pack_index *load_multi_pack_index_chain(const char *object_dir,
+							    int local)
+{
+	struct multi_pack_index *midx_chain = NULL;
+	struct strbuf line = STRBUF_INIT;
+	struct stat st;
+	struct object_id *oids;
+	int i, count;
+	char *chain_name = get_midx_chain_filename(object_dir);
+	FILE *fp;
+	int stat_res;
+
+	fp = fopen(chain_name, "r");
+	stat_res = stat(chain_name, &st);
+	free(chain_name);
+
+	if (!fp)
+		return NULL;
+	if (stat_res || st.st_size <= the_hash_algo->hexsz) {
+		fclose(fp);
+		return NULL;
+	}
+
+	count = st.st_size / (the_hash_algo->hexsz + 1);
+	CALLOC_ARRAY(oids, count);
+
+	for (i = 0; i < count; i++) {
+		struct multi_pack_index *m;
+		char *midx_name;
+
+		if (strbuf_getline_lf(&line, fp) == EOF)
+			break;
+
+		if (get_oid_hex(line.buf, &oids[i])) {
+			warning(_("invalid multi-pack-index chain: line '%s' not a hash"),
+				line.buf);
+			break;
+		}
+
+		midx_name = get_split_midx_filename(object_dir, line.buf);
+		m = load_multi_pack_index_one(object_dir, midx_name, local);
+		free(midx_name);
+
+		if (!m || !add_midx_to_chain(m, midx_chain, oids, i)) {
+			warning(_("unable to find all multi-pack-index files"));
+			if (m) {
+				close_midx(m);
+				free(m);
+			}
+			break;
+		}
+
+		midx_chain = m;
+	}
+
+	free(oids);
+	fclose(fp);
+	strbuf_release(&line);
+
+	return midx_chain;
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct multi_pack_index *m;
+	char *midx_name = get_midx_filename(object_dir);
+
+	m = load_multi_pack_index_one(object_dir, midx_name, local);
+	free(midx_name);
+
+	if (!m)
+		m = load_multi_pack_index_chain(object_dir, local);
+
+	return m;
+}
+
 void close_midx(struct multi_pack_index *m)
 {
 	uint32_t i;
@@ -203,6 +360,11 @@ void close_midx(struct multi_pack_index *m)
 	if (!m)
 		return;
 
+	if (m->base_midx) {
+		close_midx(m->base_midx);
+		FREE_AND_NULL(m->base_midx);
+	}
+
 	munmap((unsigned char *)m->data, m->data_len);
 
 	for (i = 0; i < m->num_packs; i++) {
@@ -213,14 +375,71 @@ void close_midx(struct multi_pack_index *m)
 	FREE_AND_NULL(m->pack_names);
 }
 
+static uint32_t midx_num_packs(struct multi_pack_index *m)
+{
+	return m->num_packs_in_base + m->num_packs;
+}
+
+static uint32_t midx_num_objects(struct multi_pack_index *m)
+{
+	return m->num_objects_in_base + m->num_objects;
+}
+
+/*
+ * Find the layer of the chain "m" holding the pack "*pack_int_id", and
+ * make "*pack_int_id" relative to that layer.
+ */
+static struct multi_pack_index *midx_for_pack(struct multi_pack_index *m,
+					      uint32_t *pack_int_id)
+{
+	if (*pack_int_id >= midx_num_packs(m))
+		BUG("pack-int-id %u out of range (%u total packs)",
+		    *pack_int_id, midx_num_packs(m));
+
+	while (*pack_int_id < m->num_packs_in_base)
+		m = m->base_midx;
+	*pack_int_id -= m->num_packs_in_base;
+	return m;
+}
+
+/* Likewise, for the object at position "*pos". */
+static struct multi_pack_index *midx_for_object(struct multi_pack_index *m,
+						uint32_t *pos)
+{
+	if (*pos >= midx_num_objects(m))
+		BUG("object position %u out of range (%u total objects)",
+		    *pos, midx_num_objects(m));
+
+	while (*pos < m->num_objects_in_base)
+		m = m->base_midx;
+	*pos -= m->num_objects_in_base;
+	return m;
+}
+
+struct packed_git *nth_midxed_pack(struct multi_pack_index *m,
+				   uint32_t pack_int_id)
+{
+	m = midx_for_pack(m, &pack_int_id);
+	return m->packs[pack_int_id];
+}
+
+const char *nth_midxed_pack_name(struct multi_pack_index *m,
+				 uint32_t pack_int_id)
+{
+	m = midx_for_pack(m, &pack_int_id);
+	return m->pack_names[pack_int_id];
+}
+
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id)
 {
 	struct strbuf pack_name = STRBUF_INIT;
 	struct packed_git *p;
 
-	if (pack_int_id >= m->num_packs)
+	if (pack_int_id >= midx_num_packs(m))
 		die(_("bad pack-int-id: %u (%u total packs)"),
-		    pack_int_id, m->num_packs);
+		    pack_int_id, midx_num_packs(m));
+
+	m = midx_for_pack(m, &pack_int_id);
 
 	if (m->packs[pack_int_id])
 		return 0;
@@ -242,28 +461,46 @@ int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t
 	return 0;
 }
 
+/*
+ * Look for "oid" in the layer "m" only, ignoring its base layers. On
+ * failure, "*result" is where "oid" would be inserted in that layer.
+ */
+int bsearch_one_midx(const struct object_id *oid, struct multi_pack_index *m,
+		     uint32_t *result)
+{
+	int ret = bsearch_hash(oid->hash, m->chunk_oid_fanout,
+			       m->chunk_oid_lookup, the_hash_algo->rawsz,
+			       result);
+	*result += m->num_objects_in_base;
+	return ret;
+}
+
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result)
 {
-	return bsearch_hash(oid->hash, m->chunk_oid_fanout, m->chunk_oid_lookup,
-			    the_hash_algo->rawsz, result);
+	for (; m; m = m->base_midx)
+		if (bsearch_one_midx(oid, m, result))
+			return 1;
+	return 0;
 }
 
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n)
 {
-	if (n >= m->num_objects)
+	if (n >= midx_num_objects(m))
 		return NULL;
 
+	m = midx_for_object(m, &n);
 	hashcpy(oid->hash, m->chunk_oid_lookup + m->hash_len * n);
 	return oid;
 }
 
-static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 {
 	const unsigned char *offset_data;
 	uint32_t offset32;
 
+	m = midx_for_object(m, &pos);
 	offset_data = m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH;
 	offset32 = get_be32(offset_data + sizeof(uint32_t));
 
@@ -278,9 +515,11 @@ static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	return offset32;
 }
 
-static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
-	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
+	m = midx_for_object(m, &pos);
+	return m->num_packs_in_base +
+	       get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
 
 static int nth_midxed_pack_entry(struct repository *r,
@@ -291,14 +530,14 @@ static int nth_midxed_pack_entry(struct repository *r,
 	uint32_t pack_int_id;
 	struct packed_git *p;
 
-	if (pos >= m->num_objects)
+	if (pos >= midx_num_objects(m))
 		return 0;
 
 	pack_int_id = nth_midxed_pack_int_id(m, pos);
 
 	if (prepare_midx_pack(r, m, pack_int_id))
 		die(_("error preparing packfile from multi-pack-index"));
-	p = m->packs[pack_int_id];
+	p = nth_midxed_pack(m, pack_int_id);
 
 	/*
 	* We are about to tell the caller where they can locate the
@@ -371,7 +610,8 @@ static int cmp_idx_or_pack_name(const char *idx_or_pack_name,
 	return strcmp(idx_or_pack_name, idx_name);
 }
 
-int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+static int midx_contains_pack_one(struct multi_pack_index *m,
+				  const char *idx_or_pack_name)
 {
 	uint32_t first = 0, last = m->num_packs;
 
@@ -394,6 +634,14 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
 	return 0;
 }
 
+int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name)
+{
+	for (; m; m = m->base_midx)
+		if (midx_contains_pack_one(m, idx_or_pack_name))
+			return 1;
+	return 0;
+}
+
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
 {
 	struct multi_pack_index *m;
@@ -430,13 +678,14 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 
 static size_t write_midx_header(struct hashfile *f,
 				unsigned char num_chunks,
-				uint32_t num_packs)
+				uint32_t num_packs,
+				unsigned char num_base_midxs)
 {
 	hashwrite_be32(f, MIDX_SIGNATURE);
 	hashwrite_u8(f, MIDX_VERSION);
 	hashwrite_u8(f, oid_version());
 	hashwrite_u8(f, num_chunks);
-	hashwrite_u8(f, 0); /* unused */
+	hashwrite_u8(f, num_base_midxs);
 	hashwrite_be32(f, num_packs);
 
 	return MIDX_HEADER_SIZE;
@@ -465,6 +714,36 @@ struct pack_list {
 	unsigned pack_paths_checked;
 };
 
+static void add_pack_info(struct pack_list *packs,
+			  const char *full_path, size_t full_path_len,
+			  const char *file_name)
+{
+	ALLOC_GROW(packs->info, packs->nr + 1, packs->alloc);
+
+	packs->info[packs->nr].p = add_packed_git(full_path,
+						  full_path_len,
+						  0);
+
+	if (!packs->info[packs->nr].p) {
+		warning(_("failed to add packfile '%s'"),
+			full_path);
+		return;
+	}
+
+	if (open_pack_index(packs->info[packs->nr].p)) {
+		warning(_("failed to open pack-index '%s'"),
+			full_path);
+		close_pack(packs->info[packs->nr].p);
+		FREE_AND_NULL(packs->info[packs->nr].p);
+		return;
+	}
+
+	packs->info[packs->nr].pack_name = xstrdup(file_name);
+	packs->info[packs->nr].orig_pack_int_id = packs->nr;
+	packs->info[packs->nr].expired = 0;
+	packs->nr++;
+}
+
 static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 			     const char *file_name, void *data)
 {
@@ -475,30 +754,7 @@ static void add_pack_to_midx(const char *full_path, size_t full_path_len,
 		if (packs->m && midx_contains_pack(packs->m, file_name))
 			return;
 
-		ALLOC_GROW(packs->info, packs->nr + 1, packs->alloc);
-
-		packs->info[packs->nr].p = add_packed_git(full_path,
-							  full_path_len,
-							  0);
-
-		if (!packs->info[packs->nr].p) {
-			warning(_("failed to add packfile '%s'"),
-				full_path);
-			return;
-		}
-
-		if (open_pack_index(packs->info[packs->nr].p)) {
-			warning(_("failed to open pack-index '%s'"),
-				full_path);
-			close_pack(packs->info[packs->nr].p);
-			FREE_AND_NULL(packs->info[packs->nr].p);
-			return;
-		}
-
-		packs->info[packs->nr].pack_name = xstrdup(file_name);
-		packs->info[packs->nr].orig_pack_int_id = packs->nr;
-		packs->info[packs->nr].expired = 0;
-		packs->nr++;
+		add_pack_info(packs, full_path, full_path_len, file_name);
 	}
 }
 
@@ -507,6 +763,7 @@ struct pack_midx_entry {
 	uint32_t pack_int_id;
 	time_t pack_mtime;
 	uint64_t offset;
+	unsigned preferred : 1;
 };
 
 static int midx_oid_compare(const void *_a, const void *_b)
@@ -518,6 +775,12 @@ static int midx_oid_compare(const void *_a, const void *_b)
 	if (cmp)
 		return cmp;
 
+	/* Sort objects in a preferred pack first when multiple copies exist. */
+	if (a->preferred > b->preferred)
+		return -1;
+	if (a->preferred < b->preferred)
+		return 1;
+
 	if (a->pack_mtime > b->pack_mtime)
 		return -1;
 	else if (a->pack_mtime < b->pack_mtime)
@@ -539,19 +802,22 @@ static int nth_midxed_pack_midx_entry(struct multi_pack_index *m,
 
 	/* consider objects in midx to be from "old" packs */
 	e->pack_mtime = 0;
+	e->preferred = 0;
 	return 0;
 }
 
 static void fill_pack_entry(uint32_t pack_int_id,
 			    struct packed_git *p,
 			    uint32_t cur_object,
-			    struct pack_midx_entry *entry)
+			    struct pack_midx_entry *entry,
+			    int preferred)
 {
 	if (nth_packed_object_id(&entry->oid, p, cur_object) < 0)
 		die(_("failed to locate object %d in packfile"), cur_object);
 
 	entry->pack_int_id = pack_int_id;
 	entry->pack_mtime = p->mtime;
+	entry->preferred = !!preferred;
 
 	entry->offset = nth_packed_object_offset(p, cur_object);
 }
@@ -564,13 +830,15 @@ static void fill_pack_entry(uint32_t pack_int_id,
  * group objects by the first byte of their object id. Use the IDX fanout
  * tables to group the data, copy to a local array, then sort.
  *
- * Copy only the de-duplicated entries (selected by most-recent modified time
- * of a packfile containing the object).
+ * Copy only the de-duplicated entries (selected by the preferred pack, if
+ * any, and then by most-recent modified time of a packfile containing the
+ * object).
  */
 static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 						  struct pack_info *info,
 						  uint32_t nr_packs,
-						  uint32_t *nr_objects)
+						  uint32_t *nr_objects,
+						  int preferred_pack)
 {
 	uint32_t cur_fanout, cur_pack, cur_object;
 	uint32_t alloc_fanout, alloc_objects, total_objects = 0;
@@ -579,7 +847,8 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 	uint32_t start_pack = m ? m->num_packs : 0;
 
 	for (cur_pack = start_pack; cur_pack < nr_packs; cur_pack++)
-		total_objects += info[cur_pack].p->num_objects;
+		if (info[cur_pack].p)
+			total_objects += info[cur_pack].p->num_objects;
 
 	/*
 	 * As we de-duplicate by fanout value, we expect the fanout
@@ -614,13 +883,17 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 		for (cur_pack = start_pack; cur_pack < nr_packs; cur_pack++) {
 			uint32_t start = 0, end;
 
+			if (!info[cur_pack].p)
+				continue;
 			if (cur_fanout)
 				start = get_pack_fanout(info[cur_pack].p, cur_fanout - 1);
 			end = get_pack_fanout(info[cur_pack].p, cur_fanout);
 
 			for (cur_object = start; cur_object < end; cur_object++) {
 				ALLOC_GROW(entries_by_fanout, nr_fanout + 1, alloc_fanout);
-				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object, &entries_by_fanout[nr_fanout]);
+				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object,
+						&entries_by_fanout[nr_fanout],
+						preferred_pack == (int)cur_pack);
 				nr_fanout++;
 			}
 		}
@@ -800,11 +1073,360 @@ static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_off
 	return written;
 }
 
+struct midx_pack_order_data {
+	uint32_t nr;
+	uint32_t pack;
+	off_t offset;
+};
+
+static int midx_pack_order_cmp(const void *va, const void *vb)
+{
+	const struct midx_pack_order_data *a = va, *b = vb;
+	if (a->pack < b->pack)
+		return -1;
+	else if (a->pack > b->pack)
+		return 1;
+	else if (a->offset < b->offset)
+		return -1;
+	else if (a->offset > b->offset)
+		return 1;
+	else
+		return 0;
+}
+
+/*
+ * Compute the "pseudo-pack" order of the objects in the multi-pack-index:
+ * the objects of the preferred pack come first, followed by those of every
+ * other pack in pack-int-id order, each pack's objects sorted by offset.
+ * The result maps pseudo-pack positions to positions in the lexicographic
+ * order of the multi-pack-index.
+ */
+static uint32_t *midx_pack_order(struct pack_midx_entry *entries,
+				 uint32_t nr_entries, uint32_t *pack_perm)
+{
+	struct midx_pack_order_data *data;
+	uint32_t *pack_order;
+	uint32_t i;
+
+	ALLOC_ARRAY(data, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		struct pack_midx_entry *e = &entries[i];
+		data[i].nr = i;
+		data[i].pack = pack_perm[e->pack_int_id];
+		if (!e->preferred)
+			data[i].pack |= (1U << 31);
+		data[i].offset = e->offset;
+	}
+
+	QSORT(data, nr_entries, midx_pack_order_cmp);
+
+	ALLOC_ARRAY(pack_order, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		pack_order[i] = data[i].nr;
+	free(data);
+
+	return pack_order;
+}
+
+static size_t write_midx_revindex(struct hashfile *f, uint32_t *pack_order,
+				  uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+
+	return st_mult(nr_objects, sizeof(uint32_t));
+}
+
+static size_t write_midx_base_midxs(struct hashfile *f,
+				    struct object_id *base_oids,
+				    uint32_t nr_base)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_base; i++)
+		hashwrite(f, base_oids[i].hash, the_hash_algo->rawsz);
+
+	return st_mult(nr_base, the_hash_algo->rawsz);
+}
+
+struct midx_bitmap_data {
+	struct pack_midx_entry *entries;
+	uint32_t nr_entries;
+
+	struct commit **commits;
+	uint32_t commits_nr, commits_alloc;
+};
+
+static const unsigned char *midx_entry_hash_access(size_t pos, void *table)
+{
+	struct pack_midx_entry *entries = table;
+	return entries[pos].oid.hash;
+}
+
+static int add_ref_to_pending(const char *refname,
+			      const struct object_id *oid,
+			      int flag, void *cb_data)
+{
+	struct rev_info *revs = cb_data;
+	struct object *object;
+
+	if (flag & REF_ISSYMREF)
+		return 0;
+
+	object = parse_object_or_die(oid, refname);
+	object = deref_tag(the_repository, object, refname, 0);
+	if (!object || object->type != OBJ_COMMIT)
+		return 0;
+
+	add_pending_object(revs, object, "");
+	return 0;
+}
+
+static void bitmap_show_commit(struct commit *commit, void *cb_data)
+{
+	struct midx_bitmap_data *data = cb_data;
+
+	if (sha1_pos(commit->object.oid.hash, data->entries, data->nr_entries,
+		     midx_entry_hash_access) < 0)
+		return;
+
+	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
+	data->commits[data->commits_nr++] = commit;
+}
+
+static void bitmap_show_object(struct object *object, const char *name,
+			       void *cb_data)
+{
+}
+
+/*
+ * Write a reachability bitmap for the multi-pack-index whose checksum is
+ * "midx_hash", selecting commits among those reachable from the refs.
+ * Objects are numbered in the pseudo-pack order given by "pack_order".
+ */
+static int write_midx_bitmap(const char *object_dir,
+			     const unsigned char *midx_hash,
+			     struct pack_midx_entry *entries,
+			     uint32_t nr_entries,
+			     uint32_t *pack_order,
+			     unsigned flags)
+{
+	struct packing_data pdata;
+	struct pack_idx_entry **index;
+	struct midx_bitmap_data data;
+	struct rev_info revs;
+	char *bitmap_name;
+	uint32_t i;
+	int ret = 0;
+
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(the_repository, &pdata);
+	for (i = 0; i < nr_entries; i++) {
+		struct object_entry *to;
+
+		to = packlist_alloc(&pdata, &entries[i].oid);
+		oe_set_type(to, oid_object_info(the_repository,
+						&entries[i].oid, NULL));
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.entries = entries;
+	data.nr_entries = nr_entries;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	for_each_ref(add_ref_to_pending, &revs);
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, bitmap_show_commit, bitmap_show_object,
+			     &data);
+	reset_revision_walk();
+
+	/*
+	 * The type index (and thus every bitmap) is built in pseudo-pack
+	 * order, but commits are recorded by their position in the
+	 * lexicographic order, as for a single pack.
+	 */
+	ALLOC_ARRAY(index, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		index[i] = &pdata.objects[pack_order[i]].idx;
+
+	bitmap_writer_show_progress(flags & MIDX_PROGRESS);
+	bitmap_writer_build_type_index(&pdata, index, nr_entries);
+
+	for (i = 0; i < nr_entries; i++)
+		index[i] = &pdata.objects[i].idx;
+
+	bitmap_writer_select_commits(data.commits, data.commits_nr, -1);
+	if (bitmap_writer_build(&pdata) < 0) {
+		ret = error(_("could not write multi-pack bitmap"));
+		goto cleanup;
+	}
+
+	bitmap_name = get_midx_bitmap_filename(object_dir, midx_hash);
+	bitmap_writer_set_checksum((unsigned char *)midx_hash);
+	bitmap_writer_finish(index, nr_entries, bitmap_name, 0);
+	free(bitmap_name);
+
+cleanup:
+	free(index);
+	free(data.commits);
+	clear_packing_data(&pdata);
+	return ret;
+}
+
+struct clear_midx_data {
+	char *keep;
+	const char *ext;
+};
+
+static void clear_midx_file_ext(const char *full_path, size_t full_path_len,
+				const char *file_name, void *_data)
+{
+	struct clear_midx_data *data = _data;
+
+	if (!(starts_with(file_name, "multi-pack-index-") &&
+	      ends_with(file_name, data->ext)))
+		return;
+	if (data->keep && !strcmp(data->keep, file_name))
+		return;
+
+	if (unlink(full_path))
+		die_errno(_("failed to remove %s"), full_path);
+}
+
+/*
+ * Remove the multi-pack-index auxiliary files with the extension "ext",
+ * except for the one belonging to the multi-pack-index with the checksum
+ * "keep_hash" (if not NULL).
+ */
+static void clear_midx_files_ext(const char *object_dir, const char *ext,
+				 const unsigned char *keep_hash)
+{
+	struct clear_midx_data data;
+	memset(&data, 0, sizeof(data));
+
+	if (keep_hash)
+		data.keep = xstrfmt("multi-pack-index-%s%s",
+				    hash_to_hex(keep_hash), ext);
+	data.ext = ext;
+
+	for_each_file_in_pack_dir(object_dir, clear_midx_file_ext, &data);
+
+	free(data.keep);
+}
+
+/*
+ * Remove the layers of the multi-pack-index chain which are not listed in
+ * "keep". Without "keep", remove the whole chain.
+ */
+static void clear_midx_chain(const char *object_dir, struct string_list *keep)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirnamelen;
+	DIR *dir;
+	struct dirent *de;
+
+	if (!keep) {
+		char *chain_name = get_midx_chain_filename(object_dir);
+		unlink_or_warn(chain_name);
+		free(chain_name);
+	}
+
+	strbuf_addf(&path, "%s/pack/multi-pack-index.d", object_dir);
+	dir = opendir(path.buf);
+	if (!dir)
+		goto out;
+
+	strbuf_addch(&path, '/');
+	dirnamelen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		if (!starts_with(de->d_name, "multi-pack-index-") ||
+		    !ends_with(de->d_name, ".midx"))
+			continue;
+		if (keep && unsorted_string_list_has_string(keep, de->d_name))
+			continue;
+
+		strbuf_setlen(&path, dirnamelen);
+		strbuf_addstr(&path, de->d_name);
+		unlink_or_warn(path.buf);
+	}
+	closedir(dir);
+
+	if (!keep) {
+		strbuf_setlen(&path, dirnamelen - 1);
+		rmdir(path.buf);
+	}
+
+out:
+	strbuf_release(&path);
+}
+
+/* Does the layer "m" refer to a pack which has been removed since? */
+static int midx_has_missing_pack(struct multi_pack_index *m)
+{
+	uint32_t i;
+
+	for (i = 0; i < m->num_packs; i++) {
+		char *idx_name = xstrfmt("%s/pack/%s", m->object_dir,
+					 m->pack_names[i]);
+		int missing = !file_exists(idx_name);
+
+		free(idx_name);
+		if (missing)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Choose the layers of the chain "m" to merge into a new layer holding
+ * "num_objects" objects. As for commit-graph chains, a layer is merged
+ * unless it has more than "size_multiple" times as many objects as the
+ * layers merged so far. A layer referring to a removed pack is always
+ * merged, along with all the layers above it.
+ *
+ * Return the topmost layer to keep as a base of the new layer.
+ */
+static struct multi_pack_index *midx_merge_strategy(struct multi_pack_index *m,
+						    uint32_t num_objects,
+						    const struct midx_write_opts *opts)
+{
+	struct multi_pack_index *g, *broken = NULL;
+	int size_mult = 2;
+
+	if (opts && opts->size_multiple)
+		size_mult = opts->size_multiple;
+
+	for (g = m; g; g = g->base_midx)
+		if (midx_has_missing_pack(g))
+			broken = g;
+
+	g = m;
+	while (g && (broken ||
+		     (num_objects &&
+		      g->num_objects <= (uint64_t)size_mult * num_objects))) {
+		num_objects += g->num_objects;
+		if (g == broken)
+			broken = NULL;
+		g = g->base_midx;
+	}
+
+	return g;
+}
+
 static int write_midx_internal(const char *object_dir, struct multi_pack_index *m,
-			       struct string_list *packs_to_drop, unsigned flags)
+			       struct string_list *packs_to_drop,
+			       const char *preferred_pack_name,
+			       unsigned flags,
+			       const struct midx_write_opts *opts)
 {
 	unsigned char cur_chunk, num_chunks = 0;
 	char *midx_name;
+	char *chain_name = NULL;
+	struct strbuf layer_name = STRBUF_INIT;
 	uint32_t i;
 	struct hashfile *f = NULL;
 	struct lock_file lk;
@@ -819,8 +1441,21 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	int large_offsets_needed = 0;
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
+	int preferred_pack = -1;
+	uint32_t *pack_order = NULL;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
+	int incremental = flags & MIDX_WRITE_INCREMENTAL;
+	int from_chain, rename_midx_file = 0;
+	struct multi_pack_index *base = NULL;
+	struct object_id *base_oids = NULL;
+	uint32_t nr_base = 0;
 	int result = 0;
 
+	if ((flags & MIDX_WRITE_BITMAP) && packs_to_drop)
+		BUG("cannot write a multi-pack bitmap while dropping packs");
+	if (incremental && ((flags & MIDX_WRITE_BITMAP) || packs_to_drop))
+		BUG("cannot write a bitmap or drop packs in a multi-pack-index chain");
+
 	midx_name = get_midx_filename(object_dir);
 	if (safe_create_leading_directories(midx_name))
 		die_errno(_("unable to create leading directories of %s"),
@@ -831,17 +1466,23 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	else
 		packs.m = load_multi_pack_index(object_dir, 1);
 
+	/*
+	 * A multi-pack-index read from a chain is flattened by a full
+	 * write, which then has to read the objects of all the packs.
+	 */
+	from_chain = packs.m && !file_exists(midx_name);
+
 	packs.nr = 0;
-	packs.alloc = packs.m ? packs.m->num_packs : 16;
+	packs.alloc = packs.m ? midx_num_packs(packs.m) : 16;
 	packs.info = NULL;
 	ALLOC_ARRAY(packs.info, packs.alloc);
 
-	if (packs.m) {
-		for (i = 0; i < packs.m->num_packs; i++) {
+	if (packs.m && !incremental) {
+		for (i = 0; i < midx_num_packs(packs.m); i++) {
 			ALLOC_GROW(packs.info, packs.nr + 1, packs.alloc);
 
 			packs.info[packs.nr].orig_pack_int_id = i;
-			packs.info[packs.nr].pack_name = xstrdup(packs.m->pack_names[i]);
+			packs.info[packs.nr].pack_name = xstrdup(nth_midxed_pack_name(packs.m, i));
 			packs.info[packs.nr].p = NULL;
 			packs.info[packs.nr].expired = 0;
 			packs.nr++;
@@ -857,10 +1498,145 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
 	stop_progress(&packs.progress);
 
-	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop)
-		goto cleanup;
+	if (incremental) {
+		struct multi_pack_index *g;
+		uint32_t num_objects = 0;
 
-	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries);
+		for (i = 0; i < packs.nr; i++)
+			num_objects += packs.info[i].p->num_objects;
+
+		if (packs.m) {
+			base = midx_merge_strategy(packs.m, num_objects, opts);
+			if (!packs.nr && base == packs.m)
+				goto cleanup;
+		}
+
+		/* The new layer takes over the packs of the merged layers. */
+		for (g = packs.m; g != base; g = g->base_midx) {
+			for (i = 0; i < g->num_packs; i++) {
+				struct strbuf pack_name = STRBUF_INIT;
+
+				strbuf_addf(&pack_name, "%s/pack/%s", object_dir,
+					    g->pack_names[i]);
+				if (file_exists(pack_name.buf))
+					add_pack_info(&packs, pack_name.buf,
+						      pack_name.len,
+						      g->pack_names[i]);
+				strbuf_release(&pack_name);
+			}
+		}
+
+		for (g = base; g; g = g->base_midx)
+			nr_base++;
+		if (nr_base > 255)
+			die(_("too many multi-pack-index layers"));
+		ALLOC_ARRAY(base_oids, nr_base);
+		i = nr_base;
+		for (g = base; g; g = g->base_midx)
+			hashcpy(base_oids[--i].hash, get_midx_checksum(g));
+
+		rename_midx_file = base && !from_chain;
+	} else if (packs.m && !from_chain &&
+		   packs.nr == packs.m->num_packs && !packs_to_drop) {
+		struct stat st;
+		char *bitmap_name;
+		int has_bitmap;
+
+		if (!(flags & MIDX_WRITE_BITMAP))
+			goto cleanup;
+
+		bitmap_name = get_midx_bitmap_filename(object_dir,
+						       get_midx_checksum(packs.m));
+		has_bitmap = !stat(bitmap_name, &st);
+		free(bitmap_name);
+		if (has_bitmap && packs.m->chunk_revindex && !preferred_pack_name)
+			goto cleanup;
+	}
+
+	if (!incremental && ((flags & MIDX_WRITE_BITMAP) || from_chain)) {
+		/*
+		 * The preferred pack must win every duplicate object, so
+		 * read the objects of all the packs, including the ones
+		 * already covered by the existing multi-pack-index.
+		 */
+		for (i = 0; i < packs.nr; i++) {
+			struct strbuf pack_name = STRBUF_INIT;
+			struct packed_git *p;
+
+			if (packs.info[i].p)
+				continue;
+			if (packs_to_drop &&
+			    string_list_has_string(packs_to_drop,
+						   packs.info[i].pack_name))
+				continue;
+
+			strbuf_addf(&pack_name, "%s/pack/%s", object_dir,
+				    packs.info[i].pack_name);
+			p = add_packed_git(pack_name.buf, pack_name.len, 0);
+			if (!p || open_pack_index(p)) {
+				result = error(_("could not open pack-index '%s'"),
+					       pack_name.buf);
+				strbuf_release(&pack_name);
+				if (p) {
+					close_pack(p);
+					free(p);
+				}
+				goto cleanup;
+			}
+			packs.info[i].p = p;
+			strbuf_release(&pack_name);
+		}
+	}
+
+	if (incremental) {
+		entries = get_sorted_entries(NULL, packs.info, packs.nr,
+					     &nr_entries, -1);
+
+		/* Leave out the objects the base layers already know about. */
+		if (base) {
+			uint32_t pos, kept = 0;
+
+			for (i = 0; i < nr_entries; i++) {
+				if (bsearch_midx(&entries[i].oid, base, &pos))
+					continue;
+				entries[kept++] = entries[i];
+			}
+			nr_entries = kept;
+		}
+	} else if (flags & MIDX_WRITE_BITMAP) {
+		for (i = 0; i < packs.nr; i++) {
+			if (preferred_pack_name) {
+				if (!cmp_idx_or_pack_name(preferred_pack_name,
+							  packs.info[i].pack_name)) {
+					preferred_pack = i;
+					break;
+				}
+			} else if (preferred_pack < 0 ||
+				   packs.info[i].p->num_objects >
+				   packs.info[preferred_pack].p->num_objects)
+				preferred_pack = i;
+		}
+
+		if (preferred_pack_name && preferred_pack < 0) {
+			result = error(_("unknown preferred pack: '%s'"),
+				       preferred_pack_name);
+			goto cleanup;
+		}
+		if (preferred_pack >= 0 &&
+		    !packs.info[preferred_pack].p->num_objects) {
+			result = error(_("cannot select preferred pack %s with no objects"),
+				       packs.info[preferred_pack].pack_name);
+			goto cleanup;
+		}
+
+		entries = get_sorted_entries(NULL, packs.info, packs.nr,
+					     &nr_entries, preferred_pack);
+	} else if (from_chain)
+		entries = get_sorted_entries(NULL, packs.info, packs.nr,
+					     &nr_entries, -1);
+	else
+		entries = get_sorted_entries(packs.m, packs.info, packs.nr,
+					     &nr_entries, -1);
 
 	for (i = 0; i < nr_entries; i++) {
 		if (entries[i].offset > 0x7fffffff)
@@ -924,15 +1700,8 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
-	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
-	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
-	FREE_AND_NULL(midx_name);
-
-	if (packs.m)
-		close_midx(packs.m);
-
-	cur_chunk = 0;
-	num_chunks = large_offsets_needed ? 5 : 4;
+	if (flags & MIDX_WRITE_BITMAP)
+		pack_order = midx_pack_order(entries, nr_entries, pack_perm);
 
 	if (packs.nr - dropped_packs == 0) {
 		error(_("no pack files to index."));
@@ -940,7 +1709,43 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		goto cleanup;
 	}
 
-	written = write_midx_header(f, num_chunks, packs.nr - dropped_packs);
+	if (incremental) {
+		int fd;
+
+		chain_name = get_midx_chain_filename(object_dir);
+		if (safe_create_leading_directories(chain_name))
+			die_errno(_("unable to create leading directories of %s"),
+				  chain_name);
+		hold_lock_file_for_update(&lk, chain_name, LOCK_DIE_ON_ERROR);
+
+		strbuf_addf(&layer_name, "%s/pack/multi-pack-index.d/tmp_midx_XXXXXX",
+			    object_dir);
+		fd = git_mkstemp_mode(layer_name.buf, 0444);
+		if (fd < 0) {
+			result = error_errno(_("unable to create temporary multi-pack-index layer"));
+			rollback_lock_file(&lk);
+			goto cleanup;
+		}
+		f = hashfd(fd, layer_name.buf);
+	} else {
+		hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+		f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	}
+
+	if (packs.m)
+		close_midx(packs.m);
+
+	cur_chunk = 0;
+	num_chunks = 4;
+	if (large_offsets_needed)
+		num_chunks++;
+	if (pack_order)
+		num_chunks++;
+	if (nr_base)
+		num_chunks++;
+
+	written = write_midx_header(f, num_chunks, packs.nr - dropped_packs,
+				    nr_base);
 
 	chunk_ids[cur_chunk] = MIDX_CHUNKID_PACKNAMES;
 	chunk_offsets[cur_chunk] = written + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
@@ -967,6 +1772,22 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 					   num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
 	}
 
+	if (pack_order) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_REVINDEX;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   st_mult(nr_entries, sizeof(uint32_t));
+	}
+
+	if (nr_base) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_BASE;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   st_mult(nr_base, the_hash_algo->rawsz);
+	}
+
 	chunk_ids[cur_chunk] = 0;
 
 	for (i = 0; i <= num_chunks; i++) {
@@ -1017,6 +1838,14 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 				written += write_midx_large_offsets(f, num_large_offsets, entries, nr_entries);
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				written += write_midx_revindex(f, pack_order, nr_entries);
+				break;
+
+			case MIDX_CHUNKID_BASE:
+				written += write_midx_base_midxs(f, base_oids, nr_base);
+				break;
+
 			default:
 				BUG("trying to write unknown chunk id %"PRIx32,
 				    chunk_ids[i]);
@@ -1031,9 +1860,71 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		    written,
 		    chunk_offsets[num_chunks]);
 
-	finalize_hashfile(f, NULL, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM |
+			  (incremental ? CSUM_CLOSE : 0));
+
+	if (incremental) {
+		FILE *chainf = fdopen_lock_file(&lk, "w");
+		char *final_name = get_split_midx_filename(object_dir,
+							   hash_to_hex(midx_hash));
+
+		/* The multi-pack-index we are layering on joins the chain. */
+		if (rename_midx_file) {
+			char *base_name = get_split_midx_filename(object_dir,
+					oid_to_hex(&base_oids[nr_base - 1]));
+			if (rename(midx_name, base_name))
+				result = error_errno(_("failed to rename %s"),
+						     midx_name);
+			free(base_name);
+		}
+		if (!result && rename(layer_name.buf, final_name))
+			result = error_errno(_("failed to rename temporary multi-pack-index layer"));
+		free(final_name);
+
+		if (!chainf)
+			result = error(_("unable to open multi-pack-index chain file"));
+		if (result) {
+			unlink(layer_name.buf);
+			rollback_lock_file(&lk);
+			goto cleanup;
+		}
+
+		for (i = 0; i < nr_base; i++)
+			fprintf(chainf, "%s\n", oid_to_hex(&base_oids[i]));
+		fprintf(chainf, "%s\n", hash_to_hex(midx_hash));
+	}
+
+	if (flags & MIDX_WRITE_BITMAP) {
+		if (write_midx_bitmap(object_dir, midx_hash, entries,
+				      nr_entries, pack_order, flags) < 0) {
+			rollback_lock_file(&lk);
+			result = 1;
+			goto cleanup;
+		}
+	}
+
 	commit_lock_file(&lk);
 
+	if (incremental) {
+		struct string_list keep = STRING_LIST_INIT_NODUP;
+
+		for (i = 0; i < nr_base; i++)
+			string_list_append_nodup(&keep,
+				xstrfmt("multi-pack-index-%s.midx",
+					oid_to_hex(&base_oids[i])));
+		string_list_append_nodup(&keep,
+			xstrfmt("multi-pack-index-%s.midx",
+				hash_to_hex(midx_hash)));
+
+		unlink_or_warn(midx_name);
+		clear_midx_chain(object_dir, &keep);
+		string_list_clear(&keep, 0);
+	} else
+		clear_midx_chain(object_dir, NULL);
+
+	clear_midx_files_ext(object_dir, ".bitmap",
+			     (flags & MIDX_WRITE_BITMAP) ? midx_hash : NULL);
+
 cleanup:
 	for (i = 0; i < packs.nr; i++) {
 		if (packs.info[i].p) {
@@ -1046,13 +1937,19 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	free(packs.info);
 	free(entries);
 	free(pack_perm);
+	free(pack_order);
+	free(base_oids);
+	free(chain_name);
+	strbuf_release(&layer_name);
 	free(midx_name);
 	return result;
 }
 
-int write_midx_file(const char *object_dir, unsigned flags)
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags, const struct midx_write_opts *opts)
 {
-	return write_midx_internal(object_dir, NULL, NULL, flags);
+	return write_midx_internal(object_dir, NULL, NULL,
+				   preferred_pack_name, flags, opts);
 }
 
 void clear_midx_file(struct repository *r)
@@ -1067,6 +1964,9 @@ void clear_midx_file(struct repository *r)
 	if (remove_path(midx))
 		die(_("failed to clear multi-pack-index at %s"), midx);
 
+	clear_midx_chain(r->objects->odb->path, NULL);
+	clear_midx_files_ext(r->objects->odb->path, ".bitmap", NULL);
+
 	free(midx);
 }
 
@@ -1111,27 +2011,33 @@ static int compare_pair_pos_vs_id(const void *_a, const void *_b)
 int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags)
 {
 	struct pair_pos_vs_id *pairs = NULL;
-	uint32_t i;
+	uint32_t i, num_packs, num_objects;
 	struct progress *progress = NULL;
 	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	struct multi_pack_index *layer;
 	verify_midx_error = 0;
 
 	if (!m) {
 		int result = 0;
 		struct stat sb;
 		char *filename = get_midx_filename(object_dir);
-		if (!stat(filename, &sb)) {
+		char *chain_name = get_midx_chain_filename(object_dir);
+		if (!stat(filename, &sb) || !stat(chain_name, &sb)) {
 			error(_("multi-pack-index file exists, but failed to parse"));
 			result = 1;
 		}
 		free(filename);
+		free(chain_name);
 		return result;
 	}
 
+	num_packs = midx_num_packs(m);
+	num_objects = midx_num_objects(m);
+
 	if (flags & MIDX_PROGRESS)
 		progress = start_progress(_("Looking for referenced packfiles"),
-					  m->num_packs);
-	for (i = 0; i < m->num_packs; i++) {
+					  num_packs);
+	for (i = 0; i < num_packs; i++) {
 		if (prepare_midx_pack(r, m, i))
 			midx_report("failed to load pack in position %d", i);
 
@@ -1139,16 +2045,18 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	}
 	stop_progress(&progress);
 
-	for (i = 0; i < 255; i++) {
-		uint32_t oid_fanout1 = ntohl(m->chunk_oid_fanout[i]);
-		uint32_t oid_fanout2 = ntohl(m->chunk_oid_fanout[i + 1]);
+	for (layer = m; layer; layer = layer->base_midx) {
+		for (i = 0; i < 255; i++) {
+			uint32_t oid_fanout1 = ntohl(layer->chunk_oid_fanout[i]);
+			uint32_t oid_fanout2 = ntohl(layer->chunk_oid_fanout[i + 1]);
 
-		if (oid_fanout1 > oid_fanout2)
-			midx_report(_("oid fanout out of order: fanout[%d] = %"PRIx32" > %"PRIx32" = fanout[%d]"),
-				    i, oid_fanout1, oid_fanout2, i + 1);
+			if (oid_fanout1 > oid_fanout2)
+				midx_report(_("oid fanout out of order: fanout[%d] = %"PRIx32" > %"PRIx32" = fanout[%d]"),
+					    i, oid_fanout1, oid_fanout2, i + 1);
+		}
 	}
 
-	if (m->num_objects == 0) {
+	if (num_objects == 0) {
 		midx_report(_("the midx contains no oid"));
 		/*
 		 * Remaining tests assume that we have objects, so we can
@@ -1159,10 +2067,17 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_sparse_progress(_("Verifying OID order in multi-pack-index"),
-						 m->num_objects - 1);
-	for (i = 0; i < m->num_objects - 1; i++) {
+						 num_objects - 1);
+	for (i = 0; i < num_objects - 1; i++) {
 		struct object_id oid1, oid2;
 
+		/* Objects are only sorted within each layer. */
+		layer = m;
+		while (i + 1 < layer->num_objects_in_base)
+			layer = layer->base_midx;
+		if (i + 1 == layer->num_objects_in_base)
+			continue;
+
 		nth_midxed_object_oid(&oid1, m, i);
 		nth_midxed_object_oid(&oid2, m, i + 1);
 
@@ -1180,31 +2095,32 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 	 * each of the objects and only require 1 packfile to be open at a
 	 * time.
 	 */
-	ALLOC_ARRAY(pairs, m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
+	ALLOC_ARRAY(pairs, num_objects);
+	for (i = 0; i < num_objects; i++) {
 		pairs[i].pos = i;
 		pairs[i].pack_int_id = nth_midxed_pack_int_id(m, i);
 	}
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_sparse_progress(_("Sorting objects by packfile"),
-						 m->num_objects);
+						 num_objects);
 	display_progress(progress, 0); /* TODO: Measure QSORT() progress */
-	QSORT(pairs, m->num_objects, compare_pair_pos_vs_id);
+	QSORT(pairs, num_objects, compare_pair_pos_vs_id);
 	stop_progress(&progress);
 
 	if (flags & MIDX_PROGRESS)
-		progress = start_sparse_progress(_("Verifying object offsets"), m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
+		progress = start_sparse_progress(_("Verifying object offsets"), num_objects);
+	for (i = 0; i < num_objects; i++) {
 		struct object_id oid;
 		struct pack_entry e;
 		off_t m_offset, p_offset;
 
 		if (i > 0 && pairs[i-1].pack_int_id != pairs[i].pack_int_id &&
-		    m->packs[pairs[i-1].pack_int_id])
+		    nth_midxed_pack(m, pairs[i-1].pack_int_id))
 		{
-			close_pack_fd(m->packs[pairs[i-1].pack_int_id]);
-			close_pack_index(m->packs[pairs[i-1].pack_int_id]);
+			struct packed_git *p = nth_midxed_pack(m, pairs[i-1].pack_int_id);
+			close_pack_fd(p);
+			close_pack_index(p);
 		}
 
 		nth_midxed_object_oid(&oid, m, pairs[i].pos);
@@ -1234,6 +2150,22 @@ int verify_midx_file(struct repository *r, const char *object_dir, unsigned flag
 
 	free(pairs);
 
+	if (!load_midx_revindex(m)) {
+		if (flags & MIDX_PROGRESS)
+			progress = start_sparse_progress(_("Verifying multi-pack-index reverse index"),
+							 m->num_objects);
+		for (i = 0; i < m->num_objects; i++) {
+			uint32_t pos;
+
+			if (midx_to_pack_pos(m, i, &pos) < 0 ||
+			    pack_pos_to_midx(m, pos) != i)
+				midx_report(_("incorrect reverse index entry for oid[%d]"), i);
+
+			midx_display_sparse_progress(progress, i + 1);
+		}
+		stop_progress(&progress);
+	}
+
 	return verify_midx_error;
 }
 
@@ -1247,12 +2179,12 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 	if (!m)
 		return 0;
 
-	count = xcalloc(m->num_packs, sizeof(uint32_t));
+	count = xcalloc(midx_num_packs(m), sizeof(uint32_t));
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_progress(_("Counting referenced objects"),
-					  m->num_objects);
-	for (i = 0; i < m->num_objects; i++) {
+					  midx_num_objects(m));
+	for (i = 0; i < midx_num_objects(m); i++) {
 		int pack_int_id = nth_midxed_pack_int_id(m, i);
 		count[pack_int_id]++;
 		display_progress(progress, i + 1);
@@ -1261,8 +2193,9 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 
 	if (flags & MIDX_PROGRESS)
 		progress = start_progress(_("Finding and deleting unreferenced packfiles"),
-					  m->num_packs);
-	for (i = 0; i < m->num_packs; i++) {
+					  midx_num_packs(m));
+	for (i = 0; i < midx_num_packs(m); i++) {
+		struct packed_git *p;
 		char *pack_name;
 		display_progress(progress, i + 1);
 
@@ -1272,13 +2205,14 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 		if (prepare_midx_pack(r, m, i))
 			continue;
 
-		if (m->packs[i]->pack_keep)
+		p = nth_midxed_pack(m, i);
+		if (p->pack_keep)
 			continue;
 
-		pack_name = xstrdup(m->packs[i]->pack_name);
-		close_pack(m->packs[i]);
+		pack_name = xstrdup(p->pack_name);
+		close_pack(p);
 
-		string_list_insert(&packs_to_drop, m->pack_names[i]);
+		string_list_insert(&packs_to_drop, nth_midxed_pack_name(m, i));
 		unlink_pack_path(pack_name, 0);
 		free(pack_name);
 	}
@@ -1287,7 +2221,7 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 	free(count);
 
 	if (packs_to_drop.nr)
-		result = write_midx_internal(object_dir, m, &packs_to_drop, flags);
+		result = write_midx_internal(object_dir, m, &packs_to_drop, NULL, flags, NULL);
 
 	string_list_clear(&packs_to_drop, 0);
 	return result;
@@ -1322,10 +2256,10 @@ static int fill_included_packs_all(struct repository *r,
 
 	repo_config_get_bool(r, "repack.packkeptobjects", &pack_kept_objects);
 
-	for (i = 0; i < m->num_packs; i++) {
+	for (i = 0; i < midx_num_packs(m); i++) {
 		if (prepare_midx_pack(r, m, i))
 			continue;
-		if (!pack_kept_objects && m->packs[i]->pack_keep)
+		if (!pack_kept_objects && nth_midxed_pack(m, i)->pack_keep)
 			continue;
 
 		include_pack[i] = 1;
@@ -1342,32 +2276,33 @@ static int fill_included_packs_batch(struct repository *r,
 {
 	uint32_t i, packs_to_repack;
 	size_t total_size;
-	struct repack_info *pack_info = xcalloc(m->num_packs, sizeof(struct repack_info));
+	uint32_t num_packs = midx_num_packs(m);
+	struct repack_info *pack_info = xcalloc(num_packs, sizeof(struct repack_info));
 	int pack_kept_objects = 0;
 
 	repo_config_get_bool(r, "repack.packkeptobjects", &pack_kept_objects);
 
-	for (i = 0; i < m->num_packs; i++) {
+	for (i = 0; i < num_packs; i++) {
 		pack_info[i].pack_int_id = i;
 
 		if (prepare_midx_pack(r, m, i))
 			continue;
 
-		pack_info[i].mtime = m->packs[i]->mtime;
+		pack_info[i].mtime = nth_midxed_pack(m, i)->mtime;
 	}
 
-	for (i = 0; batch_size && i < m->num_objects; i++) {
+	for (i = 0; batch_size && i < midx_num_objects(m); i++) {
 		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
 		pack_info[pack_int_id].referenced_objects++;
 	}
 
-	QSORT(pack_info, m->num_packs, compare_by_mtime);
+	QSORT(pack_info, num_packs, compare_by_mtime);
 
 	total_size = 0;
 	packs_to_repack = 0;
-	for (i = 0; total_size < batch_size && i < m->num_packs; i++) {
+	for (i = 0; total_size < batch_size && i < num_packs; i++) {
 		int pack_int_id = pack_info[i].pack_int_id;
-		struct packed_git *p = m->packs[pack_int_id];
+		struct packed_git *p = nth_midxed_pack(m, pack_int_id);
 		size_t expected_size;
 
 		if (!p)
@@ -1418,7 +2353,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 	if (!m)
 		return 0;
 
-	include_pack = xcalloc(m->num_packs, sizeof(unsigned char));
+	include_pack = xcalloc(midx_num_packs(m), sizeof(unsigned char));
 
 	if (batch_size) {
 		if (fill_included_packs_batch(r, m, include_pack, batch_size))
@@ -1458,7 +2393,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 
 	cmd_in = xfdopen(cmd.in, "w");
 
-	for (i = 0; i < m->num_objects; i++) {
+	for (i = 0; i < midx_num_objects(m); i++) {
 		struct object_id oid;
 		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
 
@@ -1476,7 +2411,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 		goto cleanup;
 	}
 
-	result = write_midx_internal(object_dir, m, NULL, flags);
+	result = write_midx_internal(object_dir, m, NULL, NULL, flags, NULL);
 	m = NULL;
 
 cleanup:
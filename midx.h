@@ -24,11 +24,23 @@ struct multi_pack_index {
 
 	int local;
 
+	/*
+	 * A multi-pack-index read from a chain is made of layers, each one
+	 * covering only the packs (and objects) not found in the layers
+	 * below it. Pack-int-ids and object positions are numbered across
+	 * the whole chain, with those of the base layers first.
+	 */
+	struct multi_pack_index *base_midx;
+	uint32_t num_packs_in_base;
+	uint32_t num_objects_in_base;
+
 	const unsigned char *chunk_pack_names;
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_object_offsets;
 	const unsigned char *chunk_large_offsets;
+	const unsigned char *chunk_revindex;
+	const unsigned char *chunk_base_midxs;
 
 	const char **pack_names;
 	struct packed_git **packs;
@@ -36,18 +48,48 @@ struct multi_pack_index {
 };
 
 #define MIDX_PROGRESS     (1 << 0)
+#define MIDX_WRITE_BITMAP (1 << 1)
+#define MIDX_WRITE_INCREMENTAL (1 << 2)
+
+struct midx_write_opts {
+	/*
+	 * When writing an incremental layer, merge it with the layers below
+	 * it while they hold fewer than "size_multiple" times as many objects
+	 * as the new layer. Defaults to 2.
+	 */
+	int size_multiple;
+};
 
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct repository *r, struct multi_pack_index *m, uint32_t pack_int_id);
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
+int bsearch_one_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
+struct packed_git *nth_midxed_pack(struct multi_pack_index *m, uint32_t pack_int_id);
+const char *nth_midxed_pack_name(struct multi_pack_index *m, uint32_t pack_int_id);
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(const char *object_dir, const unsigned char *hash);
+char *get_midx_chain_filename(const char *object_dir);
 int fill_midx_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_or_pack_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
-int write_midx_file(const char *object_dir, unsigned flags);
+/*
+ * Write a multi-pack-index covering every pack in "object_dir". With
+ * MIDX_WRITE_BITMAP, also write a reachability bitmap over the objects of
+ * the multi-pack-index, ordering them so that those of "preferred_pack_name"
+ * (or, if NULL, of the pack with the most objects) come first.
+ *
+ * With MIDX_WRITE_INCREMENTAL, write only a new layer on top of the
+ * multi-pack-index chain for the packs it does not cover yet, merging
+ * layers as directed by "opts" (which may be NULL).
+ */
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags, const struct midx_write_opts *opts);
 void clear_midx_file(struct repository *r);
 int verify_midx_file(struct repository *r, const char *object_dir, unsigned flags);
 int expire_midx_packs(struct repository *r, const char *object_dir, unsigned flags);
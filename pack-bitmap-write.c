@@ -38,6 +38,9 @@ struct bitmap_writer {
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
+
+	/* set when an object reachable from a selected commit is missing */
+	unsigned missing_objects : 1;
 };
 
 static struct bitmap_writer writer;
@@ -142,22 +145,29 @@ static inline void reset_all_seen(void)
 	seen_objects_nr = 0;
 }
 
-static uint32_t find_object_pos(const struct object_id *oid)
+static int find_object_pos(const struct object_id *oid, uint32_t *pos)
 {
 	struct object_entry *entry = packlist_find(writer.to_pack, oid);
 
 	if (!entry) {
-		die("Failed to write bitmap index. Packfile doesn't have full closure "
-			"(object %s is missing)", oid_to_hex(oid));
+		if (!writer.missing_objects)
+			error("Failed to write bitmap index. Packfile doesn't have full closure "
+			      "(object %s is missing)", oid_to_hex(oid));
+		writer.missing_objects = 1;
+		return -1;
 	}
 
-	return oe_in_pack_pos(writer.to_pack, entry);
+	*pos = oe_in_pack_pos(writer.to_pack, entry);
+	return 0;
 }
 
 static void show_object(struct object *object, const char *name, void *data)
 {
 	struct bitmap *base = data;
-	bitmap_set(base, find_object_pos(&object->oid));
+	uint32_t pos;
+
+	if (!find_object_pos(&object->oid, &pos))
+		bitmap_set(base, pos);
 	mark_as_seen(object);
 }
 
@@ -170,7 +180,10 @@ static int
 add_to_include_set(struct bitmap *base, struct commit *commit)
 {
 	khiter_t hash_pos;
-	uint32_t bitmap_pos = find_object_pos(&commit->object.oid);
+	uint32_t bitmap_pos;
+
+	if (find_object_pos(&commit->object.oid, &bitmap_pos) < 0)
+		return 0;
 
 	if (bitmap_get(base, bitmap_pos))
 		return 0;
@@ -248,7 +261,7 @@ static void compute_xor_offsets(void)
 	}
 }
 
-void bitmap_writer_build(struct packing_data *to_pack)
+int bitmap_writer_build(struct packing_data *to_pack)
 {
 	static const double REUSE_BITMAP_THRESHOLD = 0.2;
 
@@ -258,6 +271,7 @@ void bitmap_writer_build(struct packing_data *to_pack)
 
 	writer.bitmaps = kh_init_oid_map();
 	writer.to_pack = to_pack;
+	writer.missing_objects = 0;
 
 	if (writer.show_progress)
 		writer.progress = start_progress("Building bitmaps", writer.selected_nr);
@@ -323,7 +337,11 @@ void bitmap_writer_build(struct packing_data *to_pack)
 	bitmap_free(base);
 	stop_progress(&writer.progress);
 
+	if (writer.missing_objects)
+		return -1;
+
 	compute_xor_offsets();
+	return 0;
 }
 
 /**
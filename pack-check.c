@@ -198,5 +198,7 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
 	unuse_pack(&w_curs);
 
+	err |= verify_pack_revindex(p);
+
 	return err;
 }
@@ -0,0 +1,123 @@
+#include "cache.h"
+#include "pack-mtimes.h"
+#include "object-store.h"
+#include "packfile.h"
+
+char *pack_mtimes_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.mtimes", (int)len, p->pack_name);
+}
+
+#define MTIMES_HEADER_SIZE (12)
+#define MTIMES_MIN_SIZE (MTIMES_HEADER_SIZE + (2 * the_hash_algo->rawsz))
+
+struct mtimes_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t hash_id;
+};
+
+static int load_mtimes_from_disk(const char *mtimes_name,
+				 uint32_t num_objects,
+				 const uint32_t **data_p, size_t *len_p)
+{
+	int fd, ret = 0;
+	struct stat st;
+	void *data = NULL;
+	size_t mtimes_size;
+	struct mtimes_header *hdr;
+
+	fd = git_open(mtimes_name);
+
+	if (fd < 0)
+		return error_errno(_("failed to read %s"), mtimes_name);
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), mtimes_name);
+		goto cleanup;
+	}
+
+	mtimes_size = xsize_t(st.st_size);
+
+	if (mtimes_size < MTIMES_MIN_SIZE) {
+		ret = error(_("mtimes file %s is too small"), mtimes_name);
+		goto cleanup;
+	}
+
+	if (mtimes_size - MTIMES_MIN_SIZE != st_mult(sizeof(uint32_t), num_objects)) {
+		ret = error(_("mtimes file %s is corrupt"), mtimes_name);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, mtimes_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	hdr = data;
+
+	if (ntohl(hdr->signature) != MTIMES_SIGNATURE) {
+		ret = error(_("mtimes file %s has unknown signature"), mtimes_name);
+		goto cleanup;
+	}
+	if (ntohl(hdr->version) != MTIMES_VERSION) {
+		ret = error(_("mtimes file %s has unsupported version %"PRIu32),
+			    mtimes_name, ntohl(hdr->version));
+		goto cleanup;
+	}
+	if (ntohl(hdr->hash_id) != hash_algo_by_ptr(the_hash_algo)) {
+		ret = error(_("mtimes file %s has unsupported hash id %"PRIu32),
+			    mtimes_name, ntohl(hdr->hash_id));
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret) {
+		if (data)
+			munmap(data, mtimes_size);
+	} else {
+		*len_p = mtimes_size;
+		*data_p = (const uint32_t *)data;
+	}
+
+	close(fd);
+	return ret;
+}
+
+int load_pack_mtimes(struct packed_git *p)
+{
+	char *mtimes_name;
+	int ret;
+
+	if (!p->is_cruft)
+		return -1;
+	if (p->mtimes_map)
+		return 0;
+
+	if (open_pack_index(p))
+		return -1;
+
+	mtimes_name = pack_mtimes_filename(p);
+	ret = load_mtimes_from_disk(mtimes_name, p->num_objects,
+				    &p->mtimes_map, &p->mtimes_size);
+	free(mtimes_name);
+	return ret;
+}
+
+void close_pack_mtimes(struct packed_git *p)
+{
+	if (!p->mtimes_map)
+		return;
+
+	munmap((void *)p->mtimes_map, p->mtimes_size);
+	p->mtimes_map = NULL;
+}
+
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (!p->mtimes_map)
+		BUG("pack .mtimes file not loaded for %s", p->pack_name);
+	if (p->num_objects <= pos)
+		BUG("pack .mtimes out-of-bounds (%"PRIu32" vs %"PRIu32")",
+		    pos, p->num_objects);
+
+	return get_be32(p->mtimes_map + pos + (MTIMES_HEADER_SIZE / sizeof(uint32_t)));
+}
@@ -0,0 +1,46 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+/**
+ * A cruft pack holds objects which are not reachable from any reference,
+ * but which are not old enough to be pruned yet. Loose objects record
+ * their age in the mtime of their file; a cruft pack instead carries a
+ * ".mtimes" file next to its ".idx", giving the mtime of each object
+ * (see Documentation/technical/pack-format.txt).
+ *
+ * The mtimes are stored in the order of the objects in the .idx file,
+ * so they can be looked up by index position.
+ */
+
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+
+struct packed_git;
+
+/*
+ * Return the name of the ".mtimes" file belonging to the given pack.
+ * The caller is responsible for freeing it.
+ */
+char *pack_mtimes_filename(struct packed_git *p);
+
+/*
+ * load_pack_mtimes maps the ".mtimes" file of the given cruft pack,
+ * returning zero on success and a negative value otherwise.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/*
+ * Release the mmap'd ".mtimes" file of the given pack, if any.
+ */
+void close_pack_mtimes(struct packed_git *p);
+
+/*
+ * nth_packed_mtime returns the mtime of the object at index position
+ * 'pos' in the given cruft pack.
+ *
+ * The ".mtimes" file must have been loaded with load_pack_mtimes(), and
+ * the position must be within bounds; otherwise this function aborts.
+ */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+#endif
@@ -151,6 +151,25 @@ void prepare_packing_data(struct repository *r, struct packing_data *pdata)
 	init_recursive_mutex(&pdata->odb_lock);
 }
 
+void clear_packing_data(struct packing_data *pdata)
+{
+	if (!pdata)
+		return;
+
+	free(pdata->objects);
+	free(pdata->index);
+	free(pdata->in_pack_pos);
+	free(pdata->delta_size);
+	free(pdata->in_pack_by_idx);
+	free(pdata->in_pack);
+	free(pdata->ext_bases);
+	free(pdata->tree_depth);
+	free(pdata->layer);
+	free(pdata->cruft_mtime);
+	free(pdata->path_hash);
+	pthread_mutex_destroy(&pdata->odb_lock);
+}
+
 struct object_entry *packlist_alloc(struct packing_data *pdata,
 				    const struct object_id *oid)
 {
@@ -170,6 +189,12 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 		if (pdata->layer)
 			REALLOC_ARRAY(pdata->layer, pdata->nr_alloc);
+
+		if (pdata->cruft_mtime)
+			REALLOC_ARRAY(pdata->cruft_mtime, pdata->nr_alloc);
+
+		if (pdata->path_hash)
+			REALLOC_ARRAY(pdata->path_hash, pdata->nr_alloc);
 	}
 
 	new_entry = pdata->objects + pdata->nr_objects++;
@@ -198,6 +223,12 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	if (pdata->layer)
 		pdata->layer[pdata->nr_objects - 1] = 0;
 
+	if (pdata->cruft_mtime)
+		pdata->cruft_mtime[pdata->nr_objects - 1] = 0;
+
+	if (pdata->path_hash)
+		pdata->path_hash[pdata->nr_objects - 1] = 0;
+
 	return new_entry;
 }
 
@@ -168,9 +168,16 @@ struct packing_data {
 	/* delta islands */
 	unsigned int *tree_depth;
 	unsigned char *layer;
+
+	/* cruft packs */
+	uint32_t *cruft_mtime;
+
+	/* pack.pathDeltas */
+	uint32_t *path_hash;
 };
 
 void prepare_packing_data(struct repository *r, struct packing_data *pdata);
+void clear_packing_data(struct packing_data *pdata);
 
 /* Protect access to object database */
 static inline void packing_data_lock(struct packing_data *pdata)
@@ -208,6 +215,21 @@ static inline uint32_t pack_name_hash(const char *name)
 	return hash;
 }
 
+/*
+ * Unlike pack_name_hash(), hash the whole path, so that only objects
+ * found at the same path (modulo collisions) share a value. Never
+ * returns 0, which stands for "no path".
+ */
+static inline uint32_t pack_path_hash(const char *name)
+{
+	uint32_t hash;
+
+	if (!name)
+		return 0;
+	hash = strhash(name);
+	return hash ? hash : 1;
+}
+
 static inline enum object_type oe_type(const struct object_entry *e)
 {
 	return e->type_valid ? e->type_ : OBJ_BAD;
@@ -448,4 +470,38 @@ static inline void oe_set_layer(struct packing_data *pack,
 	pack->layer[e - pack->objects] = layer;
 }
 
+static inline uint32_t oe_path_hash(struct packing_data *pack,
+				    const struct object_entry *e)
+{
+	if (!pack->path_hash)
+		return 0;
+	return pack->path_hash[e - pack->objects];
+}
+
+static inline void oe_set_path_hash(struct packing_data *pack,
+				    struct object_entry *e,
+				    uint32_t path_hash)
+{
+	if (!pack->path_hash)
+		CALLOC_ARRAY(pack->path_hash, pack->nr_alloc);
+	pack->path_hash[e - pack->objects] = path_hash;
+}
+
+static inline uint32_t oe_cruft_mtime(struct packing_data *pack,
+				      struct object_entry *e)
+{
+	if (!pack->cruft_mtime)
+		return 0;
+	return pack->cruft_mtime[e - pack->objects];
+}
+
+static inline void oe_set_cruft_mtime(struct packing_data *pack,
+				      struct object_entry *e,
+				      uint32_t mtime)
+{
+	if (!pack->cruft_mtime)
+		CALLOC_ARRAY(pack->cruft_mtime, pack->nr_alloc);
+	pack->cruft_mtime[e - pack->objects] = mtime;
+}
+
 #endif
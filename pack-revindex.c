@@ -2,6 +2,9 @@
 #include "pack-revindex.h"
 #include "object-store.h"
 #include "packfile.h"
+#include "config.h"
+#include "csum-file.h"
+#include "midx.h"
 
 /*
  * Pack index for existing packs give us easy access to the offsets into
@@ -159,27 +162,209 @@ static void create_pack_revindex(struct packed_git *p)
 	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
+static int create_pack_revindex_in_memory(struct packed_git *p)
+{
+	if (git_env_bool(GIT_TEST_REV_INDEX_DIE_IN_MEMORY, 0))
+		die("dying as requested by '%s'",
+		    GIT_TEST_REV_INDEX_DIE_IN_MEMORY);
+	if (open_pack_index(p))
+		return -1;
+	create_pack_revindex(p);
+	return 0;
+}
+
+static char *pack_revindex_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
+}
+
+#define RIDX_HEADER_SIZE (12)
+#define RIDX_MIN_SIZE (RIDX_HEADER_SIZE + (2 * the_hash_algo->rawsz))
+
+struct revindex_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t hash_id;
+};
+
+static int load_revindex_from_disk(char *revindex_name,
+				   uint32_t num_objects,
+				   const uint32_t **data_p, size_t *len_p)
+{
+	int fd, ret = 0;
+	struct stat st;
+	void *data = NULL;
+	size_t revindex_size;
+	struct revindex_header *hdr;
+
+	fd = git_open(revindex_name);
+
+	if (fd < 0) {
+		/* A missing .rev file is not an error. */
+		if (errno != ENOENT)
+			error_errno(_("failed to read %s"), revindex_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), revindex_name);
+		goto cleanup;
+	}
+
+	revindex_size = xsize_t(st.st_size);
+
+	if (revindex_size < RIDX_MIN_SIZE) {
+		ret = error(_("reverse-index file %s is too small"), revindex_name);
+		goto cleanup;
+	}
+
+	if (revindex_size - RIDX_MIN_SIZE != st_mult(sizeof(uint32_t), num_objects)) {
+		ret = error(_("reverse-index file %s is corrupt"), revindex_name);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, revindex_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	hdr = data;
+
+	if (ntohl(hdr->signature) != RIDX_SIGNATURE) {
+		ret = error(_("reverse-index file %s has unknown signature"), revindex_name);
+		goto cleanup;
+	}
+	if (ntohl(hdr->version) != RIDX_VERSION) {
+		ret = error(_("reverse-index file %s has unsupported version %"PRIu32),
+			    revindex_name, ntohl(hdr->version));
+		goto cleanup;
+	}
+	if (ntohl(hdr->hash_id) != hash_algo_by_ptr(the_hash_algo)) {
+		ret = error(_("reverse-index file %s has unsupported hash id %"PRIu32),
+			    revindex_name, ntohl(hdr->hash_id));
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret) {
+		if (data)
+			munmap(data, revindex_size);
+	} else {
+		*len_p = revindex_size;
+		*data_p = (const uint32_t *)data;
+	}
+
+	close(fd);
+	return ret;
+}
+
+static int load_pack_revindex_from_disk(struct packed_git *p)
+{
+	char *revindex_name;
+	int ret;
+
+	if (open_pack_index(p))
+		return -1;
+
+	revindex_name = pack_revindex_filename(p);
+
+	ret = load_revindex_from_disk(revindex_name,
+				      p->num_objects,
+				      &p->revindex_map,
+				      &p->revindex_size);
+	if (ret)
+		goto cleanup;
+
+	p->revindex_data = (const uint32_t *)((const char *)p->revindex_map + RIDX_HEADER_SIZE);
+
+cleanup:
+	free(revindex_name);
+	return ret;
+}
+
 int load_pack_revindex(struct packed_git *p)
 {
-	if (!p->revindex) {
-		if (open_pack_index(p))
+	if (p->revindex || p->revindex_data)
+		return 0;
+
+	if (!load_pack_revindex_from_disk(p))
+		return 0;
+	else if (!create_pack_revindex_in_memory(p))
+		return 0;
+	return -1;
+}
+
+void close_pack_revindex(struct packed_git *p)
+{
+	if (!p->revindex_map)
+		return;
+
+	munmap((void *)p->revindex_map, p->revindex_size);
+	p->revindex_map = NULL;
+	p->revindex_data = NULL;
+}
+
+int verify_pack_revindex(struct packed_git *p)
+{
+	int res = 0;
+	uint32_t i;
+
+	/* Only an on-disk reverse index can be out of sync with its pack. */
+	if (!p->revindex_data) {
+		char *revindex_name = pack_revindex_filename(p);
+		int missing = access(revindex_name, F_OK) && errno == ENOENT;
+
+		free(revindex_name);
+		if (missing)
+			return res;
+		if (load_pack_revindex_from_disk(p))
 			return -1;
-		create_pack_revindex(p);
 	}
-	return 0;
+
+	if (!hashfile_checksum_valid((const unsigned char *)p->revindex_map,
+				     p->revindex_size))
+		res = error(_("invalid checksum in reverse-index file for %s"),
+			    p->pack_name);
+
+	if (!hasheq((const unsigned char *)p->revindex_map + p->revindex_size -
+		    2 * the_hash_algo->rawsz, p->hash))
+		res = error(_("reverse-index file for %s does not match its pack"),
+			    p->pack_name);
+
+	/* This may fail due to a broken .idx. */
+	if (!p->revindex && create_pack_revindex_in_memory(p))
+		return res;
+
+	for (i = 0; i < p->num_objects; i++) {
+		uint32_t nr = p->revindex[i].nr;
+		uint32_t rev_val = get_be32(p->revindex_data + i);
+
+		if (nr != rev_val) {
+			res = error(_("invalid reverse-index position at %"PRIu32": %"PRIu32" != %"PRIu32),
+				    i, nr, rev_val);
+			break;
+		}
+	}
+
+	return res;
 }
 
-int find_revindex_position(struct packed_git *p, off_t ofs)
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
 {
-	int lo = 0;
-	int hi = p->num_objects + 1;
-	const struct revindex_entry *revindex = p->revindex;
+	unsigned lo, hi;
+
+	if (load_pack_revindex(p) < 0)
+		return -1;
+
+	lo = 0;
+	hi = p->num_objects + 1;
 
 	do {
 		const unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
+		off_t got = pack_pos_to_offset(p, mi);
+
+		if (got == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < got)
 			hi = mi;
 		else
 			lo = mi + 1;
@@ -189,17 +374,105 @@ int find_revindex_position(struct packed_git *p, off_t ofs)
 	return -1;
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
 {
-	int pos;
+	if (!(p->revindex || p->revindex_data))
+		BUG("pack_pos_to_index: reverse index not yet loaded");
+	if (p->num_objects <= pos)
+		BUG("pack_pos_to_index: out-of-bounds object at %"PRIu32, pos);
 
-	if (load_pack_revindex(p))
-		return NULL;
+	if (p->revindex)
+		return p->revindex[pos].nr;
+	else
+		return get_be32(p->revindex_data + pos);
+}
+
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (!(p->revindex || p->revindex_data))
+		BUG("pack_pos_to_index: reverse index not yet loaded");
+	if (p->num_objects < pos)
+		BUG("pack_pos_to_offset: out-of-bounds object at %"PRIu32, pos);
 
-	pos = find_revindex_position(p, ofs);
+	if (p->revindex)
+		return p->revindex[pos].offset;
+	else if (pos == p->num_objects)
+		return p->pack_size - the_hash_algo->rawsz;
+	else
+		return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
+}
+
+int load_midx_revindex(struct multi_pack_index *m)
+{
+	/* A reverse index only covers a single multi-pack-index layer. */
+	if (!m->chunk_revindex || m->base_midx)
+		return -1;
+	return 0;
+}
 
-	if (pos < 0)
-		return NULL;
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos)
+{
+	if (!m->chunk_revindex)
+		BUG("pack_pos_to_midx: reverse index not yet loaded");
+	if (m->num_objects <= pos)
+		BUG("pack_pos_to_midx: out-of-bounds object at %"PRIu32, pos);
+	return get_be32(m->chunk_revindex + st_mult(sizeof(uint32_t), pos));
+}
+
+/*
+ * The pseudo-pack order key of an object: objects of the preferred pack
+ * sort first, then by pack-int-id, then by offset.
+ */
+static int midx_pack_order_cmp(struct multi_pack_index *m,
+			       uint32_t preferred, uint32_t a, uint32_t b)
+{
+	uint32_t pack_a = nth_midxed_pack_int_id(m, a);
+	uint32_t pack_b = nth_midxed_pack_int_id(m, b);
+	off_t ofs_a, ofs_b;
+
+	if (pack_a != pack_b) {
+		if (pack_a == preferred)
+			return -1;
+		if (pack_b == preferred)
+			return 1;
+		return pack_a < pack_b ? -1 : 1;
+	}
+
+	ofs_a = nth_midxed_offset(m, a);
+	ofs_b = nth_midxed_offset(m, b);
+	if (ofs_a < ofs_b)
+		return -1;
+	if (ofs_a > ofs_b)
+		return 1;
+	return 0;
+}
+
+int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos)
+{
+	uint32_t preferred, lo, hi;
+
+	if (load_midx_revindex(m) < 0)
+		return -1;
+	if (at >= m->num_objects)
+		return error(_("invalid multi-pack-index position %"PRIu32), at);
+
+	preferred = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0));
+
+	lo = 0;
+	hi = m->num_objects;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = midx_pack_order_cmp(m, preferred, at,
+					      pack_pos_to_midx(m, mi));
+
+		if (!cmp) {
+			*pos = mi;
+			return 0;
+		} else if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
 
-	return p->revindex + pos;
+	return error(_("object at multi-pack-index position %"PRIu32" missing from its reverse index"), at);
 }
@@ -1,16 +1,128 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
+/**
+ * A revindex allows converting efficiently between three properties
+ * of an object within a pack:
+ *
+ * - index position: the numeric position within the list of sorted object ids
+ *   found in the .idx file
+ *
+ * - pack position: the numeric position within the list of objects in their
+ *   order within the actual .pack file (i.e., 0 is the first object in the
+ *   .pack, 1 is the second, and so on)
+ *
+ * - offset: the byte offset within the .pack file at which the object contents
+ *   can be found
+ *
+ * The revindex is either read from a ".rev" file stored next to the ".idx"
+ * (see Documentation/technical/pack-format.txt), or computed in memory by
+ * sorting the offsets found in the ".idx".
+ *
+ * A multi-pack-index may similarly carry a reverse index (its "RIDX" chunk),
+ * which orders its objects as if they were all stored in a single
+ * "pseudo-pack": the objects of the preferred pack come first, followed by
+ * those of the remaining packs in pack-int-id order, each pack's objects in
+ * offset order. A "pack position" in a multi-pack-index is a position in
+ * this pseudo-pack.
+ */
+
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+
+#define GIT_TEST_WRITE_REV_INDEX "GIT_TEST_WRITE_REV_INDEX"
+#define GIT_TEST_REV_INDEX_DIE_IN_MEMORY "GIT_TEST_REV_INDEX_DIE_IN_MEMORY"
+
 struct packed_git;
+struct multi_pack_index;
 
 struct revindex_entry {
 	off_t offset;
 	unsigned int nr;
 };
 
+/*
+ * load_pack_revindex populates the revindex's internal data-structures for the
+ * given pack, returning zero on success and a negative value otherwise.
+ *
+ * If a '.rev' file is present it is mmap'd, and pointers are assigned into it
+ * (instead of using the in-memory variant).
+ */
 int load_pack_revindex(struct packed_git *p);
-int find_revindex_position(struct packed_git *p, off_t ofs);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Release the mmap'd '.rev' file of the given pack, if any.
+ */
+void close_pack_revindex(struct packed_git *p);
+
+/*
+ * verify_pack_revindex verifies that the on-disk rev-index for the given
+ * pack-file is the same that would be created if written from scratch.
+ *
+ * A negative number is returned on error.
+ */
+int verify_pack_revindex(struct packed_git *p);
+
+/*
+ * offset_to_pack_pos converts an object offset to a pack position. This
+ * function returns zero on success, and a negative number otherwise. The
+ * parameter 'pos' is usable only on success.
+ *
+ * If the reverse index has not yet been loaded, this function loads it lazily,
+ * and returns an negative number if an error was encountered.
+ *
+ * This function runs in time O(log N) with the number of objects in the pack.
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
+
+/*
+ * pack_pos_to_index converts the given pack-relative position 'pos' by
+ * returning an index-relative position.
+ *
+ * If the reverse index has not yet been loaded, or the position is out of
+ * bounds, this function aborts.
+ *
+ * This function runs in constant time.
+ */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+
+/*
+ * pack_pos_to_offset converts the given pack-relative position 'pos' into a
+ * pack offset. For a pack with 'N' objects, asking for position 'N' will return
+ * the total size (in bytes) of the pack.
+ *
+ * If the reverse index has not yet been loaded, or the position is out of
+ * bounds, this function aborts.
+ *
+ * This function runs in constant time under both in-memory and on-disk
+ * reverse indexes, but an additional step is taken to consult the
+ * corresponding .idx file when using the on-disk format.
+ */
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
+
+/*
+ * load_midx_revindex returns zero if the given multi-pack-index carries a
+ * reverse index, and a negative value otherwise.
+ */
+int load_midx_revindex(struct multi_pack_index *m);
+
+/*
+ * pack_pos_to_midx converts the object at pseudo-pack position 'pos' into
+ * its lexicographic position within the multi-pack-index.
+ *
+ * If the reverse index is missing, or the position is out of bounds, this
+ * function aborts.
+ */
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos);
+
+/*
+ * midx_to_pack_pos converts the object at lexicographic position 'at' in
+ * the multi-pack-index into its pseudo-pack position. Returns zero on
+ * success, and a negative number otherwise.
+ *
+ * This function runs in time O(log N) with the number of objects in the
+ * multi-pack-index.
+ */
+int midx_to_pack_pos(struct multi_pack_index *m, uint32_t at, uint32_t *pos);
 
 #endif
@@ -17,6 +17,7 @@
 #include "midx.h"
 #include "commit-graph.h"
 #include "promisor-remote.h"
+#include "pack-mtimes.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *hash,
@@ -328,6 +329,8 @@ void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
+	close_pack_revindex(p);
+	close_pack_mtimes(p);
 	close_pack_index(p);
 }
 
@@ -351,7 +354,7 @@ void close_object_store(struct raw_object_store *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".promisor"};
+	static const char *exts[] = {".pack", ".idx", ".rev", ".mtimes", ".keep", ".bitmap", ".promisor"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -721,6 +724,10 @@ struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_promisor = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -868,6 +875,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (!strcmp(file_name, "multi-pack-index"))
 		return;
 	if (ends_with(file_name, ".idx") ||
+	    ends_with(file_name, ".rev") ||
+	    ends_with(file_name, ".mtimes") ||
 	    ends_with(file_name, ".pack") ||
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
@@ -916,7 +925,7 @@ unsigned long repo_approximate_object_count(struct repository *r)
 		prepare_packed_git(r);
 		count = 0;
 		for (m = get_multi_pack_index(r); m; m = m->next)
-			count += m->num_objects;
+			count += m->num_objects_in_base + m->num_objects;
 		for (p = r->objects->packed_git; p; p = p->next) {
 			if (open_pack_index(p))
 				continue;
@@ -1046,7 +1055,7 @@ struct packed_git *get_all_packs(struct repository *r)
 	prepare_packed_git(r);
 	for (m = r->objects->multi_pack_index; m; m = m->next) {
 		uint32_t i;
-		for (i = 0; i < m->num_packs; i++)
+		for (i = 0; i < m->num_packs_in_base + m->num_packs; i++)
 			prepare_midx_pack(r, m, i);
 	}
 
@@ -1250,18 +1259,18 @@ static int get_delta_base_oid(struct packed_git *p,
 		oidread(oid, base);
 		return 0;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return -1;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return -1;
 
-		return nth_packed_object_id(oid, p, revidx->nr);
+		return nth_packed_object_id(oid, p,
+					    pack_pos_to_index(p, base_pos));
 	} else
 		return -1;
 }
@@ -1271,12 +1280,11 @@ static int retry_bad_packed_offset(struct repository *r,
 				   off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	struct object_id oid;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	nth_packed_object_id(&oid, p, revidx->nr);
+	nth_packed_object_id(&oid, p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, oid.hash);
 	type = oid_object_info(r, &oid, NULL);
 	if (type <= OBJ_NONE)
@@ -1354,10 +1362,36 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
+/*
+ * The delta base cache is split into a fixed number of shards, each
+ * with its own hashmap, LRU list and lock. Readers running on several
+ * threads (e.g. "git grep" with threads) then only contend when they
+ * hit the same shard, and can copy cached bases out without holding
+ * obj_read_mutex.
+ *
+ * delta_base_cache_limit applies to all shards together, so that one
+ * large base can still be cached. The total can only go over it when
+ * some shard holds more than its share, so only a shard that has just
+ * gone over its share adds up the others (locking one at a time) and,
+ * if the cache is over the limit, evicts its own entries first and then
+ * those of the other shards.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
 
-static LIST_HEAD(delta_base_cache_lru);
+struct delta_base_cache_shard {
+	struct hashmap map;
+	struct list_head lru;
+	size_t cached;
+	pthread_mutex_t mutex;
+
+	/* statistics, reported through trace2 at exit */
+	uintmax_t hits;
+	uintmax_t misses;
+	uintmax_t evictions;
+};
+
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static int delta_base_cache_initialized;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1382,22 +1416,6 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
-{
-	struct hashmap_entry entry, *e;
-	struct delta_base_cache_key key;
-
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	e = hashmap_get(&delta_base_cache, &entry, &key);
-	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
-}
-
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1421,95 +1439,292 @@ static int delta_base_cache_hash_cmp(const void *unused_cmp_data,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
+static void report_delta_base_cache(void)
+{
+	uintmax_t hits = 0, misses = 0, evictions = 0;
+	int i;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		hits += delta_base_cache[i].hits;
+		misses += delta_base_cache[i].misses;
+		evictions += delta_base_cache[i].evictions;
+	}
+	if (!hits && !misses)
+		return;
+
+	trace2_data_intmax("delta-base-cache", NULL, "hits", hits);
+	trace2_data_intmax("delta-base-cache", NULL, "misses", misses);
+	trace2_data_intmax("delta-base-cache", NULL, "evictions", evictions);
+}
+
+/*
+ * Callers either run single-threaded or hold obj_read_mutex when they
+ * first reach the cache, so the lazy initialization cannot race.
+ */
+static void init_delta_base_cache(void)
+{
+	int i;
+
+	if (delta_base_cache_initialized)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+
+		hashmap_init(&shard->map, delta_base_cache_hash_cmp, NULL, 0);
+		INIT_LIST_HEAD(&shard->lru);
+		pthread_mutex_init(&shard->mutex, NULL);
+	}
+	delta_base_cache_initialized = 1;
+	atexit(report_delta_base_cache);
+}
+
+static struct delta_base_cache_shard *delta_base_cache_shard_for(unsigned int hash)
+{
+	/*
+	 * The hashmap of each shard picks buckets from the low bits of
+	 * the hash, so select the shard from the top bits of a
+	 * multiplicative mix instead.
+	 */
+	init_delta_base_cache();
+	return &delta_base_cache[(hash * 2654435769u) >> 28];
+}
+
+static void lock_shard(struct delta_base_cache_shard *shard)
+{
+	pthread_mutex_lock(&shard->mutex);
+}
+
+static void unlock_shard(struct delta_base_cache_shard *shard)
+{
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/* The caller must hold the lock of "shard". */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   unsigned int hash,
+			   struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry entry, *e;
+	struct delta_base_cache_key key;
+
+	hashmap_entry_init(&entry, hash);
+	key.p = p;
+	key.base_offset = base_offset;
+	e = hashmap_get(&shard->map, &entry, &key);
+	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
+}
+
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard_for(hash);
+	int ret;
+
+	lock_shard(shard);
+	ret = !!get_delta_base_cache_entry(shard, hash, p, base_offset);
+	unlock_shard(shard);
+	return ret;
 }
 
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
- * should copy out any fields it wants before detaching.
+ * should copy out any fields it wants before detaching. The caller
+ * must hold the lock of "shard".
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
+	hashmap_remove(&shard->map, &ent->ent, &ent->key);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
+	shard->cached -= ent->size;
 	free(ent);
 }
 
+/*
+ * Look up the base at "base_offset" and, if it is cached, remove it
+ * from the cache and hand its data over to the caller.
+ */
+static void *take_delta_base_cache_entry(struct packed_git *p, off_t base_offset,
+					 unsigned long *base_size,
+					 enum object_type *type)
+{
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard_for(hash);
+	struct delta_base_cache_entry *ent;
+	void *data = NULL;
+
+	lock_shard(shard);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		shard->hits++;
+		*type = ent->type;
+		*base_size = ent->size;
+		data = ent->data;
+		detach_delta_base_cache_entry(shard, ent);
+	} else {
+		shard->misses++;
+	}
+	unlock_shard(shard);
+	return data;
+}
+
 static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard_for(hash);
 	struct delta_base_cache_entry *ent;
+	void *data = NULL;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
-		return unpack_entry(r, p, base_offset, type, base_size);
+	/*
+	 * The shard lock is enough to keep the entry alive while we copy
+	 * it, so let other readers make progress in the meantime.
+	 */
+	obj_read_unlock();
+	lock_shard(shard);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		shard->hits++;
+		if (type)
+			*type = ent->type;
+		if (base_size)
+			*base_size = ent->size;
+		data = xmemdupz(ent->data, ent->size);
+	}
+	unlock_shard(shard);
+	obj_read_lock();
 
-	if (type)
-		*type = ent->type;
-	if (base_size)
-		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	if (!data)
+		return unpack_entry(r, p, base_offset, type, base_size);
+	return data;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+/* The caller must hold the lock of "shard". */
+static inline void release_delta_base_cache(struct delta_base_cache_shard *shard,
+					    struct delta_base_cache_entry *ent)
 {
 	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	detach_delta_base_cache_entry(shard, ent);
 }
 
 void clear_delta_base_cache(void)
+{
+	int i;
+
+	if (!delta_base_cache_initialized)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		struct list_head *lru, *tmp;
+
+		lock_shard(shard);
+		list_for_each_safe(lru, tmp, &shard->lru) {
+			struct delta_base_cache_entry *entry =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			release_delta_base_cache(shard, entry);
+		}
+		unlock_shard(shard);
+	}
+}
+
+/*
+ * Evict the least recently used bases of "shard" while "*total" is over
+ * the limit and the shard holds more than "keep_bytes", updating
+ * "*total". With "keep_newest", the newest entry is never evicted.
+ */
+static void evict_delta_base_cache(struct delta_base_cache_shard *shard,
+				   size_t *total, size_t keep_bytes,
+				   int keep_newest)
 {
 	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
+
+	lock_shard(shard);
+	list_for_each_safe(lru, tmp, &shard->lru) {
+		struct delta_base_cache_entry *f =
 			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+		if (*total <= delta_base_cache_limit ||
+		    shard->cached <= keep_bytes)
+			break;
+		if (keep_newest && tmp == &shard->lru)
+			break;
+		*total -= f->size;
+		release_delta_base_cache(shard, f);
+		shard->evictions++;
 	}
+	unlock_shard(shard);
+}
+
+/*
+ * Called without any shard locked after "own" went over its share:
+ * if the whole cache is over the limit, evict from "own" down to its
+ * share, then from the other shards, and finally whatever "own" still
+ * holds except its newest entry (the one just added), which may exceed
+ * the limit on its own.
+ */
+static void shrink_delta_base_cache(struct delta_base_cache_shard *own)
+{
+	size_t share = delta_base_cache_limit / DELTA_BASE_CACHE_SHARDS;
+	size_t start = own - delta_base_cache;
+	size_t total = 0;
+	size_t i;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		lock_shard(&delta_base_cache[i]);
+		total += delta_base_cache[i].cached;
+		unlock_shard(&delta_base_cache[i]);
+	}
+
+	evict_delta_base_cache(own, &total, share, 1);
+	for (i = 1; i < DELTA_BASE_CACHE_SHARDS; i++)
+		evict_delta_base_cache(&delta_base_cache[(start + i) %
+							 DELTA_BASE_CACHE_SHARDS],
+				       &total, 0, 0);
+	evict_delta_base_cache(own, &total, 0, 1);
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard_for(hash);
+	size_t share = delta_base_cache_limit / DELTA_BASE_CACHE_SHARDS;
 	struct delta_base_cache_entry *ent;
-	struct list_head *lru, *tmp;
+	int over_share;
+
+	lock_shard(shard);
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
 	 * is unpacking the same object, in unpack_entry() (since its phases I
 	 * and III might run concurrently across multiple threads).
 	 */
-	if (in_delta_base_cache(p, base_offset)) {
+	if (get_delta_base_cache_entry(shard, hash, p, base_offset)) {
+		unlock_shard(shard);
 		free(base);
 		return;
 	}
 
-	delta_base_cached += base_size;
-
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
-	}
-
 	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	list_add_tail(&ent->lru, &shard->lru);
+
+	hashmap_entry_init(&ent->ent, hash);
+	hashmap_add(&shard->map, &ent->ent);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, &ent->ent);
+	shard->cached += base_size;
+	over_share = shard->cached > share;
+
+	unlock_shard(shard);
+
+	if (over_share)
+		shrink_delta_base_cache(shard);
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1553,8 +1768,15 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			error("could not find object at offset %"PRIuMAX" "
+			      "in pack %s", (uintmax_t)obj_offset, p->pack_name);
+			type = OBJ_BAD;
+			goto out;
+		}
+
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->type_name) {
@@ -1690,24 +1912,29 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+
+		data = take_delta_base_cache_entry(p, curpos, &size, &type);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pack_pos, index_pos;
+			off_t len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0) {
+				error("could not find object at offset %"PRIuMAX" in pack %s",
+				      (uintmax_t)obj_offset, p->pack_name);
+				data = NULL;
+				goto out;
+			}
+
+			len = pack_pos_to_offset(p, pack_pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pack_pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				struct object_id oid;
-				nth_packed_object_id(&oid, p, revidx->nr);
+				nth_packed_object_id(&oid, p, index_pos);
 				error("bad packed object CRC for %s",
 				      oid_to_hex(&oid));
 				mark_bad_packed_object(p, oid.hash);
@@ -1790,11 +2017,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			struct object_id base_oid;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				nth_packed_object_id(&base_oid, p, revidx->nr);
+			if (!(offset_to_pack_pos(p, obj_offset, &pos))) {
+				nth_packed_object_id(&base_oid, p,
+						     pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      oid_to_hex(&base_oid), (uintmax_t)obj_offset,
@@ -1821,8 +2048,14 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Both buffers are private to us, so the delta
+			 * can be applied without holding obj_read_mutex.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -2085,7 +2318,7 @@ int for_each_object_in_pack(struct packed_git *p,
 		struct object_id oid;
 
 		if (flags & FOR_EACH_OBJECT_PACK_ORDER)
-			pos = p->revindex[i].nr;
+			pos = pack_pos_to_index(p, i);
 		else
 			pos = i;
 
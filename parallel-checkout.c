@@ -0,0 +1,441 @@
+#include "cache.h"
+#include "config.h"
+#include "object-store.h"
+#include "parallel-checkout.h"
+#include "progress.h"
+#include "thread-utils.h"
+#include "trace2.h"
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+#define DEFAULT_NUM_WORKERS 1
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The entry could not be written because there was another file
+	 * already present in its path or leading directories. Since
+	 * checkout_entry() removes such files from the working tree before
+	 * enqueueing the entry for parallel checkout, it means that there
+	 * was a path collision among the entries being written.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED,
+};
+
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	struct stat st;
+	enum pc_item_status status;
+};
+
+struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items; /* The parallel checkout queue. */
+	size_t nr, alloc;
+
+	/* The fields below are only used while running the workers. */
+	const struct checkout *state;
+	size_t next_item;
+	struct progress *progress;
+	unsigned int *progress_cnt;
+	pthread_mutex_t mutex;
+};
+
+static struct parallel_checkout parallel_checkout;
+
+enum pc_status parallel_checkout_status(void)
+{
+	return parallel_checkout.status;
+}
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	const char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		if (strtol_i(env_workers, 10, num_workers))
+			die(_("invalid value for GIT_TEST_CHECKOUT_WORKERS: '%s'"),
+			    env_workers);
+		if (*num_workers < 1)
+			*num_workers = online_cpus();
+		*threshold = 0;
+	} else {
+		if (git_config_get_int("checkout.workers", num_workers))
+			*num_workers = DEFAULT_NUM_WORKERS;
+		else if (*num_workers < 1)
+			*num_workers = online_cpus();
+
+		if (git_config_get_int("checkout.thresholdForParallelism",
+				       threshold))
+			*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+	}
+
+	if (!HAVE_THREADS)
+		*num_workers = 1;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		BUG("parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		BUG("cannot finish parallel checkout: not initialized yet");
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
+					     const struct conv_attrs *ca)
+{
+	unsigned long size;
+
+	/*
+	 * Symlinks cannot be checked out in parallel as, in case of path
+	 * collision, they could racily replace leading directories of other
+	 * entries being checked out. Submodules are checked out by child
+	 * processes.
+	 */
+	if (!S_ISREG(ce->ce_mode))
+		return 0;
+
+	switch (classify_conv_attrs(ca)) {
+	case CA_CLASS_INCORE:
+		return 1;
+	case CA_CLASS_STREAMABLE:
+		/*
+		 * The workers load each blob in-core, while write_entry()
+		 * streams the ones above core.bigFileThreshold; leave those
+		 * to it, lest several huge blobs be held in memory at once.
+		 */
+		if (oid_object_info(the_repository, &ce->oid,
+				    &size) != OBJ_BLOB)
+			return 0;
+		return size <= big_file_threshold;
+	case CA_CLASS_INCORE_FILTER:
+	case CA_CLASS_INCORE_PROCESS:
+		/*
+		 * External filters are neither thread-safe nor cheap to
+		 * spawn, and long-running processes may delay entries;
+		 * leave them to the sequential code.
+		 */
+		return 0;
+	default:
+		BUG("unsupported conv_attrs classification");
+	}
+}
+
+int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca)
+{
+	struct parallel_checkout_item *pc_item;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    !ca || !is_eligible_for_parallel_checkout(ce, ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr++];
+	pc_item->ce = ce;
+	memcpy(&pc_item->ca, ca, sizeof(pc_item->ca));
+	pc_item->status = PC_ITEM_PENDING;
+
+	return 0;
+}
+
+size_t pc_queue_size(void)
+{
+	return parallel_checkout.nr;
+}
+
+static void advance_progress_meter(void)
+{
+	if (parallel_checkout.progress) {
+		(*parallel_checkout.progress_cnt)++;
+		display_progress(parallel_checkout.progress,
+				 *parallel_checkout.progress_cnt);
+	}
+}
+
+static int handle_results(struct checkout *state)
+{
+	int ret = 0;
+	size_t i;
+
+	/*
+	 * We first update the successfully written entries with the collected
+	 * stat() data, so that they can be found by mark_colliding_entries(),
+	 * in the next loop, when necessary.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		if (pc_item->status == PC_ITEM_WRITTEN)
+			update_ce_after_write(state, pc_item->ce, &pc_item->st);
+	}
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			/* Already handled */
+			break;
+		case PC_ITEM_COLLIDED:
+			/*
+			 * The entry could not be written due to a path
+			 * collision with another entry. Write it again,
+			 * sequentially, so that it gets its stat() data
+			 * stored in the index and so that the collision is
+			 * reported, exactly as the sequential checkout
+			 * would have done.
+			 */
+			ret |= checkout_entry(pc_item->ce, state, NULL, NULL);
+			advance_progress_meter();
+			break;
+		case PC_ITEM_PENDING:
+			BUG("parallel checkout finished with pending entries");
+		case PC_ITEM_FAILED:
+			ret = -1;
+			break;
+		default:
+			BUG("unknown checkout item status in parallel checkout");
+		}
+	}
+
+	return ret;
+}
+
+static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
+			       const char *path)
+{
+	int ret;
+	void *blob;
+	unsigned long size;
+	size_t newsize = 0;
+	struct strbuf buf = STRBUF_INIT;
+	struct checkout_metadata meta;
+
+	/*
+	 * The blob is always loaded in-core: streaming from a packfile is
+	 * not protected by the object read lock.
+	 */
+	blob = read_blob_entry(pc_item->ce, &size);
+	if (!blob)
+		return error("unable to read sha1 file of %s (%s)",
+			     path, oid_to_hex(&pc_item->ce->oid));
+
+	clone_checkout_metadata(&meta, &parallel_checkout.state->meta,
+				&pc_item->ce->oid);
+
+	if (convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name, blob,
+				       size, &buf, &meta)) {
+		free(blob);
+		blob = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	ret = write_in_full(fd, blob, size);
+	free(blob);
+	if (ret < 0)
+		return error("unable to write file '%s'", path);
+
+	return 0;
+}
+
+static void write_pc_item(struct parallel_checkout_item *pc_item)
+{
+	const struct checkout *state = parallel_checkout.state;
+	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
+	int fd, fstat_done;
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_add(&path, state->base_dir, state->base_dir_len);
+	strbuf_add(&path, pc_item->ce->name, pc_item->ce->ce_namelen);
+
+	fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == EISDIR) {
+			/*
+			 * Errors which probably represent a path collision.
+			 * Suppress the error message and mark the item to be
+			 * retried later, sequentially.
+			 */
+			pc_item->status = PC_ITEM_COLLIDED;
+		} else {
+			error_errno("failed to open file '%s'", path.buf);
+			pc_item->status = PC_ITEM_FAILED;
+		}
+		goto out;
+	}
+
+	if (write_pc_item_to_fd(pc_item, fd, path.buf)) {
+		/* Error was already reported. */
+		pc_item->status = PC_ITEM_FAILED;
+		close(fd);
+		unlink(path.buf);
+		goto out;
+	}
+
+	fstat_done = fstat_checkout_output(fd, state, &pc_item->st);
+
+	if (close(fd)) {
+		error_errno("unable to close file '%s'", path.buf);
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	if (state->refresh_cache && !fstat_done && lstat(path.buf, &pc_item->st) < 0) {
+		error_errno("unable to stat just-written file '%s'", path.buf);
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+
+out:
+	strbuf_release(&path);
+}
+
+static struct parallel_checkout_item *next_pc_item(void)
+{
+	struct parallel_checkout_item *pc_item = NULL;
+
+	pthread_mutex_lock(&parallel_checkout.mutex);
+	while (parallel_checkout.next_item < parallel_checkout.nr) {
+		pc_item = &parallel_checkout.items[parallel_checkout.next_item++];
+		if (pc_item->status == PC_ITEM_PENDING)
+			break;
+		pc_item = NULL;
+	}
+	pthread_mutex_unlock(&parallel_checkout.mutex);
+	return pc_item;
+}
+
+static void *checkout_worker(void *data)
+{
+	struct parallel_checkout_item *pc_item;
+
+	while ((pc_item = next_pc_item())) {
+		write_pc_item(pc_item);
+
+		if (pc_item->status == PC_ITEM_WRITTEN) {
+			pthread_mutex_lock(&parallel_checkout.mutex);
+			advance_progress_meter();
+			pthread_mutex_unlock(&parallel_checkout.mutex);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The leading directories of the queued entries were created when the
+ * entries were enqueued. But, in case of path collisions, one of them
+ * could have been replaced by a symlink afterwards, when a colliding
+ * entry was checked out sequentially. Check the leading directories again
+ * before letting the workers write through them. Nothing but regular files
+ * is created while the workers run, so this check cannot go stale.
+ */
+static void mark_collided_leading_dirs(const struct checkout *state)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		const char *dir_sep;
+
+		strbuf_reset(&path);
+		strbuf_add(&path, state->base_dir, state->base_dir_len);
+		strbuf_add(&path, pc_item->ce->name, pc_item->ce->ce_namelen);
+
+		dir_sep = find_last_dir_sep(path.buf);
+		if (dir_sep && !has_dirs_only_path(path.buf, dir_sep - path.buf,
+						   state->base_dir_len))
+			pc_item->status = PC_ITEM_COLLIDED;
+	}
+	strbuf_release(&path);
+}
+
+static void write_items_in_parallel(int num_workers)
+{
+	pthread_t *workers;
+	int i, err;
+
+	ALLOC_ARRAY(workers, num_workers);
+	pthread_mutex_init(&parallel_checkout.mutex, NULL);
+	enable_obj_read_lock();
+
+	for (i = 0; i < num_workers; i++) {
+		err = pthread_create(&workers[i], NULL, checkout_worker, NULL);
+		if (err)
+			die(_("unable to create checkout worker thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < num_workers; i++) {
+		if (pthread_join(workers[i], NULL))
+			die(_("unable to join checkout worker thread"));
+	}
+
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&parallel_checkout.mutex);
+	free(workers);
+}
+
+static void write_items_sequentially(void)
+{
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		if (pc_item->status != PC_ITEM_PENDING)
+			continue;
+		write_pc_item(pc_item);
+		if (pc_item->status == PC_ITEM_WRITTEN)
+			advance_progress_meter();
+	}
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold,
+			  struct progress *progress, unsigned int *progress_cnt)
+{
+	int ret;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		BUG("cannot run parallel checkout: uninitialized or already running");
+
+	parallel_checkout.status = PC_RUNNING;
+	parallel_checkout.state = state;
+	parallel_checkout.progress = progress;
+	parallel_checkout.progress_cnt = progress_cnt;
+
+	if (parallel_checkout.nr < (size_t)num_workers)
+		num_workers = parallel_checkout.nr;
+	if (parallel_checkout.nr < (size_t)threshold)
+		num_workers = 1;
+
+	trace2_data_intmax("pcheckout", NULL, "workers", num_workers);
+	trace2_region_enter("pcheckout", "run_parallel_checkout", NULL);
+
+	mark_collided_leading_dirs(state);
+
+	if (num_workers <= 1)
+		write_items_sequentially();
+	else
+		write_items_in_parallel(num_workers);
+
+	ret = handle_results(state);
+
+	trace2_region_leave("pcheckout", "run_parallel_checkout", NULL);
+	finish_parallel_checkout();
+	return ret;
+}
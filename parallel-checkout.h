@@ -0,0 +1,61 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct cache_entry;
+struct checkout;
+struct conv_attrs;
+struct progress;
+
+/****************************************************************
+ * Parallel checkout
+ *
+ * Regular files which need no external filter can be written by a
+ * pool of worker threads. The caller queues them up through
+ * checkout_entry() (which calls enqueue_checkout()), and then
+ * run_parallel_checkout() reads, smudges and writes the queued
+ * entries concurrently. Entries which collide with each other on the
+ * filesystem are detected by the workers and written sequentially
+ * afterwards, so that mark_colliding_entries() still sees them.
+ ****************************************************************/
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING,
+};
+
+enum pc_status parallel_checkout_status(void);
+
+/*
+ * Read the "checkout.workers" and "checkout.thresholdForParallelism"
+ * settings. A number of workers of 1 (the default) means that parallel
+ * checkout is disabled.
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Put parallel checkout into the PC_ACCEPTING_ENTRIES state. Should be used
+ * only when in the PC_UNINITIALIZED state.
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Return -1 if parallel checkout is currently not accepting entries or if
+ * the entry is not eligible for parallel checkout. Otherwise, enqueue the
+ * entry for later write and return 0.
+ */
+int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca);
+
+/* Return the number of entries queued so far. */
+size_t pc_queue_size(void);
+
+/*
+ * Write all the queued entries, returning 0 on success. If the number of
+ * entries is smaller than the given threshold, the entries are written
+ * sequentially. The progress meter, if any, is advanced from
+ * *progress_cnt as entries are written.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold,
+			  struct progress *progress, unsigned int *progress_cnt);
+
+#endif /* PARALLEL_CHECKOUT_H */
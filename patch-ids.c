@@ -1,7 +1,11 @@
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "commit.h"
+#include "blob.h"
+#include "object-store.h"
 #include "sha1-lookup.h"
+#include "notes-cache.h"
 #include "patch-ids.h"
 
 static int patch_id_defined(struct commit *commit)
@@ -25,6 +29,138 @@ int commit_patch_id(struct commit *commit, struct diff_options *options,
 	return diff_flush_patch_id(options, oid, diff_header_only, stable);
 }
 
+/*
+ * The patch id of a commit depends on its tree, the tree of its parent
+ * and the order of the files in the diff.  The other options used by
+ * patch_ids are fixed, and the patch-id diff ignores diff.algorithm and
+ * friends.  So the cache maps a commit to
+ * "<patch-id> <parent-tree> <tree>" and an entry is only used when both
+ * trees still match, e.g. after grafts or replace refs changed what the
+ * commit looks like, and a diff.orderFile is recorded by the hash of
+ * its contents in the validity string of the whole cache.  Changes to
+ * the attributes deciding whether a file is binary do not invalidate
+ * the cache.
+ */
+static struct notes_cache *patch_id_cache(struct patch_ids *ids,
+					  int diff_header_only)
+{
+	struct notes_cache **c;
+
+	/* patch ids limited to a pathspec are not worth keeping */
+	if (!ids->want_cache || ids->diffopts.pathspec.nr)
+		return NULL;
+
+	c = diff_header_only ? &ids->header_cache : &ids->full_cache;
+	if (!*c) {
+		const char *kind = diff_header_only ? "header" : "full";
+		const char *orderfile = ids->diffopts.orderfile;
+		struct strbuf validity = STRBUF_INIT;
+		struct strbuf name = STRBUF_INIT;
+
+		strbuf_addf(&validity, "patch-id cache v1 %s", kind);
+		if (orderfile) {
+			struct strbuf order = STRBUF_INIT;
+			struct object_id oid;
+
+			if (strbuf_read_file(&order, orderfile, 0) < 0) {
+				/* diffcore_order() will complain */
+				strbuf_release(&order);
+				strbuf_release(&validity);
+				return NULL;
+			}
+			hash_object_file(the_hash_algo, order.buf, order.len,
+					 blob_type, &oid);
+			strbuf_addf(&validity, " order %s", oid_to_hex(&oid));
+			strbuf_release(&order);
+		}
+		strbuf_addf(&name, "patch-id/%s", kind);
+		*c = xmalloc(sizeof(**c));
+		notes_cache_init(ids->diffopts.repo, *c, name.buf,
+				 validity.buf);
+		strbuf_release(&name);
+		strbuf_release(&validity);
+	}
+	return *c;
+}
+
+static int patch_id_trees(struct repository *r, struct commit *commit,
+			  struct object_id *old_tree, struct object_id *new_tree)
+{
+	if (repo_parse_commit(r, commit))
+		return -1;
+	oidcpy(new_tree, get_commit_tree_oid(commit));
+	if (!commit->parents) {
+		oidclr(old_tree);
+		return 0;
+	}
+	if (repo_parse_commit(r, commit->parents->item))
+		return -1;
+	oidcpy(old_tree, get_commit_tree_oid(commit->parents->item));
+	return 0;
+}
+
+static int cached_patch_id(struct patch_ids *ids, struct commit *commit,
+			   struct object_id *oid, int diff_header_only)
+{
+	struct notes_cache *c = patch_id_cache(ids, diff_header_only);
+	struct object_id old_tree, new_tree, id, tree;
+	const char *p;
+	char *value;
+	size_t size;
+	int ret = -1;
+
+	if (!c ||
+	    patch_id_trees(ids->diffopts.repo, commit, &old_tree, &new_tree))
+		return -1;
+	value = notes_cache_get(c, &commit->object.oid, &size);
+	if (!value)
+		return -1;
+
+	if (!parse_oid_hex(value, &id, &p) && *p++ == ' ' &&
+	    !parse_oid_hex(p, &tree, &p) && oideq(&tree, &old_tree) &&
+	    *p++ == ' ' &&
+	    !parse_oid_hex(p, &tree, &p) && oideq(&tree, &new_tree)) {
+		oidcpy(oid, &id);
+		ret = 0;
+	}
+	free(value);
+	return ret;
+}
+
+static void cache_patch_id(struct patch_ids *ids, struct commit *commit,
+			   const struct object_id *oid, int diff_header_only)
+{
+	struct notes_cache *c = patch_id_cache(ids, diff_header_only);
+	struct object_id old_tree, new_tree;
+	struct strbuf value = STRBUF_INIT;
+
+	if (!c ||
+	    patch_id_trees(ids->diffopts.repo, commit, &old_tree, &new_tree))
+		return;
+	strbuf_addf(&value, "%s", oid_to_hex(oid));
+	strbuf_addf(&value, " %s", oid_to_hex(&old_tree));
+	strbuf_addf(&value, " %s\n", oid_to_hex(&new_tree));
+	notes_cache_put(c, &commit->object.oid, value.buf, value.len);
+	strbuf_release(&value);
+}
+
+/*
+ * Like commit_patch_id(), but consults (and fills) the patch-id cache
+ * of ids first.
+ */
+static int patch_ids_commit_patch_id(struct patch_ids *ids,
+				     struct commit *commit,
+				     struct object_id *oid,
+				     int diff_header_only)
+{
+	if (!cached_patch_id(ids, commit, oid, diff_header_only))
+		return 0;
+	if (commit_patch_id(commit, &ids->diffopts, oid, diff_header_only, 0))
+		return -1;
+	cache_patch_id(ids, commit, oid, diff_header_only);
+	return 0;
+}
+
 /*
  * When we cannot load the full patch-id for both commits for whatever
  * reason, the function returns -1 (i.e. return error(...)). Despite
@@ -41,18 +177,18 @@ static int patch_id_neq(const void *cmpfn_data,
 			const void *unused_keydata)
 {
 	/* NEEDSWORK: const correctness? */
-	struct diff_options *opt = (void *)cmpfn_data;
+	struct patch_ids *ids = (void *)cmpfn_data;
 	struct patch_id *a, *b;
 
 	a = container_of(eptr, struct patch_id, ent);
 	b = container_of(entry_or_key, struct patch_id, ent);
 
 	if (is_null_oid(&a->patch_id) &&
-	    commit_patch_id(a->commit, opt, &a->patch_id, 0, 0))
+	    patch_ids_commit_patch_id(ids, a->commit, &a->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&a->commit->object.oid));
 	if (is_null_oid(&b->patch_id) &&
-	    commit_patch_id(b->commit, opt, &b->patch_id, 0, 0))
+	    patch_ids_commit_patch_id(ids, b->commit, &b->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&b->commit->object.oid));
 	return !oideq(&a->patch_id, &b->patch_id);
@@ -65,12 +201,25 @@ int init_patch_ids(struct repository *r, struct patch_ids *ids)
 	ids->diffopts.detect_rename = 0;
 	ids->diffopts.flags.recursive = 1;
 	diff_setup_done(&ids->diffopts);
-	hashmap_init(&ids->patches, patch_id_neq, &ids->diffopts, 256);
+	hashmap_init(&ids->patches, patch_id_neq, ids, 256);
+	repo_config_get_bool(r, "diff.cachepatchids", &ids->want_cache);
 	return 0;
 }
 
+static void free_patch_id_cache(struct notes_cache *c)
+{
+	if (!c)
+		return;
+	notes_cache_write(c);
+	free_notes(&c->tree);
+	free(c->validity);
+	free(c);
+}
+
 int free_patch_ids(struct patch_ids *ids)
 {
+	free_patch_id_cache(ids->header_cache);
+	free_patch_id_cache(ids->full_cache);
 	hashmap_free_entries(&ids->patches, struct patch_id, ent);
 	return 0;
 }
@@ -82,7 +231,7 @@ static int init_patch_id_entry(struct patch_id *patch,
 	struct object_id header_only_patch_id;
 
 	patch->commit = commit;
-	if (commit_patch_id(commit, &ids->diffopts, &header_only_patch_id, 1, 0))
+	if (patch_ids_commit_patch_id(ids, commit, &header_only_patch_id, 1))
 		return -1;
 
 	hashmap_entry_init(&patch->ent, oidhash(&header_only_patch_id));
@@ -5,6 +5,7 @@
 #include "hashmap.h"
 
 struct commit;
+struct notes_cache;
 struct object_id;
 struct repository;
 
@@ -17,6 +18,14 @@ struct patch_id {
 struct patch_ids {
 	struct hashmap patches;
 	struct diff_options diffopts;
+
+	/*
+	 * Patch ids computed earlier, kept in notes refs when
+	 * diff.cachePatchIds is set; see patch_id_cache().
+	 */
+	int want_cache;
+	struct notes_cache *header_cache;
+	struct notes_cache *full_cache;
 };
 
 int commit_patch_id(struct commit *commit, struct diff_options *options,
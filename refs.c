@@ -1752,12 +1752,15 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
  * gitdir.
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					const char *be_name,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	if (!be_name)
+		be_name = "files";
+	be = find_ref_storage_backend(be_name);
 	if (!be)
 		BUG("reference backend %s is unknown", be_name);
 
@@ -1773,7 +1776,8 @@ struct ref_store *get_main_ref_store(struct repository *r)
 	if (!r->gitdir)
 		BUG("attempting to get main_ref_store outside of repository");
 
-	r->refs_private = ref_store_init(r->gitdir, REF_STORE_ALL_CAPS);
+	r->refs_private = ref_store_init(r->gitdir, r->ref_storage_format,
+					 REF_STORE_ALL_CAPS);
 	r->refs_private = maybe_debug_wrap_ref_store(r->gitdir, r->refs_private);
 	return r->refs_private;
 }
@@ -1797,10 +1801,31 @@ static void register_ref_store_map(struct hashmap *map,
 		BUG("%s ref_store '%s' initialized twice", type, name);
 }
 
+/*
+ * Return the reference storage format of the repository whose gitdir
+ * is `gitdir`, or NULL for the default.
+ */
+static char *read_ref_storage_format(const char *gitdir)
+{
+	struct repository_format format = REPOSITORY_FORMAT_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	char *ret;
+
+	get_common_dir_noenv(&sb, gitdir);
+	strbuf_addstr(&sb, "/config");
+	read_repository_format(&format, sb.buf);
+	ret = xstrdup_or_null(format.ref_storage_format);
+
+	clear_repository_format(&format);
+	strbuf_release(&sb);
+	return ret;
+}
+
 struct ref_store *get_submodule_ref_store(const char *submodule)
 {
 	struct strbuf submodule_sb = STRBUF_INIT;
 	struct ref_store *refs;
+	char *format;
 	char *to_free = NULL;
 	size_t len;
 
@@ -1829,8 +1854,10 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 		goto done;
 
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
+	format = read_ref_storage_format(submodule_sb.buf);
+	refs = ref_store_init(submodule_sb.buf, format,
 			      REF_STORE_READ | REF_STORE_ODB);
+	free(format);
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
@@ -1856,9 +1883,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
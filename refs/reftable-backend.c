@@ -0,0 +1,1934 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../object.h"
+#include "../worktree.h"
+#include "../chdir-notify.h"
+#include "../dir.h"
+
+/*
+ * Flags that can be set in `ref_update::flags`, in addition to the
+ * REF_NO_DEREF, REF_FORCE_CREATE_REFLOG, REF_HAVE_NEW, REF_HAVE_OLD
+ * and REF_LOG_ONLY flags. They use the same values as their files
+ * backend counterparts.
+ */
+
+/* The reference is to be deleted. */
+#define REF_DELETING (1 << 5)
+
+/* The reference has to be written to the new table. */
+#define REF_NEEDS_COMMIT (1 << 6)
+
+/* The update was split off from an update of HEAD. */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+/*
+ * A reference store keeping its references in reftable stacks: one in
+ * "$GIT_COMMON_DIR/reftable" for the shared references and, for linked
+ * worktrees, one in "$GIT_DIR/reftable" for HEAD and the per-worktree
+ * references. Pseudorefs other than HEAD (ORIG_HEAD, MERGE_HEAD, ...)
+ * are written by all sorts of commands as plain files, so they are
+ * left to a files ref store.
+ */
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitcommondir;
+	struct reftable_write_options write_options;
+
+	struct reftable_stack main_stack;
+	/* NULL unless this is the store of a linked worktree. */
+	struct reftable_stack *worktree_stack;
+	/* The stacks of other worktrees, opened on demand. */
+	struct string_list other_worktree_stacks;
+
+	struct ref_store *files_store;
+};
+
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static void init_stack(struct reftable_ref_store *refs,
+		       struct reftable_stack *st, const char *dir)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_add_absolute_path(&path, dir);
+	strbuf_addstr(&path, "/reftable");
+	reftable_stack_init(st, path.buf, &refs->write_options);
+	strbuf_release(&path);
+}
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+	unsigned long block_size;
+	int value;
+
+	ref_store->gitdir = xstrdup(gitdir);
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	if (!git_config_get_ulong("reftable.blocksize", &block_size)) {
+		if (block_size > 0xffffff)
+			die(_("reftable.blockSize must not exceed 16777215"));
+		refs->write_options.block_size = block_size;
+	}
+	if (!git_config_get_int("reftable.restartinterval", &value)) {
+		if (value <= 0 || value > 0xffff)
+			die(_("reftable.restartInterval must be between 1 and 65535"));
+		refs->write_options.restart_interval = value;
+	}
+	if (!git_config_get_bool("reftable.autocompaction", &value))
+		refs->write_options.disable_auto_compact = !value;
+	refs->write_options.lock_timeout_ms = get_files_ref_lock_timeout_ms();
+
+	init_stack(refs, &refs->main_stack, refs->gitcommondir);
+	if (strcmp(gitdir, refs->gitcommondir)) {
+		refs->worktree_stack = xmalloc(sizeof(*refs->worktree_stack));
+		init_stack(refs, refs->worktree_stack, gitdir);
+	}
+	string_list_init(&refs->other_worktree_stacks, 1);
+
+	refs->files_store = refs_be_files.init(gitdir, flags);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->base.gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	return ref_store;
+}
+
+static struct reftable_stack *other_worktree_stack(struct reftable_ref_store *refs,
+						   const char *id, int len)
+{
+	struct string_list_item *item;
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_add(&sb, id, len);
+	item = string_list_insert(&refs->other_worktree_stacks, sb.buf);
+	if (!item->util) {
+		struct reftable_stack *st = xmalloc(sizeof(*st));
+
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/worktrees/%.*s", refs->gitcommondir,
+			    len, id);
+		init_stack(refs, st, sb.buf);
+		item->util = st;
+	}
+	strbuf_release(&sb);
+	return item->util;
+}
+
+/*
+ * Return the stack holding `refname` and set `*name` to the name of the
+ * reference within that stack, or return NULL if the reference is a
+ * pseudoref that lives in the files store.
+ */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname,
+					const char **name)
+{
+	const char *worktree_name;
+	int len;
+
+	*name = refname;
+
+	switch (ref_type(refname)) {
+	case REF_TYPE_PSEUDOREF:
+		if (strcmp(refname, "HEAD"))
+			return NULL;
+		/* fallthrough */
+	case REF_TYPE_PER_WORKTREE:
+		if (refs->worktree_stack)
+			return refs->worktree_stack;
+		return &refs->main_stack;
+	case REF_TYPE_MAIN_PSEUDOREF:
+	case REF_TYPE_OTHER_PSEUDOREF:
+		if (parse_worktree_ref(refname, &worktree_name, &len, name))
+			BUG("refname %s is not a other-worktree ref", refname);
+		if (strcmp(*name, "HEAD"))
+			return NULL;
+		if (!worktree_name)
+			return &refs->main_stack;
+		return other_worktree_stack(refs, worktree_name, len);
+	case REF_TYPE_NORMAL:
+		return &refs->main_stack;
+	}
+	BUG("unknown ref type %d of ref %s", ref_type(refname), refname);
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct reftable_stack *st;
+	const char *name;
+	int ret;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return refs_read_raw_ref(refs->files_store, refname, oid,
+					 referent, type);
+
+	*type = 0;
+	if (reftable_stack_reload(st)) {
+		errno = EIO;
+		return -1;
+	}
+
+	ret = reftable_stack_read_ref(st, name, &rec);
+	if (ret) {
+		reftable_ref_record_release(&rec);
+		errno = ret > 0 ? ENOENT : EIO;
+		return -1;
+	}
+
+	if (rec.value_type == REFTABLE_REF_SYMREF) {
+		/* `refname` might point into `referent`. */
+		strbuf_reset(referent);
+		strbuf_addbuf(referent, &rec.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &rec.value);
+	}
+	reftable_ref_record_release(&rec);
+	return 0;
+}
+
+/* Which references of a stack a ref iterator should produce. */
+enum iterator_filter {
+	FILTER_NONE,
+	FILTER_SHARED,		/* the main stack of a linked worktree */
+	FILTER_PER_WORKTREE	/* the stack of a linked worktree */
+};
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iterator *iter;
+	struct reftable_ref_record rec;
+	struct object_id oid;
+	unsigned int flags;
+	enum iterator_filter filter;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ok = ITER_DONE, ret = 0;
+
+	while (iter->iter &&
+	       !(ret = reftable_iterator_next_ref(iter->iter, &iter->rec))) {
+		const char *refname = iter->rec.refname.buf;
+		int flags = 0;
+
+		/* HEAD lives in the same stack, but is not iterated over. */
+		if (!starts_with(refname, "refs/"))
+			continue;
+
+		switch (iter->filter) {
+		case FILTER_NONE:
+			break;
+		case FILTER_SHARED:
+			if (ref_type(refname) == REF_TYPE_PER_WORKTREE)
+				continue;
+			break;
+		case FILTER_PER_WORKTREE:
+			if (ref_type(refname) != REF_TYPE_PER_WORKTREE)
+				continue;
+			break;
+		}
+
+		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		    ref_type(refname) != REF_TYPE_PER_WORKTREE)
+			continue;
+
+		if (iter->rec.value_type == REFTABLE_REF_SYMREF) {
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, &flags)) {
+				oidclr(&iter->oid);
+				flags |= REF_ISSYMREF | REF_ISBROKEN;
+			}
+		} else {
+			oidcpy(&iter->oid, &iter->rec.value);
+		}
+
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(refname))
+				die("loose refname is dangerous: %s", refname);
+			oidclr(&iter->oid);
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid, flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (!iter->iter || ret < 0)
+		ok = ITER_ERROR;
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->rec.value_type == REFTABLE_REF_VAL2) {
+		oidcpy(peeled, &iter->rec.peeled);
+		return 0;
+	}
+	if (iter->rec.value_type == REFTABLE_REF_VAL1 &&
+	    !(iter->base.flags & REF_ISBROKEN))
+		return peel_object(&iter->oid, peeled) ? -1 : 0;
+	return -1;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iterator_free(iter->iter);
+	reftable_ref_record_release(&iter->rec);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(struct reftable_ref_store *refs,
+						     struct reftable_stack *st,
+						     const char *prefix,
+						     unsigned int flags,
+						     enum iterator_filter filter)
+{
+	struct reftable_ref_iterator *iter;
+	struct reftable_ref_record rec_init = REFTABLE_REF_RECORD_INIT;
+
+	/* Only references under "refs/" are iterated over. */
+	if (!starts_with(prefix, "refs/")) {
+		if (!starts_with("refs/", prefix))
+			return empty_ref_iterator_begin();
+		prefix = "refs/";
+	}
+
+	iter = xcalloc(1, sizeof(*iter));
+	base_ref_iterator_init(&iter->base, &reftable_ref_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->rec = rec_init;
+	iter->flags = flags;
+	iter->filter = filter;
+
+	/* A NULL `iter->iter` makes the first advance fail. */
+	if (!reftable_stack_reload(st))
+		iter->iter = reftable_stack_iterate_refs(st, prefix);
+
+	return &iter->base;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+
+	refs = reftable_downcast(ref_store, required_flags,
+				 "ref_iterator_begin");
+
+	if (!prefix)
+		prefix = "";
+	if (!refs->worktree_stack)
+		return stack_ref_iterator_begin(refs, &refs->main_stack,
+						prefix, flags, FILTER_NONE);
+
+	/* The two stacks hold disjoint sets of references. */
+	return overlay_ref_iterator_begin(
+			stack_ref_iterator_begin(refs, refs->worktree_stack,
+						 prefix, flags,
+						 FILTER_PER_WORKTREE),
+			stack_ref_iterator_begin(refs, &refs->main_stack,
+						 prefix, flags, FILTER_SHARED));
+}
+
+/*
+ * Read the reflog of `name` from `st`, newest entry first.
+ */
+static int read_reflog(struct reftable_stack *st, const char *name,
+		       struct reftable_log_record **logs, size_t *nr)
+{
+	struct reftable_iterator *it;
+	size_t alloc = 0;
+	int ret;
+
+	*logs = NULL;
+	*nr = 0;
+
+	it = reftable_stack_iterate_logs(st, name);
+	if (!it)
+		return -1;
+	for (;;) {
+		struct reftable_log_record rec = REFTABLE_LOG_RECORD_INIT;
+
+		ret = reftable_iterator_next_log(it, &rec);
+		if (ret) {
+			reftable_log_record_release(&rec);
+			break;
+		}
+		ALLOC_GROW(*logs, *nr + 1, alloc);
+		(*logs)[(*nr)++] = rec;
+	}
+	reftable_iterator_free(it);
+	return ret < 0 ? -1 : 0;
+}
+
+static void free_reflog(struct reftable_log_record *logs, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+}
+
+/*
+ * A reflog cannot be empty; reflogs created without an update (as with
+ * "git branch --create-reflog") start with an entry between two null
+ * object names, which we do not show.
+ */
+static int is_reflog_marker(const struct reftable_log_record *log)
+{
+	return is_null_oid(&log->old_oid) && is_null_oid(&log->new_oid);
+}
+
+static int should_write_log(struct reftable_stack *st, const char *name,
+			    unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	if ((flags & REF_FORCE_CREATE_REFLOG) || should_autocreate_reflog(name))
+		return 1;
+	return reftable_stack_has_log(st, name) > 0;
+}
+
+/*
+ * The records of a table about to be written. They are sorted before
+ * being written.
+ */
+struct table_data {
+	struct reftable_ref_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record *logs;
+	size_t logs_nr, logs_alloc;
+
+	/* The committer of new reflog entries. */
+	struct strbuf name;
+	struct strbuf email;
+	timestamp_t time;
+	int tz_offset;
+};
+
+#define TABLE_DATA_INIT { \
+	.name = STRBUF_INIT, \
+	.email = STRBUF_INIT, \
+}
+
+static void table_data_release(struct table_data *data)
+{
+	size_t i;
+
+	for (i = 0; i < data->refs_nr; i++)
+		reftable_ref_record_release(&data->refs[i]);
+	FREE_AND_NULL(data->refs);
+	data->refs_nr = data->refs_alloc = 0;
+	free_reflog(data->logs, data->logs_nr);
+	data->logs = NULL;
+	data->logs_nr = data->logs_alloc = 0;
+	strbuf_release(&data->name);
+	strbuf_release(&data->email);
+}
+
+static void table_data_set_committer(struct table_data *data)
+{
+	const char *info = git_committer_info(0);
+	struct ident_split ident;
+
+	if (split_ident_line(&ident, info, strlen(info)) ||
+	    !ident.date_begin || !ident.tz_begin)
+		BUG("unable to parse committer ident '%s'", info);
+
+	strbuf_reset(&data->name);
+	strbuf_add(&data->name, ident.name_begin,
+		   ident.name_end - ident.name_begin);
+	strbuf_reset(&data->email);
+	strbuf_add(&data->email, ident.mail_begin,
+		   ident.mail_end - ident.mail_begin);
+	data->time = parse_timestamp(ident.date_begin, NULL, 10);
+	data->tz_offset = strtol(ident.tz_begin, NULL, 10);
+}
+
+static struct reftable_ref_record *add_ref(struct table_data *data,
+					   const char *name,
+					   uint64_t update_index)
+{
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+
+	strbuf_addstr(&rec.refname, name);
+	rec.update_index = update_index;
+	ALLOC_GROW(data->refs, data->refs_nr + 1, data->refs_alloc);
+	data->refs[data->refs_nr] = rec;
+	return &data->refs[data->refs_nr++];
+}
+
+/* Add a record making `name` point at `oid`, peeled if possible. */
+static void add_ref_value(struct table_data *data, const char *name,
+			  uint64_t update_index, const struct object_id *oid)
+{
+	struct reftable_ref_record *rec = add_ref(data, name, update_index);
+
+	oidcpy(&rec->value, oid);
+	if (peel_object(oid, &rec->peeled) == PEEL_PEELED)
+		rec->value_type = REFTABLE_REF_VAL2;
+	else
+		rec->value_type = REFTABLE_REF_VAL1;
+}
+
+static struct reftable_log_record *add_log(struct table_data *data,
+					   const char *name,
+					   uint64_t update_index)
+{
+	struct reftable_log_record rec = REFTABLE_LOG_RECORD_INIT;
+
+	strbuf_addstr(&rec.refname, name);
+	rec.update_index = update_index;
+	ALLOC_GROW(data->logs, data->logs_nr + 1, data->logs_alloc);
+	data->logs[data->logs_nr] = rec;
+	return &data->logs[data->logs_nr++];
+}
+
+static void add_log_update(struct table_data *data, const char *name,
+			   uint64_t update_index,
+			   const struct object_id *old_oid,
+			   const struct object_id *new_oid,
+			   const char *msg)
+{
+	struct reftable_log_record *rec = add_log(data, name, update_index);
+
+	rec->value_type = REFTABLE_LOG_UPDATE;
+	oidcpy(&rec->old_oid, old_oid);
+	oidcpy(&rec->new_oid, new_oid);
+	strbuf_addbuf(&rec->name, &data->name);
+	strbuf_addbuf(&rec->email, &data->email);
+	rec->time = data->time;
+	rec->tz_offset = data->tz_offset;
+	if (msg)
+		strbuf_addstr(&rec->message, msg);
+	strbuf_addch(&rec->message, '\n');
+}
+
+static struct reftable_log_record *add_log_copy(struct table_data *data,
+						const char *name,
+						uint64_t update_index,
+						const struct reftable_log_record *log)
+{
+	struct reftable_log_record *rec = add_log(data, name, update_index);
+
+	rec->value_type = log->value_type;
+	oidcpy(&rec->old_oid, &log->old_oid);
+	oidcpy(&rec->new_oid, &log->new_oid);
+	strbuf_addbuf(&rec->name, &log->name);
+	strbuf_addbuf(&rec->email, &log->email);
+	rec->time = log->time;
+	rec->tz_offset = log->tz_offset;
+	strbuf_addbuf(&rec->message, &log->message);
+	return rec;
+}
+
+static void add_log_deletion(struct table_data *data, const char *name,
+			     uint64_t update_index)
+{
+	add_log(data, name, update_index)->value_type = REFTABLE_LOG_DELETION;
+}
+
+static int ref_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_ref_record *a = va, *b = vb;
+
+	return strcmp(a->refname.buf, b->refname.buf);
+}
+
+static int log_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a = va, *b = vb;
+	int cmp = strcmp(a->refname.buf, b->refname.buf);
+
+	if (cmp)
+		return cmp;
+	/* Newest first. */
+	if (a->update_index != b->update_index)
+		return a->update_index < b->update_index ? 1 : -1;
+	return 0;
+}
+
+static int write_table_data(struct reftable_writer *writer, void *cb_data)
+{
+	struct table_data *data = cb_data;
+	size_t i;
+
+	QSORT(data->refs, data->refs_nr, ref_record_cmp);
+	QSORT(data->logs, data->logs_nr, log_record_cmp);
+
+	for (i = 0; i < data->refs_nr; i++)
+		if (reftable_writer_add_ref(writer, &data->refs[i]))
+			return -1;
+	for (i = 0; i < data->logs_nr; i++)
+		if (reftable_writer_add_log(writer, &data->logs[i]))
+			return -1;
+	return 0;
+}
+
+/*
+ * Lock `st`, write a table with the records of `data` covering the
+ * update indices starting at the next one and going up by `extra`,
+ * and commit it.
+ */
+static int write_single_table(struct reftable_stack *st,
+			      struct reftable_addition *add,
+			      struct table_data *data, uint64_t extra)
+{
+	uint64_t index = add->next_update_index;
+	int ret;
+
+	ret = reftable_addition_add(add, index, index + extra,
+				    write_table_data, data);
+	if (!ret)
+		ret = reftable_addition_commit(add);
+	return ret;
+}
+
+struct write_stack {
+	struct reftable_stack *stack;
+	struct reftable_addition add;
+};
+
+struct reftable_transaction_data {
+	struct write_stack *stacks;
+	size_t stacks_nr, stacks_alloc;
+
+	/* For pseudorefs, which are kept in the files store. */
+	struct ref_transaction *files_transaction;
+};
+
+/* The `backend_data` of each update of a reftable stack. */
+struct reftable_update {
+	size_t stack;
+	const char *name;
+	struct object_id old_oid;
+	unsigned int exists : 1;
+};
+
+static int lock_stack(struct reftable_transaction_data *data,
+		      struct reftable_stack *st, size_t *index,
+		      struct strbuf *err)
+{
+	struct reftable_addition add_init = REFTABLE_ADDITION_INIT;
+	struct write_stack *ws;
+	size_t i;
+
+	for (i = 0; i < data->stacks_nr; i++) {
+		if (data->stacks[i].stack == st) {
+			*index = i;
+			return 0;
+		}
+	}
+
+	ALLOC_GROW(data->stacks, data->stacks_nr + 1, data->stacks_alloc);
+	ws = &data->stacks[data->stacks_nr];
+	ws->stack = st;
+	ws->add = add_init;
+	if (reftable_stack_lock(st, &ws->add, err))
+		return -1;
+	*index = data->stacks_nr++;
+	return 0;
+}
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	struct strbuf err = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	if (data) {
+		for (i = 0; i < data->stacks_nr; i++)
+			reftable_addition_release(&data->stacks[i].add);
+		free(data->stacks);
+
+		if (data->files_transaction &&
+		    ref_transaction_abort(data->files_transaction, &err)) {
+			error("error aborting transaction: %s", err.buf);
+			strbuf_release(&err);
+		}
+		free(data);
+		transaction->backend_data = NULL;
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Turn it into a REF_LOG_ONLY update and add a
+ * separate update for the referent.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * Prepare for carrying out update: lock the stack holding the
+ * reference, read the reference and check its old value, split up
+ * updates of symrefs and HEAD's referent, and check that the new value
+ * is valid. Updates of pseudorefs are passed on to the files store.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct reftable_transaction_data *data,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct strbuf reason = STRBUF_INIT;
+	struct reftable_update *ud;
+	struct reftable_stack *st;
+	const char *name;
+	int ret;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			return ret;
+	}
+
+	st = stack_for(refs, update->refname, &name);
+	if (!st) {
+		if (!data->files_transaction) {
+			data->files_transaction =
+				ref_store_transaction_begin(refs->files_store,
+							    err);
+			if (!data->files_transaction)
+				return TRANSACTION_GENERIC_ERROR;
+		}
+		ref_transaction_add_update(data->files_transaction,
+					   update->refname,
+					   update->flags & (REF_NO_DEREF |
+							    REF_FORCE_CREATE_REFLOG |
+							    REF_HAVE_NEW |
+							    REF_HAVE_OLD |
+							    REF_LOG_ONLY),
+					   &update->new_oid, &update->old_oid,
+					   update->msg);
+		return 0;
+	}
+
+	ud = xcalloc(1, sizeof(*ud));
+	ud->name = name;
+	update->backend_data = ud;
+
+	if (lock_stack(data, st, &ud->stack, &reason)) {
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update), reason.buf);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+
+	ret = reftable_stack_read_ref(st, name, &rec);
+	if (ret < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "error reading reference",
+			    original_update_refname(update));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+	ud->exists = !ret;
+	ret = 0;
+
+	if (!ud->exists && (update->flags & REF_HAVE_OLD) &&
+	    !is_null_oid(&update->old_oid)) {
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "unable to resolve reference '%s'",
+			    original_update_refname(update), update->refname);
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+
+	if (ud->exists && rec.value_type == REFTABLE_REF_SYMREF) {
+		update->type |= REF_ISSYMREF;
+		if (!(update->flags & REF_NO_DEREF)) {
+			/*
+			 * The old value is recorded and checked when
+			 * the split-off update is processed.
+			 */
+			ret = split_symref_update(update, rec.target.buf,
+						  transaction,
+						  affected_refnames, err);
+			goto out;
+		}
+
+		if (refs_read_ref_full(&refs->base, rec.target.buf, 0,
+				       &ud->old_oid, NULL)) {
+			if (update->flags & REF_HAVE_OLD) {
+				strbuf_addf(err, "cannot lock ref '%s': "
+					    "error reading reference",
+					    original_update_refname(update));
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else if (check_old_oid(update, &ud->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (ud->exists)
+			oidcpy(&ud->old_oid, &rec.value);
+		if (check_old_oid(update, &ud->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_update *parent_ud =
+				parent_update->backend_data;
+			oidcpy(&parent_ud->old_oid, &ud->old_oid);
+		}
+	}
+
+	if (!(update->flags & REF_HAVE_NEW) ||
+	    (update->flags & (REF_DELETING | REF_LOG_ONLY)))
+		goto out;
+
+	if (!ud->exists &&
+	    refs_verify_refname_available(&refs->base, update->refname,
+					  affected_refnames, NULL, &reason)) {
+		strbuf_addf(err, "cannot lock ref '%s': %s",
+			    original_update_refname(update), reason.buf);
+		ret = TRANSACTION_NAME_CONFLICT;
+		goto out;
+	}
+
+	if (ud->exists && !(update->type & REF_ISSYMREF) &&
+	    oideq(&ud->old_oid, &update->new_oid)) {
+		/*
+		 * The reference already has the desired value, so we
+		 * don't need to write it.
+		 */
+	} else {
+		struct object *o = parse_object(the_repository,
+						&update->new_oid);
+
+		if (!o) {
+			strbuf_addf(err, "cannot update ref '%s': "
+				    "trying to write ref '%s' with nonexistent object %s",
+				    update->refname, update->refname,
+				    oid_to_hex(&update->new_oid));
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		if (o->type != OBJ_COMMIT && is_branch(update->refname)) {
+			strbuf_addf(err, "cannot update ref '%s': "
+				    "trying to write non-commit object %s to branch '%s'",
+				    update->refname, oid_to_hex(&update->new_oid),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		update->flags |= REF_NEEDS_COMMIT;
+	}
+
+out:
+	reftable_ref_record_release(&rec);
+	strbuf_release(&reason);
+	return ret;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_data *data;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	data = xcalloc(1, sizeof(*data));
+	transaction->backend_data = data;
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	/*
+	 * Fail if a refname appears more than once in the transaction.
+	 * (If we end up splitting up any updates, those functions check
+	 * that the new updates don't have the same refname as any
+	 * existing ones.)
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * As in the files backend, a direct update of the branch HEAD
+	 * points to is logged in HEAD's reflog, too.
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/*
+	 * Lock the stacks, verify old values and check the new ones.
+	 * Note that prepare_update() might append more updates to the
+	 * transaction.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, data, transaction->updates[i],
+				     transaction, head_ref,
+				     &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+	if (data->files_transaction) {
+		ret = ref_transaction_prepare(data->files_transaction, err);
+		if (ret) {
+			/* A failed prepare aborts, but does not free. */
+			ref_transaction_free(data->files_transaction);
+			data->files_transaction = NULL;
+		}
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+/*
+ * Collect the records that the updates of the stack `index` of the
+ * transaction write into its new table.
+ */
+static int collect_updates(struct ref_transaction *transaction,
+			   size_t index, struct reftable_stack *st,
+			   uint64_t update_index, int write_logs,
+			   struct table_data *data)
+{
+	size_t i, j;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update *ud = update->backend_data;
+
+		if (!ud || ud->stack != index)
+			continue;
+
+		if ((update->flags & REF_DELETING) &&
+		    !(update->flags & REF_LOG_ONLY)) {
+			struct reftable_log_record *logs;
+			size_t nr;
+
+			if (!ud->exists)
+				continue;
+
+			/* Deleting a reference deletes its reflog. */
+			add_ref(data, ud->name, update_index)->value_type =
+				REFTABLE_REF_DELETION;
+			if (read_reflog(st, ud->name, &logs, &nr))
+				return -1;
+			for (j = 0; j < nr; j++)
+				add_log_deletion(data, ud->name,
+						 logs[j].update_index);
+			free_reflog(logs, nr);
+			continue;
+		}
+
+		if (update->flags & REF_NEEDS_COMMIT)
+			add_ref_value(data, ud->name, update_index,
+				      &update->new_oid);
+
+		if ((update->flags & (REF_NEEDS_COMMIT | REF_LOG_ONLY)) &&
+		    write_logs && should_write_log(st, ud->name, update->flags))
+			add_log_update(data, ud->name, update_index,
+				       &ud->old_oid, &update->new_oid,
+				       update->msg);
+	}
+	return 0;
+}
+
+static int transaction_finish(struct ref_transaction *transaction,
+			      int write_logs, struct strbuf *err)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < data->stacks_nr; i++) {
+		struct write_stack *ws = &data->stacks[i];
+		uint64_t index = ws->add.next_update_index;
+		struct table_data table = TABLE_DATA_INIT;
+
+		table_data_set_committer(&table);
+		ret = collect_updates(transaction, i, ws->stack, index,
+				      write_logs, &table);
+		if (!ret)
+			ret = reftable_addition_add(&ws->add, index, index,
+						    write_table_data, &table);
+		table_data_release(&table);
+		if (ret) {
+			strbuf_addf(err, "unable to write new table to '%s'",
+				    ws->stack->dir);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+	if (data->files_transaction) {
+		ret = ref_transaction_commit(data->files_transaction, err);
+		ref_transaction_free(data->files_transaction);
+		data->files_transaction = NULL;
+		if (ret)
+			goto cleanup;
+	}
+
+	for (i = 0; i < data->stacks_nr; i++) {
+		struct write_stack *ws = &data->stacks[i];
+
+		if (reftable_addition_commit(&ws->add)) {
+			strbuf_addf(err, "unable to update '%s'",
+				    ws->stack->list_file);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_finish");
+
+	return transaction_finish(transaction, 1, err);
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	int ret;
+
+	if (transaction->state != REF_TRANSACTION_OPEN)
+		BUG("commit called for transaction that is not open");
+
+	/*
+	 * Unlike the files backend, we have no cheaper way to write many
+	 * references at once than a normal transaction. Like it, we do
+	 * not write reflog entries for the initial references.
+	 */
+	ret = reftable_transaction_prepare(ref_store, transaction, err);
+	if (!ret)
+		ret = transaction_finish(transaction, 0, err);
+	return ret;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	int ret = 0;
+
+	if (reftable_stack_compact_all(&refs->main_stack))
+		ret = -1;
+	if (refs->worktree_stack &&
+	    reftable_stack_compact_all(refs->worktree_stack))
+		ret = -1;
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct reftable_addition add = REFTABLE_ADDITION_INIT;
+	struct table_data data = TABLE_DATA_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_ref_record *rec;
+	struct reftable_stack *st;
+	struct object_id old_oid, new_oid;
+	const char *name;
+	int ret;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return refs_create_symref(refs->files_store, refname, target,
+					  logmsg);
+
+	if (reftable_stack_lock(st, &add, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	rec = add_ref(&data, name, add.next_update_index);
+	rec->value_type = REFTABLE_REF_SYMREF;
+	strbuf_addstr(&rec->target, target);
+
+	if (logmsg &&
+	    !refs_read_ref_full(&refs->base, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_write_log(st, name, 0)) {
+		if (!refs_resolve_ref_unsafe(&refs->base, refname, 0,
+					     &old_oid, NULL))
+			oidclr(&old_oid);
+		table_data_set_committer(&data);
+		add_log_update(&data, name, add.next_update_index,
+			       &old_oid, &new_oid, logmsg);
+	}
+
+	ret = write_single_table(st, &add, &data, 0);
+	if (ret)
+		ret = error("unable to write symref for %s", refname);
+
+out:
+	reftable_addition_release(&add);
+	table_data_release(&data);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	struct string_list_item *item;
+	int ret = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err))
+			goto error;
+	}
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+	goto out;
+
+error:
+	if (refnames->nr == 1)
+		ret = error(_("could not delete reference %s: %s"),
+			    refnames->items[0].string, err.buf);
+	else
+		ret = error(_("could not delete references: %s"), err.buf);
+out:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct reftable_addition add = REFTABLE_ADDITION_INIT;
+	struct table_data data = TABLE_DATA_INIT;
+	struct reftable_log_record *old_logs = NULL, *new_logs = NULL;
+	size_t old_nr = 0, new_nr = 0, i;
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_stack *st, *new_st;
+	const char *oldname, *newname;
+	struct object_id orig_oid;
+	uint64_t index, max_index;
+	int same, flag = 0, ret;
+
+	if (!refs_resolve_ref_unsafe(ref_store, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     &orig_oid, &flag))
+		return error("refname %s not found", oldrefname);
+
+	if (flag & REF_ISSYMREF) {
+		if (copy)
+			return error("refname %s is a symbolic ref, copying it is not supported",
+				     oldrefname);
+		return error("refname %s is a symbolic ref, renaming it is not supported",
+			     oldrefname);
+	}
+	if (!refs_rename_ref_available(ref_store, oldrefname, newrefname))
+		return 1;
+	/* Unlike a rename, a copy keeps the old reference in the way. */
+	if (copy && refs_verify_refname_available(ref_store, newrefname,
+						  NULL, NULL, &err)) {
+		ret = error("%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+
+	st = stack_for(refs, oldrefname, &oldname);
+	new_st = stack_for(refs, newrefname, &newname);
+	if (!st || st != new_st) {
+		if (copy)
+			return error("unable to copy '%s' to '%s': %s", oldrefname,
+				     newrefname, "references are stored apart");
+		return error("unable to rename '%s' to '%s': %s", oldrefname,
+			     newrefname, "references are stored apart");
+	}
+	same = !strcmp(oldname, newname);
+
+	if (reftable_stack_lock(st, &add, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	if ((!same && read_reflog(st, oldname, &old_logs, &old_nr)) ||
+	    (!same && read_reflog(st, newname, &new_logs, &new_nr))) {
+		ret = error("unable to read reflogs");
+		goto out;
+	}
+
+	/*
+	 * The reflog of the old reference moves over to the new one,
+	 * getting new update indices. The new entry for the rename
+	 * comes last.
+	 */
+	index = add.next_update_index;
+	max_index = index + old_nr;
+	table_data_set_committer(&data);
+
+	for (i = 0; i < old_nr; i++)
+		add_log_copy(&data, newname, max_index - 1 - i, &old_logs[i]);
+	for (i = 0; i < new_nr; i++)
+		add_log_deletion(&data, newname, new_logs[i].update_index);
+	if (old_nr || should_write_log(st, newname, 0))
+		add_log_update(&data, newname, max_index,
+			       &orig_oid, &orig_oid, logmsg);
+	add_ref_value(&data, newname, max_index, &orig_oid);
+
+	if (!copy && !same) {
+		add_ref(&data, oldname, max_index)->value_type =
+			REFTABLE_REF_DELETION;
+		for (i = 0; i < old_nr; i++)
+			add_log_deletion(&data, oldname,
+					 old_logs[i].update_index);
+	}
+
+	ret = write_single_table(st, &add, &data, old_nr);
+	if (ret) {
+		if (copy)
+			ret = error("unable to copy '%s' to '%s'",
+				    oldrefname, newrefname);
+		else
+			ret = error("unable to rename '%s' to '%s'",
+				    oldrefname, newrefname);
+	}
+
+out:
+	reftable_addition_release(&add);
+	table_data_release(&data);
+	free_reflog(old_logs, old_nr);
+	free_reflog(new_logs, new_nr);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 1);
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct ref_store *ref_store;
+	struct string_list refnames;
+	size_t next;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (iter->next < iter->refnames.nr) {
+		const char *refname = iter->refnames.items[iter->next++].string;
+		int flags;
+
+		if (refs_read_ref_full(iter->ref_store, refname, 0,
+				       &iter->oid, &flags)) {
+			error("bad ref for %s", refname);
+			continue;
+		}
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) == ITER_ERROR)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	string_list_clear(&iter->refnames, 0);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static void collect_reflog_names(struct reftable_stack *st,
+				 enum iterator_filter filter,
+				 struct string_list *refnames)
+{
+	struct reftable_log_record rec = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+	const char *last = NULL;
+
+	if (reftable_stack_reload(st))
+		return;
+	it = reftable_stack_iterate_logs(st, NULL);
+	if (!it)
+		return;
+
+	while (!reftable_iterator_next_log(it, &rec)) {
+		const char *refname = rec.refname.buf;
+
+		if (last && !strcmp(last, refname))
+			continue;
+		if (filter == FILTER_SHARED &&
+		    (ref_type(refname) == REF_TYPE_PER_WORKTREE ||
+		     !strcmp(refname, "HEAD")))
+			continue;
+		last = string_list_append(refnames, refname)->string;
+	}
+
+	reftable_iterator_free(it);
+	reftable_log_record_release(&rec);
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+
+	base_ref_iterator_init(&iter->base, &reftable_reflog_iterator_vtable, 0);
+	iter->ref_store = ref_store;
+	string_list_init(&iter->refnames, 1);
+
+	collect_reflog_names(&refs->main_stack,
+			     refs->worktree_stack ? FILTER_SHARED : FILTER_NONE,
+			     &iter->refnames);
+	if (refs->worktree_stack)
+		collect_reflog_names(refs->worktree_stack, FILTER_NONE,
+				     &iter->refnames);
+	string_list_sort(&iter->refnames);
+	string_list_remove_duplicates(&iter->refnames, 0);
+
+	return &iter->base;
+}
+
+static int show_reflog_ent(const struct reftable_log_record *log,
+			   struct strbuf *committer,
+			   each_reflog_ent_fn fn, void *cb_data)
+{
+	struct object_id old_oid, new_oid;
+
+	if (is_reflog_marker(log))
+		return 0;
+
+	strbuf_reset(committer);
+	strbuf_addf(committer, "%s <%s>", log->name.buf, log->email.buf);
+	oidcpy(&old_oid, &log->old_oid);
+	oidcpy(&new_oid, &log->new_oid);
+	return fn(&old_oid, &new_oid, committer->buf, log->time,
+		  log->tz_offset, log->message.buf, cb_data);
+}
+
+static int do_for_each_reflog_ent(struct ref_store *ref_store,
+			       const char *refname,
+			       each_reflog_ent_fn fn, void *cb_data,
+			       int reverse)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct reftable_log_record *logs;
+	struct strbuf committer = STRBUF_INIT;
+	struct reftable_stack *st;
+	const char *name;
+	size_t i, nr;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st) {
+		if (reverse)
+			return refs_for_each_reflog_ent_reverse(refs->files_store,
+								refname, fn,
+								cb_data);
+		return refs_for_each_reflog_ent(refs->files_store, refname,
+						fn, cb_data);
+	}
+
+	if (reftable_stack_reload(st) ||
+	    read_reflog(st, name, &logs, &nr))
+		return -1;
+
+	for (i = 0; i < nr && !ret; i++)
+		ret = show_reflog_ent(&logs[reverse ? i : nr - 1 - i],
+				      &committer, fn, cb_data);
+
+	free_reflog(logs, nr);
+	strbuf_release(&committer);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	return do_for_each_reflog_ent(ref_store, refname, fn, cb_data, 0);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	return do_for_each_reflog_ent(ref_store, refname, fn, cb_data, 1);
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *st;
+	const char *name;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return refs_reflog_exists(refs->files_store, refname);
+
+	return !reftable_stack_reload(st) && reftable_stack_has_log(st, name) > 0;
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct reftable_addition add = REFTABLE_ADDITION_INIT;
+	struct table_data data = TABLE_DATA_INIT;
+	struct reftable_stack *st;
+	const char *name;
+	int ret;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return refs_create_reflog(refs->files_store, refname,
+					  force_create, err);
+
+	if (!force_create && !should_autocreate_reflog(name))
+		return 0;
+
+	if (reftable_stack_lock(st, &add, err))
+		return -1;
+	ret = reftable_stack_has_log(st, name);
+	if (!ret) {
+		table_data_set_committer(&data);
+		add_log_update(&data, name, add.next_update_index,
+			       &null_oid, &null_oid, NULL);
+		ret = write_single_table(st, &add, &data, 0);
+		if (ret)
+			strbuf_addf(err, "unable to create reflog for '%s'",
+				    refname);
+	}
+
+	reftable_addition_release(&add);
+	table_data_release(&data);
+	return ret < 0 ? -1 : 0;
+}
+
+/* Write tombstones for the given reflog entries. */
+static void add_reflog_deletions(struct table_data *data, const char *name,
+				 struct reftable_log_record *logs, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		add_log_deletion(data, name, logs[i].update_index);
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct reftable_addition add = REFTABLE_ADDITION_INIT;
+	struct table_data data = TABLE_DATA_INIT;
+	struct reftable_log_record *logs = NULL;
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_stack *st;
+	const char *name;
+	size_t nr = 0;
+	int ret;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return refs_delete_reflog(refs->files_store, refname);
+
+	if (reftable_stack_lock(st, &add, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	ret = read_reflog(st, name, &logs, &nr);
+	if (!ret) {
+		add_reflog_deletions(&data, name, logs, nr);
+		ret = write_single_table(st, &add, &data, 0);
+	}
+
+out:
+	reftable_addition_release(&add);
+	table_data_release(&data);
+	free_reflog(logs, nr);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct reftable_addition add = REFTABLE_ADDITION_INIT;
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct table_data data = TABLE_DATA_INIT;
+	struct reftable_log_record *logs = NULL;
+	struct strbuf committer = STRBUF_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct object_id last_kept_oid;
+	struct reftable_stack *st;
+	const char *name;
+	size_t nr = 0, i;
+	int dry_run = flags & EXPIRE_REFLOGS_DRY_RUN;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return refs_reflog_expire(refs->files_store, refname, oid,
+					  flags, prepare_fn, should_prune_fn,
+					  cleanup_fn, policy_cb_data);
+
+	/*
+	 * Holding the lock on the stack keeps both the reference and
+	 * its reflog from changing under us.
+	 */
+	if (reftable_stack_lock(st, &add, &err)) {
+		ret = error("cannot lock ref '%s': %s", refname, err.buf);
+		goto out;
+	}
+	if (read_reflog(st, name, &logs, &nr)) {
+		ret = -1;
+		goto out;
+	}
+	if (!nr)
+		goto out;
+
+	oidclr(&last_kept_oid);
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	for (i = nr; i--; ) {
+		struct reftable_log_record *log = &logs[i];
+		struct object_id *ooid = &log->old_oid;
+
+		if (is_reflog_marker(log))
+			continue;
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			ooid = &last_kept_oid;
+
+		strbuf_reset(&committer);
+		strbuf_addf(&committer, "%s <%s>", log->name.buf,
+			    log->email.buf);
+		if ((*should_prune_fn)(ooid, &log->new_oid, committer.buf,
+				       log->time, log->tz_offset,
+				       log->message.buf, policy_cb_data)) {
+			if (dry_run)
+				printf("would prune %s", log->message.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", log->message.buf);
+			add_log_deletion(&data, name, log->update_index);
+		} else {
+			if (!dry_run) {
+				if (!oideq(ooid, &log->old_oid))
+					add_log_copy(&data, name,
+						     log->update_index,
+						     log)->old_oid = *ooid;
+				oidcpy(&last_kept_oid, &log->new_oid);
+			}
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", log->message.buf);
+		}
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (dry_run)
+		goto out;
+
+	/*
+	 * As in the files backend, a symbolic reference is never
+	 * updated, nor is a reference when no entries remain.
+	 */
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !is_null_oid(&last_kept_oid) &&
+	    !reftable_stack_read_ref(st, name, &ref) &&
+	    ref.value_type != REFTABLE_REF_SYMREF)
+		add_ref_value(&data, name, add.next_update_index,
+			      &last_kept_oid);
+
+	if (write_single_table(st, &add, &data, 0))
+		ret = error("unable to write reflog '%s'", refname);
+
+out:
+	reftable_addition_release(&add);
+	reftable_ref_record_release(&ref);
+	table_data_release(&data);
+	free_reflog(logs, nr);
+	strbuf_release(&committer);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int init_stack_dir(struct reftable_stack *st, struct strbuf *err)
+{
+	if (safe_create_leading_directories(st->list_file)) {
+		strbuf_addf(err, "unable to create directory '%s'", st->dir);
+		return -1;
+	}
+	adjust_shared_perm(st->dir);
+	if (!file_exists(st->list_file)) {
+		write_file_buf(st->list_file, "", 0);
+		adjust_shared_perm(st->list_file);
+	}
+	return 0;
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	if (init_stack_dir(&refs->main_stack, err) ||
+	    (refs->worktree_stack && init_stack_dir(refs->worktree_stack, err)))
+		return -1;
+
+	/*
+	 * Git recognizes a repository by its HEAD file, which we keep
+	 * pointing at a branch nobody can create.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->base.gitdir);
+	if (!file_exists(sb.buf))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+	strbuf_release(&sb);
+	return 0;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	NULL,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
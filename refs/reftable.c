@@ -0,0 +1,1877 @@
+#include "../cache.h"
+#include "reftable.h"
+#include "../tempfile.h"
+#include "../varint.h"
+
+#define REFTABLE_MAGIC "REFT"
+#define REFTABLE_FOOTER_FIELDS_SIZE (5 * 8)
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+
+/* One byte of block type followed by a 24-bit block length. */
+#define BLOCK_HEADER_SIZE 4
+
+#define MAX_RESTARTS 0xffff
+#define MAX_BLOCK_SIZE ((1 << 24) - 1)
+
+static size_t header_size(int version)
+{
+	return version == 1 ? 24 : 28;
+}
+
+static size_t footer_size(int version)
+{
+	return header_size(version) + REFTABLE_FOOTER_FIELDS_SIZE + 4;
+}
+
+static void put_be24(unsigned char *p, uint32_t value)
+{
+	p[0] = (value >> 16) & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = value & 0xff;
+}
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uint64_t value)
+{
+	unsigned char buf[16];
+	int len = encode_varint(value, buf);
+
+	strbuf_add(sb, buf, len);
+}
+
+/*
+ * Like decode_varint(), but does not read beyond `end`. Return 0 on
+ * success.
+ */
+static int get_varint(const unsigned char **p, const unsigned char *end,
+		      uint64_t *out)
+{
+	const unsigned char *s = *p;
+	uint64_t val;
+	unsigned char c;
+
+	if (s >= end)
+		return -1;
+	c = *s++;
+	val = c & 127;
+	while (c & 128) {
+		if (s >= end || val + 1 > (UINT64_MAX >> 7))
+			return -1;
+		c = *s++;
+		val = ((val + 1) << 7) | (c & 127);
+	}
+	*p = s;
+	*out = val;
+	return 0;
+}
+
+static int get_varint_string(const unsigned char **p, const unsigned char *end,
+			     struct strbuf *out)
+{
+	uint64_t len;
+
+	if (get_varint(p, end, &len) || len > end - *p)
+		return -1;
+	strbuf_reset(out);
+	strbuf_add(out, *p, len);
+	*p += len;
+	return 0;
+}
+
+static void strbuf_add_varint_string(struct strbuf *sb, const struct strbuf *s)
+{
+	strbuf_add_varint(sb, s->len);
+	strbuf_addbuf(sb, s);
+}
+
+void reftable_ref_record_release(struct reftable_ref_record *rec)
+{
+	strbuf_release(&rec->refname);
+	strbuf_release(&rec->target);
+}
+
+void reftable_log_record_release(struct reftable_log_record *rec)
+{
+	strbuf_release(&rec->refname);
+	strbuf_release(&rec->name);
+	strbuf_release(&rec->email);
+	strbuf_release(&rec->message);
+}
+
+/*
+ * The key of a reflog entry is the refname, a NUL and the update index,
+ * inverted so that the newest entry of each reference comes first.
+ */
+static void log_key(struct strbuf *key, const char *refname,
+		    uint64_t update_index)
+{
+	unsigned char buf[8];
+
+	strbuf_reset(key);
+	strbuf_addstr(key, refname);
+	strbuf_addch(key, '\0');
+	put_be64(buf, UINT64_MAX - update_index);
+	strbuf_add(key, buf, sizeof(buf));
+}
+
+static int parse_log_key(const struct strbuf *key, struct strbuf *refname,
+			 uint64_t *update_index)
+{
+	if (key->len < 9 || key->buf[key->len - 9] != '\0')
+		return -1;
+	strbuf_reset(refname);
+	strbuf_add(refname, key->buf, key->len - 9);
+	*update_index = UINT64_MAX - get_be64(key->buf + key->len - 8);
+	return 0;
+}
+
+/*
+ * Skip over the value of a record of the given block and value type.
+ */
+static int skip_value(unsigned char block_type, unsigned char value_type,
+		      size_t rawsz,
+		      const unsigned char **p, const unsigned char *end)
+{
+	uint64_t dummy;
+
+	if (block_type == BLOCK_TYPE_REF) {
+		if (get_varint(p, end, &dummy))
+			return -1;
+		switch (value_type) {
+		case REFTABLE_REF_DELETION:
+			return 0;
+		case REFTABLE_REF_VAL1:
+			dummy = rawsz;
+			break;
+		case REFTABLE_REF_VAL2:
+			dummy = 2 * rawsz;
+			break;
+		case REFTABLE_REF_SYMREF:
+			if (get_varint(p, end, &dummy))
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+		if (dummy > end - *p)
+			return -1;
+		*p += dummy;
+		return 0;
+	}
+
+	switch (value_type) {
+	case REFTABLE_LOG_DELETION:
+		return 0;
+	case REFTABLE_LOG_UPDATE:
+		break;
+	default:
+		return -1;
+	}
+
+	if (2 * rawsz > end - *p)
+		return -1;
+	*p += 2 * rawsz;
+	/* name and email */
+	if (get_varint(p, end, &dummy) || dummy > end - *p)
+		return -1;
+	*p += dummy;
+	if (get_varint(p, end, &dummy) || dummy > end - *p)
+		return -1;
+	*p += dummy;
+	/* time and time zone */
+	if (get_varint(p, end, &dummy) || 2 > end - *p)
+		return -1;
+	*p += 2;
+	/* message */
+	if (get_varint(p, end, &dummy) || dummy > end - *p)
+		return -1;
+	*p += dummy;
+	return 0;
+}
+
+static int decode_ref_value(struct reftable_ref_record *rec,
+			    unsigned char value_type,
+			    const unsigned char *p, const unsigned char *end,
+			    uint64_t min_update_index, size_t rawsz)
+{
+	uint64_t delta;
+
+	if (get_varint(&p, end, &delta))
+		return -1;
+	rec->update_index = min_update_index + delta;
+	rec->value_type = value_type;
+	strbuf_reset(&rec->target);
+
+	switch (value_type) {
+	case REFTABLE_REF_DELETION:
+		return 0;
+	case REFTABLE_REF_VAL2:
+		if (2 * rawsz > end - p)
+			return -1;
+		oidread(&rec->value, p);
+		oidread(&rec->peeled, p + rawsz);
+		return 0;
+	case REFTABLE_REF_VAL1:
+		if (rawsz > end - p)
+			return -1;
+		oidread(&rec->value, p);
+		return 0;
+	case REFTABLE_REF_SYMREF:
+		return get_varint_string(&p, end, &rec->target);
+	}
+	return -1;
+}
+
+static void encode_ref_value(struct strbuf *out,
+			     const struct reftable_ref_record *rec,
+			     uint64_t min_update_index, size_t rawsz)
+{
+	strbuf_add_varint(out, rec->update_index - min_update_index);
+
+	switch (rec->value_type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL2:
+		strbuf_add(out, rec->value.hash, rawsz);
+		strbuf_add(out, rec->peeled.hash, rawsz);
+		break;
+	case REFTABLE_REF_VAL1:
+		strbuf_add(out, rec->value.hash, rawsz);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_add_varint_string(out, &rec->target);
+		break;
+	}
+}
+
+static int decode_log_value(struct reftable_log_record *rec,
+			    unsigned char value_type,
+			    const unsigned char *p, const unsigned char *end,
+			    size_t rawsz)
+{
+	uint64_t time;
+
+	rec->value_type = value_type;
+	strbuf_reset(&rec->name);
+	strbuf_reset(&rec->email);
+	strbuf_reset(&rec->message);
+
+	if (value_type == REFTABLE_LOG_DELETION)
+		return 0;
+	if (value_type != REFTABLE_LOG_UPDATE || 2 * rawsz > end - p)
+		return -1;
+
+	oidread(&rec->old_oid, p);
+	oidread(&rec->new_oid, p + rawsz);
+	p += 2 * rawsz;
+
+	if (get_varint_string(&p, end, &rec->name) ||
+	    get_varint_string(&p, end, &rec->email) ||
+	    get_varint(&p, end, &time) || 2 > end - p)
+		return -1;
+	rec->time = time;
+	rec->tz_offset = (int16_t)get_be16(p);
+	p += 2;
+	return get_varint_string(&p, end, &rec->message);
+}
+
+static void encode_log_value(struct strbuf *out,
+			     const struct reftable_log_record *rec,
+			     size_t rawsz)
+{
+	unsigned char tz[2];
+	uint16_t tz_offset = (int16_t)rec->tz_offset;
+
+	if (rec->value_type == REFTABLE_LOG_DELETION)
+		return;
+
+	strbuf_add(out, rec->old_oid.hash, rawsz);
+	strbuf_add(out, rec->new_oid.hash, rawsz);
+	strbuf_add_varint_string(out, &rec->name);
+	strbuf_add_varint_string(out, &rec->email);
+	strbuf_add_varint(out, rec->time);
+	tz[0] = tz_offset >> 8;
+	tz[1] = tz_offset & 0xff;
+	strbuf_add(out, tz, sizeof(tz));
+	strbuf_add_varint_string(out, &rec->message);
+}
+
+/*
+ * Blocks.
+ *
+ * A block consists of a type byte, its 24-bit length, a series of
+ * records, the 24-bit offsets of its restart points and their 16-bit
+ * count. The first block of a file shares its start with the file
+ * header, so its length and offsets count from the start of the file.
+ */
+struct block {
+	const unsigned char *data;
+	unsigned char type;
+	size_t records_start;
+	const unsigned char *restarts;
+	size_t restart_nr;
+};
+
+static int block_init(struct block *b, const unsigned char *data,
+		      size_t avail, size_t header_off)
+{
+	size_t len;
+
+	if (avail < header_off + BLOCK_HEADER_SIZE + 2)
+		return -1;
+
+	b->data = data;
+	b->type = data[header_off];
+	len = get_be24(data + header_off + 1);
+	if (len > avail || len < header_off + BLOCK_HEADER_SIZE + 2)
+		return -1;
+
+	b->restart_nr = get_be16(data + len - 2);
+	b->records_start = header_off + BLOCK_HEADER_SIZE;
+	if (b->records_start + 3 * b->restart_nr + 2 > len)
+		return -1;
+	b->restarts = data + len - 2 - 3 * b->restart_nr;
+	return 0;
+}
+
+struct block_iter {
+	struct block block;
+	size_t next_off;
+	size_t rawsz;
+
+	/* The current record. */
+	struct strbuf key;
+	unsigned char value_type;
+	const unsigned char *value;
+	const unsigned char *value_end;
+};
+
+static int decode_record(struct block_iter *bi, const unsigned char **pp)
+{
+	const unsigned char *p = *pp, *end = bi->block.restarts;
+	uint64_t prefix, suffix_type, suffix_len;
+
+	if (get_varint(&p, end, &prefix) ||
+	    get_varint(&p, end, &suffix_type))
+		return -1;
+	suffix_len = suffix_type >> 3;
+	if (prefix > bi->key.len || suffix_len > end - p)
+		return -1;
+
+	strbuf_setlen(&bi->key, prefix);
+	strbuf_add(&bi->key, p, suffix_len);
+	p += suffix_len;
+
+	bi->value_type = suffix_type & 7;
+	bi->value = p;
+	if (skip_value(bi->block.type, bi->value_type, bi->rawsz, &p, end))
+		return -1;
+	bi->value_end = p;
+	*pp = p;
+	return 0;
+}
+
+/*
+ * Read the next record of the block. Return 0 on success, 1 at the
+ * end of the block and -1 if the block is corrupt.
+ */
+static int block_iter_next(struct block_iter *bi)
+{
+	const unsigned char *p = bi->block.data + bi->next_off;
+
+	if (p >= bi->block.restarts)
+		return 1;
+	if (decode_record(bi, &p))
+		return -1;
+	bi->next_off = p - bi->block.data;
+	return 0;
+}
+
+static void block_iter_start(struct block_iter *bi, size_t off)
+{
+	bi->next_off = off;
+	strbuf_reset(&bi->key);
+}
+
+static size_t restart_offset(const struct block *b, size_t i)
+{
+	return get_be24(b->restarts + 3 * i);
+}
+
+/* Return the key of the i-th restart point, or -1 if corrupt. */
+static int restart_key(struct block_iter *bi, size_t i)
+{
+	const unsigned char *p;
+	size_t off = restart_offset(&bi->block, i);
+
+	if (off < bi->block.records_start ||
+	    bi->block.data + off >= bi->block.restarts)
+		return -1;
+	p = bi->block.data + off;
+	strbuf_reset(&bi->key);
+	return decode_record(bi, &p);
+}
+
+static int key_cmp(const struct strbuf *a, const struct strbuf *b)
+{
+	size_t len = a->len < b->len ? a->len : b->len;
+	int cmp = memcmp(a->buf, b->buf, len);
+
+	if (cmp)
+		return cmp;
+	return a->len < b->len ? -1 : a->len != b->len;
+}
+
+/*
+ * Position the iterator on the first record whose key is not less
+ * than `want`. Return 0 if there is one, 1 if all keys of the block
+ * are smaller and -1 if the block is corrupt.
+ */
+static int block_iter_seek(struct block_iter *bi, const struct strbuf *want)
+{
+	size_t lo = 0, hi = bi->block.restart_nr;
+	int ret;
+
+	/* Find the first restart point with a key greater than `want`. */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (restart_key(bi, mid))
+			return -1;
+		if (key_cmp(&bi->key, want) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	if (lo)
+		block_iter_start(bi, restart_offset(&bi->block, lo - 1));
+	else
+		block_iter_start(bi, bi->block.records_start);
+
+	while (!(ret = block_iter_next(bi)))
+		if (key_cmp(&bi->key, want) >= 0)
+			return 0;
+	return ret;
+}
+
+/*
+ * Tables.
+ */
+struct reftable_table {
+	char *name;
+	int refcount;
+
+	unsigned char *data;
+	size_t size;
+
+	int version;
+	size_t rawsz;
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	/* Number of (fixed-size) ref blocks at the start of the file. */
+	size_t ref_blocks;
+	size_t ref_end;
+
+	size_t log_start;
+	size_t log_end;
+};
+
+static void table_unref(struct reftable_table *t)
+{
+	if (!t || --t->refcount)
+		return;
+	if (t->data)
+		munmap(t->data, t->size);
+	free(t->name);
+	free(t);
+}
+
+static int table_parse(struct reftable_table *t, const char *path)
+{
+	const unsigned char *footer;
+	size_t hsz, fsz, footer_start;
+	uint64_t ref_index_pos, obj_pos, log_pos, log_index_pos;
+
+	if (t->size < 5 || memcmp(t->data, REFTABLE_MAGIC, 4))
+		return error(_("'%s' is not a reftable"), path);
+
+	t->version = t->data[4];
+	if (t->version != 1 && t->version != 2)
+		return error(_("reftable '%s' has unknown version %d"),
+			     path, t->version);
+
+	hsz = header_size(t->version);
+	fsz = footer_size(t->version);
+	if (t->size < hsz + fsz)
+		return error(_("reftable '%s' is truncated"), path);
+
+	if (t->version == 1) {
+		if (hash_algo_by_ptr(the_hash_algo) != GIT_HASH_SHA1)
+			return error(_("reftable '%s' uses a different hash"),
+				     path);
+	} else if (get_be32(t->data + 24) != the_hash_algo->format_id) {
+		return error(_("reftable '%s' uses a different hash"), path);
+	}
+	t->rawsz = the_hash_algo->rawsz;
+
+	t->block_size = get_be24(t->data + 5);
+	t->min_update_index = get_be64(t->data + 8);
+	t->max_update_index = get_be64(t->data + 16);
+
+	footer_start = t->size - fsz;
+	footer = t->data + footer_start;
+	if (memcmp(footer, t->data, hsz) ||
+	    crc32(0, footer, fsz - 4) != get_be32(footer + fsz - 4))
+		return error(_("reftable '%s' has a corrupt footer"), path);
+
+	ref_index_pos = get_be64(footer + hsz);
+	obj_pos = get_be64(footer + hsz + 8) >> 5;
+	log_pos = get_be64(footer + hsz + 24);
+	log_index_pos = get_be64(footer + hsz + 32);
+
+	if (ref_index_pos > footer_start || obj_pos > footer_start ||
+	    log_pos > footer_start || log_index_pos > footer_start)
+		return error(_("reftable '%s' has a corrupt footer"), path);
+
+	/* Ref blocks end where the next section starts. */
+	if (ref_index_pos)
+		t->ref_end = ref_index_pos;
+	else if (obj_pos)
+		t->ref_end = obj_pos;
+	else if (log_pos)
+		t->ref_end = log_pos;
+	else
+		t->ref_end = footer_start;
+
+	if (t->ref_end > hsz && t->data[hsz] == BLOCK_TYPE_REF) {
+		if (!t->block_size)
+			return error(_("reftable '%s' has unpadded ref blocks"),
+				     path);
+		t->ref_blocks = DIV_ROUND_UP(t->ref_end, t->block_size);
+	}
+
+	if (log_pos) {
+		t->log_start = log_pos;
+		t->log_end = log_index_pos ? log_index_pos : footer_start;
+		if (t->log_end < t->log_start)
+			return error(_("reftable '%s' has a corrupt footer"),
+				     path);
+	}
+	return 0;
+}
+
+static int table_open(struct reftable_table **out, const char *dir,
+		      const char *name)
+{
+	struct reftable_table *t;
+	struct stat st;
+	char *path = xstrfmt("%s/%s", dir, name);
+	int fd, ret = 0;
+
+	fd = git_open(path);
+	if (fd < 0) {
+		ret = errno == ENOENT ? 1 : error_errno(_("unable to open '%s'"),
+							path);
+		goto out;
+	}
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("unable to stat '%s'"), path);
+		close(fd);
+		goto out;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->refcount = 1;
+	t->name = xstrdup(name);
+	t->size = xsize_t(st.st_size);
+	if (t->size)
+		t->data = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (table_parse(t, path)) {
+		table_unref(t);
+		ret = -1;
+		goto out;
+	}
+	*out = t;
+
+out:
+	free(path);
+	return ret;
+}
+
+/*
+ * An iterator over the ref or log records of one table. When `valid`
+ * is set, the current record is in `bi`.
+ */
+struct table_iter {
+	struct reftable_table *table;
+	int is_log;
+	int valid;
+
+	size_t block_off;
+	size_t next_block_off;
+	struct strbuf inflated;
+
+	struct block_iter bi;
+};
+
+static void table_iter_init(struct table_iter *ti, struct reftable_table *t,
+			    int is_log)
+{
+	memset(ti, 0, sizeof(*ti));
+	ti->table = t;
+	ti->is_log = is_log;
+	ti->bi.rawsz = t->rawsz;
+	strbuf_init(&ti->inflated, 0);
+	strbuf_init(&ti->bi.key, 0);
+}
+
+static void table_iter_release(struct table_iter *ti)
+{
+	strbuf_release(&ti->inflated);
+	strbuf_release(&ti->bi.key);
+}
+
+static int inflate_log_block(struct table_iter *ti, size_t off)
+{
+	struct reftable_table *t = ti->table;
+	const unsigned char *data = t->data + off;
+	size_t len;
+	git_zstream stream;
+	int status;
+
+	len = get_be24(data + 1);
+	if (len < BLOCK_HEADER_SIZE + 2)
+		return -1;
+
+	strbuf_reset(&ti->inflated);
+	strbuf_grow(&ti->inflated, len);
+	memcpy(ti->inflated.buf, data, BLOCK_HEADER_SIZE);
+
+	memset(&stream, 0, sizeof(stream));
+	git_inflate_init(&stream);
+	stream.next_in = (unsigned char *)data + BLOCK_HEADER_SIZE;
+	stream.avail_in = t->log_end - off - BLOCK_HEADER_SIZE;
+	stream.next_out = (unsigned char *)ti->inflated.buf + BLOCK_HEADER_SIZE;
+	stream.avail_out = len - BLOCK_HEADER_SIZE;
+	status = git_inflate(&stream, Z_FINISH);
+	git_inflate_end(&stream);
+	if (status != Z_STREAM_END || stream.avail_out)
+		return -1;
+
+	strbuf_setlen(&ti->inflated, len);
+	ti->next_block_off = off + BLOCK_HEADER_SIZE + stream.total_in;
+	return block_init(&ti->bi.block,
+			  (const unsigned char *)ti->inflated.buf, len, 0);
+}
+
+/*
+ * Load the block at `off`. Return 0 on success, 1 if there is no
+ * (suitable) block there and -1 if the block is corrupt.
+ */
+static int table_iter_load_block(struct table_iter *ti, size_t off)
+{
+	struct reftable_table *t = ti->table;
+	int ret;
+
+	ti->valid = 0;
+	ti->block_off = off;
+
+	if (!ti->is_log) {
+		size_t header_off = off ? 0 : header_size(t->version);
+		size_t avail;
+
+		if (off >= t->ref_blocks * t->block_size)
+			return 1;
+		avail = t->ref_end - off;
+		if (avail > t->block_size)
+			avail = t->block_size;
+		ret = block_init(&ti->bi.block, t->data + off, avail, header_off);
+		ti->next_block_off = off + t->block_size;
+		if (!ret && ti->bi.block.type != BLOCK_TYPE_REF)
+			return 1;
+	} else {
+		if (!t->log_start || off + BLOCK_HEADER_SIZE > t->log_end)
+			return 1;
+		if (t->data[off] != BLOCK_TYPE_LOG)
+			return 1;
+		ret = inflate_log_block(ti, off);
+	}
+
+	if (ret)
+		return error(_("reftable '%s' has a corrupt block at %"PRIuMAX),
+			     t->name, (uintmax_t)off);
+	block_iter_start(&ti->bi, ti->bi.block.records_start);
+	return 0;
+}
+
+/*
+ * Move to the next record. Return 0 if there is one, 1 at the end and
+ * -1 on errors.
+ */
+static int table_iter_next(struct table_iter *ti)
+{
+	for (;;) {
+		int ret = block_iter_next(&ti->bi);
+
+		if (!ret) {
+			ti->valid = 1;
+			return 0;
+		}
+		ti->valid = 0;
+		if (ret < 0)
+			return error(_("reftable '%s' has a corrupt block at %"PRIuMAX),
+				     ti->table->name, (uintmax_t)ti->block_off);
+
+		ret = table_iter_load_block(ti, ti->next_block_off);
+		if (ret)
+			return ret;
+	}
+}
+
+static int table_iter_start(struct table_iter *ti)
+{
+	size_t off = ti->is_log ? ti->table->log_start : 0;
+	int ret;
+
+	if (!off && ti->is_log)
+		return 1;
+	ret = table_iter_load_block(ti, off);
+	if (ret)
+		return ret;
+	return table_iter_next(ti);
+}
+
+/* Return the key of the first record of ref block `i` in `key`. */
+static int first_key_of_block(struct table_iter *ti, size_t i)
+{
+	int ret = table_iter_load_block(ti, i * ti->table->block_size);
+
+	if (!ret)
+		ret = block_iter_next(&ti->bi);
+	return ret ? -1 : 0;
+}
+
+/*
+ * Position the iterator on the first record whose key is not less than
+ * `want`. Return 0 if there is one, 1 if there is none and -1 on
+ * errors.
+ */
+static int table_iter_seek(struct table_iter *ti, const struct strbuf *want)
+{
+	int ret;
+
+	if (!ti->is_log) {
+		size_t lo = 0, hi = ti->table->ref_blocks;
+
+		if (!hi)
+			return 1;
+
+		/* Find the last block starting at or before `want`. */
+		while (lo + 1 < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+
+			if (first_key_of_block(ti, mid))
+				return error(_("reftable '%s' is corrupt"),
+					     ti->table->name);
+			if (key_cmp(&ti->bi.key, want) <= 0)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		ret = table_iter_load_block(ti, lo * ti->table->block_size);
+		if (ret)
+			return ret;
+	} else {
+		/*
+		 * Log blocks are compressed and vary in size, so we can
+		 * only walk them in order.
+		 */
+		ret = table_iter_load_block(ti, ti->table->log_start);
+		if (ret)
+			return ret;
+		for (;;) {
+			struct block *b = &ti->bi.block;
+
+			/* Does the last restart point lie beyond `want`? */
+			if (b->restart_nr &&
+			    restart_key(&ti->bi, b->restart_nr - 1))
+				return error(_("reftable '%s' is corrupt"),
+					     ti->table->name);
+			if (!b->restart_nr || key_cmp(&ti->bi.key, want) >= 0)
+				break;
+
+			/* Otherwise, `want` might still be in this block. */
+			ret = block_iter_seek(&ti->bi, want);
+			if (ret <= 0)
+				goto found;
+
+			ret = table_iter_load_block(ti, ti->next_block_off);
+			if (ret)
+				return ret;
+		}
+	}
+
+	ret = block_iter_seek(&ti->bi, want);
+found:
+	if (ret < 0)
+		return error(_("reftable '%s' is corrupt"), ti->table->name);
+	if (!ret) {
+		ti->valid = 1;
+		return 0;
+	}
+	/* Everything in this block is smaller; take the next one. */
+	ret = table_iter_load_block(ti, ti->next_block_off);
+	if (ret)
+		return ret;
+	return table_iter_next(ti);
+}
+
+/*
+ * Merged iteration over several tables. For equal keys, the newest
+ * table wins.
+ */
+struct reftable_iterator {
+	int is_log;
+	int keep_deletions;
+	struct strbuf prefix;
+
+	struct table_iter *subs;
+	size_t nr;
+
+	struct strbuf scratch;
+};
+
+static struct reftable_iterator *merged_iter_new(struct reftable_table **tables,
+						 size_t nr, int is_log,
+						 int keep_deletions)
+{
+	struct reftable_iterator *it = xcalloc(1, sizeof(*it));
+	size_t i;
+
+	it->is_log = is_log;
+	it->keep_deletions = keep_deletions;
+	strbuf_init(&it->prefix, 0);
+	strbuf_init(&it->scratch, 0);
+	CALLOC_ARRAY(it->subs, nr);
+	it->nr = nr;
+	for (i = 0; i < nr; i++) {
+		tables[i]->refcount++;
+		table_iter_init(&it->subs[i], tables[i], is_log);
+	}
+	return it;
+}
+
+static int merged_iter_seek(struct reftable_iterator *it,
+			    const struct strbuf *prefix)
+{
+	size_t i;
+
+	strbuf_reset(&it->prefix);
+	strbuf_addbuf(&it->prefix, prefix);
+
+	for (i = 0; i < it->nr; i++) {
+		int ret;
+
+		if (prefix->len)
+			ret = table_iter_seek(&it->subs[i], prefix);
+		else
+			ret = table_iter_start(&it->subs[i]);
+		if (ret < 0)
+			return -1;
+	}
+	return 0;
+}
+
+void reftable_iterator_free(struct reftable_iterator *it)
+{
+	size_t i;
+
+	if (!it)
+		return;
+	for (i = 0; i < it->nr; i++) {
+		struct reftable_table *t = it->subs[i].table;
+
+		table_iter_release(&it->subs[i]);
+		table_unref(t);
+	}
+	free(it->subs);
+	strbuf_release(&it->prefix);
+	strbuf_release(&it->scratch);
+	free(it);
+}
+
+/*
+ * Find the table iterator holding the next record. Records with the
+ * same key in older tables are skipped. Return 1 at the end.
+ */
+static int merged_iter_pick(struct reftable_iterator *it,
+			    struct table_iter **out)
+{
+	struct table_iter *best = NULL;
+	size_t i;
+
+	for (i = 0; i < it->nr; i++) {
+		struct table_iter *ti = &it->subs[i];
+
+		if (!ti->valid)
+			continue;
+		/* Later (newer) tables win ties. */
+		if (!best || key_cmp(&ti->bi.key, &best->bi.key) <= 0)
+			best = ti;
+	}
+	if (!best)
+		return 1;
+
+	if (it->prefix.len &&
+	    (best->bi.key.len < it->prefix.len ||
+	     memcmp(best->bi.key.buf, it->prefix.buf, it->prefix.len)))
+		return 1;
+
+	for (i = 0; i < it->nr; i++) {
+		struct table_iter *ti = &it->subs[i];
+
+		if (ti == best || !ti->valid ||
+		    key_cmp(&ti->bi.key, &best->bi.key))
+			continue;
+		if (table_iter_next(ti) < 0)
+			return -1;
+	}
+
+	*out = best;
+	return 0;
+}
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec)
+{
+	for (;;) {
+		struct table_iter *ti;
+		int ret = merged_iter_pick(it, &ti);
+
+		if (ret)
+			return ret;
+
+		strbuf_reset(&rec->refname);
+		strbuf_addbuf(&rec->refname, &ti->bi.key);
+		if (decode_ref_value(rec, ti->bi.value_type,
+				     ti->bi.value, ti->bi.value_end,
+				     ti->table->min_update_index,
+				     ti->table->rawsz))
+			return error(_("reftable '%s' has a corrupt record for '%s'"),
+				     ti->table->name, rec->refname.buf);
+		if (table_iter_next(ti) < 0)
+			return -1;
+
+		if (rec->value_type != REFTABLE_REF_DELETION ||
+		    it->keep_deletions)
+			return 0;
+	}
+}
+
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec)
+{
+	for (;;) {
+		struct table_iter *ti;
+		int ret = merged_iter_pick(it, &ti);
+
+		if (ret)
+			return ret;
+
+		if (parse_log_key(&ti->bi.key, &rec->refname,
+				  &rec->update_index) ||
+		    decode_log_value(rec, ti->bi.value_type,
+				     ti->bi.value, ti->bi.value_end,
+				     ti->table->rawsz))
+			return error(_("reftable '%s' has a corrupt log record"),
+				     ti->table->name);
+		if (table_iter_next(ti) < 0)
+			return -1;
+
+		if (rec->value_type != REFTABLE_LOG_DELETION ||
+		    it->keep_deletions)
+			return 0;
+	}
+}
+
+/*
+ * Writing.
+ */
+struct reftable_writer {
+	int fd;
+	struct reftable_write_options opts;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	int version;
+	unsigned char header[28];
+	size_t header_len;
+	int wrote_header;
+
+	uint64_t offset;
+	uint64_t log_position;
+	size_t nr_records;
+	int err;
+
+	/* The block being filled, if `block_type` is set. */
+	unsigned char block_type;
+	size_t block_header_off;
+	struct strbuf block;
+	uint32_t *restarts;
+	size_t restart_nr, restart_alloc;
+	unsigned int since_restart;
+	struct strbuf last_key;
+
+	/* For checking the order of the records. */
+	unsigned char prev_type;
+	struct strbuf prev_key;
+
+	struct strbuf scratch;
+	struct strbuf key;
+};
+
+static void writer_init(struct reftable_writer *w, int fd,
+			const struct reftable_write_options *opts,
+			uint64_t min_update_index, uint64_t max_update_index)
+{
+	unsigned char *p;
+
+	memset(w, 0, sizeof(*w));
+	w->fd = fd;
+	w->opts = *opts;
+	if (!w->opts.block_size)
+		w->opts.block_size = REFTABLE_DEFAULT_BLOCK_SIZE;
+	if (w->opts.block_size > MAX_BLOCK_SIZE)
+		w->opts.block_size = MAX_BLOCK_SIZE;
+	if (!w->opts.restart_interval)
+		w->opts.restart_interval = REFTABLE_DEFAULT_RESTART_INTERVAL;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+
+	/* Version 1 only knows about SHA-1. */
+	w->version = hash_algo_by_ptr(the_hash_algo) == GIT_HASH_SHA1 ? 1 : 2;
+	w->header_len = header_size(w->version);
+	p = w->header;
+	memcpy(p, REFTABLE_MAGIC, 4);
+	p[4] = w->version;
+	put_be24(p + 5, w->opts.block_size);
+	put_be64(p + 8, min_update_index);
+	put_be64(p + 16, max_update_index);
+	if (w->version == 2)
+		put_be32(p + 24, the_hash_algo->format_id);
+
+	strbuf_init(&w->block, w->opts.block_size);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->prev_key, 0);
+	strbuf_init(&w->scratch, 0);
+	strbuf_init(&w->key, 0);
+}
+
+static void writer_release(struct reftable_writer *w)
+{
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->prev_key);
+	strbuf_release(&w->scratch);
+	strbuf_release(&w->key);
+	free(w->restarts);
+}
+
+static int writer_write(struct reftable_writer *w, const void *buf, size_t len)
+{
+	if (w->err)
+		return -1;
+	if (write_in_full(w->fd, buf, len) < 0) {
+		w->err = error_errno(_("unable to write reftable"));
+		return -1;
+	}
+	w->offset += len;
+	return 0;
+}
+
+static void writer_start_block(struct reftable_writer *w, unsigned char type)
+{
+	strbuf_reset(&w->block);
+	w->block_header_off = 0;
+
+	if (!w->wrote_header) {
+		if (type == BLOCK_TYPE_REF) {
+			/* The first ref block starts with the file header. */
+			strbuf_add(&w->block, w->header, w->header_len);
+			w->block_header_off = w->header_len;
+		} else {
+			writer_write(w, w->header, w->header_len);
+		}
+		w->wrote_header = 1;
+	}
+
+	w->block_type = type;
+	strbuf_addch(&w->block, type);
+	strbuf_addchars(&w->block, 0, 3);
+	w->restart_nr = 0;
+	w->since_restart = 0;
+	strbuf_reset(&w->last_key);
+}
+
+static int writer_deflate_block(struct reftable_writer *w)
+{
+	git_zstream stream;
+	unsigned char *out;
+	unsigned long bound;
+	size_t in_len = w->block.len - BLOCK_HEADER_SIZE;
+	int status, ret;
+
+	memset(&stream, 0, sizeof(stream));
+	git_deflate_init(&stream, zlib_compression_level);
+	bound = git_deflate_bound(&stream, in_len);
+	out = xmalloc(BLOCK_HEADER_SIZE + bound);
+	memcpy(out, w->block.buf, BLOCK_HEADER_SIZE);
+
+	stream.next_in = (unsigned char *)w->block.buf + BLOCK_HEADER_SIZE;
+	stream.avail_in = in_len;
+	stream.next_out = out + BLOCK_HEADER_SIZE;
+	stream.avail_out = bound;
+	do {
+		status = git_deflate(&stream, Z_FINISH);
+	} while (status == Z_OK);
+	if (status != Z_STREAM_END)
+		BUG("unable to deflate reftable log block (%d)", status);
+	git_deflate_end(&stream);
+
+	ret = writer_write(w, out, BLOCK_HEADER_SIZE + stream.total_out);
+	free(out);
+	return ret;
+}
+
+static int writer_flush_block(struct reftable_writer *w)
+{
+	unsigned char buf[3];
+	size_t i;
+
+	if (!w->block_type)
+		return 0;
+
+	for (i = 0; i < w->restart_nr; i++) {
+		put_be24(buf, w->restarts[i]);
+		strbuf_add(&w->block, buf, 3);
+	}
+	buf[0] = (w->restart_nr >> 8) & 0xff;
+	buf[1] = w->restart_nr & 0xff;
+	strbuf_add(&w->block, buf, 2);
+	put_be24((unsigned char *)w->block.buf + w->block_header_off + 1,
+		 w->block.len);
+
+	if (w->block_type == BLOCK_TYPE_REF) {
+		/* Ref blocks are padded so that readers can bisect them. */
+		strbuf_addchars(&w->block, 0, w->opts.block_size - w->block.len);
+		writer_write(w, w->block.buf, w->block.len);
+	} else {
+		if (!w->log_position)
+			w->log_position = w->offset;
+		writer_deflate_block(w);
+	}
+
+	w->block_type = 0;
+	return w->err;
+}
+
+static int writer_add_record(struct reftable_writer *w, unsigned char type,
+			     const struct strbuf *key, unsigned char value_type,
+			     const struct strbuf *value)
+{
+	struct strbuf *rec = &w->scratch;
+
+	if (w->err)
+		return -1;
+
+	if (w->prev_type && (w->prev_type != type ?
+			     w->prev_type == BLOCK_TYPE_LOG :
+			     key_cmp(&w->prev_key, key) >= 0))
+		BUG("reftable records added out of order");
+	w->prev_type = type;
+	strbuf_reset(&w->prev_key);
+	strbuf_addbuf(&w->prev_key, key);
+
+	if (w->block_type && w->block_type != type &&
+	    writer_flush_block(w))
+		return -1;
+	if (!w->block_type)
+		writer_start_block(w, type);
+
+	for (;;) {
+		int restart = !w->since_restart;
+		size_t prefix = 0, needed;
+
+		if (!restart)
+			while (prefix < key->len && prefix < w->last_key.len &&
+			       key->buf[prefix] == w->last_key.buf[prefix])
+				prefix++;
+
+		strbuf_reset(rec);
+		strbuf_add_varint(rec, prefix);
+		strbuf_add_varint(rec, ((uint64_t)(key->len - prefix) << 3) |
+				  value_type);
+		strbuf_add(rec, key->buf + prefix, key->len - prefix);
+		strbuf_addbuf(rec, value);
+
+		needed = w->block.len + rec->len +
+			3 * (w->restart_nr + restart) + 2;
+		if ((needed <= w->opts.block_size || (type == BLOCK_TYPE_LOG &&
+						      !w->restart_nr &&
+						      needed <= MAX_BLOCK_SIZE)) &&
+		    w->restart_nr + restart <= MAX_RESTARTS) {
+			if (restart) {
+				ALLOC_GROW(w->restarts, w->restart_nr + 1,
+					   w->restart_alloc);
+				w->restarts[w->restart_nr++] = w->block.len;
+			}
+			strbuf_addbuf(&w->block, rec);
+			w->since_restart = (w->since_restart + 1) %
+				w->opts.restart_interval;
+			strbuf_reset(&w->last_key);
+			strbuf_addbuf(&w->last_key, key);
+			w->nr_records++;
+			return 0;
+		}
+
+		if (!w->restart_nr) {
+			w->err = error(_("reftable record for '%.*s' does not "
+					 "fit into a block"),
+				       (int)strnlen(key->buf, key->len),
+				       key->buf);
+			return -1;
+		}
+		if (writer_flush_block(w))
+			return -1;
+		writer_start_block(w, type);
+	}
+}
+
+int reftable_writer_add_ref(struct reftable_writer *w,
+			    const struct reftable_ref_record *rec)
+{
+	struct strbuf value = STRBUF_INIT;
+	int ret;
+
+	if (rec->update_index < w->min_update_index ||
+	    rec->update_index > w->max_update_index)
+		BUG("update index %"PRIu64" of '%s' out of range",
+		    rec->update_index, rec->refname.buf);
+
+	encode_ref_value(&value, rec, w->min_update_index,
+			 the_hash_algo->rawsz);
+	ret = writer_add_record(w, BLOCK_TYPE_REF, &rec->refname,
+				rec->value_type, &value);
+	strbuf_release(&value);
+	return ret;
+}
+
+int reftable_writer_add_log(struct reftable_writer *w,
+			    const struct reftable_log_record *rec)
+{
+	struct strbuf value = STRBUF_INIT;
+	int ret;
+
+	if (strchr(rec->message.buf, '\n') !=
+	    (rec->message.len ? rec->message.buf + rec->message.len - 1 : NULL))
+		BUG("reftable log message must be one line ending in LF");
+
+	log_key(&w->key, rec->refname.buf, rec->update_index);
+	encode_log_value(&value, rec, the_hash_algo->rawsz);
+	ret = writer_add_record(w, BLOCK_TYPE_LOG, &w->key,
+				rec->value_type, &value);
+	strbuf_release(&value);
+	return ret;
+}
+
+static int writer_finish(struct reftable_writer *w)
+{
+	unsigned char footer[28 + REFTABLE_FOOTER_FIELDS_SIZE + 4];
+	unsigned char *p = footer;
+
+	if (writer_flush_block(w))
+		return -1;
+	if (!w->wrote_header) {
+		writer_write(w, w->header, w->header_len);
+		w->wrote_header = 1;
+	}
+
+	memcpy(p, w->header, w->header_len);
+	p += w->header_len;
+	put_be64(p, 0);			/* ref index */
+	put_be64(p + 8, 0);		/* objects and object id length */
+	put_be64(p + 16, 0);		/* object index */
+	put_be64(p + 24, w->log_position);
+	put_be64(p + 32, 0);		/* log index */
+	p += REFTABLE_FOOTER_FIELDS_SIZE;
+	put_be32(p, crc32(0, footer, p - footer));
+	p += 4;
+
+	return writer_write(w, footer, p - footer);
+}
+
+/*
+ * Stacks.
+ */
+void reftable_stack_init(struct reftable_stack *st, const char *dir,
+			 const struct reftable_write_options *opts)
+{
+	memset(st, 0, sizeof(*st));
+	string_list_init(&st->log_names, 1);
+	st->dir = xstrdup(dir);
+	st->list_file = xstrfmt("%s/tables.list", dir);
+	st->opts = *opts;
+}
+
+static void stack_clear_log_names(struct reftable_stack *st)
+{
+	string_list_clear(&st->log_names, 0);
+}
+
+static void stack_clear_tables(struct reftable_stack *st)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		table_unref(st->tables[i]);
+	FREE_AND_NULL(st->tables);
+	st->nr = st->alloc = 0;
+}
+
+void reftable_stack_release(struct reftable_stack *st)
+{
+	stack_clear_tables(st);
+	stack_clear_log_names(st);
+	FREE_AND_NULL(st->dir);
+	FREE_AND_NULL(st->list_file);
+}
+
+/*
+ * Read "tables.list" and open its tables. Return 1 if a table vanished
+ * under us (presumably because of a concurrent compaction).
+ */
+static int stack_reload_once(struct reftable_stack *st)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct reftable_table **tables = NULL;
+	size_t nr = 0, alloc = 0, i;
+	int fd, ret = 0;
+
+	fd = open(st->list_file, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return error_errno(_("unable to open '%s'"),
+					   st->list_file);
+	} else {
+		if (strbuf_read(&buf, fd, 0) < 0) {
+			ret = error_errno(_("unable to read '%s'"),
+					  st->list_file);
+			close(fd);
+			goto out;
+		}
+		close(fd);
+	}
+	string_list_split(&names, buf.buf, '\n', -1);
+
+	for (i = 0; i < names.nr; i++) {
+		const char *name = names.items[i].string;
+		struct reftable_table *t = NULL;
+		size_t j;
+
+		if (!*name)
+			continue;
+		for (j = 0; j < st->nr; j++) {
+			if (!strcmp(st->tables[j]->name, name)) {
+				t = st->tables[j];
+				t->refcount++;
+				break;
+			}
+		}
+		if (!t) {
+			ret = table_open(&t, st->dir, name);
+			if (ret)
+				goto out;
+		}
+		ALLOC_GROW(tables, nr + 1, alloc);
+		tables[nr++] = t;
+	}
+
+	/* Keep the reflog names if we did not pick up any new tables. */
+	if (nr != st->nr ||
+	    (nr && memcmp(tables, st->tables, st_mult(nr, sizeof(*tables)))))
+		stack_clear_log_names(st);
+	stack_clear_tables(st);
+	st->tables = tables;
+	st->nr = nr;
+	st->alloc = alloc;
+	tables = NULL;
+	nr = 0;
+
+out:
+	for (i = 0; i < nr; i++)
+		table_unref(tables[i]);
+	free(tables);
+	string_list_clear(&names, 0);
+	strbuf_release(&buf);
+	return ret;
+}
+
+/*
+ * Note that "tables.list" is read even if its stat data did not
+ * change: it is replaced by renaming a new file over it, so after a
+ * compaction within the same second, the new file may well have the
+ * old one's inode and size. Reading it is cheap, and tables we already
+ * have open are reused.
+ */
+int reftable_stack_reload(struct reftable_stack *st)
+{
+	int tries;
+
+	for (tries = 0; tries < 10; tries++) {
+		int ret = stack_reload_once(st);
+
+		if (ret <= 0)
+			return ret;
+		sleep_millisec(1 << tries);
+	}
+	return error(_("tables listed in '%s' keep disappearing"),
+		     st->list_file);
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	if (!st->nr)
+		return 1;
+	return st->tables[st->nr - 1]->max_update_index + 1;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec)
+{
+	struct strbuf want = STRBUF_INIT;
+	size_t i = st->nr;
+	int ret = 1;
+
+	strbuf_addstr(&want, refname);
+	while (i--) {
+		struct reftable_table *t = st->tables[i];
+		struct table_iter ti;
+
+		table_iter_init(&ti, t, 0);
+		ret = table_iter_seek(&ti, &want);
+		if (!ret && key_cmp(&ti.bi.key, &want))
+			ret = 1;
+		if (!ret) {
+			strbuf_reset(&rec->refname);
+			strbuf_addbuf(&rec->refname, &want);
+			if (decode_ref_value(rec, ti.bi.value_type,
+					     ti.bi.value, ti.bi.value_end,
+					     t->min_update_index, t->rawsz))
+				ret = error(_("reftable '%s' has a corrupt record for '%s'"),
+					    t->name, refname);
+			else if (rec->value_type == REFTABLE_REF_DELETION)
+				ret = 1;
+		}
+		table_iter_release(&ti);
+		if (ret <= 0)
+			break;
+		/* Not in this table; look at older ones. */
+		ret = 1;
+	}
+
+	strbuf_release(&want);
+	return ret;
+}
+
+struct reftable_iterator *reftable_stack_iterate_refs(struct reftable_stack *st,
+						      const char *prefix)
+{
+	struct reftable_iterator *it = merged_iter_new(st->tables, st->nr, 0, 0);
+	struct strbuf want = STRBUF_INIT;
+
+	strbuf_addstr(&want, prefix ? prefix : "");
+	if (merged_iter_seek(it, &want)) {
+		reftable_iterator_free(it);
+		it = NULL;
+	}
+	strbuf_release(&want);
+	return it;
+}
+
+int reftable_stack_has_log(struct reftable_stack *st, const char *refname)
+{
+	struct reftable_log_record rec = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+	struct string_list_item *item;
+	int ret;
+
+	item = string_list_lookup(&st->log_names, refname);
+	if (item)
+		return !!item->util;
+
+	/* The seek lands on the newest entry of `refname`, if any. */
+	it = reftable_stack_iterate_logs(st, refname);
+	if (!it)
+		return -1;
+	ret = reftable_iterator_next_log(it, &rec);
+	reftable_iterator_free(it);
+	if (ret >= 0) {
+		ret = !ret && !strcmp(rec.refname.buf, refname);
+		string_list_insert(&st->log_names, refname)->util =
+			ret ? st : NULL;
+	}
+	reftable_log_record_release(&rec);
+	return ret;
+}
+
+struct reftable_iterator *reftable_stack_iterate_logs(struct reftable_stack *st,
+						      const char *refname)
+{
+	struct reftable_iterator *it = merged_iter_new(st->tables, st->nr, 1, 0);
+	struct strbuf want = STRBUF_INIT;
+
+	if (refname) {
+		strbuf_addstr(&want, refname);
+		strbuf_addch(&want, '\0');
+	}
+	if (merged_iter_seek(it, &want)) {
+		reftable_iterator_free(it);
+		it = NULL;
+	}
+	strbuf_release(&want);
+	return it;
+}
+
+int reftable_stack_lock(struct reftable_stack *st,
+			struct reftable_addition *add,
+			struct strbuf *err)
+{
+	add->stack = st;
+
+	if (safe_create_leading_directories(st->list_file)) {
+		strbuf_addf(err, _("unable to create directory for '%s'"),
+			    st->list_file);
+		return -1;
+	}
+	if (hold_lock_file_for_update_timeout(&add->lock, st->list_file, 0,
+					      st->opts.lock_timeout_ms) < 0) {
+		unable_to_lock_message(st->list_file, errno, err);
+		return -1;
+	}
+	if (reftable_stack_reload(st)) {
+		rollback_lock_file(&add->lock);
+		strbuf_addf(err, _("unable to read '%s'"), st->list_file);
+		return -1;
+	}
+
+	add->next_update_index = reftable_stack_next_update_index(st);
+	return 0;
+}
+
+/*
+ * Write a table into the stack directory and return its name, or NULL
+ * if it would be empty or on errors (in which case `*ret` is set).
+ */
+static char *stack_write_table(struct reftable_stack *st,
+			       uint64_t min, uint64_t max,
+			       reftable_write_fn *fn, void *cb_data, int *ret)
+{
+	struct reftable_writer w;
+	struct tempfile *tmp;
+	char *template = xstrfmt("%s/tmp_table_XXXXXX", st->dir);
+	char *name = NULL, *path = NULL;
+	const char *suffix;
+
+	*ret = 0;
+	tmp = mks_tempfile_m(template, 0666);
+	if (!tmp) {
+		*ret = error_errno(_("unable to create temporary file '%s'"),
+				   template);
+		free(template);
+		return NULL;
+	}
+	free(template);
+
+	writer_init(&w, get_tempfile_fd(tmp), &st->opts, min, max);
+	*ret = fn(&w, cb_data);
+	if (!*ret)
+		*ret = writer_finish(&w);
+	if (*ret || !w.nr_records) {
+		delete_tempfile(&tmp);
+		goto out;
+	}
+
+	adjust_shared_perm(get_tempfile_path(tmp));
+	suffix = strrchr(get_tempfile_path(tmp), '_') + 1;
+	name = xstrfmt("0x%012"PRIx64"-0x%012"PRIx64"-%s.ref",
+		       min, max, suffix);
+	path = xstrfmt("%s/%s", st->dir, name);
+	if (rename_tempfile(&tmp, path)) {
+		*ret = error_errno(_("unable to write '%s'"), path);
+		FREE_AND_NULL(name);
+	}
+
+out:
+	writer_release(&w);
+	free(path);
+	return name;
+}
+
+int reftable_addition_add(struct reftable_addition *add,
+			  uint64_t min, uint64_t max,
+			  reftable_write_fn *fn, void *cb_data)
+{
+	char *name;
+	int ret;
+
+	name = stack_write_table(add->stack, min, max, fn, cb_data, &ret);
+	if (name)
+		string_list_append_nodup(&add->new_tables, name);
+	return ret;
+}
+
+static void unlink_tables(struct reftable_stack *st, struct string_list *names)
+{
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, names) {
+		char *path = xstrfmt("%s/%s", st->dir, item->string);
+
+		unlink(path);
+		free(path);
+	}
+	string_list_clear(names, 0);
+}
+
+/*
+ * Replace the tables `first` to `last` (exclusive) of the locked stack
+ * by those in `names` and commit the lock.
+ */
+static int stack_commit_list(struct reftable_stack *st, struct lock_file *lock,
+			     size_t first, size_t last,
+			     const struct string_list *names)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < first; i++)
+		strbuf_addf(&buf, "%s\n", st->tables[i]->name);
+	for (i = 0; i < names->nr; i++)
+		strbuf_addf(&buf, "%s\n", names->items[i].string);
+	for (i = last; i < st->nr; i++)
+		strbuf_addf(&buf, "%s\n", st->tables[i]->name);
+
+	if (write_in_full(get_lock_file_fd(lock), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(lock))
+		ret = error_errno(_("unable to write '%s'"), st->list_file);
+
+	strbuf_release(&buf);
+	return ret;
+}
+
+struct compaction_data {
+	struct reftable_table **tables;
+	size_t nr;
+	int keep_deletions;
+};
+
+static int write_compacted(struct reftable_writer *w, void *cb_data)
+{
+	struct compaction_data *data = cb_data;
+	struct reftable_iterator *it;
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct strbuf empty = STRBUF_INIT;
+	int ret;
+
+	it = merged_iter_new(data->tables, data->nr, 0, data->keep_deletions);
+	ret = merged_iter_seek(it, &empty);
+	while (!ret && !(ret = reftable_iterator_next_ref(it, &ref)))
+		ret = reftable_writer_add_ref(w, &ref);
+	reftable_iterator_free(it);
+	if (ret < 0)
+		goto out;
+
+	it = merged_iter_new(data->tables, data->nr, 1, data->keep_deletions);
+	ret = merged_iter_seek(it, &empty);
+	while (!ret && !(ret = reftable_iterator_next_log(it, &log)))
+		ret = reftable_writer_add_log(w, &log);
+	reftable_iterator_free(it);
+
+out:
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Merge the tables `first` to `last` (exclusive) of the stack, which
+ * must be locked with `lock` and up to date.
+ */
+static int stack_compact_locked(struct reftable_stack *st,
+				struct lock_file *lock,
+				size_t first, size_t last)
+{
+	struct compaction_data data;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list old_names = STRING_LIST_INIT_DUP;
+	char *name;
+	size_t i;
+	int ret;
+
+	data.tables = st->tables + first;
+	data.nr = last - first;
+	/* Tombstones only matter if there are older tables. */
+	data.keep_deletions = first > 0;
+
+	trace2_region_enter("reftable", "compact", the_repository);
+	name = stack_write_table(st, st->tables[first]->min_update_index,
+				 st->tables[last - 1]->max_update_index,
+				 write_compacted, &data, &ret);
+	if (ret) {
+		rollback_lock_file(lock);
+		goto out;
+	}
+	if (name)
+		string_list_append_nodup(&names, name);
+
+	for (i = first; i < last; i++)
+		string_list_append(&old_names, st->tables[i]->name);
+
+	ret = stack_commit_list(st, lock, first, last, &names);
+	if (ret) {
+		unlink_tables(st, &names);
+		goto out;
+	}
+
+	/* Readers that still have the old tables open keep them alive. */
+	unlink_tables(st, &old_names);
+	ret = reftable_stack_reload(st);
+
+out:
+	trace2_region_leave("reftable", "compact", the_repository);
+	string_list_clear(&names, 0);
+	string_list_clear(&old_names, 0);
+	return ret;
+}
+
+/*
+ * Find the tables to compact so that every table ends up being more
+ * than twice as big as all newer tables combined. Return the index of
+ * the oldest table to compact; `st->nr - 1` means nothing to do.
+ */
+static size_t stack_compaction_start(struct reftable_stack *st)
+{
+	size_t i, sum;
+
+	if (st->nr < 2)
+		return st->nr ? st->nr - 1 : 0;
+
+	i = st->nr - 1;
+	sum = st->tables[i]->size;
+	while (i > 0 && st->tables[i - 1]->size <= 2 * sum) {
+		i--;
+		sum += st->tables[i]->size;
+	}
+	return i;
+}
+
+static int stack_auto_compact(struct reftable_stack *st)
+{
+	struct lock_file lock = LOCK_INIT;
+	size_t first;
+
+	if (stack_compaction_start(st) + 1 >= st->nr)
+		return 0;
+
+	/* Somebody else is busy with the stack; leave it to them. */
+	if (hold_lock_file_for_update(&lock, st->list_file, 0) < 0)
+		return 0;
+	if (reftable_stack_reload(st)) {
+		rollback_lock_file(&lock);
+		return -1;
+	}
+
+	first = stack_compaction_start(st);
+	if (first + 1 >= st->nr) {
+		rollback_lock_file(&lock);
+		return 0;
+	}
+	return stack_compact_locked(st, &lock, first, st->nr);
+}
+
+int reftable_stack_compact_all(struct reftable_stack *st)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf err = STRBUF_INIT;
+
+	if (reftable_stack_reload(st))
+		return -1;
+	if (st->nr < 2)
+		return 0;
+
+	if (hold_lock_file_for_update_timeout(&lock, st->list_file, 0,
+					      st->opts.lock_timeout_ms) < 0) {
+		unable_to_lock_message(st->list_file, errno, &err);
+		error("%s", err.buf);
+		strbuf_release(&err);
+		return -1;
+	}
+	if (reftable_stack_reload(st)) {
+		rollback_lock_file(&lock);
+		return -1;
+	}
+	if (st->nr < 2) {
+		rollback_lock_file(&lock);
+		return 0;
+	}
+	return stack_compact_locked(st, &lock, 0, st->nr);
+}
+
+int reftable_addition_commit(struct reftable_addition *add)
+{
+	struct reftable_stack *st = add->stack;
+	int ret;
+
+	if (!add->new_tables.nr) {
+		rollback_lock_file(&add->lock);
+		return 0;
+	}
+
+	ret = stack_commit_list(st, &add->lock, st->nr, st->nr,
+				&add->new_tables);
+	if (ret) {
+		unlink_tables(st, &add->new_tables);
+		return ret;
+	}
+	string_list_clear(&add->new_tables, 0);
+
+	if (reftable_stack_reload(st))
+		return -1;
+
+	/* The update is done; failing to compact is not an error. */
+	if (!st->opts.disable_auto_compact)
+		stack_auto_compact(st);
+	return 0;
+}
+
+void reftable_addition_release(struct reftable_addition *add)
+{
+	rollback_lock_file(&add->lock);
+	if (add->stack)
+		unlink_tables(add->stack, &add->new_tables);
+	string_list_clear(&add->new_tables, 0);
+}
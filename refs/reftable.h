@@ -0,0 +1,234 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+#include "cache.h"
+#include "lockfile.h"
+#include "string-list.h"
+
+/*
+ * Reading and writing reftables.
+ *
+ * A reftable is an immutable file holding a sorted list of reference
+ * records followed by a sorted list of reflog records, all stamped with
+ * an "update index" that orders them in time. Records are grouped into
+ * blocks; keys within a block are prefix-compressed, with a full key
+ * at every restart point, so that a key can be found with a binary
+ * search over the (fixed-size) ref blocks and then over the restart
+ * points of one block. Log blocks are zlib-compressed.
+ *
+ * A stack is a directory of reftables plus a "tables.list" file naming
+ * them from oldest to newest. A lookup consults the tables newest first,
+ * so each update only needs to add a small table with the changed
+ * records. To keep the number of tables logarithmic in the number of
+ * updates, adjacent tables are merged ("compacted") whenever the newer
+ * ones together come close in size to the older ones.
+ *
+ * See Documentation/technical/reftable.txt for the file format.
+ */
+
+enum reftable_ref_value_type {
+	REFTABLE_REF_DELETION = 0,	/* tombstone for an older record */
+	REFTABLE_REF_VAL1 = 1,		/* an object name */
+	REFTABLE_REF_VAL2 = 2,		/* an object name and its peeled value */
+	REFTABLE_REF_SYMREF = 3		/* a symbolic reference */
+};
+
+struct reftable_ref_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_ref_value_type value_type;
+	struct object_id value;
+	struct object_id peeled;
+	struct strbuf target;
+};
+
+#define REFTABLE_REF_RECORD_INIT { \
+	.refname = STRBUF_INIT, \
+	.target = STRBUF_INIT, \
+}
+
+void reftable_ref_record_release(struct reftable_ref_record *rec);
+
+enum reftable_log_value_type {
+	REFTABLE_LOG_DELETION = 0,	/* tombstone for an older entry */
+	REFTABLE_LOG_UPDATE = 1
+};
+
+struct reftable_log_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_log_value_type value_type;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	struct strbuf name;
+	struct strbuf email;
+	timestamp_t time;
+	int tz_offset;
+	/* One line, terminated by LF. */
+	struct strbuf message;
+};
+
+#define REFTABLE_LOG_RECORD_INIT { \
+	.refname = STRBUF_INIT, \
+	.name = STRBUF_INIT, \
+	.email = STRBUF_INIT, \
+	.message = STRBUF_INIT, \
+}
+
+void reftable_log_record_release(struct reftable_log_record *rec);
+
+struct reftable_write_options {
+	/* The size of ref blocks; ref and log records must fit into one. */
+	unsigned int block_size;
+	/* Write a full key for every this many records. */
+	unsigned int restart_interval;
+	/* How long to wait for the lock on "tables.list". */
+	long lock_timeout_ms;
+	/* Do not compact the stack after adding tables. */
+	unsigned int disable_auto_compact : 1;
+};
+
+#define REFTABLE_DEFAULT_BLOCK_SIZE 4096
+#define REFTABLE_DEFAULT_RESTART_INTERVAL 16
+
+/*
+ * Writing a table. All references must be added before all reflog
+ * entries, both in the order of their keys (refname for references,
+ * refname and then descending update index for reflog entries). The
+ * update indices of references must lie within the limits given when
+ * the writer was created.
+ */
+struct reftable_writer;
+
+typedef int reftable_write_fn(struct reftable_writer *writer, void *cb_data);
+
+int reftable_writer_add_ref(struct reftable_writer *writer,
+			    const struct reftable_ref_record *rec);
+int reftable_writer_add_log(struct reftable_writer *writer,
+			    const struct reftable_log_record *rec);
+
+/*
+ * Iterating over records. Tombstones are hidden, as are the records
+ * they shadow.
+ */
+struct reftable_iterator;
+
+/*
+ * Return 0 and fill in `rec` if there is another record, 1 at the end
+ * of the iteration, and a negative value on errors.
+ */
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec);
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec);
+void reftable_iterator_free(struct reftable_iterator *it);
+
+struct reftable_table;
+
+struct reftable_stack {
+	char *dir;
+	char *list_file;
+	struct reftable_write_options opts;
+
+	/* The tables of the stack, from oldest to newest. */
+	struct reftable_table **tables;
+	size_t nr, alloc;
+
+	/*
+	 * Answers of reftable_stack_has_log() for the tables above: the
+	 * names looked up so far, with a non-NULL util if they have a
+	 * reflog.
+	 */
+	struct string_list log_names;
+};
+
+/*
+ * Initialize `st` for the stack in `dir`. The directory does not have
+ * to exist yet; it is created when the first table is added.
+ */
+void reftable_stack_init(struct reftable_stack *st, const char *dir,
+			 const struct reftable_write_options *opts);
+void reftable_stack_release(struct reftable_stack *st);
+
+/*
+ * Make sure we look at the current tables by re-reading "tables.list".
+ * Return 0 on success.
+ */
+int reftable_stack_reload(struct reftable_stack *st);
+
+/* The update index for the next table added to the stack. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/*
+ * Look up a single reference. Return 0 if it exists, 1 if it doesn't
+ * and a negative value on errors.
+ */
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec);
+
+/* Iterate over the references whose name starts with `prefix`. */
+struct reftable_iterator *reftable_stack_iterate_refs(struct reftable_stack *st,
+						      const char *prefix);
+
+/*
+ * Return 1 if `refname` has a reflog, 0 if not and a negative value on
+ * errors. The answer is remembered until the tables change.
+ */
+int reftable_stack_has_log(struct reftable_stack *st, const char *refname);
+
+/*
+ * Iterate over the reflog of `refname`, newest entry first, or over
+ * all reflog entries if `refname` is NULL.
+ */
+struct reftable_iterator *reftable_stack_iterate_logs(struct reftable_stack *st,
+						      const char *refname);
+
+/*
+ * Adding to the stack. Locking the stack reloads it; while the lock is
+ * held, nobody else can change it. Tables that were added are only
+ * visible once the addition is committed.
+ */
+struct reftable_addition {
+	struct reftable_stack *stack;
+	struct lock_file lock;
+	struct string_list new_tables;
+	uint64_t next_update_index;
+};
+
+#define REFTABLE_ADDITION_INIT { \
+	.lock = LOCK_INIT, \
+	.new_tables = STRING_LIST_INIT_DUP, \
+}
+
+/*
+ * Lock the stack for `add`. On errors, write a message to `err` and
+ * return a negative value.
+ */
+int reftable_stack_lock(struct reftable_stack *st,
+			struct reftable_addition *add,
+			struct strbuf *err);
+
+/*
+ * Write a new table covering the update indices `min` to `max` by
+ * calling `fn`. A table to which `fn` adds nothing is dropped.
+ */
+int reftable_addition_add(struct reftable_addition *add,
+			  uint64_t min, uint64_t max,
+			  reftable_write_fn *fn, void *cb_data);
+
+/*
+ * Make the new tables part of the stack, release the lock and compact
+ * the stack if needed.
+ */
+int reftable_addition_commit(struct reftable_addition *add);
+
+/* Release the lock, throwing away any uncommitted tables. */
+void reftable_addition_release(struct reftable_addition *add);
+
+/*
+ * Merge all tables of the stack into one, dropping tombstones. Return 0
+ * on success.
+ */
+int reftable_stack_compact_all(struct reftable_stack *st);
+
+#endif /* REFS_REFTABLE_H */
@@ -653,25 +653,47 @@ static void trace2_bloom_filter_statistics_atexit(void)
 
 static int forbid_bloom_filters(struct pathspec *spec)
 {
-	if (spec->has_wildcard)
-		return 1;
-	if (spec->nr > 1)
-		return 1;
-	if (spec->magic & ~PATHSPEC_LITERAL)
-		return 1;
-	if (spec->nr && (spec->items[0].magic & ~PATHSPEC_LITERAL))
+	int i;
+
+	if (spec->magic & ~(PATHSPEC_LITERAL | PATHSPEC_GLOB))
 		return 1;
 
+	for (i = 0; i < spec->nr; i++) {
+		struct pathspec_item *pi = &spec->items[i];
+
+		if (pi->magic & ~(PATHSPEC_LITERAL | PATHSPEC_GLOB))
+			return 1;
+	}
+
 	return 0;
 }
 
+/*
+ * Return the length of the leading part of "pi" that every matching
+ * path must start with and that can be looked up in a Bloom filter,
+ * i.e. the whole path for a literal pathspec, and the leading
+ * directories before the first wildcard otherwise. Returns 0 if there
+ * is no such part.
+ */
+static size_t bloom_key_len(const struct pathspec_item *pi)
+{
+	size_t len = pi->nowildcard_len;
+
+	if (len < pi->len) {
+		while (len && pi->match[len - 1] != '/')
+			len--;
+	}
+
+	/* remove trailing slash from path, if needed */
+	if (len && pi->match[len - 1] == '/')
+		len--;
+	return len;
+}
+
 static void prepare_to_use_bloom_filter(struct rev_info *revs)
 {
-	struct pathspec_item *pi;
-	char *path_alloc = NULL;
-	const char *path, *p;
-	size_t len;
-	int path_component_nr = 1;
+	struct pathspec *spec = &revs->pruning.pathspec;
+	int i;
 
 	if (!revs->commits)
 		return;
@@ -685,66 +707,50 @@ static void prepare_to_use_bloom_filter(struct rev_info *revs)
 	if (!revs->bloom_filter_settings)
 		return;
 
-	if (!revs->pruning.pathspec.nr)
-		return;
-
-	pi = &revs->pruning.pathspec.items[0];
-
-	/* remove single trailing slash from path, if needed */
-	if (pi->len > 0 && pi->match[pi->len - 1] == '/') {
-		path_alloc = xmemdupz(pi->match, pi->len - 1);
-		path = path_alloc;
-	} else
-		path = pi->match;
-
-	len = strlen(path);
-	if (!len) {
-		revs->bloom_filter_settings = NULL;
-		free(path_alloc);
+	if (!spec->nr)
 		return;
-	}
 
-	p = path;
-	while (*p) {
-		/*
-		 * At this point, the path is normalized to use Unix-style
-		 * path separators. This is required due to how the
-		 * changed-path Bloom filters store the paths.
-		 */
-		if (*p == '/')
-			path_component_nr++;
-		p++;
+	/*
+	 * Every pathspec item needs a key; a single item that may match
+	 * anywhere in the tree makes the filters useless.
+	 */
+	for (i = 0; i < spec->nr; i++) {
+		if (!bloom_key_len(&spec->items[i])) {
+			revs->bloom_filter_settings = NULL;
+			return;
+		}
 	}
 
-	revs->bloom_keys_nr = path_component_nr;
-	ALLOC_ARRAY(revs->bloom_keys, revs->bloom_keys_nr);
+	ALLOC_ARRAY(revs->bloom_keyvecs, spec->nr);
+	for (i = 0; i < spec->nr; i++) {
+		struct pathspec_item *pi = &spec->items[i];
 
-	fill_bloom_key(path, len, &revs->bloom_keys[0],
-		       revs->bloom_filter_settings);
-	path_component_nr = 1;
-
-	p = path + len - 1;
-	while (p > path) {
-		if (*p == '/')
-			fill_bloom_key(path, p - path,
-				       &revs->bloom_keys[path_component_nr++],
-				       revs->bloom_filter_settings);
-		p--;
+		revs->bloom_keyvecs[revs->bloom_keyvecs_nr++] =
+			bloom_keyvec_new(pi->match, bloom_key_len(pi),
+					 revs->bloom_filter_settings);
 	}
 
 	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
 		atexit(trace2_bloom_filter_statistics_atexit);
 		bloom_filter_atexit_registered = 1;
 	}
+}
+
+static void free_bloom_keyvecs(struct rev_info *revs)
+{
+	int i;
 
-	free(path_alloc);
+	for (i = 0; i < revs->bloom_keyvecs_nr; i++)
+		bloom_keyvec_free(revs->bloom_keyvecs[i]);
+	FREE_AND_NULL(revs->bloom_keyvecs);
+	revs->bloom_keyvecs_nr = 0;
 }
 
 static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 						 struct commit *commit)
 {
 	struct bloom_filter *filter;
-	int result = 1, j;
+	int result = 0, j;
 
 	if (!revs->repo->objects->commit_graph)
 		return -1;
@@ -759,10 +765,10 @@ static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
 		return -1;
 	}
 
-	for (j = 0; result && j < revs->bloom_keys_nr; j++) {
-		result = bloom_filter_contains(filter,
-					       &revs->bloom_keys[j],
-					       revs->bloom_filter_settings);
+	for (j = 0; !result && j < revs->bloom_keyvecs_nr; j++) {
+		result = bloom_filter_contains_vec(filter,
+						   revs->bloom_keyvecs[j],
+						   revs->bloom_filter_settings);
 	}
 
 	if (result)
@@ -803,7 +809,7 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
-	if (revs->bloom_keys_nr && !nth_parent) {
+	if (revs->bloom_keyvecs_nr && !nth_parent) {
 		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
 
 		if (bloom_ret == 0)
@@ -3308,7 +3314,7 @@ define_commit_slab(indegree_slab, int);
 define_commit_slab(author_date_slab, timestamp_t);
 
 struct topo_walk_info {
-	uint32_t min_generation;
+	timestamp_t min_generation;
 	struct prio_queue explore_queue;
 	struct prio_queue indegree_queue;
 	struct prio_queue topo_queue;
@@ -3354,7 +3360,7 @@ static void explore_walk_step(struct rev_info *revs)
 }
 
 static void explore_to_depth(struct rev_info *revs,
-			     uint32_t gen_cutoff)
+			     timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3381,6 +3387,13 @@ static void indegree_walk_step(struct rev_info *revs)
 		struct commit *parent = p->item;
 		int *pi = indegree_slab_at(&info->indegree, parent);
 
+		/*
+		 * The indegree queue is ordered by generation, which is
+		 * only known once the parent is parsed.
+		 */
+		if (repo_parse_commit_gently(revs->repo, parent, 1) < 0)
+			return;
+
 		if (*pi)
 			(*pi)++;
 		else
@@ -3394,7 +3407,7 @@ static void indegree_walk_step(struct rev_info *revs)
 }
 
 static void compute_indegrees_to_depth(struct rev_info *revs,
-				       uint32_t gen_cutoff)
+				       timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3452,7 +3465,7 @@ static void init_topo_walk(struct rev_info *revs)
 	info->min_generation = GENERATION_NUMBER_INFINITY;
 	for (list = revs->commits; list; list = list->next) {
 		struct commit *c = list->item;
-		uint32_t generation;
+		timestamp_t generation;
 
 		if (repo_parse_commit_gently(revs->repo, c, 1))
 			continue;
@@ -3513,7 +3526,7 @@ static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
 	for (p = commit->parents; p; p = p->next) {
 		struct commit *parent = p->item;
 		int *pi;
-		uint32_t generation;
+		timestamp_t generation;
 
 		if (parent->object.flags & UNINTERESTING)
 			continue;
@@ -4178,6 +4191,7 @@ struct commit *get_revision(struct rev_info *revs)
 		graph_update(revs->graph, c);
 	if (!c) {
 		free_saved_parents(revs);
+		free_bloom_keyvecs(revs);
 		if (revs->previous_parents) {
 			free_commit_list(revs->previous_parents);
 			revs->previous_parents = NULL;
@@ -60,7 +60,7 @@ struct repository;
 struct rev_info;
 struct string_list;
 struct saved_parents;
-struct bloom_key;
+struct bloom_keyvec;
 struct bloom_filter_settings;
 define_shared_commit_slab(revision_sources, char *);
 
@@ -302,9 +302,13 @@ struct rev_info {
 	struct topo_walk_info *topo_walk_info;
 
 	/* Commit graph bloom filter fields */
-	/* The bloom filter key(s) for the pathspec */
-	struct bloom_key *bloom_keys;
-	int bloom_keys_nr;
+	/*
+	 * The bloom filter keys for the pathspec, one key vector per
+	 * pathspec item. A commit may have touched the pathspec if its
+	 * filter contains any of them.
+	 */
+	struct bloom_keyvec **bloom_keyvecs;
+	int bloom_keyvecs_nr;
 
 	/*
 	 * The bloom filter settings used to generate the key.
@@ -14,6 +14,8 @@
 #include "diff.h"
 #include "revision.h"
 #include "rerere.h"
+#include "merge-ort.h"
+#include "merge-ort-wrappers.h"
 #include "merge-recursive.h"
 #include "refs.h"
 #include "strvec.h"
@@ -588,6 +590,20 @@ void append_conflicts_hint(struct index_state *istate,
 	}
 }
 
+/*
+ * Whether to merge in-process with the "ort" strategy instead of
+ * "recursive".  GIT_TEST_MERGE_ALGORITHM lets the test suite switch
+ * the default.
+ */
+static int use_ort_strategy(struct replay_opts *opts)
+{
+	const char *strategy = opts->strategy;
+
+	if (!strategy)
+		strategy = getenv("GIT_TEST_MERGE_ALGORITHM");
+	return strategy && !strcmp(strategy, "ort");
+}
+
 static int do_recursive_merge(struct repository *r,
 			      struct commit *base, struct commit *next,
 			      const char *base_label, const char *next_label,
@@ -620,9 +636,13 @@ static int do_recursive_merge(struct repository *r,
 	for (i = 0; i < opts->xopts_nr; i++)
 		parse_merge_opt(&o, opts->xopts[i]);
 
-	clean = merge_trees(&o,
-			    head_tree,
-			    next_tree, base_tree);
+	if (use_ort_strategy(opts))
+		clean = merge_ort_nonrecursive(&o, head_tree,
+					       next_tree, base_tree);
+	else
+		clean = merge_trees(&o,
+				    head_tree,
+				    next_tree, base_tree);
 	if (is_rebase_i(opts) && clean <= 0)
 		fputs(o.obuf.buf, stdout);
 	strbuf_release(&o.obuf);
@@ -1991,7 +2011,10 @@ static int do_pick_commit(struct repository *r,
 
 	if (is_rebase_i(opts) && write_author_script(msg.message) < 0)
 		res = -1;
-	else if (!opts->strategy || !strcmp(opts->strategy, "recursive") || command == TODO_REVERT) {
+	else if (!opts->strategy ||
+		 !strcmp(opts->strategy, "recursive") ||
+		 !strcmp(opts->strategy, "ort") ||
+		 command == TODO_REVERT) {
 		res = do_recursive_merge(r, base, next, base_label, next_label,
 					 &head, &msgbuf, opts);
 		if (res < 0)
@@ -3485,7 +3508,9 @@ static int do_merge(struct repository *r,
 	struct commit_list *bases, *j, *reversed = NULL;
 	struct commit_list *to_merge = NULL, **tail = &to_merge;
 	const char *strategy = !opts->xopts_nr &&
-		(!opts->strategy || !strcmp(opts->strategy, "recursive")) ?
+		(!opts->strategy ||
+		 !strcmp(opts->strategy, "recursive") ||
+		 !strcmp(opts->strategy, "ort")) ?
 		NULL : opts->strategy;
 	struct merge_options o;
 	int merge_arg_len, oneline_offset, can_fast_forward, ret, k;
@@ -3722,7 +3747,12 @@ static int do_merge(struct repository *r,
 	o.branch2 = ref_name.buf;
 	o.buffer_output = 2;
 
-	ret = merge_recursive(&o, head_commit, merge_commit, reversed, &i);
+	if (use_ort_strategy(opts))
+		ret = merge_ort_recursive(&o, head_commit, merge_commit,
+					  reversed, &i);
+	else
+		ret = merge_recursive(&o, head_commit, merge_commit,
+				      reversed, &i);
 	if (ret <= 0)
 		fputs(o.obuf.buf, stdout);
 	strbuf_release(&o.obuf);
@@ -1920,6 +1920,12 @@ static int freshen_packed_object(const struct object_id *oid)
 	struct pack_entry e;
 	if (!find_pack_entry(the_repository, oid, &e))
 		return 0;
+	/*
+	 * The mtime of a cruft pack does not tell anything about the age of
+	 * its objects; write a fresh loose copy instead.
+	 */
+	if (e.p->is_cruft)
+		return 0;
 	if (e.p->freshened)
 		return 1;
 	if (!freshen_file(e.p->pack_name))
@@ -2074,7 +2080,9 @@ static int index_mem(struct index_state *istate,
 			check_tag(buf, size);
 	}
 
-	if (write_object)
+	if (write_object && bulk_checkin_batched())
+		ret = index_bulk_checkin_mem(oid, buf, size, type, path, flags);
+	else if (write_object)
 		ret = write_object_file(buf, size, type_name(type), oid);
 	else
 		ret = hash_object_file(the_hash_algo, buf, size,
@@ -2100,7 +2108,10 @@ static int index_stream_convert_blob(struct index_state *istate,
 	convert_to_git_filter_fd(istate, path, fd, &sbuf,
 				 get_conv_flags(flags));
 
-	if (write_object)
+	if (write_object && bulk_checkin_batched())
+		ret = index_bulk_checkin_mem(oid, sbuf.buf, sbuf.len, OBJ_BLOB,
+					     path, flags);
+	else if (write_object)
 		ret = write_object_file(sbuf.buf, sbuf.len, type_name(OBJ_BLOB),
 					oid);
 	else
@@ -130,12 +130,12 @@ static void unique_in_midx(struct multi_pack_index *m,
 {
 	uint32_t num, i, first = 0;
 	const struct object_id *current = NULL;
-	num = m->num_objects;
+	num = m->num_objects_in_base + m->num_objects;
 
-	if (!num)
+	if (!m->num_objects)
 		return;
 
-	bsearch_midx(&ds->bin_pfx, m, &first);
+	bsearch_one_midx(&ds->bin_pfx, m, &first);
 
 	/*
 	 * At this point, "first" is the location of the lowest object
@@ -185,8 +185,13 @@ static void find_short_packed_object(struct disambiguate_state *ds)
 	struct packed_git *p;
 
 	for (m = get_multi_pack_index(ds->repo); m && !ds->ambiguous;
-	     m = m->next)
-		unique_in_midx(m, ds);
+	     m = m->next) {
+		struct multi_pack_index *layer;
+
+		for (layer = m; layer && !ds->ambiguous;
+		     layer = layer->base_midx)
+			unique_in_midx(layer, ds);
+	}
 	for (p = get_packed_git(ds->repo); p && !ds->ambiguous;
 	     p = p->next)
 		unique_in_pack(p, ds);
@@ -591,9 +596,9 @@ static void find_abbrev_len_for_midx(struct multi_pack_index *m,
 	if (!m->num_objects)
 		return;
 
-	num = m->num_objects;
+	num = m->num_objects_in_base + m->num_objects;
 	mad_oid = mad->oid;
-	match = bsearch_midx(mad_oid, m, &first);
+	match = bsearch_one_midx(mad_oid, m, &first);
 
 	/*
 	 * first is now the position in the packfile where we would insert
@@ -603,13 +608,13 @@ static void find_abbrev_len_for_midx(struct multi_pack_index *m,
 	 */
 	mad->init_len = 0;
 	if (!match) {
-		if (nth_midxed_object_oid(&oid, m, first))
+		if (first < num && nth_midxed_object_oid(&oid, m, first))
 			extend_abbrev_len(&oid, mad);
 	} else if (first < num - 1) {
 		if (nth_midxed_object_oid(&oid, m, first + 1))
 			extend_abbrev_len(&oid, mad);
 	}
-	if (first > 0) {
+	if (first > m->num_objects_in_base) {
 		if (nth_midxed_object_oid(&oid, m, first - 1))
 			extend_abbrev_len(&oid, mad);
 	}
@@ -660,8 +665,12 @@ static void find_abbrev_len_packed(struct min_abbrev_data *mad)
 	struct multi_pack_index *m;
 	struct packed_git *p;
 
-	for (m = get_multi_pack_index(mad->repo); m; m = m->next)
-		find_abbrev_len_for_midx(m, mad);
+	for (m = get_multi_pack_index(mad->repo); m; m = m->next) {
+		struct multi_pack_index *layer;
+
+		for (layer = m; layer; layer = layer->base_midx)
+			find_abbrev_len_for_midx(layer, mad);
+	}
 	for (p = get_packed_git(mad->repo); p; p = p->next)
 		find_abbrev_len_for_pack(p, mad);
 }
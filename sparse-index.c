@@ -0,0 +1,305 @@
+#include "cache.h"
+#include "repository.h"
+#include "sparse-index.h"
+#include "tree.h"
+#include "pathspec.h"
+#include "trace2.h"
+#include "cache-tree.h"
+#include "config.h"
+#include "dir.h"
+
+static struct cache_entry *construct_sparse_dir_entry(
+				struct index_state *istate,
+				const char *sparse_dir,
+				size_t len,
+				struct cache_tree *tree)
+{
+	struct cache_entry *de;
+
+	de = make_empty_cache_entry(istate, len);
+	oidcpy(&de->oid, &tree->oid);
+	memcpy(de->name, sparse_dir, len);
+	de->ce_namelen = len;
+	de->ce_mode = S_IFDIR;
+	de->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	return de;
+}
+
+/*
+ * Compact the entries [start, end) of the index, which make up the
+ * tree 'ct' at 'ct_path', into the index starting at 'num_converted'.
+ * Returns the number of entries written.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 int num_converted,
+				 int start, int end,
+				 const char *ct_path, size_t ct_pathlen,
+				 struct cache_tree *ct,
+				 struct pattern_list *pl)
+{
+	int i, can_convert = 1;
+	int start_converted = num_converted;
+	struct strbuf child_path = STRBUF_INIT;
+
+	/*
+	 * Is the current path outside of the sparse cone? Then check
+	 * whether the region can be replaced by a sparse directory
+	 * entry, i.e. whether everything in it is merged and not
+	 * checked out. The root can never be sparse.
+	 */
+	if (!ct_pathlen) {
+		can_convert = 0;
+	} else {
+		int dtype = DT_DIR;
+
+		if (path_matches_pattern_list(ct_path, ct_pathlen, NULL,
+					      &dtype, pl, istate) != NOT_MATCHED)
+			can_convert = 0;
+	}
+
+	for (i = start; can_convert && i < end; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) ||
+		    S_ISGITLINK(ce->ce_mode) ||
+		    !ce_skip_worktree(ce))
+			can_convert = 0;
+	}
+
+	if (can_convert) {
+		struct cache_entry *se;
+
+		se = construct_sparse_dir_entry(istate, ct_path, ct_pathlen, ct);
+		istate->cache[num_converted++] = se;
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		int count, span, pos = -1;
+		const char *base, *slash;
+		struct cache_entry *ce = istate->cache[i];
+
+		/*
+		 * Detect if this is a normal entry outside of any
+		 * subtree entry.
+		 */
+		base = ce->name + ct_pathlen;
+		slash = strchr(base, '/');
+
+		if (slash)
+			pos = cache_tree_subtree_pos(ct, base, slash - base);
+
+		if (pos < 0) {
+			istate->cache[num_converted++] = ce;
+			i++;
+			continue;
+		}
+
+		strbuf_setlen(&child_path, 0);
+		strbuf_add(&child_path, ce->name, slash - ce->name + 1);
+
+		span = ct->down[pos]->cache_tree->entry_count;
+		count = convert_to_sparse_rec(istate,
+					      num_converted, i, i + span,
+					      child_path.buf, child_path.len,
+					      ct->down[pos]->cache_tree, pl);
+		num_converted += count;
+		i += span;
+	}
+
+	strbuf_release(&child_path);
+	return num_converted - start_converted;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	struct pattern_list file_pl, *pl = istate->sparse_checkout_patterns;
+	char *sparse_filename = NULL;
+	int i, ret = 0;
+
+	if (istate->split_index || istate->sparse_index || !istate->cache_nr ||
+	    !core_apply_sparse_checkout || !core_sparse_checkout_cone)
+		return 0;
+
+	prepare_repo_settings(the_repository);
+	if (!the_repository->settings.sparse_index)
+		return 0;
+
+	/*
+	 * The cache tree must describe every entry; unmerged and
+	 * intent-to-add entries keep it from doing so.
+	 */
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || ce_intent_to_add(ce) ||
+		    (ce->ce_flags & CE_REMOVE))
+			return 0;
+	}
+
+	/*
+	 * Unless the caller tells us which patterns the index was
+	 * built from, use the recorded ones.
+	 */
+	memset(&file_pl, 0, sizeof(file_pl));
+	if (!pl) {
+		pl = &file_pl;
+		pl->use_cone_patterns = 1;
+		sparse_filename = git_pathdup("info/sparse-checkout");
+		if (add_patterns_from_file_to_list(sparse_filename, "", 0,
+						   pl, NULL) < 0)
+			goto done;
+	}
+	if (!pl->use_cone_patterns)
+		goto done;
+
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT) ||
+	    !cache_tree_fully_valid(istate->cache_tree))
+		goto done;
+
+	trace2_region_enter("index", "convert_to_sparse", the_repository);
+
+	free_name_hash(istate);
+	istate->cache_nr = convert_to_sparse_rec(istate, 0, 0, istate->cache_nr,
+						 "", 0, istate->cache_tree, pl);
+	istate->sparse_index = 1;
+
+	/* The entry counts of the cache tree have changed. */
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT))
+		ret = error(_("unable to update cache-tree of the sparse index"));
+
+	trace2_data_intmax("index", the_repository, "sparse/cache_nr",
+			   istate->cache_nr);
+	trace2_region_leave("index", "convert_to_sparse", the_repository);
+
+done:
+	clear_pattern_list(&file_pl);
+	free(sparse_filename);
+	return ret;
+}
+
+struct expand_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+};
+
+static void add_expanded_entry(struct expand_data *data,
+			       struct cache_entry *ce)
+{
+	ALLOC_GROW(data->cache, data->nr + 1, data->alloc);
+	data->cache[data->nr++] = ce;
+}
+
+static int add_path_to_index(const struct object_id *oid,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct expand_data *data = context;
+	struct cache_entry *ce;
+	size_t pathlen, len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	pathlen = strlen(path);
+	len = st_add(base->len, pathlen);
+	ce = make_empty_cache_entry(data->istate, len);
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, pathlen);
+	ce->ce_namelen = len;
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(stage) | CE_SKIP_WORKTREE;
+
+	add_expanded_entry(data, ce);
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct expand_data data;
+	struct pathspec ps;
+	unsigned int cache_changed;
+	int i;
+
+	if (!istate || !istate->sparse_index)
+		return;
+
+	trace2_region_enter("index", "ensure_full_index", the_repository);
+
+	/* Expanding does not change what the index records. */
+	cache_changed = istate->cache_changed;
+
+	data.istate = istate;
+	data.nr = 0;
+	data.alloc = (3 * istate->cache_alloc) / 2;
+	ALLOC_ARRAY(data.cache, data.alloc);
+
+	memset(&ps, 0, sizeof(ps));
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			add_expanded_entry(&data, ce);
+			continue;
+		}
+		if (!ce_skip_worktree(ce))
+			warning(_("index entry is a directory, but not sparse (%08x)"),
+				ce->ce_flags);
+
+		tree = parse_tree_indirect(&ce->oid);
+		if (!tree ||
+		    read_tree_recursive(the_repository, tree,
+					ce->name, ce_namelen(ce), 0, &ps,
+					add_path_to_index, &data))
+			die(_("unable to expand sparse directory '%s'"),
+			    ce->name);
+
+		/*
+		 * The sparse directory was a leaf of the cache tree;
+		 * whatever it recorded for the directory is stale now.
+		 */
+		cache_tree_invalidate_path(istate, ce->name);
+		discard_cache_entry(ce);
+	}
+
+	free_name_hash(istate);
+	free(istate->cache);
+	istate->cache = data.cache;
+	istate->cache_nr = data.nr;
+	istate->cache_alloc = data.alloc;
+	istate->sparse_index = 0;
+
+	/*
+	 * The trees of the expanded directories all exist, so we can
+	 * recompute their part of the cache tree without writing any.
+	 */
+	if (istate->cache_tree)
+		cache_tree_update(istate, WRITE_TREE_REPAIR | WRITE_TREE_SILENT);
+	istate->cache_changed = cache_changed;
+
+	trace2_data_intmax("index", the_repository, "sparse/expanded_nr",
+			   istate->cache_nr);
+	trace2_region_leave("index", "ensure_full_index", the_repository);
+}
+
+int set_sparse_index_config(struct repository *repo, int enable)
+{
+	char *config_path = repo_git_path(repo, "config.worktree");
+	int res;
+
+	res = git_config_set_in_file_gently(config_path, "index.sparse",
+					    enable ? "true" : NULL);
+	free(config_path);
+
+	prepare_repo_settings(repo);
+	repo->settings.sparse_index = enable;
+	return res;
+}
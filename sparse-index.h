@@ -0,0 +1,35 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+struct repository;
+
+/*
+ * In cone-mode sparse-checkout, a directory outside of the cone whose
+ * entries are all skip-worktree can be stored as a single "sparse
+ * directory" entry: its name is the directory path with a trailing
+ * slash, its mode is S_IFDIR and its object name is that of the tree.
+ * An index holding such entries is a "sparse index".
+ */
+
+/*
+ * Replace the out-of-cone directories of 'istate' by sparse directory
+ * entries, if the sparse index is enabled and the index qualifies.
+ * Returns 0 when the index was converted or left alone, negative on
+ * error.
+ */
+int convert_to_sparse(struct index_state *istate);
+
+/*
+ * Expand all sparse directory entries of 'istate' back into the
+ * entries of their trees. This is a no-op for a full index.
+ */
+void ensure_full_index(struct index_state *istate);
+
+/*
+ * Enable or disable the sparse index (the "index.sparse" setting) in
+ * the worktree config of 'repo'.
+ */
+int set_sparse_index_config(struct repository *repo, int enable);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * test-fsmonitor-client.c: client code to send commands/requests to
+ * a `git fsmonitor--daemon` daemon.
+ */
+
+#include "test-tool.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "fsmonitor-ipc.h"
+
+static const char * const fsmonitor_client_usage[] = {
+	"test-tool fsmonitor-client query [--token=<token>]",
+	"test-tool fsmonitor-client flush",
+	NULL,
+};
+
+/*
+ * Send a query to the daemon and print the response with one token
+ * or pathname per line.
+ */
+static int do_send_query(const char *token)
+{
+	struct strbuf answer = STRBUF_INIT;
+	size_t i;
+
+	if (fsmonitor_ipc__send_query(token, &answer))
+		die("could not query fsmonitor--daemon");
+
+	for (i = 0; i < answer.len; i++)
+		if (!answer.buf[i])
+			answer.buf[i] = '\n';
+	fwrite(answer.buf, 1, answer.len, stdout);
+
+	strbuf_release(&answer);
+	return 0;
+}
+
+static int do_send_flush(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (fsmonitor_ipc__send_command("flush", &answer))
+		die("could not flush fsmonitor--daemon");
+	printf("%s\n", answer.buf);
+
+	strbuf_release(&answer);
+	return 0;
+}
+
+int cmd__fsmonitor_client(int argc, const char **argv)
+{
+	const char *subcmd;
+	const char *token = "0";
+
+	struct option options[] = {
+		OPT_STRING(0, "token", &token, "token",
+			   "command token to send to the daemon"),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, NULL, options,
+			     fsmonitor_client_usage, 0);
+	if (argc != 1)
+		usage_with_options(fsmonitor_client_usage, options);
+
+	subcmd = argv[0];
+
+	setup_git_directory();
+
+	if (!fsmonitor_ipc__is_supported())
+		die("fsmonitor--daemon is not supported on this platform");
+
+	if (!strcmp(subcmd, "query"))
+		return !!do_send_query(token);
+
+	if (!strcmp(subcmd, "flush"))
+		return !!do_send_flush();
+
+	die("Unhandled subcommand: '%s'", subcmd);
+}
@@ -1,21 +1,48 @@
 #include "test-tool.h"
 #include "cache.h"
 #include "config.h"
+#include "repository.h"
+
+static void print_cache_entry(struct cache_entry *ce)
+{
+	const char *type;
+
+	if (S_ISSPARSEDIR(ce->ce_mode))
+		type = "tree";
+	else if (S_ISGITLINK(ce->ce_mode))
+		type = "commit";
+	else
+		type = "blob";
+
+	printf("%06o %s %s\t%s\n", ce->ce_mode, type,
+	       oid_to_hex(&ce->oid), ce->name);
+}
 
 int cmd__read_cache(int argc, const char **argv)
 {
 	int i, cnt = 1;
 	const char *name = NULL;
+	int table = 0, expand = 0;
 
-	if (argc > 1 && skip_prefix(argv[1], "--print-and-refresh=", &name)) {
-		argc--;
-		argv++;
+	for (++argv, --argc; argc && starts_with(*argv, "--"); ++argv, --argc) {
+		if (skip_prefix(*argv, "--print-and-refresh=", &name))
+			continue;
+		if (!strcmp(*argv, "--table"))
+			table = 1;
+		else if (!strcmp(*argv, "--expand"))
+			expand = 1;
 	}
 
-	if (argc == 2)
-		cnt = strtol(argv[1], NULL, 0);
+	if (argc == 1)
+		cnt = strtol(argv[0], NULL, 0);
+
 	setup_git_directory();
 	git_config(git_default_config, NULL);
+
+	/* Show sparse directory entries as they are, unless asked not to. */
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = expand;
+
 	for (i = 0; i < cnt; i++) {
 		read_cache();
 		if (name) {
@@ -30,6 +57,12 @@ int cmd__read_cache(int argc, const char **argv)
 			       ce_uptodate(the_index.cache[pos]) ? "" : " not");
 			write_file(name, "%d\n", i);
 		}
+		if (table) {
+			int j;
+
+			for (j = 0; j < the_index.cache_nr; j++)
+				print_cache_entry(the_index.cache[j]);
+		}
 		discard_cache();
 	}
 	return 0;
@@ -14,6 +14,10 @@ depth of 50.
 The setting of core.deltaBaseCacheLimit in the source repository is also
 relevant (depending on the size of your test repo), so be sure it is consistent
 between runs.
+
+"git grep" over a revision exercises the cache from several threads at once;
+set GIT_PERF_GREP_THREADS to a list of thread counts (e.g. "1 4 8") to see how
+it scales.
 '
 . ./perf-lib.sh
 
@@ -28,4 +32,11 @@ test_perf 'log -S' '
 	git log --raw -Sfoo >/dev/null
 '
 
+for threads in ${GIT_PERF_GREP_THREADS:-1 8}
+do
+	test_perf "grep HEAD with $threads threads" "
+		git grep --threads=$threads -e foo HEAD >/dev/null || :
+	"
+done
+
 test_done
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# This test measures the performance of populating a working tree with
+# an increasing number of parallel checkout workers. Unlike p0006, it is
+# interested in the cost of inflating, smudging and writing the files.
+
+test_description="Tests performance of parallel checkout"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'setup' '
+	nr_files=$(git ls-files | wc -l) &&
+	export nr_files
+'
+
+for workers in 1 2 4 8
+do
+	test_perf "populate worktree with $workers worker(s) ($nr_files files)" '
+		rm -rf ../pc-worktree ../pc-index &&
+		mkdir ../pc-worktree &&
+		GIT_INDEX_FILE="$PWD/../pc-index" \
+		GIT_WORK_TREE="$PWD/../pc-worktree" \
+		git -c checkout.workers=$workers \
+		    -c checkout.thresholdForParallelism=0 \
+		    read-tree -u --reset HEAD
+	'
+done
+
+test_expect_success 'cleanup' '
+	rm -rf ../pc-worktree ../pc-index
+'
+
+test_done
@@ -26,4 +26,27 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_expect_success 'setup large generated files' '
+	test-tool genrandom gen 4000000 |
+	od -An -tx1 -v >large-a &&
+	awk "NR % 1000 == 0 { print \"changed\" } { print }" large-a >large-b
+'
+
+for algo in myers histogram patience minimal
+do
+	test_perf "diff ($algo) on large generated files" "
+		test_expect_code 1 git diff --no-index --diff-algorithm=$algo \\
+			large-a large-b >/dev/null
+	"
+done
+
+test_perf 'diff --ignore-space-at-eol on large generated files' '
+	test_expect_code 1 git diff --no-index --ignore-space-at-eol \
+		large-a large-b >/dev/null
+'
+
+test_perf 'diff -w on large generated files' '
+	test_expect_code 1 git diff --no-index -w large-a large-b >/dev/null
+'
+
 test_done
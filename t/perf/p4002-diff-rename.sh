@@ -0,0 +1,36 @@
+#!/bin/sh
+
+test_description="Test rename detection performance"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+test_checkout_worktree
+
+test_expect_success 'setup a commit moving and editing many files' '
+	git ls-files -- "*.c" "*.h" | head -n 2000 >files &&
+	while read f
+	do
+		mkdir -p "moved/$(dirname "$f")" &&
+		git mv "$f" "moved/$f" &&
+		echo "edited" >>"moved/$f" || return 1
+	done <files &&
+	# a few files also change their basename, which only the
+	# similarity matrix can pair up
+	for f in $(sed -n -e "1,200p" files)
+	do
+		git mv "moved/$f" "moved/$f.renamed" || return 1
+	done &&
+	git add moved &&
+	git commit -q -m "move files around"
+'
+
+test_perf 'diff -M, one thread' '
+	git -c diff.renameThreads=1 diff -M --name-status HEAD^ HEAD >/dev/null
+'
+
+test_perf 'diff -M, all threads' '
+	git -c diff.renameThreads=0 diff -M --name-status HEAD^ HEAD >/dev/null
+'
+
+test_done
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+test_description='Tests diff --color-moved performance'
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_perf 'log -p --color-moved -1000' '
+	git log -p --color --color-moved -1000 >/dev/null
+'
+
+test_perf 'log -p --color-moved-ws=allow-indentation-change -1000' '
+	git log -p --color --color-moved \
+		--color-moved-ws=allow-indentation-change -1000 >/dev/null
+'
+
+# Many repeated lines, like in generated code and lockfiles, give every
+# moved line a lot of candidate blocks to continue.
+test_expect_success 'setup repetitive files' '
+	awk "BEGIN {
+		srand(1);
+		for (i = 0; i < 20000; i++)
+			print \"  value: \" int(rand() * 8)
+	}" >repetitive-a &&
+	awk "{ l[NR] = \$0 }
+	END {
+		h = int(NR / 2);
+		for (i = h + 1; i <= NR; i++)
+			print l[i];
+		for (i = 1; i <= h; i++) {
+			if (i % 500 == 0)
+				print \"changed\";
+			print l[i]
+		}
+	}" repetitive-a >repetitive-b
+'
+
+for mode in plain zebra dimmed-zebra
+do
+	test_perf "diff --color-moved=$mode on repetitive files" "
+		test_expect_code 1 git diff --no-index --color --color-moved=$mode \\
+			repetitive-a repetitive-b >/dev/null
+	"
+done
+
+test_perf 'diff --color-moved-ws=allow-indentation-change on repetitive files' '
+	test_expect_code 1 git diff --no-index --color --color-moved=zebra \
+		--color-moved-ws=allow-indentation-change \
+		repetitive-a repetitive-b >/dev/null
+'
+
+test_done
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+test_description='repacking with deltas grouped by full path'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# Compare the default filename-hash ordering of delta candidates with
+# pack.pathDeltas, which first tries deltas within each full path. The
+# latter matters most for trees with many files of the same name deep
+# in different directories (BUILD, index.js, pom.xml, ...).
+for mode in false true
+do
+	title=$(printf '%16s' "(pathDeltas=$mode)")
+
+	test_perf "repack -adf $title" "
+		git -c pack.pathDeltas=$mode repack -adf
+	"
+
+	test_size "size $title" '
+		cat .git/objects/pack/*.pack | wc -c
+	'
+
+	test_perf "pack-objects --all --stdout $title" "
+		git -c pack.pathDeltas=$mode pack-objects --stdout --revs --all \
+			--no-reuse-delta --delta-base-offset </dev/null >tmp.pack
+	"
+
+	test_size "size of --stdout $title" '
+		wc -c <tmp.pack
+	'
+done
+
+test_done
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+test_description='Tests performance of on-disk reverse indexes'
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup' '
+	git -c pack.writeReverseIndex=false repack -adb &&
+	git rev-parse HEAD >tip &&
+	git rev-list --objects --no-object-names --all >objects
+'
+
+for rev_index in false true
+do
+	test_expect_success "repack (pack.writeReverseIndex=$rev_index)" '
+		git -c pack.writeReverseIndex=$rev_index repack -adb
+	'
+
+	test_perf "cat-file %(objectsize:disk), one object (rev=$rev_index)" '
+		git cat-file --batch-check="%(objectsize:disk)" <tip
+	'
+
+	test_perf "cat-file %(objectsize:disk), all objects (rev=$rev_index)" '
+		git cat-file --batch-check="%(objectsize:disk)" <objects
+	'
+
+	test_perf "rev-list --use-bitmap-index --count (rev=$rev_index)" '
+		git rev-list --use-bitmap-index --count --objects --all
+	'
+done
+
+test_done
@@ -0,0 +1,270 @@
+#!/bin/sh
+
+test_description='the reftable reference backend'
+
+. ./test-lib.sh
+
+INVALID_OID=$(test_oid 001)
+
+# Print the number of tables in the stack of the repository "repo".
+table_count () {
+	wc -l <repo/.git/reftable/tables.list | tr -d " "
+}
+
+test_expect_success 'init with reftable' '
+	git init --ref-format=reftable repo &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryFormatVersion >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'GIT_DEFAULT_REF_FORMAT selects the backend' '
+	GIT_DEFAULT_REF_FORMAT=reftable git init env &&
+	test_path_is_dir env/.git/reftable &&
+	test_must_fail git init --ref-format=bogus bogus &&
+	test_must_fail git -C repo init --ref-format=files
+'
+
+test_expect_success 'commits update branches and HEAD' '
+	test_commit -C repo first &&
+	test_commit -C repo second &&
+	git -C repo rev-parse second >expect &&
+	git -C repo rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse refs/heads/master >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing repo/.git/refs/heads/master
+'
+
+test_expect_success 'update-ref checks old values' '
+	git -C repo update-ref refs/heads/topic first &&
+	test_must_fail git -C repo update-ref refs/heads/topic second second &&
+	git -C repo update-ref refs/heads/topic second first &&
+	git -C repo rev-parse second >expect &&
+	git -C repo rev-parse topic >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo update-ref refs/heads/bad $INVALID_OID &&
+	test_must_fail git -C repo update-ref -d refs/heads/topic first &&
+	git -C repo update-ref -d refs/heads/topic &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/topic
+'
+
+test_expect_success 'symbolic refs' '
+	git -C repo symbolic-ref refs/heads/alias refs/heads/master &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref refs/heads/alias >actual &&
+	test_cmp expect actual &&
+	git -C repo update-ref refs/heads/alias first &&
+	git -C repo rev-parse first >expect &&
+	git -C repo rev-parse master >actual &&
+	test_cmp expect actual &&
+	git -C repo update-ref refs/heads/master second &&
+	git -C repo symbolic-ref -d refs/heads/alias &&
+	test_must_fail git -C repo symbolic-ref refs/heads/alias
+'
+
+test_expect_success 'tags are peeled' '
+	git -C repo tag -a -m annotated annotated first &&
+	git -C repo rev-parse first >expect &&
+	git -C repo rev-parse annotated^{} >actual &&
+	test_cmp expect actual &&
+	git -C repo for-each-ref --format="%(refname) %(*objectname)" \
+		refs/tags/annotated >actual &&
+	echo "refs/tags/annotated $(git -C repo rev-parse first)" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'for-each-ref lists references in order' '
+	git -C repo branch b/one &&
+	git -C repo branch a &&
+	git -C repo branch c &&
+	cat >expect <<-\EOF &&
+	refs/heads/a
+	refs/heads/b/one
+	refs/heads/c
+	refs/heads/master
+	refs/tags/annotated
+	refs/tags/first
+	refs/tags/second
+	EOF
+	git -C repo for-each-ref --format="%(refname)" >actual &&
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	refs/heads/b/one
+	EOF
+	git -C repo for-each-ref --format="%(refname)" refs/heads/b >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'directory/file conflicts are rejected' '
+	test_must_fail git -C repo branch b &&
+	test_must_fail git -C repo branch a/two &&
+	git -C repo branch -d a &&
+	git -C repo branch a/two
+'
+
+test_expect_success 'transactions are atomic' '
+	git -C repo for-each-ref >before &&
+	test_must_fail git -C repo update-ref --stdin <<-EOF &&
+	create refs/heads/new $(git -C repo rev-parse first)
+	update refs/heads/c $(git -C repo rev-parse first) $INVALID_OID
+	EOF
+	git -C repo for-each-ref >after &&
+	test_cmp before after &&
+	git -C repo update-ref --stdin <<-EOF &&
+	create refs/heads/new $(git -C repo rev-parse first)
+	update refs/heads/c $(git -C repo rev-parse first)
+	delete refs/heads/b/one
+	EOF
+	git -C repo rev-parse first >expect &&
+	git -C repo rev-parse new >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse c >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo rev-parse --verify b/one
+'
+
+test_expect_success 'each transaction adds a single table' '
+	git -C repo config reftable.autoCompaction false &&
+	before=$(table_count) &&
+	git -C repo update-ref --stdin <<-EOF &&
+	create refs/heads/x $(git -C repo rev-parse first)
+	create refs/heads/y $(git -C repo rev-parse first)
+	create refs/heads/z $(git -C repo rev-parse first)
+	EOF
+	test $(table_count) = $(($before + 1)) &&
+	git -C repo config --unset reftable.autoCompaction
+'
+
+test_expect_success 'reflogs' '
+	git -C repo checkout -b logged &&
+	test_commit -C repo third &&
+	git -C repo reflog show --format="%gs" logged >actual &&
+	cat >expect <<-\EOF &&
+	commit: third
+	branch: Created from HEAD
+	EOF
+	test_cmp expect actual &&
+	git -C repo reflog show --format="%gs" HEAD -2 >actual &&
+	cat >expect <<-\EOF &&
+	commit: third
+	checkout: moving from master to logged
+	EOF
+	test_cmp expect actual &&
+	git -C repo rev-parse second >expect &&
+	git -C repo rev-parse logged@{1} >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reflog expire and delete' '
+	git -C repo reflog expire --expire=all logged &&
+	git -C repo reflog show logged >actual &&
+	test_must_be_empty actual &&
+	test_commit -C repo fourth &&
+	test_commit -C repo fifth &&
+	git -C repo reflog delete logged@{1} &&
+	git -C repo reflog show --format="%gs" logged >actual &&
+	cat >expect <<-\EOF &&
+	commit: fifth
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'existing reflogs are kept up to date without logAllRefUpdates' '
+	git -C repo -c core.logAllRefUpdates=false \
+		update-ref --create-reflog refs/misc/logged first &&
+	git -C repo -c core.logAllRefUpdates=false update-ref --stdin <<-\EOF &&
+	start
+	update refs/misc/logged second
+	create refs/misc/unlogged second
+	commit
+	EOF
+	git -C repo reflog show --format=%H refs/misc/logged >actual &&
+	test_line_count = 2 actual &&
+	test_must_fail git -C repo reflog exists refs/misc/unlogged
+'
+
+test_expect_success 'branch rename carries the reflog along' '
+	git -C repo checkout master &&
+	git -C repo branch -m logged renamed &&
+	test_must_fail git -C repo rev-parse --verify logged &&
+	git -C repo reflog show --format="%gs" renamed >actual &&
+	cat >expect <<-\EOF &&
+	Branch: renamed refs/heads/logged to refs/heads/renamed
+	commit: fifth
+	EOF
+	test_cmp expect actual &&
+	git -C repo branch -c renamed copied &&
+	git -C repo rev-parse renamed >expect &&
+	git -C repo rev-parse copied >actual &&
+	test_cmp expect actual &&
+	git -C repo branch -D copied &&
+	test_must_fail git -C repo reflog exists refs/heads/copied
+'
+
+test_expect_success 'pack-refs compacts the stack' '
+	git -C repo for-each-ref >before &&
+	git -C repo pack-refs &&
+	test $(table_count) = 1 &&
+	git -C repo for-each-ref >after &&
+	test_cmp before after &&
+	git -C repo reflog show --format="%gs" renamed >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'the stack is compacted automatically' '
+	for i in $(test_seq 32)
+	do
+		git -C repo update-ref refs/heads/auto-$i HEAD || return 1
+	done &&
+	test $(table_count) -lt 8 &&
+	git -C repo for-each-ref refs/heads/auto-* >actual &&
+	test_line_count = 32 actual
+'
+
+test_expect_success 'pseudorefs other than HEAD are files' '
+	git -C repo update-ref ORIG_HEAD first &&
+	test_path_is_file repo/.git/ORIG_HEAD &&
+	git -C repo rev-parse first >expect &&
+	git -C repo rev-parse ORIG_HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'worktrees have their own HEAD' '
+	git -C repo worktree add ../wt -b wt-branch first &&
+	test_path_is_dir repo/.git/worktrees/wt/reftable &&
+	echo refs/heads/wt-branch >expect &&
+	git -C wt symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	test_commit -C wt in-worktree &&
+	git -C wt rev-parse HEAD >expect &&
+	git -C repo rev-parse wt-branch >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse worktrees/wt/HEAD >actual &&
+	test_cmp expect actual &&
+	git -C wt update-ref refs/bisect/here HEAD &&
+	test_must_fail git -C repo rev-parse --verify refs/bisect/here
+'
+
+test_expect_success 'clone into a reftable repository' '
+	GIT_DEFAULT_REF_FORMAT=reftable git clone repo clone &&
+	echo reftable >expect &&
+	git -C clone config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse master >expect &&
+	git -C clone rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	git -C clone fsck
+'
+
+test_done
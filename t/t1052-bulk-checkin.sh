@@ -0,0 +1,73 @@
+#!/bin/sh
+
+test_description='adding files in batch mode with core.bulkCheckin'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub &&
+	for i in $(test_seq 200)
+	do
+		echo "content $i" >dir/file-$i &&
+		echo "content $i" >dir/sub/copy-$i || return 1
+	done &&
+	printf "line\r\n" >crlf.txt &&
+	echo "*.txt text" >.gitattributes &&
+	test_commit initial
+'
+
+count_loose () {
+	find .git/objects/?? -type f 2>/dev/null | wc -l
+}
+
+for threads in 1 4
+do
+	test_expect_success "add with $threads threads writes a single pack" '
+		test_when_finished "rm -f .git/index && git reset -q" &&
+		rm -f .git/objects/pack/pack-*.* &&
+		git -c core.bulkCheckin=false add dir crlf.txt &&
+		git write-tree >expect &&
+		git rm -q -r --cached dir crlf.txt &&
+		git prune &&
+
+		loose_before=$(count_loose) &&
+		git -c core.bulkCheckin=true \
+			-c core.bulkCheckinThreads=$threads add dir crlf.txt &&
+		test $(count_loose) = $loose_before &&
+		ls .git/objects/pack/pack-*.pack >packs &&
+		test_line_count = 1 packs &&
+		git write-tree >actual &&
+		test_cmp expect actual &&
+
+		# every distinct file content is stored exactly once
+		idx=$(echo .git/objects/pack/pack-*.idx) &&
+		git show-index <"$idx" >idx &&
+		test_line_count = 201 idx &&
+		git fsck
+	'
+done
+
+test_expect_success 'objects in the pack are readable' '
+	git -c core.bulkCheckin=true add dir crlf.txt &&
+	git commit -q -m batch &&
+	echo "content 17" >expect &&
+	git cat-file blob HEAD:dir/sub/copy-17 >actual &&
+	test_cmp expect actual &&
+	printf "line\n" >expect &&
+	git cat-file blob HEAD:crlf.txt >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'existing objects are not written again' '
+	git repack -a -d -q &&
+	ls .git/objects/pack/pack-*.pack >before &&
+	test_line_count = 1 before &&
+	echo new >dir/new &&
+	git -c core.bulkCheckin=true add dir &&
+	ls .git/objects/pack/pack-*.pack >after &&
+	test_line_count = 2 after &&
+	git show-index <$(comm -13 before after | sed "s/pack\$/idx/") >idx &&
+	test_line_count = 1 idx
+'
+
+test_done
@@ -0,0 +1,209 @@
+#!/bin/sh
+
+test_description='compare full and sparse index
+
+Run the same commands in a full checkout, a sparse checkout with a full
+index and a sparse checkout with a sparse index, and make sure they
+agree.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init initial-repo &&
+	(
+		cd initial-repo &&
+		echo a >a &&
+		echo "after deep" >e &&
+		echo "after folder1" >g &&
+		mkdir folder1 folder2 deep x &&
+		mkdir deep/deeper1 deep/deeper2 &&
+		mkdir deep/deeper1/deepest &&
+		echo "after deeper1" >deep/e &&
+		echo "after deepest" >deep/deeper1/e &&
+		cp a folder1 &&
+		cp a folder2 &&
+		cp a x &&
+		cp a deep &&
+		cp a deep/deeper1 &&
+		cp a deep/deeper2 &&
+		cp a deep/deeper1/deepest &&
+		git add . &&
+		git commit -m "initial commit" &&
+		git checkout -b update-folder1 &&
+		echo "updated" >folder1/a &&
+		git commit -am "update folder1" &&
+		git checkout -
+	) &&
+
+	git clone initial-repo full-checkout &&
+
+	git clone initial-repo sparse-checkout &&
+	git -C sparse-checkout sparse-checkout init --cone &&
+	git -C sparse-checkout sparse-checkout set deep &&
+
+	git clone initial-repo sparse-index &&
+	git -C sparse-index sparse-checkout init --cone --sparse-index &&
+	git -C sparse-index sparse-checkout set deep
+'
+
+# Run the same command in all three repositories and compare their
+# output and exit codes.
+test_all_match () {
+	(
+		cd full-checkout &&
+		"$@" >../full-checkout-out 2>../full-checkout-err
+	)
+	echo $? >full-checkout-code &&
+	(
+		cd sparse-checkout &&
+		"$@" >../sparse-checkout-out 2>../sparse-checkout-err
+	)
+	echo $? >sparse-checkout-code &&
+	(
+		cd sparse-index &&
+		"$@" >../sparse-index-out 2>../sparse-index-err
+	)
+	echo $? >sparse-index-code &&
+
+	test_cmp full-checkout-code sparse-checkout-code &&
+	test_cmp full-checkout-code sparse-index-code &&
+	test_cmp full-checkout-out sparse-checkout-out &&
+	test_cmp full-checkout-out sparse-index-out
+}
+
+# Like test_all_match, but only compare the two sparse checkouts.
+test_sparse_match () {
+	(
+		cd sparse-checkout &&
+		"$@" >../sparse-checkout-out 2>../sparse-checkout-err
+	)
+	echo $? >sparse-checkout-code &&
+	(
+		cd sparse-index &&
+		"$@" >../sparse-index-out 2>../sparse-index-err
+	)
+	echo $? >sparse-index-code &&
+
+	test_cmp sparse-checkout-code sparse-index-code &&
+	test_cmp sparse-checkout-out sparse-index-out &&
+	test_cmp sparse-checkout-err sparse-index-err
+}
+
+test_expect_success 'sparse-index contents' '
+	test-tool -C sparse-index read-cache --table >cache &&
+	for dir in folder1 folder2 x
+	do
+		TREE=$(git -C sparse-index rev-parse HEAD:$dir) &&
+		grep "^040000 tree $TREE	$dir/\$" cache ||
+		return 1
+	done &&
+	for dir in deep/deeper1 deep/deeper2
+	do
+		! grep "	$dir/\$" cache ||
+		return 1
+	done &&
+	grep "	deep/deeper1/deepest/a\$" cache &&
+
+	git -C sparse-index sparse-checkout set folder1 &&
+	test-tool -C sparse-index read-cache --table >cache &&
+	for dir in deep folder2 x
+	do
+		TREE=$(git -C sparse-index rev-parse HEAD:$dir) &&
+		grep "^040000 tree $TREE	$dir/\$" cache ||
+		return 1
+	done &&
+	grep "	folder1/a\$" cache &&
+
+	git -C sparse-index sparse-checkout set deep/deeper1 &&
+	test-tool -C sparse-index read-cache --table >cache &&
+	for dir in deep/deeper2 folder1 folder2 x
+	do
+		TREE=$(git -C sparse-index rev-parse HEAD:$dir) &&
+		grep "^040000 tree $TREE	$dir/\$" cache ||
+		return 1
+	done &&
+
+	git -C sparse-index sparse-checkout set deep
+'
+
+test_expect_success 'expanded in-memory index matches full index' '
+	test-tool -C sparse-checkout read-cache --table >expect &&
+	test-tool -C sparse-index read-cache --expand --table >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status with sparse directory entries' '
+	test_all_match git status --porcelain=v2 &&
+
+	echo >>sparse-index/deep/a &&
+	echo >>sparse-checkout/deep/a &&
+	echo >>full-checkout/deep/a &&
+	test_all_match git status --porcelain=v2 &&
+
+	mkdir full-checkout/deep/new sparse-checkout/deep/new \
+	      sparse-index/deep/new &&
+	echo new >full-checkout/deep/new/file &&
+	echo new >sparse-checkout/deep/new/file &&
+	echo new >sparse-index/deep/new/file &&
+	test_all_match git status --porcelain=v2 -uall &&
+	test_all_match git status --porcelain=v2 -unormal &&
+
+	test_all_match git checkout -- deep/a &&
+	rm -r full-checkout/deep/new sparse-checkout/deep/new \
+	      sparse-index/deep/new &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'status does not expand the sparse index' '
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" GIT_TRACE2_EVENT_NESTING=10 \
+		git -C sparse-index status &&
+	grep "\"region_enter\".*\"label\":\"do_read_index\"" trace2.txt &&
+	! grep "ensure_full_index" trace2.txt
+'
+
+test_expect_success 'untracked file in a sparse directory' '
+	mkdir -p sparse-checkout/folder1 sparse-index/folder1 &&
+	echo untracked >sparse-checkout/folder1/untracked &&
+	echo untracked >sparse-index/folder1/untracked &&
+	test_sparse_match git status --porcelain=v2 -uall &&
+	rm -r sparse-checkout/folder1 sparse-index/folder1
+'
+
+test_expect_success 'add, commit, checkout keep the index sparse' '
+	for repo in full-checkout sparse-checkout sparse-index
+	do
+		echo "more" >>$repo/deep/a || return 1
+	done &&
+	test_all_match git add deep/a &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git commit -m "update deep/a" &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git rev-parse HEAD^{tree} &&
+
+	test_all_match git checkout update-folder1 &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git diff HEAD~1 --name-status &&
+	test_all_match git checkout - &&
+	test_all_match git status --porcelain=v2 &&
+
+	test-tool -C sparse-index read-cache --table >cache &&
+	grep "^040000 tree .*	folder1/\$" cache
+'
+
+test_expect_success 'sparse-index is written back after expansion' '
+	test-tool -C sparse-index read-cache --table >before &&
+	git -C sparse-index update-index --refresh &&
+	git -C sparse-index reset --hard &&
+	test-tool -C sparse-index read-cache --table >after &&
+	test_cmp before after
+'
+
+test_expect_success 'sparse-checkout disable writes a full index' '
+	git -C sparse-index sparse-checkout disable &&
+	test-tool -C sparse-index read-cache --table >cache &&
+	! grep "^040000 tree" cache &&
+	test_must_fail git -C sparse-index config index.sparse &&
+	test_path_is_file sparse-index/folder1/a
+'
+
+test_done
@@ -0,0 +1,249 @@
+#!/bin/sh
+
+test_description='parallel-checkout basics
+
+Ensure that parallel-checkout basically works on clone and checkout, spawning
+the required number of workers and correctly populating both the index and
+the working tree.
+'
+
+TEST_NO_CREATE_REPO=1
+. ./test-lib.sh
+
+# Parallel checkout tests need full control of the number of workers
+unset GIT_TEST_CHECKOUT_WORKERS
+
+set_checkout_config () {
+	test_config_global checkout.workers $1 &&
+	test_config_global checkout.thresholdForParallelism $2
+}
+
+# Run "${@:2}" and check that $1 checkout workers were used
+test_checkout_workers () {
+	expected_workers=$1 &&
+	shift &&
+
+	rm -f trace-checkout-workers &&
+	GIT_TRACE2_EVENT="$(pwd)/trace-checkout-workers" "$@" &&
+
+	if test $expected_workers -gt 1
+	then
+		grep "\"category\":\"pcheckout\",\"key\":\"workers\",\"value\":\"$expected_workers\"" \
+			trace-checkout-workers
+	else
+		! grep "\"category\":\"pcheckout\",\"key\":\"workers\",\"value\":\"[2-9]" \
+			trace-checkout-workers
+	fi &&
+	rm trace-checkout-workers
+}
+
+# Check that the working tree of $1 matches the one of $2, and that the
+# index of $1 is up to date.
+verify_checkout () {
+	git -C "$1" diff-index --quiet HEAD -- &&
+	git -C "$1" status --porcelain --untracked-files=no >"$1".status &&
+	test_must_be_empty "$1".status &&
+	git -C "$1" ls-files >"$1".files &&
+	git -C "$2" ls-files >"$2".files &&
+	test_cmp "$2".files "$1".files &&
+	while read path
+	do
+		test_cmp "$2/$path" "$1/$path" || return 1
+	done <"$1".files
+}
+
+test_expect_success 'setup repo for checkout with various types of changes' '
+	git init various &&
+	(
+		cd various &&
+		git checkout -b B1 &&
+		echo a >a &&
+		mkdir b &&
+		echo b1 >b/b1 &&
+		echo b2 >b/b2 &&
+		echo c >c &&
+		echo d >d &&
+		mkdir e &&
+		echo e1 >e/e1 &&
+		echo f >f &&
+		echo x >x &&
+		chmod +x x &&
+		for i in $(test_seq 20)
+		do
+			mkdir -p many/dir$i &&
+			echo "$i" >many/dir$i/file || return 1
+		done &&
+		git add . &&
+		git commit -m B1 &&
+
+		git checkout -b B2 &&
+		echo modified >a &&
+		rm -rf b &&
+		echo changed >b &&
+		rm -rf c &&
+		mkdir c &&
+		echo c1 >c/c1 &&
+		echo "new file" >new &&
+		chmod -x x &&
+		rm many/dir7/file &&
+		echo 21 >many/dir21 &&
+		git add -A &&
+		git commit -m B2
+	)
+'
+
+test_expect_success 'sequential clone' '
+	set_checkout_config 1 0 &&
+	test_checkout_workers 0 \
+		git clone --branch B1 various various_sequential_clone &&
+	test -x various_sequential_clone/x
+'
+
+test_expect_success 'parallel clone' '
+	set_checkout_config 2 0 &&
+	test_checkout_workers 2 \
+		git clone --branch B1 various various_parallel_clone &&
+	verify_checkout various_parallel_clone various_sequential_clone &&
+	test -x various_parallel_clone/x
+'
+
+test_expect_success 'fallback to sequential checkout (threshold)' '
+	set_checkout_config 2 100 &&
+	test_checkout_workers 0 \
+		git clone --branch B1 various various_sequential_fallback &&
+	verify_checkout various_sequential_fallback various_sequential_clone
+'
+
+test_expect_success 'parallel checkout on clean repo' '
+	set_checkout_config 2 0 &&
+	git -C various_sequential_clone checkout B2 &&
+	test_checkout_workers 2 \
+		git -C various_parallel_clone checkout B2 &&
+	verify_checkout various_parallel_clone various_sequential_clone &&
+	test_path_is_file various_parallel_clone/b &&
+	test_path_is_dir various_parallel_clone/c &&
+	test_path_is_missing various_parallel_clone/many/dir7/file
+'
+
+test_expect_success 'parallel checkout on dirty repo' '
+	set_checkout_config 2 0 &&
+	echo dirty >various_parallel_clone/d &&
+	echo untracked >various_parallel_clone/untracked &&
+	test_checkout_workers 2 \
+		git -C various_parallel_clone checkout --force B1 &&
+	git -C various_sequential_clone checkout B1 &&
+	verify_checkout various_parallel_clone various_sequential_clone &&
+	test_path_is_file various_parallel_clone/untracked
+'
+
+test_expect_success 'parallel checkout honors conversion attributes' '
+	set_checkout_config 2 0 &&
+	git init attrs &&
+	(
+		cd attrs &&
+		cat >.gitattributes <<-\EOF &&
+		ident.txt ident
+		crlf.txt text eol=crlf
+		utf16.txt text working-tree-encoding=UTF-16LE
+		EOF
+		echo "\$Id\$" >ident.txt &&
+		printf "one\ntwo\n" >crlf.txt &&
+		printf "t\000e\000x\000t\000\n\000" >utf16.txt &&
+		git add . &&
+		git commit -m attrs
+	) &&
+	set_checkout_config 1 0 &&
+	git clone attrs attrs_sequential &&
+	set_checkout_config 2 0 &&
+	test_checkout_workers 2 git clone attrs attrs_parallel &&
+	verify_checkout attrs_parallel attrs_sequential &&
+	printf "one\r\ntwo\r\n" >expect &&
+	test_cmp expect attrs_parallel/crlf.txt &&
+	git -C attrs rev-parse HEAD:ident.txt >blob &&
+	echo "\$Id: $(cat blob) \$" >expect &&
+	test_cmp expect attrs_parallel/ident.txt
+'
+
+test_expect_success 'entries with a smudge filter are checked out sequentially' '
+	set_checkout_config 2 0 &&
+	test_config_global filter.upper.smudge "tr a-z A-Z" &&
+	test_config_global filter.upper.clean "tr A-Z a-z" &&
+	git init filter &&
+	(
+		cd filter &&
+		echo "*.up filter=upper" >.gitattributes &&
+		for i in 1 2 3
+		do
+			echo "content $i" >file$i.up &&
+			echo "content $i" >file$i.txt || return 1
+		done &&
+		git add . &&
+		git commit -m filters
+	) &&
+	test_checkout_workers 2 git clone filter filter_parallel &&
+	echo "CONTENT 2" >expect &&
+	test_cmp expect filter_parallel/file2.up &&
+	echo "content 2" >expect &&
+	test_cmp expect filter_parallel/file2.txt &&
+	git -C filter_parallel status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'blobs above core.bigFileThreshold are checked out sequentially' '
+	set_checkout_config 2 0 &&
+	test_config_global core.bigFileThreshold 1k &&
+	git init bigfile &&
+	(
+		cd bigfile &&
+		test_seq 1000 >big &&
+		echo small >small &&
+		git add . &&
+		git commit -m big &&
+		git repack -a -d -q
+	) &&
+	# only "small" is left for the workers, so a single one is used
+	test_checkout_workers 1 git clone bigfile bigfile_parallel &&
+	verify_checkout bigfile_parallel bigfile
+'
+
+test_expect_success SYMLINKS 'parallel checkout with symlinks' '
+	set_checkout_config 2 0 &&
+	git init symlinks &&
+	(
+		cd symlinks &&
+		mkdir dir &&
+		echo content >dir/file &&
+		echo other >dir/other &&
+		ln -s dir link &&
+		ln -s dir/file file-link &&
+		git add . &&
+		git commit -m symlinks
+	) &&
+	test_checkout_workers 2 git clone symlinks symlinks_parallel &&
+	test -h symlinks_parallel/link &&
+	test -h symlinks_parallel/file-link &&
+	echo content >expect &&
+	test_cmp expect symlinks_parallel/file-link
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are detected' '
+	set_checkout_config 2 0 &&
+	git init collisions &&
+	(
+		cd collisions &&
+		for name in file FILE File dir/x DIR/y
+		do
+			mkdir -p $(dirname $name) &&
+			echo $name >$name &&
+			git update-index --add --cacheinfo 100644 \
+				$(git hash-object -w $name) $name || return 1
+		done &&
+		git commit -m collisions
+	) &&
+	test_checkout_workers 2 git clone collisions collisions_parallel 2>err &&
+	test_i18ngrep "the following paths have collided" err &&
+	grep FILE err &&
+	grep File err
+'
+
+test_done
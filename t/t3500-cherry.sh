@@ -78,4 +78,77 @@ test_expect_success 'cherry ignores whitespace' '
 	test_cmp expect actual
 '
 
+test_expect_success 'cherry stores patch ids with diff.cachePatchIds' '
+	git -c diff.cachePatchIds=true \
+		cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual &&
+	git rev-parse --verify refs/notes/patch-id/header &&
+	git notes --ref=patch-id/header show feature-without-space^ >note &&
+	cat >expect.note <<-EOF &&
+	$(git rev-parse feature-without-space^^^{tree}) $(git rev-parse feature-without-space^^{tree})
+	EOF
+	cut -d" " -f2- note >actual.note &&
+	test_cmp expect.note actual.note
+'
+
+test_expect_success 'cherry reuses cached patch ids' '
+	commit=$(git rev-parse feature-without-space^) &&
+	git notes --ref=patch-id/header show $commit >note &&
+	git notes --ref=patch-id/header add -f \
+		-m "$ZERO_OID $(cut -d" " -f2- note)" $commit &&
+	tree=$(git rev-parse refs/notes/patch-id/header^{tree}) &&
+	git update-ref refs/notes/patch-id/header \
+		$(git commit-tree -m "patch-id cache v1 header" $tree) &&
+
+	# the tampered entry no longer matches upstream
+	git -c diff.cachePatchIds=true \
+		cherry upstream-with-space feature-without-space >actual &&
+	sed "1s/^-/+/" expect >expect.tampered &&
+	test_cmp expect.tampered actual &&
+
+	# without the config, the cache is not consulted
+	git cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'patch-id cache with a different validity is ignored' '
+	tree=$(git rev-parse refs/notes/patch-id/header^{tree}) &&
+	git update-ref refs/notes/patch-id/header \
+		$(git commit-tree -m "something else" $tree) &&
+	git -c diff.cachePatchIds=true \
+		cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cached patch ids are not used when the trees differ' '
+	commit=$(git rev-parse feature-without-space^) &&
+	git notes --ref=patch-id/header add -f \
+		-m "$ZERO_OID $ZERO_OID $ZERO_OID" $commit &&
+	tree=$(git rev-parse refs/notes/patch-id/header^{tree}) &&
+	git update-ref refs/notes/patch-id/header \
+		$(git commit-tree -m "patch-id cache v1 header" $tree) &&
+	git -c diff.cachePatchIds=true \
+		cherry upstream-with-space feature-without-space >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'patch-id cache depends on diff.orderFile' '
+	commit=$(git rev-parse feature-without-space^) &&
+	git notes --ref=patch-id/header add -f \
+		-m "$ZERO_OID $(git rev-parse $commit^^{tree} $commit^{tree} | tr "\n" " ")" \
+		$commit &&
+	tree=$(git rev-parse refs/notes/patch-id/header^{tree}) &&
+	git update-ref refs/notes/patch-id/header \
+		$(git commit-tree -m "patch-id cache v1 header" $tree) &&
+	echo "*" >order &&
+	git log --cherry-mark --format="%m %H" \
+		upstream-with-space...feature-without-space >expect.log &&
+	git -c diff.cachePatchIds=true -c diff.orderFile=order \
+		log --cherry-mark --format="%m %H" \
+		upstream-with-space...feature-without-space >actual.log &&
+	test_cmp expect.log actual.log &&
+	git log -1 --format=%s refs/notes/patch-id/header >validity &&
+	grep "^patch-id cache v1 header order " validity
+'
+
 test_done
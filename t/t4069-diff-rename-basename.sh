@@ -0,0 +1,100 @@
+#!/bin/sh
+
+test_description='basename-guided and multi-threaded rename detection'
+
+. ./test-lib.sh
+
+# Prints 20 lines that are unique to <prefix>.
+content () {
+	for i in $(test_seq 20)
+	do
+		echo "$1 line $i"
+	done
+}
+
+test_expect_success 'setup' '
+	mkdir old &&
+	content shared >old/config &&
+	for i in $(test_seq 40)
+	do
+		content "file $i" >old/file-$i || return 1
+	done &&
+	git add . &&
+	test_commit base &&
+
+	mkdir new &&
+	git mv old/config new/config &&
+	echo tweak >>new/config &&
+	git add new/config &&
+	for i in $(test_seq 40)
+	do
+		git mv old/file-$i new/moved-$i &&
+		echo "edit $i" >>new/moved-$i || return 1
+	done &&
+	git add new &&
+	test_commit moved
+'
+
+test_expect_success 'setup competing sources' '
+	git checkout -b competing base &&
+	mkdir -p lib &&
+	content settings >lib/settings &&
+	content settings | sed -e "s/line 20/other line 20/" >lib/other &&
+	content settings |
+	sed -e "s/line 1\$/conf line 1/" -e "s/line 2\$/conf line 2/" \
+	    >lib/conf &&
+	git add lib &&
+	test_commit competing-base &&
+	mkdir src &&
+	git mv lib/conf src/conf &&
+	content settings | sed -e "s/line 19/moved line 19/" >src/conf &&
+	git rm -q lib/other lib/settings &&
+	git add src/conf &&
+	test_commit competing-moved
+'
+
+test_expect_success 'a source with the same basename is preferred' '
+	git diff --name-status -M competing-base competing-moved >actual &&
+	cat >expect <<-\EOF &&
+	D	lib/other
+	D	lib/settings
+	EOF
+	grep ^D actual >actual.deleted &&
+	test_cmp expect actual.deleted &&
+	grep "^R[0-9]*	lib/conf	src/conf" actual
+'
+
+test_expect_success 'basename pairing uses a higher similarity threshold' '
+	git diff --name-status -M80% competing-base competing-moved >actual &&
+	grep "^R[0-9]*	lib/settings	src/conf" actual
+'
+
+test_expect_success 'renames are found without raising the rename limit' '
+	git -c diff.renameLimit=1 diff --name-status -M base moved \
+		>actual 2>err &&
+	grep "^R[0-9]*	old/config	new/config" actual &&
+	grep "^D	old/file-1$" actual &&
+	grep "^A	new/moved-1$" actual
+'
+
+test_expect_success 'threaded rename detection matches the serial one' '
+	git -c diff.renameThreads=1 diff -M --name-status base moved >expect &&
+	test_line_count = 42 expect &&
+	for threads in 2 4 7
+	do
+		GIT_TRACE2_EVENT="$(pwd)/trace.$threads" \
+		git -c diff.renameThreads=$threads \
+			diff -M --name-status base moved >actual &&
+		test_cmp expect actual &&
+		grep "\"key\":\"rename/threads\",\"value\":\"$threads\"" \
+			trace.$threads || return 1
+	done
+'
+
+test_expect_success 'threaded copy detection matches the serial one' '
+	git -c diff.renameThreads=1 diff -C -C --name-status base moved >expect &&
+	git -c diff.renameThreads=4 diff -C -C --name-status base moved >actual &&
+	test_cmp expect actual
+'
+
+test_done
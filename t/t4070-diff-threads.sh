@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='generating patches on multiple threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 40)
+	do
+		test_seq $i 60 >file-$i || return 1
+	done &&
+	printf "\0binary\0" >binary &&
+	test_write_lines a b c d e f g h i j >moved &&
+	test_write_lines 1 2 3 >remove-me &&
+	git add . &&
+	test_commit base &&
+
+	for i in $(test_seq 40)
+	do
+		sed -e "s/^3/three/" -e "/^5/d" file-$i >tmp &&
+		echo end >>tmp &&
+		mv tmp file-$i || return 1
+	done &&
+	printf "\0binary\0changed\0" >binary &&
+	git mv moved moved-away &&
+	test_write_lines f g h i j a b c d e >>moved-away &&
+	git rm -q remove-me &&
+	echo new >new-file &&
+	git add . &&
+	test_commit change
+'
+
+compare_threads () {
+	git "$@" --threads=1 >expect &&
+	git "$@" --threads=4 >actual &&
+	test_cmp expect actual &&
+	git "$@" --threads=0 >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'patch output does not depend on threads' '
+	compare_threads diff -p --binary base change
+'
+
+test_expect_success '--stat -p output does not depend on threads' '
+	compare_threads diff --stat -p -M base change
+'
+
+test_expect_success '--color-moved output does not depend on threads' '
+	compare_threads diff --color --color-moved=zebra base change
+'
+
+test_expect_success 'pickaxe output does not depend on threads' '
+	compare_threads log -p -Sthree
+'
+
+test_expect_success 'log -p output does not depend on threads' '
+	compare_threads log -p --format=%s
+'
+
+test_expect_success 'diff.threads configures the default' '
+	git diff base change >expect &&
+	git -c diff.threads=4 diff base change >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--exit-code with threads' '
+	test_expect_code 1 git diff --exit-code --threads=4 base change &&
+	git diff --exit-code --threads=4 change change
+'
+
+test_expect_success 'external diff drivers still work with threads' '
+	write_script ext-diff <<-\EOF &&
+	echo "ext $1"
+	EOF
+	test_config diff.ext.command "./ext-diff" &&
+	echo "file-1* diff=ext" >.gitattributes &&
+	test_when_finished "rm .gitattributes" &&
+	compare_threads diff --ext-diff base change &&
+	grep "^ext file-1\$" actual
+'
+
+test_done
@@ -5,6 +5,7 @@ test_description='git log for a path with Bloom filters'
 
 GIT_TEST_COMMIT_GRAPH=0
 GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+GIT_TEST_COMMIT_GRAPH_REACH_LABELS=0
 
 test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
 	git init &&
@@ -40,11 +41,11 @@ test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
 '
 
 graph_read_expect () {
-	NUM_CHUNKS=5
+	NUM_CHUNKS=6
 	cat >expect <<- EOF
 	header: 43475048 1 $(test_oid oid_version) $NUM_CHUNKS 0
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata bloom_indexes bloom_data
+	chunks: oid_fanout oid_lookup commit_metadata generation_data bloom_indexes bloom_data
 	EOF
 	test-tool read-graph >actual &&
 	test_cmp expect actual
@@ -117,8 +118,9 @@ test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
 	test_bloom_filters_not_used "--walk-reflogs -- A"
 '
 
-test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
-	test_bloom_filters_not_used "-- file4 A/file1"
+test_expect_success 'git log -- multiple path specs uses Bloom filters' '
+	test_bloom_filters_used "-- file4 A/file1" &&
+	test_bloom_filters_used "-- A/B/C A/file1 file5"
 '
 
 test_expect_success 'git log -- "." pathspec at root does not use Bloom filters' '
@@ -130,9 +132,23 @@ test_expect_success 'git log with wildcard that resolves to a single path uses B
 	test_bloom_filters_used "-- *renamed"
 '
 
-test_expect_success 'git log with wildcard that resolves to a multiple paths does not uses Bloom filters' '
-	test_bloom_filters_not_used "-- *" &&
-	test_bloom_filters_not_used "-- file*"
+test_expect_success 'git log with wildcard that resolves to a multiple paths uses Bloom filters' '
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- file*"
+'
+
+# The patterns below do not match anything in the worktree, so the
+# shell passes them to git unexpanded.
+test_expect_success 'git log with a wildcard below a fixed directory uses Bloom filters' '
+	test_bloom_filters_used "-- A/*/file3" &&
+	test_bloom_filters_used "-- :(glob)A/**/file3" &&
+	test_bloom_filters_used "-- A/B/file2 A/B/*/file9"
+'
+
+test_expect_success 'git log with a wildcard in the leading directory does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(glob)**/file3" &&
+	test_bloom_filters_not_used "-- A/file1 :(glob)*/file3" &&
+	test_bloom_filters_not_used "-- :(icase)a/file1"
 '
 
 test_expect_success 'setup - add commit-graph to the chain without Bloom filters' '
@@ -402,4 +418,69 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+test_expect_success 'setup - repository for threaded Bloom filters' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 30)
+		do
+			mkdir -p dir$((i % 3))/sub$((i % 4)) &&
+			echo $i >dir$((i % 3))/sub$((i % 4))/file$i &&
+			git add . &&
+			git commit -q -m "add $i" || return 1
+		done &&
+		git rm -q -r dir1 &&
+		git commit -q -m "remove dir1" &&
+		git commit -q --allow-empty -m empty &&
+		for i in $(test_seq 1 12)
+		do
+			echo $i >many$i || return 1
+		done &&
+		git add . &&
+		git commit -q -m "many files"
+	)
+'
+
+test_expect_success 'Bloom filters do not depend on the number of threads' '
+	(
+		cd threads &&
+		for threads in 1 4
+		do
+			rm -rf .git/objects/info/commit-graph* &&
+			GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=10 \
+				git -c commitGraph.changedPathsThreads=$threads \
+				commit-graph write --reachable --changed-paths &&
+			cp .git/objects/info/commit-graph graph-$threads ||
+			return 1
+		done &&
+		test_cmp_bin graph-1 graph-4
+	)
+'
+
+test_expect_success 'threaded Bloom filters in split commit-graphs' '
+	(
+		cd threads &&
+		for threads in 1 4
+		do
+			rm -rf .git/objects/info/commit-graph* &&
+			git rev-parse HEAD~20 |
+			git -c commitGraph.changedPathsThreads=$threads \
+				commit-graph write --stdin-commits --split \
+				--changed-paths &&
+			git rev-parse HEAD |
+			git -c commitGraph.changedPathsThreads=$threads \
+				commit-graph write --stdin-commits \
+				--split=no-merge --changed-paths &&
+			test_line_count = 2 \
+				.git/objects/info/commit-graphs/commit-graph-chain &&
+			for layer in $(cat .git/objects/info/commit-graphs/commit-graph-chain)
+			do
+				cat .git/objects/info/commit-graphs/graph-$layer.graph ||
+				return 1
+			done >layers-$threads || return 1
+		done &&
+		test_cmp_bin layers-1 layers-4
+	)
+'
+
 test_done
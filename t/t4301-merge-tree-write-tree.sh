@@ -0,0 +1,112 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 >numbers &&
+	test_write_lines a b c d e >letters &&
+	echo hello >greeting &&
+	git add numbers letters greeting &&
+	test_commit base &&
+
+	git checkout -b side1 &&
+	test_write_lines 1 2 3 4 5 6 >numbers &&
+	git mv letters alphabet &&
+	echo hi >greeting &&
+	git add numbers greeting &&
+	test_commit side1-change &&
+
+	git checkout -b side2 base &&
+	test_write_lines 0 1 2 3 4 5 >numbers &&
+	test_write_lines a b c d e f >letters &&
+	git add numbers letters &&
+	test_commit side2-change &&
+
+	git checkout -b side3 base &&
+	echo howdy >greeting &&
+	test_commit side3-change greeting &&
+
+	git checkout --orphan unrelated &&
+	git rm -rfq . &&
+	test_commit unrelated
+'
+
+test_expect_success 'clean merge writes the merged tree' '
+	git merge-tree --write-tree side1 side2 >out &&
+	git checkout -B merged side1 &&
+	git merge -s recursive side2 &&
+	git rev-parse merged^{tree} >expect &&
+	test_cmp expect out
+'
+
+test_expect_success 'tree is written without touching index or worktree' '
+	git checkout -B merged side1 &&
+	git merge-tree --write-tree side1 side2 >out &&
+	test_write_lines 0 1 2 3 4 5 6 >expect &&
+	git cat-file blob $(cat out):numbers >actual &&
+	test_cmp expect actual &&
+	test_write_lines a b c d e f >expect &&
+	git cat-file blob $(cat out):alphabet >actual &&
+	test_cmp expect actual &&
+	git diff-index --exit-code HEAD &&
+	test_cmp_rev HEAD side1
+'
+
+test_expect_success 'conflicted merge lists the conflicted stages' '
+	test_expect_code 1 git merge-tree --write-tree side1 side3 >out &&
+	tree=$(head -n 1 out) &&
+	git cat-file -t $tree >actual &&
+	echo tree >expect &&
+	test_cmp expect actual &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse base:greeting) 1	greeting
+	100644 $(git rev-parse side1:greeting) 2	greeting
+	100644 $(git rev-parse side3:greeting) 3	greeting
+
+	EOF
+	sed -n "2,5p" out >actual &&
+	test_cmp expect actual &&
+	test_i18ngrep "CONFLICT (content): Merge conflict in greeting" out &&
+	git cat-file blob $tree:greeting >actual &&
+	grep "^<<<<<<< side1" actual &&
+	grep "^>>>>>>> side3" actual
+'
+
+test_expect_success '--name-only and --no-messages' '
+	test_expect_code 1 git merge-tree --write-tree --name-only \
+		--no-messages side1 side3 >out &&
+	echo greeting >expect &&
+	sed -n "2,\$p" out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '-z separates records with NUL' '
+	test_expect_code 1 git merge-tree --write-tree -z --name-only \
+		--no-messages side1 side3 >out &&
+	printf "%s\0greeting\0" $(git merge-tree --write-tree side1 side3 |
+				   head -n 1) >expect &&
+	test_cmp expect out
+'
+
+test_expect_success 'works in a bare repository' '
+	git clone --bare . bare.git &&
+	git -C bare.git merge-tree --write-tree side1 side2 >actual &&
+	git merge-tree --write-tree side1 side2 >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing bare.git/index
+'
+
+test_expect_success 'refuses unrelated histories and non-commits' '
+	test_must_fail git merge-tree --write-tree side1 unrelated 2>err &&
+	test_i18ngrep "unrelated histories" err &&
+	test_must_fail git merge-tree --write-tree side1 side1^{tree} &&
+	test_must_fail git merge-tree --write-tree side1 no-such-branch
+'
+
+test_expect_success '--trivial-merge rejects the new options' '
+	test_must_fail git merge-tree --trivial-merge -z base side1 side2
+'
+
+test_done
@@ -532,4 +532,43 @@ test_expect_success 'prefetch objects' '
 	test_line_count = 1 donelines
 '
 
+test_expect_success '--stdin-packs packs included but not excluded objects' '
+	git init stdin-packs &&
+	(
+		cd stdin-packs &&
+		for name in a b c
+		do
+			echo $name >$name &&
+			git hash-object -w $name >oid-$name &&
+			pack=$(git pack-objects .git/objects/pack/pack <oid-$name) &&
+			echo pack-$pack.pack >pack-$name || return 1
+		done &&
+		git prune-packed &&
+		cat oid-a oid-b >objs &&
+		git pack-objects .git/objects/pack/pack <objs >/dev/null &&
+
+		cat >in <<-EOF &&
+		$(cat pack-a)
+		$(cat pack-c)
+		^$(cat pack-b)
+		EOF
+		pack=$(git pack-objects --stdin-packs .git/objects/pack/pack <in) &&
+		git show-index <.git/objects/pack/pack-$pack.idx >out &&
+		cut -d" " -f2 out | sort >actual &&
+		cat oid-a oid-c | sort >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--stdin-packs rejects unknown packs and --revs' '
+	test_must_fail git -C stdin-packs pack-objects --stdin-packs \
+		.git/objects/pack/pack <<-\EOF 2>err &&
+	pack-does-not-exist.pack
+	EOF
+	test_i18ngrep "could not find pack" err &&
+	test_must_fail git -C stdin-packs pack-objects --stdin-packs --all \
+		.git/objects/pack/pack </dev/null 2>err &&
+	test_i18ngrep "cannot traverse revisions with --stdin-packs" err
+'
+
 test_done
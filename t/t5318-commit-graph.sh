@@ -4,6 +4,7 @@ test_description='commit graph'
 . ./test-lib.sh
 
 GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+GIT_TEST_COMMIT_GRAPH_REACH_LABELS=0
 
 test_expect_success 'setup full repo' '
 	mkdir full &&
@@ -75,16 +76,16 @@ graph_git_behavior 'no graph' full commits/3 commits/1
 
 graph_read_expect() {
 	OPTIONAL=""
-	NUM_CHUNKS=3
+	NUM_CHUNKS=4
 	if test ! -z $2
 	then
 		OPTIONAL=" $2"
-		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+		NUM_CHUNKS=$((4 + $(echo "$2" | wc -w)))
 	fi
 	cat >expect <<- EOF
 	header: 43475048 1 $(test_oid oid_version) $NUM_CHUNKS 0
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	chunks: oid_fanout oid_lookup commit_metadata generation_data$OPTIONAL
 	EOF
 	test-tool read-graph >output &&
 	test_cmp expect output
@@ -466,7 +467,7 @@ GRAPH_BYTE_HASH=5
 GRAPH_BYTE_CHUNK_COUNT=6
 GRAPH_CHUNK_LOOKUP_OFFSET=8
 GRAPH_CHUNK_LOOKUP_WIDTH=12
-GRAPH_CHUNK_LOOKUP_ROWS=5
+GRAPH_CHUNK_LOOKUP_ROWS=6
 GRAPH_BYTE_OID_FANOUT_ID=$GRAPH_CHUNK_LOOKUP_OFFSET
 GRAPH_BYTE_OID_LOOKUP_ID=$(($GRAPH_CHUNK_LOOKUP_OFFSET + \
 			    1 * $GRAPH_CHUNK_LOOKUP_WIDTH))
@@ -487,8 +488,12 @@ GRAPH_BYTE_COMMIT_WRONG_PARENT=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 3))
 GRAPH_BYTE_COMMIT_GENERATION=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 11))
 GRAPH_BYTE_COMMIT_DATE=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 12))
 GRAPH_COMMIT_DATA_WIDTH=$(($HASH_LEN + 16))
-GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
-			     $GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_GENERATION_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
+				$GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_GENERATION_DATA_WIDTH=4
+GRAPH_BYTE_GENERATION_DATA=$(($GRAPH_GENERATION_DATA_OFFSET + 3))
+GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_GENERATION_DATA_OFFSET + \
+			     $GRAPH_GENERATION_DATA_WIDTH * $NUM_COMMITS))
 GRAPH_BYTE_OCTOPUS=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4))
 GRAPH_BYTE_FOOTER=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4 * $NUM_OCTOPUS_EDGES))
 
@@ -631,6 +636,11 @@ test_expect_success 'detect incorrect generation number' '
 		"non-zero generation number"
 '
 
+test_expect_success 'detect incorrect corrected commit date' '
+	corrupt_graph_and_verify $GRAPH_BYTE_GENERATION_DATA "\01" \
+		"corrected commit date for commit"
+'
+
 test_expect_success 'detect incorrect commit date' '
 	corrupt_graph_and_verify $GRAPH_BYTE_COMMIT_DATE "\01" \
 		"commit date"
@@ -741,4 +751,108 @@ test_expect_success 'corrupt commit-graph write (missing tree)' '
 	)
 '
 
+test_expect_success 'commitGraph.generationVersion=1 omits corrected commit dates' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
+	test-tool read-graph >output &&
+	! grep generation_data output &&
+	git commit-graph verify &&
+	git commit-graph write --reachable &&
+	test-tool read-graph >output &&
+	grep generation_data output &&
+	git -c commitGraph.generationVersion=1 commit-graph verify
+'
+
+test_expect_success 'corrected commit dates follow skewed commit dates' '
+	rm -rf skew &&
+	git init skew &&
+	(
+		cd skew &&
+		test_commit --notick A &&
+		GIT_COMMITTER_DATE="@2000000000 +0000" git commit --allow-empty -m B &&
+		GIT_COMMITTER_DATE="@1000000000 +0000" git commit --allow-empty -m C &&
+		git commit-graph write --reachable &&
+		git commit-graph verify &&
+		graph_git_two_modes "log --topo-order" &&
+		graph_git_two_modes "merge-base --is-ancestor HEAD~2 HEAD" &&
+		graph_git_two_modes "tag --contains HEAD~2"
+	)
+'
+
+test_expect_success TIME_IS_64BIT,TIME_T_IS_64BIT 'corrected commit date offset overflow' '
+	rm -rf overflow &&
+	git init overflow &&
+	(
+		cd overflow &&
+		GIT_COMMITTER_DATE="@3000000000 +0000" git commit --allow-empty -m future &&
+		GIT_COMMITTER_DATE="@100000000 +0000" git commit --allow-empty -m past &&
+		GIT_COMMITTER_DATE="@100000001 +0000" git commit --allow-empty -m past-again &&
+		git commit-graph write --reachable &&
+		test-tool read-graph >output &&
+		grep generation_data_overflow output &&
+		git commit-graph verify &&
+		graph_git_two_modes "log --topo-order" &&
+		graph_git_two_modes "merge-base --is-ancestor HEAD~2 HEAD"
+	)
+'
+
+test_expect_success 'reachability labels answer reachability queries' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --reachable --reachability-labels &&
+	test-tool read-graph >output &&
+	grep reach_labels output &&
+	git commit-graph verify &&
+	refs=$(git for-each-ref --format="%(refname)" refs/heads) &&
+	for a in $refs
+	do
+		graph_git_two_modes "branch --contains $a" &&
+		graph_git_two_modes "branch --no-contains $a" &&
+		graph_git_two_modes "tag --contains $a" &&
+		for b in $refs
+		do
+			git -c core.commitGraph=false \
+				merge-base --is-ancestor $a $b
+			expect=$? &&
+			git -c core.commitGraph=true \
+				merge-base --is-ancestor $a $b
+			test $? = $expect || return 1
+		done || return 1
+	done
+'
+
+test_expect_success 'reachability labels are kept until disabled' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --reachable &&
+	test-tool read-graph >output &&
+	grep reach_labels output &&
+	git commit-graph write --reachable --no-reachability-labels &&
+	test-tool read-graph >output &&
+	! grep reach_labels output
+'
+
+# The reachability labels are the last chunk before the trailer.
+corrupt_reach_labels_and_verify() {
+	cd "$TRASH_DIRECTORY/full" &&
+	git commit-graph write --reachable --reachability-labels &&
+	size=$(wc -c <$objdir/info/commit-graph) &&
+	num=$(test-tool read-graph | sed -n "s/^num_commits: //p") &&
+	corrupt_graph_and_verify \
+		$(($size - $HASH_LEN - 12 * $num + $1)) "$2" "$3"
+}
+
+test_expect_success 'detect out-of-range reachability label' '
+	corrupt_reach_labels_and_verify 0 "\377" \
+		"reachability label .* is out of range"
+'
+
+test_expect_success 'detect invalid reachability interval' '
+	corrupt_reach_labels_and_verify 4 "\377" \
+		"reachability interval for commit .* is invalid"
+'
+
+test_expect_success 'detect incorrect reachability lower bound' '
+	corrupt_reach_labels_and_verify 8 "\177" \
+		"reachability lower bound"
+'
+
 test_done
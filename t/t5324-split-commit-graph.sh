@@ -5,6 +5,7 @@ test_description='split commit graph'
 
 GIT_TEST_COMMIT_GRAPH=0
 GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+GIT_TEST_COMMIT_GRAPH_REACH_LABELS=0
 
 test_expect_success 'setup repo' '
 	git init &&
@@ -13,11 +14,11 @@ test_expect_success 'setup repo' '
 	infodir=".git/objects/info" &&
 	graphdir="$infodir/commit-graphs" &&
 	test_oid_cache <<-EOM
-	shallow sha1:1760
-	shallow sha256:2064
+	shallow sha1:1820
+	shallow sha256:2124
 
-	base sha1:1376
-	base sha256:1496
+	base sha1:1408
+	base sha256:1528
 
 	oid_version sha1:1
 	oid_version sha256:2
@@ -31,9 +32,9 @@ graph_read_expect() {
 		NUM_BASE=$2
 	fi
 	cat >expect <<- EOF
-	header: 43475048 1 $(test_oid oid_version) 3 $NUM_BASE
+	header: 43475048 1 $(test_oid oid_version) 4 $NUM_BASE
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata
+	chunks: oid_fanout oid_lookup commit_metadata generation_data
 	EOF
 	test-tool read-graph >output &&
 	test_cmp expect output
@@ -440,4 +441,102 @@ test_expect_success '--split=replace with partial Bloom data' '
 	verify_chain_files_exist $graphdir
 '
 
+test_expect_success 'setup repo for mixed generation commit-graph-chain' '
+	git init mixed &&
+	(
+		cd mixed &&
+		git config core.commitGraph true &&
+		git config gc.writeCommitGraph false &&
+		for i in $(test_seq 3)
+		do
+			test_commit $i &&
+			git branch commits/$i || return 1
+		done &&
+		git checkout -b side commits/1 &&
+		for i in $(test_seq 4 6)
+		do
+			test_commit $i &&
+			git branch commits/$i || return 1
+		done &&
+		git checkout master &&
+		git merge -m merge side
+	)
+'
+
+test_expect_success 'no corrected commit dates above a layer without them' '
+	(
+		cd mixed &&
+		rm -rf $graphdir &&
+		git rev-parse commits/2 >in &&
+		git -c commitGraph.generationVersion=1 commit-graph write \
+			--split=no-merge --stdin-commits <in &&
+		git commit-graph write --split=no-merge --reachable &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		! grep generation_data output &&
+		git commit-graph verify &&
+		graph_git_two_modes "log --topo-order master" &&
+		graph_git_two_modes "merge-base master commits/6" &&
+		graph_git_two_modes "merge-base --is-ancestor commits/1 master"
+	)
+'
+
+test_expect_success 'corrected commit dates are ignored in a mixed chain' '
+	(
+		cd mixed &&
+		rm -rf $graphdir &&
+		git rev-parse commits/2 >in &&
+		git commit-graph write --split=no-merge --stdin-commits <in &&
+		git -c commitGraph.generationVersion=1 commit-graph write \
+			--split=no-merge --reachable &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		! grep generation_data output &&
+		git commit-graph verify &&
+		graph_git_two_modes "log --topo-order master" &&
+		graph_git_two_modes "merge-base master commits/6" &&
+		graph_git_two_modes "merge-base --is-ancestor commits/1 master"
+	)
+'
+
+test_expect_success 'merging a mixed chain writes corrected commit dates' '
+	(
+		cd mixed &&
+		git commit-graph write --split=replace --reachable &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		grep generation_data output &&
+		git commit-graph verify &&
+		graph_git_two_modes "log --topo-order master" &&
+		graph_git_two_modes "merge-base master commits/6"
+	)
+'
+
+test_expect_success 'reachability labels across a split chain' '
+	(
+		cd mixed &&
+		rm -rf $graphdir $infodir/commit-graph &&
+		git rev-parse commits/2 >in &&
+		git commit-graph write --split=no-merge --stdin-commits <in &&
+		git rev-parse commits/5 >in &&
+		git commit-graph write --split=no-merge --stdin-commits \
+			--reachability-labels <in &&
+		git commit-graph write --split=no-merge --reachable &&
+		test_line_count = 3 $graphdir/commit-graph-chain &&
+		test-tool read-graph >output &&
+		grep reach_labels output &&
+		git commit-graph verify &&
+		for c in commits/1 commits/3 commits/4 commits/6 master
+		do
+			graph_git_two_modes "branch --contains $c" &&
+			graph_git_two_modes "tag --contains $c" &&
+			graph_git_two_modes "merge-base --is-ancestor $c commits/5" || return 1
+		done &&
+		git commit-graph write --split=replace --reachable &&
+		test-tool read-graph >output &&
+		grep reach_labels output &&
+		git commit-graph verify
+	)
+'
+
 test_done
@@ -0,0 +1,183 @@
+#!/bin/sh
+
+test_description='exercise basic multi-pack bitmap functionality'
+. ./test-lib.sh
+
+# We'll be writing our own midx and bitmaps, so avoid getting confused by the
+# automatic ones.
+GIT_TEST_MULTI_PACK_INDEX=0
+export GIT_TEST_MULTI_PACK_INDEX
+
+objdir=.git/objects
+midx=$objdir/pack/multi-pack-index
+
+midx_checksum () {
+	tail -c "$(test_oid rawsz)" "$1" | od -An -tx1 | tr -d " \n"
+}
+
+midx_bitmap () {
+	echo "$objdir/pack/multi-pack-index-$(midx_checksum $midx).bitmap"
+}
+
+test_expect_success 'setup history spread over several packs' '
+	git config core.multiPackIndex true &&
+	test_commit_bulk --id=file 50 &&
+	git repack -d &&
+	test_commit_bulk --id=file --start=51 25 &&
+	git repack -d &&
+	git checkout -b other HEAD~10 &&
+	test_commit_bulk --id=side 10 &&
+	git repack -d &&
+	git checkout master &&
+	test_commit_bulk --id=file --start=76 25 &&
+	git repack -d &&
+
+	# Duplicate some objects into an extra pack, so that the
+	# multi-pack-index has to choose between several copies.
+	git rev-list --objects HEAD~30..HEAD~20 >dups &&
+	cut -d" " -f1 dups | git pack-objects $objdir/pack/pack &&
+
+	ls $objdir/pack/*.pack >packs &&
+	test_line_count = 5 packs &&
+	test_path_is_missing $objdir/pack/*.bitmap
+'
+
+test_expect_success 'write a multi-pack bitmap' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_file "$(midx_bitmap)" &&
+	test-tool read-midx $objdir >actual &&
+	grep "^chunks: .* revindex" actual &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'rev-list --test-bitmap verifies the multi-pack bitmap' '
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err
+'
+
+rev_list_tests () {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting partial commits via bitmap ($state)" '
+		git rev-list --count HEAD~5..HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD~5..HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting non-linear history ($state)" '
+		git rev-list --count other...master >expect &&
+		git rev-list --use-bitmap-index --count other...master >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting objects via bitmap ($state)" '
+		git rev-list --count --objects HEAD >expect &&
+		git rev-list --use-bitmap-index --count --objects HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate objects via bitmap ($state)" '
+		git rev-list --objects --all >expect.raw &&
+		git rev-list --use-bitmap-index --objects --all >actual.raw &&
+		cut -d" " -f1 <expect.raw | sort >expect &&
+		cut -d" " -f1 <actual.raw | sort >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate objects with a filter ($state)" '
+		git rev-list --objects --filter=blob:none HEAD >expect.raw &&
+		git rev-list --use-bitmap-index --objects --filter=blob:none \
+			HEAD >actual.raw &&
+		cut -d" " -f1 <expect.raw | sort >expect &&
+		cut -d" " -f1 <actual.raw | sort >actual &&
+		test_cmp expect actual
+	'
+}
+
+rev_list_tests 'default preferred pack'
+
+test_expect_success 'clone from a repository with a multi-pack bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git -C clone.git fsck &&
+	git rev-parse --all >expect &&
+	git -C clone.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects reuses objects from the preferred pack' '
+	git pack-objects --stdout --revs --all --progress </dev/null \
+		>/dev/null 2>err &&
+	grep "pack-reused [1-9]" err
+'
+
+test_expect_success 'write a multi-pack bitmap with a preferred pack' '
+	preferred=$(basename $(ls -t $objdir/pack/*.pack | tail -n 1)) &&
+	git multi-pack-index write --bitmap --preferred-pack=$preferred &&
+	ls $objdir/pack/multi-pack-index-*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	test_path_is_file "$(midx_bitmap)" &&
+	git multi-pack-index verify &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err
+'
+
+rev_list_tests 'explicit preferred pack'
+
+test_expect_success 'unknown preferred pack is rejected' '
+	test_must_fail git multi-pack-index write --bitmap \
+		--preferred-pack=pack-does-not-exist.pack 2>err &&
+	test_i18ngrep "unknown preferred pack" err
+'
+
+test_expect_success 'rewriting without --bitmap removes the stale bitmap' '
+	test_commit loose &&
+	git repack -d &&
+	git multi-pack-index write &&
+	test_path_is_missing $objdir/pack/multi-pack-index-*.bitmap &&
+	git rev-list --count --objects HEAD >expect &&
+	git rev-list --use-bitmap-index --count --objects HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tips missing from the midx are not bitmapped' '
+	test_commit not-packed &&
+	git multi-pack-index write --bitmap &&
+	test_path_is_file "$(midx_bitmap)" &&
+	git rev-list --count --objects HEAD >expect &&
+	git rev-list --use-bitmap-index --count --objects HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bitmaps require closure over the midx' '
+	test_commit partial &&
+	# Pack the commit itself, but leave its tree and blob loose.
+	git rev-parse HEAD | git pack-objects $objdir/pack/pack &&
+	ls $objdir/pack/multi-pack-index* >before &&
+	test_must_fail git multi-pack-index write --bitmap 2>err &&
+	test_i18ngrep "full closure" err &&
+
+	# The previous midx and its bitmap are left untouched.
+	ls $objdir/pack/multi-pack-index* >after &&
+	test_cmp before after &&
+	test_path_is_file "$(midx_bitmap)" &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'multi-pack bitmap takes precedence over a pack bitmap' '
+	git repack -d &&
+	git repack -adb &&
+	test_commit after-repack &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "OK!" err &&
+	test_i18ngrep ! "ignoring extra bitmap" err
+'
+
+test_done
@@ -0,0 +1,248 @@
+#!/bin/sh
+
+test_description='cruft pack related pack-objects tests'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+loose_objects () {
+	find $objdir -type f -path "$objdir/??/*" |
+	sed -e "s,$objdir/\(..\)/,\1,"
+}
+
+cruft_mtimes () {
+	cruft=$(ls $packdir/pack-*.mtimes) &&
+	test-tool pack-mtimes "$(basename $cruft)" | sort
+}
+
+test_expect_success 'setup' '
+	git config --global gc.autoDetach false
+'
+
+test_expect_success 'repack --cruft packs unreachable objects separately' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+		git repack -ad &&
+
+		blob=$(echo unreachable | git hash-object -w --stdin) &&
+		test-tool chmtime =-100 $objdir/$(test_oid_to_path $blob) &&
+		mtime=$(test-tool chmtime --get $objdir/$(test_oid_to_path $blob)) &&
+
+		git repack --cruft -d &&
+
+		loose_objects >loose &&
+		test_must_be_empty loose &&
+		test 2 -eq $(ls $packdir/*.pack | wc -l) &&
+		echo "$blob $mtime" >expect &&
+		cruft_mtimes >actual &&
+		test_cmp expect actual &&
+
+		# the reachable objects are not in the cruft pack
+		git rev-list --objects --all | cut -d" " -f1 >reachable &&
+		cut -d" " -f1 actual >cruft-objects &&
+		! grep -f reachable cruft-objects
+	)
+'
+
+test_expect_success 'repack --cruft keeps mtimes of cruft objects' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+
+		old=$(echo old | git hash-object -w --stdin) &&
+		new=$(echo new | git hash-object -w --stdin) &&
+		test-tool chmtime =-1000 $objdir/$(test_oid_to_path $old) &&
+		test-tool chmtime =-10 $objdir/$(test_oid_to_path $new) &&
+
+		git repack --cruft -d &&
+		cruft_mtimes >expect &&
+
+		test_commit more &&
+		git repack --cruft -d &&
+		cruft_mtimes >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'objects which become reachable leave the cruft pack' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit base &&
+		git checkout -b side &&
+		test_commit side &&
+		side=$(git rev-parse HEAD) &&
+		git checkout - &&
+		git branch -D side &&
+		git tag -d side &&
+		git reflog expire --all --expire=all &&
+
+		git repack --cruft -d &&
+		cruft_mtimes >cruft &&
+		grep $side cruft &&
+
+		git branch side $side &&
+		git repack --cruft -d &&
+		test_path_is_missing $(ls $packdir/pack-*.mtimes) &&
+		git cat-file -e $side
+	)
+'
+
+test_expect_success 'freshening a cruft object writes it loose' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+		blob=$(echo cruft | git hash-object -w --stdin) &&
+		test-tool chmtime =-1000 $objdir/$(test_oid_to_path $blob) &&
+		git repack --cruft -d &&
+		test_path_is_missing $objdir/$(test_oid_to_path $blob) &&
+
+		echo cruft | git hash-object -w --stdin &&
+		test_path_is_file $objdir/$(test_oid_to_path $blob) &&
+		mtime=$(test-tool chmtime --get $objdir/$(test_oid_to_path $blob)) &&
+
+		git repack --cruft -d &&
+		echo "$blob $mtime" >expect &&
+		cruft_mtimes >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--cruft-expiration drops old objects' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+
+		old=$(echo old | git hash-object -w --stdin) &&
+		pack=$(echo $old | git pack-objects $packdir/pack) &&
+		git prune-packed &&
+		test-tool chmtime =-10000 $packdir/pack-$pack.pack &&
+		new=$(echo new | git hash-object -w --stdin) &&
+
+		git repack --cruft --cruft-expiration=1.hour.ago -d &&
+
+		test_must_fail git cat-file -e $old &&
+		git cat-file -e $new &&
+		cruft_mtimes >actual &&
+		grep $new actual
+	)
+'
+
+test_expect_success '--cruft-expiration keeps old objects reachable from new ones' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+
+		old=$(echo old | git hash-object -w --stdin) &&
+		test-tool chmtime =-10000 $objdir/$(test_oid_to_path $old) &&
+		tree=$(printf "100644 blob $old\told\n" | git mktree) &&
+
+		git repack --cruft --cruft-expiration=1.hour.ago -d &&
+
+		git cat-file -e $old &&
+		git cat-file -e $tree &&
+		loose_objects >loose &&
+		test_must_be_empty loose
+	)
+'
+
+test_expect_success 'prune uses the mtimes of cruft objects' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+
+		blob=$(echo referred | git hash-object --stdin) &&
+		recent=$(printf "100644 blob $blob\trecent\n" | git mktree --missing) &&
+		old=$(printf "100644 blob $blob\told\n" | git mktree --missing) &&
+		test-tool chmtime =-10000 $objdir/$(test_oid_to_path $old) &&
+		git repack --cruft -d &&
+
+		# The pack itself looks old; the recent tree must still
+		# keep the blob it refers to.
+		test-tool chmtime =-10000 $packdir/pack-*.pack &&
+		echo referred | git hash-object -w --stdin &&
+		test-tool chmtime =-10000 $objdir/$(test_oid_to_path $blob) &&
+		git prune --expire=1.hour.ago &&
+		test_path_is_file $objdir/$(test_oid_to_path $blob)
+	)
+'
+
+test_expect_success 'prune does not keep objects for old cruft objects' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+
+		blob=$(echo referred | git hash-object --stdin) &&
+		old=$(printf "100644 blob $blob\told\n" | git mktree --missing) &&
+		test-tool chmtime =-10000 $objdir/$(test_oid_to_path $old) &&
+		git repack --cruft -d &&
+
+		echo referred | git hash-object -w --stdin &&
+		test-tool chmtime =-10000 $objdir/$(test_oid_to_path $blob) &&
+		git prune --expire=1.hour.ago &&
+		test_path_is_missing $objdir/$(test_oid_to_path $blob)
+	)
+'
+
+test_expect_success 'gc --cruft' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+		recent=$(echo recent | git hash-object -w --stdin) &&
+		old=$(echo old | git hash-object -w --stdin) &&
+		test-tool chmtime =-10000 $objdir/$(test_oid_to_path $old) &&
+
+		git gc --cruft --prune=1.hour.ago &&
+
+		loose_objects >loose &&
+		test_must_be_empty loose &&
+		git cat-file -e $recent &&
+		test_must_fail git cat-file -e $old &&
+		ls $packdir/pack-*.mtimes
+	)
+'
+
+test_expect_success 'gc.cruftPacks' '
+	git init cruft &&
+	test_when_finished "rm -fr cruft" &&
+	(
+		cd cruft &&
+		test_commit reachable &&
+		echo unreachable | git hash-object -w --stdin &&
+		git -c gc.cruftPacks=true gc &&
+		loose_objects >loose &&
+		test_must_be_empty loose &&
+		ls $packdir/pack-*.mtimes
+	)
+'
+
+test_expect_success 'pack-objects --cruft rejects incompatible options' '
+	test_must_fail git pack-objects --cruft --revs pack </dev/null 2>err &&
+	test_i18ngrep "cannot traverse revisions with --cruft" err &&
+	test_must_fail git pack-objects --cruft --stdout </dev/null 2>err &&
+	test_i18ngrep "cannot use --stdout with --cruft" err &&
+	test_must_fail git repack --cruft -A 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_done
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+test_description='delta base cache shared between threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup history with long delta chains' '
+	for i in $(test_seq 40)
+	do
+		for f in a b c d
+		do
+			test_seq $i 200 | sed "s/^/$f line /" >$f.txt || return 1
+		done &&
+		git add . &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -a -d -q --depth=50 --window=50 &&
+	git count-objects -v >counts &&
+	grep "^count: 0" counts
+'
+
+test_expect_success 'threaded grep over revisions matches single-threaded grep' '
+	git rev-list HEAD >revs &&
+	git grep --threads=1 -e "line 1[0-9]" $(cat revs) >expect &&
+	git grep --threads=8 -e "line 1[0-9]" $(cat revs) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'small cache limit still gives correct results' '
+	git -c core.deltaBaseCacheLimit=1k grep --threads=8 \
+		-e "line 1[0-9]" $(cat revs) >actual &&
+	test_cmp expect actual &&
+	git -c core.deltaBaseCacheLimit=1k log -p >small &&
+	git log -p >default &&
+	test_cmp default small
+'
+
+test_expect_success 'cache statistics are reported through trace2' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git log -p >/dev/null &&
+	grep "\"category\":\"delta-base-cache\",\"key\":\"hits\"" trace.event &&
+	grep "\"category\":\"delta-base-cache\",\"key\":\"misses\"" trace.event
+'
+
+test_done
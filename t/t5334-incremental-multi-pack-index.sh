@@ -0,0 +1,251 @@
+#!/bin/sh
+
+test_description='incremental multi-pack-index chains'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+
+objdir=.git/objects
+packdir=$objdir/pack
+midx=$packdir/multi-pack-index
+midxdir=$packdir/multi-pack-index.d
+chain=$midxdir/multi-pack-index-chain
+
+# make_pack <count> writes a pack of <count> new blobs, and prints its name
+make_pack () {
+	for i in $(test_seq $1)
+	do
+		echo "blob $i of $(next_blob_id)" |
+		git hash-object -w --stdin || return 1
+	done >oids &&
+	cat oids >>all-oids &&
+	pack=$(git pack-objects -q $packdir/pack <oids) &&
+	git prune-packed &&
+	echo pack-$pack.pack
+}
+
+next_blob_id () {
+	id=$(($(cat blob-id 2>/dev/null || echo 0) + 1)) &&
+	echo $id >blob-id &&
+	echo $id
+}
+
+layer_count () {
+	wc -l <$chain
+}
+
+test_expect_success 'setup' '
+	git config --global core.multiPackIndex true
+'
+
+test_expect_success 'write --incremental starts a chain' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 4 &&
+		make_pack 4 &&
+
+		git multi-pack-index write --incremental &&
+
+		test_path_is_missing $midx &&
+		test 1 -eq "$(layer_count)" &&
+		test_path_is_file $midxdir/multi-pack-index-$(cat $chain).midx &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'a small new pack only writes a new layer' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 16 &&
+		git multi-pack-index write --incremental &&
+		base=$(cat $chain) &&
+		cp $midxdir/multi-pack-index-$base.midx base.midx &&
+
+		make_pack 1 &&
+		git multi-pack-index write --incremental &&
+
+		test 2 -eq "$(layer_count)" &&
+		test "$base" = "$(head -n 1 $chain)" &&
+		test_cmp base.midx $midxdir/multi-pack-index-$base.midx &&
+		test 2 -eq "$(ls $midxdir/*.midx | wc -l)" &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'objects are found in every layer' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 32 &&
+		test_commit first &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test_commit second &&
+		git repack -d &&
+		git multi-pack-index write --incremental &&
+		test 2 -eq "$(layer_count)" &&
+
+		git rev-list --objects --all >objects &&
+		cut -d" " -f1 objects | git cat-file --batch-check >actual &&
+		! grep missing actual &&
+		git rev-parse --short=4 first:first.t >short &&
+		git cat-file -e $(cat short) &&
+		git log --oneline >/dev/null &&
+		git fsck
+	)
+'
+
+test_expect_success 'comparable layers are merged' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 4 &&
+		git multi-pack-index write --incremental &&
+		make_pack 4 &&
+		git multi-pack-index write --incremental &&
+
+		test 1 -eq "$(layer_count)" &&
+		test 1 -eq "$(ls $midxdir/*.midx | wc -l)" &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--size-multiple controls merging' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 8 &&
+		git multi-pack-index write --incremental &&
+		make_pack 2 &&
+		git multi-pack-index write --incremental --size-multiple=4 &&
+		test 1 -eq "$(layer_count)" &&
+
+		make_pack 1 &&
+		git multi-pack-index write --incremental --size-multiple=4 &&
+		test 2 -eq "$(layer_count)"
+	)
+'
+
+test_expect_success 'an existing multi-pack-index becomes the base layer' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 16 &&
+		git multi-pack-index write &&
+		test_path_is_file $midx &&
+		cp $midx base.midx &&
+
+		make_pack 1 &&
+		git multi-pack-index write --incremental &&
+
+		test_path_is_missing $midx &&
+		test 2 -eq "$(layer_count)" &&
+		test_cmp base.midx $midxdir/multi-pack-index-$(head -n 1 $chain).midx &&
+		git cat-file --batch-check <all-oids >actual &&
+		! grep missing actual &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'layers referring to removed packs are rewritten' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 16 &&
+		git multi-pack-index write --incremental &&
+		small=$(make_pack 1) &&
+		git multi-pack-index write --incremental &&
+		test 2 -eq "$(layer_count)" &&
+
+		rm $packdir/${small%.pack}.* &&
+		make_pack 1 &&
+		git multi-pack-index write --incremental &&
+
+		test 2 -eq "$(layer_count)" &&
+		test-tool read-midx $objdir >midx.out &&
+		! grep ${small%.pack} midx.out &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'a full write replaces the chain' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 16 &&
+		git multi-pack-index write --incremental &&
+		make_pack 1 &&
+		git multi-pack-index write --incremental &&
+
+		git multi-pack-index write &&
+
+		test_path_is_file $midx &&
+		test_path_is_missing $midxdir &&
+		git cat-file --batch-check <all-oids >actual &&
+		! grep missing actual &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'repack flattens the chain' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 16 &&
+		git multi-pack-index write --incremental &&
+		make_pack 1 &&
+		git multi-pack-index write --incremental &&
+		git multi-pack-index repack --batch-size=0 &&
+
+		test_path_is_file $midx &&
+		test_path_is_missing $chain &&
+		test 3 -eq "$(ls $packdir/*.pack | wc -l)" &&
+		test-tool read-midx $objdir >midx.out &&
+		test 3 -eq "$(grep "^pack-.*\.idx$" midx.out | wc -l)" &&
+		git cat-file --batch-check <all-oids >actual &&
+		! grep missing actual &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success 'repack --geometric --write-midx extends a chain' '
+	git init incremental &&
+	test_when_finished "rm -fr incremental" &&
+	(
+		cd incremental &&
+		make_pack 32 &&
+		git multi-pack-index write --incremental &&
+		base=$(cat $chain) &&
+		make_pack 1 &&
+		make_pack 1 &&
+
+		git repack --geometric 2 -d --write-midx &&
+
+		test 2 -eq "$(layer_count)" &&
+		test "$base" = "$(head -n 1 $chain)" &&
+		git cat-file --batch-check <all-oids >actual &&
+		! grep missing actual &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--incremental rejects incompatible options' '
+	test_must_fail git multi-pack-index write --incremental --bitmap 2>err &&
+	test_i18ngrep "cannot be combined" err &&
+	test_must_fail git multi-pack-index write --size-multiple=3 2>err &&
+	test_i18ngrep "requires --incremental" err
+'
+
+test_done
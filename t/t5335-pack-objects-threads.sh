@@ -0,0 +1,115 @@
+#!/bin/sh
+
+test_description='pack-objects enumerating objects on multiple threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p a/deep/er b c &&
+	for i in $(test_seq 20)
+	do
+		test_seq $i 40 >a/file-$i &&
+		test_seq $i 30 >a/deep/file-$i &&
+		test_seq $i 20 >a/deep/er/file-$i &&
+		test_seq $i 10 >b/file-$i || return 1
+	done &&
+	git add . &&
+	test_commit base &&
+
+	cp -R a c/copy-of-a &&
+	git add c &&
+	test_commit copy &&
+
+	git checkout -b side &&
+	git mv b b-renamed &&
+	echo changed >>a/deep/file-3 &&
+	git add a &&
+	test_commit side &&
+
+	git checkout - &&
+	for i in $(test_seq 5)
+	do
+		echo $i >>a/deep/er/file-$i &&
+		git add a &&
+		test_commit main-$i || return 1
+	done &&
+	git merge -m merge side &&
+
+	git tag -a -m "a tree" tree-tag HEAD^{tree} &&
+	git tag -a -m "a blob" blob-tag HEAD:b-renamed/file-1
+'
+
+# compare_threads <stdin> <pack-objects args>...
+compare_threads () {
+	input=$1 &&
+	shift &&
+	echo "$input" >input &&
+	git -c pack.enumerationThreads=1 pack-objects --threads=1 \
+		--stdout "$@" <input >expect.pack &&
+	git -c pack.enumerationThreads=4 pack-objects --threads=1 \
+		--stdout "$@" <input >actual.pack &&
+	test_cmp expect.pack actual.pack &&
+	git pack-objects --enumeration-threads=3 --threads=1 \
+		--stdout "$@" <input >actual.pack &&
+	test_cmp expect.pack actual.pack
+}
+
+test_expect_success 'full pack does not depend on threads' '
+	compare_threads "" --revs --all
+'
+
+test_expect_success 'incremental pack does not depend on threads' '
+	compare_threads "$(printf "HEAD\n^main-2\n")" --revs &&
+	compare_threads "$(printf "HEAD\n^main-2\n")" --revs --thin &&
+	compare_threads "$(printf "HEAD\n^main-2\n")" --revs --sparse
+'
+
+test_expect_success 'trees and blobs on the command line' '
+	compare_threads "$(printf "HEAD^{tree}\nmain-3:a\nHEAD:b-renamed/file-1\n")" \
+		--revs &&
+	compare_threads "$(printf "base:a\nHEAD\n")" --revs
+'
+
+test_expect_success 'tags to trees and blobs' '
+	compare_threads "" --revs --all --include-tag
+'
+
+test_expect_success 'delta islands do not depend on threads' '
+	test_config pack.island "refs/heads/(.*)" &&
+	compare_threads "" --revs --all --delta-islands
+'
+
+test_expect_success 'name-hash cache in bitmaps does not depend on threads' '
+	mkdir one four &&
+	git -c pack.enumerationThreads=1 pack-objects --threads=1 --revs \
+		--all --write-bitmap-index one/pack </dev/null &&
+	git -c pack.enumerationThreads=4 pack-objects --threads=1 --revs \
+		--all --write-bitmap-index four/pack </dev/null &&
+	(cd one && ls) >expect &&
+	(cd four && ls) >actual &&
+	test_cmp expect actual &&
+	for f in $(cat expect)
+	do
+		test_cmp one/$f four/$f || return 1
+	done
+'
+
+test_expect_success 'missing tree is reported' '
+	git clone --no-hardlinks . missing &&
+	(
+		cd missing &&
+		tree=$(git rev-parse main-1:a/deep) &&
+		rm .git/objects/$(test_oid_to_path $tree) &&
+		test_must_fail git pack-objects --enumeration-threads=4 \
+			--revs --all --stdout </dev/null >/dev/null 2>err &&
+		test_i18ngrep "bad tree object $tree" err
+	)
+'
+
+test_expect_success 'pack.enumerationThreads must not be negative' '
+	test_must_fail git -c pack.enumerationThreads=-1 pack-objects \
+		--revs --all --stdout </dev/null 2>err &&
+	test_i18ngrep "invalid number of threads" err
+'
+
+test_done
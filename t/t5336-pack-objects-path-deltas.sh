@@ -0,0 +1,115 @@
+#!/bin/sh
+
+test_description='pack-objects trying deltas within each path first'
+
+. ./test-lib.sh
+
+# Every module has a "src/main/BUILD" of the same size, so the filename
+# hash and the size both put the unrelated files next to each other.
+test_expect_success 'setup' '
+	for i in $(test_seq 20)
+	do
+		mkdir -p mod-$i/src/main &&
+		for j in $(test_seq 40)
+		do
+			printf "rule-%02d-of-%02d = %06d\n" $j $i \
+				$((i * 1000 + j * 17)) || return 1
+		done >mod-$i/src/main/BUILD || return 1
+	done &&
+	git add . &&
+	git commit -q -m base &&
+	for c in $(test_seq 4)
+	do
+		for i in $(test_seq 20)
+		do
+			f=mod-$i/src/main/BUILD &&
+			rule=$(printf "rule-%02d-of-%02d" $((c * 7)) $i) &&
+			value=$(printf "%06d" $((c * 10000 + i))) &&
+			sed -e "s/^$rule = .*/$rule = $value/" $f >tmp &&
+			mv tmp $f || return 1
+		done &&
+		git commit -q -a -m "change $c" || return 1
+	done &&
+	git rev-list --objects --all >objects
+'
+
+# delta_paths <pack>: print "same" or "cross" for every delta in <pack>
+delta_paths () {
+	idx=${1%.pack}.idx &&
+	git index-pack -o $idx $1 >/dev/null &&
+	git verify-pack -v $idx >verify &&
+	awk "\$2 == \"blob\" && NF == 7 { print \$1, \$7 }" verify >deltas &&
+	awk "NR == FNR { path[\$1] = \$2; next }
+	     { print (path[\$1] == path[\$2] ? \"same\" : \"cross\") }" \
+		objects deltas
+}
+
+test_expect_success '--path-deltas finds deltas within each path' '
+	git pack-objects --revs --all --no-reuse-delta --window=2 \
+		--threads=1 --stdout </dev/null >default.pack &&
+	git pack-objects --revs --all --no-reuse-delta --window=2 \
+		--threads=1 --stdout --path-deltas </dev/null >path.pack &&
+	delta_paths default.pack >default-deltas &&
+	delta_paths path.pack >path-deltas &&
+	test_line_count -lt 80 default-deltas &&
+	test_line_count = 80 path-deltas &&
+	! grep cross path-deltas &&
+	test $(wc -c <path.pack) -lt $(wc -c <default.pack)
+'
+
+test_expect_success 'objects are the same with --path-deltas' '
+	git show-index <default.idx | cut -d" " -f2 | sort >expect &&
+	git show-index <path.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack.pathDeltas is the same as --path-deltas' '
+	git -c pack.pathDeltas=true pack-objects --revs --all \
+		--no-reuse-delta --window=2 --threads=1 --stdout \
+		</dev/null >config.pack &&
+	test_cmp path.pack config.pack
+'
+
+test_expect_success 'objects without a path delta are tried across paths' '
+	blob=$(git rev-parse HEAD:mod-1/src/main/BUILD) &&
+	git cat-file blob $blob >copy &&
+	echo "one more rule" >>copy &&
+	git add copy &&
+	git commit -q -m copy &&
+	git rev-list --objects --all >objects &&
+	git pack-objects --revs --all --no-reuse-delta --threads=1 \
+		--stdout --path-deltas </dev/null >cross.pack &&
+	git index-pack -o cross.idx cross.pack >/dev/null &&
+	git verify-pack -v cross.idx >verify &&
+	grep "^$blob blob .* $(git rev-parse HEAD:copy)\$" verify
+'
+
+test_expect_success 'threaded delta search with --path-deltas' '
+	git pack-objects --revs --all --no-reuse-delta --threads=4 \
+		--stdout --path-deltas </dev/null >threads.pack &&
+	git index-pack --strict -o threads.idx threads.pack &&
+	git verify-pack threads.idx
+'
+
+test_expect_success 'thin pack with --path-deltas' '
+	git rev-parse HEAD~2 >revs &&
+	echo --not >>revs &&
+	git rev-parse HEAD~4 >>revs &&
+	git pack-objects --revs --thin --path-deltas --stdout \
+		<revs >thin.pack &&
+	git init --bare thin.git &&
+	git rev-parse HEAD~4 | git pack-objects --revs --stdout >base.pack &&
+	git -C thin.git index-pack --stdin <base.pack &&
+	git -C thin.git index-pack --stdin --fix-thin <thin.pack
+'
+
+test_expect_success 'repack with pack.pathDeltas' '
+	git -c pack.pathDeltas=true repack -adf &&
+	git fsck &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+	idx=$(ls .git/objects/pack/*.idx) &&
+	git show-index <$idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -201,4 +201,38 @@ test_expect_success 'Test delete/normalize conflict' '
 	test_path_is_missing file
 '
 
+test_expect_success 'Merge addition of text=auto in a subdirectory' '
+	git config core.eol lf &&
+	git config merge.renormalize true &&
+	git rm -fr . &&
+	rm -f .gitattributes &&
+	git checkout --orphan nested-a &&
+	mkdir sub &&
+	echo first line | append_cr >sub/file &&
+	git add sub/file &&
+	test_tick &&
+	git commit -m "nested: initial" &&
+	git tag nested-base &&
+
+	echo "* text=auto" >sub/.gitattributes &&
+	echo first line >sub/file &&
+	echo same line | append_cr >>sub/file &&
+	git add sub &&
+	test_tick &&
+	git commit -m "nested: normalize and add line" &&
+
+	git checkout -b nested-b nested-base &&
+	echo same line | append_cr >>sub/file &&
+	git add sub/file &&
+	test_tick &&
+	git commit -m "nested: add line" &&
+
+	git merge nested-a &&
+	cat <<-\EOF >expected &&
+	first line
+	same line
+	EOF
+	compare_files expected sub/file
+'
+
 test_done
@@ -0,0 +1,105 @@
+#!/bin/sh
+
+test_description='merging with the ort strategy'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >file &&
+	test_write_lines a b c d e f g h i >renamed &&
+	mkdir dir &&
+	echo keep >dir/keep &&
+	git add file renamed dir &&
+	test_commit base &&
+
+	git checkout -b side1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >file &&
+	git mv renamed moved &&
+	echo one >dir/one &&
+	git add file dir/one &&
+	test_commit side1-change &&
+
+	git checkout -b side2 base &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >file &&
+	test_write_lines a b c d e f g h I >renamed &&
+	echo two >dir/two &&
+	git add file renamed dir/two &&
+	test_commit side2-change &&
+
+	git checkout -b conflict base &&
+	test_write_lines 1 2 3 4 5 6 7 8 NINE >file &&
+	test_commit conflict-change file
+'
+
+test_expect_success 'merge -s ort matches -s recursive on a clean merge' '
+	git checkout -B recursive side1 &&
+	git merge -s recursive side2 &&
+	git checkout -B ort side1 &&
+	git merge -s ort side2 &&
+	test_cmp_rev recursive^{tree} ort^{tree} &&
+	test_write_lines a b c d e f g h I >expect &&
+	test_cmp expect moved &&
+	test_path_is_missing renamed &&
+	git diff-index --exit-code HEAD
+'
+
+test_expect_success 'merge -s ort records conflicts in index and worktree' '
+	git checkout -B ort side1 &&
+	test_must_fail git merge -s ort conflict >out &&
+	test_i18ngrep "CONFLICT (content): Merge conflict in file" out &&
+	git ls-files -u >unmerged &&
+	test_line_count = 3 unmerged &&
+	grep "^<<<<<<< HEAD" file &&
+	grep "^>>>>>>> conflict" file &&
+	git merge --abort &&
+	test_cmp_rev HEAD side1-change
+'
+
+test_expect_success 'merge -s ort refuses to clobber local changes' '
+	git checkout -B ort side1 &&
+	echo dirty >>file &&
+	git update-index file &&
+	test_must_fail git merge -s ort side2 2>err &&
+	test_i18ngrep "would be overwritten by merge" err &&
+	git reset --hard
+'
+
+test_expect_success 'merge -s ort handles rename/delete' '
+	git checkout -B delete base &&
+	git rm -q renamed &&
+	git commit -q -m delete &&
+	git checkout -B ort side1 &&
+	test_must_fail git merge -s ort delete >out &&
+	test_i18ngrep "CONFLICT (rename/delete)" out &&
+	git rev-parse --verify -q :2:moved &&
+	test_must_fail git rev-parse --verify -q :3:moved &&
+	git reset --hard
+'
+
+test_expect_success 'cherry-pick --strategy=ort' '
+	git checkout -B ort side1 &&
+	git cherry-pick --strategy=ort side2-change &&
+	test_write_lines one 2 3 4 5 6 7 8 nine >expect &&
+	test_cmp expect file &&
+	test_write_lines a b c d e f g h I >expect &&
+	test_cmp expect moved
+'
+
+test_expect_success 'rebase -s ort' '
+	git checkout -B ort side2 &&
+	git rebase -s ort side1 &&
+	test_cmp_rev HEAD^ side1-change &&
+	git checkout -B recursive side2 &&
+	git rebase -s recursive side1 &&
+	test_cmp_rev recursive^{tree} ort^{tree}
+'
+
+test_expect_success 'GIT_TEST_MERGE_ALGORITHM=ort selects ort by default' '
+	git checkout -B ort side1 &&
+	test_must_fail env GIT_TEST_MERGE_ALGORITHM=ort \
+		git merge conflict >out &&
+	test_i18ngrep "CONFLICT (content)" out &&
+	git reset --hard
+'
+
+test_done
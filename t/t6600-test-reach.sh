@@ -55,17 +55,35 @@ test_expect_success 'setup' '
 	git show-ref -s commit-5-5 | git commit-graph write --stdin-commits &&
 	mv .git/objects/info/commit-graph commit-graph-half &&
 	chmod u+w commit-graph-half &&
+	git commit-graph write --reachable --reachability-labels &&
+	mv .git/objects/info/commit-graph commit-graph-labels &&
+	chmod u+w commit-graph-labels &&
+	git show-ref -s commit-5-5 |
+		git commit-graph write --stdin-commits --reachability-labels &&
+	mv .git/objects/info/commit-graph commit-graph-half-labels &&
+	chmod u+w commit-graph-half-labels &&
+	git show-ref -s commit-3-7 | git commit-graph write --stdin-commits \
+		--split --no-reachability-labels &&
+	git show-ref -s commit-5-5 | git commit-graph write --stdin-commits \
+		--split=no-merge --reachability-labels &&
+	git commit-graph write --reachable --split=no-merge &&
+	mv .git/objects/info/commit-graphs commit-graphs-split-labels &&
 	git config core.commitGraph true
 '
 
 run_three_modes () {
-	test_when_finished rm -rf .git/objects/info/commit-graph &&
+	test_when_finished rm -rf .git/objects/info/commit-graph \
+		.git/objects/info/commit-graphs &&
 	"$@" <input >actual &&
 	test_cmp expect actual &&
-	cp commit-graph-full .git/objects/info/commit-graph &&
-	"$@" <input >actual &&
-	test_cmp expect actual &&
-	cp commit-graph-half .git/objects/info/commit-graph &&
+	for graph in full half labels half-labels
+	do
+		cp commit-graph-$graph .git/objects/info/commit-graph &&
+		"$@" <input >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	rm .git/objects/info/commit-graph &&
+	cp -R commit-graphs-split-labels .git/objects/info/commit-graphs &&
 	"$@" <input >actual &&
 	test_cmp expect actual
 }
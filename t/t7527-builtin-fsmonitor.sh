@@ -0,0 +1,236 @@
+#!/bin/sh
+
+test_description='built-in file system watcher'
+
+. ./test-lib.sh
+
+if ! test_have_prereq FSMONITOR_DAEMON
+then
+	skip_all="fsmonitor--daemon is not supported on this platform"
+	test_done
+fi
+
+stop_daemon_delete_repo () {
+	r=$1 &&
+	test_might_fail git -C $r fsmonitor--daemon stop &&
+	rm -rf $1
+}
+
+start_daemon () {
+	git -C "$1" fsmonitor--daemon start &&
+	git -C "$1" fsmonitor--daemon status
+}
+
+# Run a daemon in the foreground, but without waiting for it.
+run_daemon_in_background () {
+	git -C "$1" fsmonitor--daemon run &
+	echo $! >"$1.pid"
+}
+
+# Send a query for "repo" with the token of the previous one and
+# print the reported paths, sorted.
+query_changes () {
+	test-tool -C repo fsmonitor-client query --token="$(cat token)" >raw &&
+	head -n 1 raw >token &&
+	sed 1d raw | sort
+}
+
+test_expect_success 'explicit daemon start and stop' '
+	test_when_finished "stop_daemon_delete_repo test_explicit" &&
+
+	git init test_explicit &&
+	start_daemon test_explicit &&
+
+	git -C test_explicit fsmonitor--daemon stop &&
+	test_must_fail git -C test_explicit fsmonitor--daemon status
+'
+
+test_expect_success 'cannot run two daemons' '
+	test_when_finished "stop_daemon_delete_repo test_twice" &&
+
+	git init test_twice &&
+	start_daemon test_twice &&
+	test_must_fail git -C test_twice fsmonitor--daemon run 2>err &&
+	test_i18ngrep "already running" err &&
+
+	# "start" is happy to find a running daemon
+	start_daemon test_twice
+'
+
+test_expect_success 'daemon exits when the worktree is deleted' '
+	git init test_deleted &&
+	run_daemon_in_background test_deleted &&
+	pid=$(cat test_deleted.pid) &&
+	while ! git -C test_deleted fsmonitor--daemon status >/dev/null
+	do
+		kill -0 $pid && sleep 1 || return 1
+	done &&
+	rm -rf test_deleted &&
+	wait $pid
+'
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		: >tracked &&
+		: >modified &&
+		: >delete &&
+		: >rename &&
+		mkdir dir1 dir2 &&
+		: >dir1/tracked &&
+		: >dir1/modified &&
+		: >dir1/delete &&
+		: >dir2/tracked &&
+		git add . &&
+		test_tick &&
+		git commit -m initial &&
+		git config core.fsmonitor true
+	) &&
+	start_daemon repo &&
+
+	# Get a token for the journal of the running daemon.
+	echo unknown >token &&
+	query_changes >actual &&
+	echo / >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown tokens get a trivial response' '
+	test-tool -C repo fsmonitor-client query --token=builtin:bogus:0 >raw &&
+	sed 1d raw >actual &&
+	echo / >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'no changes' '
+	query_changes >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'report file changes' '
+	echo 1 >repo/modified &&
+	echo 2 >repo/dir1/modified &&
+	rm repo/delete &&
+	mv repo/rename repo/renamed &&
+	: >repo/new &&
+	query_changes >actual &&
+	cat >expect <<-\EOF &&
+	delete
+	dir1/modified
+	modified
+	new
+	rename
+	renamed
+	EOF
+	test_cmp expect actual &&
+
+	# The next query only reports newer changes.
+	rm repo/dir1/delete &&
+	query_changes >actual &&
+	echo dir1/delete >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'report directory changes' '
+	mkdir -p repo/dir3/sub &&
+	: >repo/dir3/sub/file &&
+	mv repo/dir2 repo/dir4 &&
+	query_changes >actual &&
+
+	# Depending on how quickly the daemon watched "dir3", we may
+	# see the changes inside it, too.
+	grep -x dir2/ actual &&
+	grep -x dir3/ actual &&
+	grep -x dir4/ actual &&
+
+	# The new and moved directories are watched, too.
+	: >repo/dir3/sub/other &&
+	: >repo/dir4/new &&
+	query_changes >actual &&
+	cat >expect <<-\EOF &&
+	dir3/sub/other
+	dir4/new
+	EOF
+	test_cmp expect actual &&
+
+	rm repo/dir4/new &&
+	mv repo/dir4 repo/dir2 &&
+	rm -rf repo/dir3 &&
+	query_changes >actual
+'
+
+test_expect_success 'changes inside .git are ignored' '
+	git -C repo update-ref refs/heads/other HEAD &&
+	query_changes >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'flush forces a trivial response' '
+	test-tool -C repo fsmonitor-client flush >actual &&
+	echo OK >expect &&
+	test_cmp expect actual &&
+	query_changes >actual &&
+	echo / >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status with the daemon matches status without it' '
+	git -C repo reset --hard &&
+	git -C repo clean -fdx &&
+	git -C repo status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+
+	echo changed >repo/tracked &&
+	echo changed >repo/dir2/tracked &&
+	rm repo/dir1/tracked &&
+	git -C repo status --porcelain -uno >actual &&
+	git -C repo -c core.fsmonitor=false status --porcelain -uno >expect &&
+	test_cmp expect actual &&
+	test_line_count = 3 actual &&
+
+	git -C repo reset --hard &&
+	git -C repo status --porcelain -uno >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'status notices a renamed directory' '
+	mv repo/dir2 repo/dir5 &&
+	git -C repo status --porcelain -uno >actual &&
+	echo " D dir2/tracked" >expect &&
+	test_cmp expect actual &&
+
+	mv repo/dir5 repo/dir2 &&
+	git -C repo status --porcelain -uno >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'status with the untracked cache' '
+	test_config -C repo core.untrackedCache true &&
+	git -C repo status --porcelain >actual &&
+	test_must_be_empty actual &&
+
+	mkdir repo/dir6 &&
+	: >repo/dir6/untracked &&
+	: >repo/dir1/untracked &&
+	git -C repo status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	?? dir1/untracked
+	?? dir6/
+	EOF
+	test_cmp expect actual &&
+
+	rm -rf repo/dir6 repo/dir1/untracked &&
+	git -C repo status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'commands start the daemon on demand' '
+	git -C repo fsmonitor--daemon stop &&
+	test_must_fail git -C repo fsmonitor--daemon status &&
+	git -C repo status >/dev/null &&
+	git -C repo fsmonitor--daemon status &&
+	git -C repo fsmonitor--daemon stop
+'
+
+test_done
@@ -0,0 +1,247 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+
+objdir=.git/objects
+packdir=$objdir/pack
+midx=$objdir/pack/multi-pack-index
+
+# make_pack <count> writes a pack of <count> new blobs, and prints its name
+make_pack () {
+	for i in $(test_seq $1)
+	do
+		echo "blob $i of $(next_blob_id)" |
+		git hash-object -w --stdin || return 1
+	done >oids &&
+	pack=$(git pack-objects -q $packdir/pack <oids) &&
+	git prune-packed &&
+	echo pack-$pack.pack
+}
+
+next_blob_id () {
+	id=$(($(cat blob-id 2>/dev/null || echo 0) + 1)) &&
+	echo $id >blob-id &&
+	echo $id
+}
+
+pack_count () {
+	ls $packdir/*.pack | wc -l
+}
+
+midx_pack_count () {
+	test-tool read-midx $objdir >midx.out &&
+	grep "^pack-.*\.idx$" midx.out | wc -l
+}
+
+test_expect_success 'setup' '
+	git config --global core.multiPackIndex true
+'
+
+test_expect_success '--geometric with no packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		git repack --write-midx --geometric 2 >out &&
+		test_i18ngrep "Nothing new to pack" out
+	)
+'
+
+test_expect_success '--geometric with an intact progression' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 1 &&
+		make_pack 2 &&
+		make_pack 4 &&
+
+		ls $packdir/*.pack | sort >expect &&
+		git repack --geometric 2 -d &&
+		ls $packdir/*.pack | sort >actual &&
+
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--geometric with small-pack rollup' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		small=$(make_pack 1) &&
+		small2=$(make_pack 1) &&
+		big=$(make_pack 4) &&
+		bigger=$(make_pack 16) &&
+
+		git repack --geometric 2 -d &&
+
+		test 3 -eq "$(pack_count)" &&
+		test_path_is_missing $packdir/$small &&
+		test_path_is_missing $packdir/$small2 &&
+		test_path_is_file $packdir/$big &&
+		test_path_is_file $packdir/$bigger
+	)
+'
+
+test_expect_success '--geometric with small- and large-pack rollup' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 3 &&
+		make_pack 3 &&
+		make_pack 5 &&
+		largest=$(make_pack 40) &&
+
+		git repack --geometric 2 -d &&
+
+		test 2 -eq "$(pack_count)" &&
+		test_path_is_file $packdir/$largest
+	)
+'
+
+test_expect_success '--geometric ignores kept packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		kept=$(make_pack 1) &&
+		make_pack 1 &&
+		make_pack 1 &&
+		touch $packdir/${kept%.pack}.keep &&
+
+		git repack --geometric 2 -d &&
+
+		test 2 -eq "$(pack_count)" &&
+		test_path_is_file $packdir/$kept
+	)
+'
+
+test_expect_success '--geometric includes loose objects' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 1 &&
+		make_pack 1 &&
+		oid=$(echo loose | git hash-object -w --stdin) &&
+
+		git repack --geometric 2 -d &&
+
+		test 1 -eq "$(pack_count)" &&
+		git cat-file -e $oid &&
+		test_path_is_missing $objdir/$(test_oid_to_path $oid)
+	)
+'
+
+test_expect_success '--geometric keeps every object' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		test_commit first &&
+		git repack -d &&
+		test_commit second &&
+		git repack -d &&
+		test_commit third &&
+
+		git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+		git repack --geometric 2 -d &&
+		test 1 -eq "$(pack_count)" &&
+		idx=$(ls $packdir/*.idx) &&
+		git show-index <$idx | cut -d" " -f2 | sort >actual &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric --write-midx writes a multi-pack index' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 1 &&
+		make_pack 1 &&
+		big=$(make_pack 8) &&
+
+		git repack --geometric 2 -d --write-midx &&
+
+		test_path_is_file $midx &&
+		test 2 -eq "$(midx_pack_count)" &&
+		grep "^${big%.pack}.idx$" midx.out &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--geometric updates an existing multi-pack index' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 1 &&
+		make_pack 1 &&
+		git multi-pack-index write &&
+		make_pack 1 &&
+
+		git repack --geometric 2 -d &&
+
+		test 1 -eq "$(midx_pack_count)" &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--geometric with --write-midx -b writes a midx bitmap' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		test_commit first &&
+		git repack -d &&
+		test_commit second &&
+		git repack -d &&
+		test_commit third &&
+
+		git repack --geometric 2 -d --write-midx -b &&
+		ls $packdir/multi-pack-index*.bitmap &&
+		git rev-list --count --all --use-bitmap-index >actual &&
+		git rev-list --count --all >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--geometric leaves cruft packs alone' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		test_commit reachable &&
+		git repack -ad &&
+		echo unreachable | git hash-object -w --stdin &&
+		git repack --cruft -d &&
+		cruft=$(ls $packdir/pack-*.mtimes) &&
+		cp $cruft mtimes.expect &&
+
+		make_pack 1 &&
+		make_pack 1 &&
+		git repack --geometric 2 -d &&
+
+		test_path_is_file $cruft &&
+		test_path_is_file ${cruft%.mtimes}.pack &&
+		test_cmp mtimes.expect $cruft &&
+		test 2 -eq "$(pack_count)"
+	)
+'
+
+test_expect_success '--geometric is incompatible with -a and -A' '
+	test_must_fail git repack --geometric 2 -a 2>err &&
+	test_i18ngrep "incompatible" err &&
+	test_must_fail git repack --geometric 2 -A 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_done
@@ -16,6 +16,8 @@
 #include "fsmonitor.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "parallel-checkout.h"
+#include "sparse-index.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -397,7 +399,7 @@ static int check_updates(struct unpack_trees_options *o,
 	int errs = 0;
 	struct progress *progress;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	trace_performance_enter();
 	state.force = 1;
@@ -460,18 +462,30 @@ static int check_updates(struct unpack_trees_options *o,
 					   to_fetch.oid, to_fetch.nr);
 		oid_array_clear(&to_fetch);
 	}
+
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
 		if (ce->ce_flags & CE_UPDATE) {
+			size_t last_pc_queue_size = pc_queue_size();
+
 			if (ce->ce_flags & CE_WT_REMOVE)
 				BUG("both update and delete flags are set on %s",
 				    ce->name);
-			display_progress(progress, ++cnt);
 			ce->ce_flags &= ~CE_UPDATE;
 			errs |= checkout_entry(ce, &state, NULL, NULL);
+
+			/* Queued entries are counted once they are written. */
+			if (last_pc_queue_size == pc_queue_size())
+				display_progress(progress, ++cnt);
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold,
+					      progress, &cnt);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state, NULL);
 	git_attr_set_direction(GIT_ATTR_CHECKIN);
@@ -1565,6 +1579,83 @@ static void populate_from_existing_patterns(struct unpack_trees_options *o,
 static int verify_absent(const struct cache_entry *,
 			 enum unpack_trees_error_types,
 			 struct unpack_trees_options *);
+
+/*
+ * Does the sparse directory entry 'ce' name a tree in 'desc' with the
+ * same object name, and does the cache tree agree?
+ */
+static int sparse_dir_matches_tree(struct index_state *istate,
+				   const struct cache_entry *ce,
+				   const struct tree_desc *desc)
+{
+	struct tree_desc t = *desc;
+	struct name_entry entry;
+	const char *slash = strchr(ce->name, '/');
+	size_t len = slash - ce->name;
+	struct cache_tree *it = istate->cache_tree;
+	const char *p;
+
+	/* Walk down the cache tree to the leaf of this entry. */
+	for (p = ce->name; it && *p; ) {
+		const char *end = strchr(p, '/');
+		int pos = cache_tree_subtree_pos(it, p, end - p);
+
+		if (pos < 0)
+			return 0;
+		it = it->down[pos]->cache_tree;
+		p = end + 1;
+	}
+	if (!it || it->entry_count < 0 || !oideq(&it->oid, &ce->oid))
+		return 0;
+
+	while (tree_entry(&t, &entry)) {
+		struct object_id oid;
+		unsigned short mode;
+
+		if (entry.pathlen != len || memcmp(entry.path, ce->name, len))
+			continue;
+		if (!S_ISDIR(entry.mode))
+			return 0;
+		if (!slash[1])
+			return oideq(&entry.oid, &ce->oid);
+		if (get_tree_entry(the_repository, &entry.oid, slash + 1,
+				   &oid, &mode))
+			return 0;
+		return S_ISDIR(mode) && oideq(&oid, &ce->oid);
+	}
+	return 0;
+}
+
+/*
+ * Only "diff-index --cached" knows how to step over sparse directory
+ * entries, and only when they are unchanged: it skips whole subtrees
+ * whose cache tree matches the tree being compared. Everybody else
+ * needs to see the individual entries.
+ */
+static void expand_index_for_unpack(unsigned len, struct tree_desc *t,
+				    struct unpack_trees_options *o)
+{
+	struct index_state *istate = o->src_index;
+	int i;
+
+	if (!istate->sparse_index)
+		return;
+	if (!o->diff_index_cached || len != 1 || o->prefix) {
+		ensure_full_index(istate);
+		return;
+	}
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (S_ISSPARSEDIR(ce->ce_mode) &&
+		    !sparse_dir_matches_tree(istate, ce, t)) {
+			ensure_full_index(istate);
+			return;
+		}
+	}
+}
+
 /*
  * N-way merge "len" trees.  Returns 0 on success, -1 on failure to manipulate the
  * resulting index, -2 on failure to reflect the changes to the work tree.
@@ -1582,6 +1673,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
 
 	trace_performance_enter();
+	expand_index_for_unpack(len, t, o);
 	if (!core_apply_sparse_checkout || !o->update)
 		o->skip_sparse_checkout = 1;
 	if (!o->skip_sparse_checkout && !o->pl) {
@@ -1780,6 +1872,7 @@ enum update_sparsity_result update_sparsity(struct unpack_trees_options *o)
 		BUG("update_sparsity() called wrong");
 
 	trace_performance_enter();
+	ensure_full_index(o->src_index);
 
 	/* If we weren't given patterns, use the recorded ones */
 	if (!o->pl) {
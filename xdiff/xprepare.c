@@ -176,7 +176,12 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	rhash = NULL;
 	recs = NULL;
 
-	if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), narec / 4 + 1) < 0)
+	/*
+	 * Allocate the records in one block sized by the line count
+	 * guessed by xdl_guess_lines(); further blocks are only needed
+	 * when the guess was too low.
+	 */
+	if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), narec) < 0)
 		goto abort;
 	if (!(recs = (xrecord_t **) xdl_malloc(narec * sizeof(xrecord_t *))))
 		goto abort;
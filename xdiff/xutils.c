@@ -294,20 +294,54 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 	return ha;
 }
 
+/*
+ * Hash the bytes [ptr, end) a machine word at a time.  This is not the
+ * same function as the byte-wise one above, but records are only ever
+ * compared with records hashed with the same flags.
+ */
+static unsigned long xdl_hash_bytes(char const *ptr, char const *end) {
+	uint64_t ha = 5381 ^ (uint64_t) (end - ptr), w;
+
+	for (; end - ptr >= 8; ptr += 8) {
+		memcpy(&w, ptr, 8);
+		ha = ((ha << 5 | ha >> 59) ^ w) * 0x9e3779b97f4a7c15ULL;
+	}
+	if (ptr < end) {
+		w = 0;
+		memcpy(&w, ptr, end - ptr);
+		ha = ((ha << 5 | ha >> 59) ^ w) * 0x9e3779b97f4a7c15ULL;
+	}
+
+	/* spread the high bits into the low ones used by XDL_HASHLONG */
+	ha ^= ha >> 33;
+	ha *= 0xff51afd7ed558ccdULL;
+	ha ^= ha >> 33;
+	return (unsigned long) (ha ^ (ha >> 32));
+}
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
 	char const *ptr = *data;
+	char const *eol = memchr(ptr, '\n', top - ptr);
+	char const *end = eol ? eol : top;
 
-	if (flags & XDF_WHITESPACE_FLAGS)
-		return xdl_hash_record_with_whitespace(data, top, flags);
+	*data = eol ? eol + 1 : top;
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+	/*
+	 * Ignoring whitespace at the end of the line only needs the
+	 * line to be trimmed; anything that changes whitespace inside
+	 * the line goes through the byte-wise hash.
+	 */
+	if (flags & (XDF_IGNORE_WHITESPACE | XDF_IGNORE_WHITESPACE_CHANGE))
+		return xdl_hash_record_with_whitespace(&ptr, top, flags);
+	if (flags & XDF_IGNORE_WHITESPACE_AT_EOL) {
+		while (end > ptr && XDL_ISSPACE(end[-1]))
+			end--;
+	} else if (flags & XDF_IGNORE_CR_AT_EOL) {
+		/* do not ignore CR at the end of an incomplete line */
+		if (eol && end > ptr && end[-1] == '\r')
+			end--;
 	}
-	*data = ptr < top ? ptr + 1: ptr;
-
-	return ha;
+	return xdl_hash_bytes(ptr, end);
 }
 
 unsigned int xdl_hashbits(unsigned int size) {